@@ -4,79 +4,125 @@
 #ifndef AEPWrap_HPP
 #define AEPWrap_HPP
 
+#include <atomic>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
 #include "Board2D.hpp"
 #include "Game.hpp"
+#include "TimeManager.hpp"
 using namespace Haliotis;
 
 namespace AbaloneEngineProtocol {
 
-#ifdef USE_OPTION
+/// Parameters of "go", see TimeManager.hpp
+using ::GoParameters;
+
+////////////////////////////////////////////////////////////////
+//
+// Options of an engine
+//
+
+/** An option of the engine that the GUI can change with "setoption". The
+  engine keeps its options as members and registers them with
+  Engine::AddOption(). The values are atomics, so search threads may read
+  them at any time. */
 class Option {
 protected:
-  const char* m_name;
+  std::string m_name;
 public:
-  Option(const char* name) : m_name(name) {}
+  Option(const std::string& name) : m_name(name) {}
   virtual ~Option() {};
+  const std::string& Name() const { return m_name; }
   /// Get a string representation of the Option that is ready for AEP
   /// transmission.
-  virtual string ToString() = 0;
-  /// Copy value from one option to another. Must have same type
-  virtual Option& operator = (Option& src);
+  virtual std::string ToString() const = 0;
+  /** Set the value from the text after "value" in "setoption".
+    @return false if the value is not valid for the option */
+  virtual bool Set(const std::string& value) = 0;
 };
 
-/** Parse a string (following command setoption) and create the corresponding
-option element */
-std::auto_ptr<Option> ParseString(string str);
-
 class OptionCheck: public Option {
 private:
-  bool m_value;
+  std::atomic<bool> m_value;
+  bool m_default;
 public:
-  OptionCheck(char* name, bool enabled)
-  : Option(name), m_value(enabled) {}
+  OptionCheck(const std::string& name, bool enabled)
+  : Option(name), m_value(enabled), m_default(enabled) {}
+  bool Value() const { return m_value.load(std::memory_order_relaxed); }
+  virtual std::string ToString() const;
+  virtual bool Set(const std::string& value);
 };
 
 class OptionSpin: public Option {
 private:
-  int m_value;
+  std::atomic<int> m_value;
   int m_min;
   int m_max;
+  int m_default;
 public:
-  OptionSpin(char* name, int min, int max, int def)
-  : Option(name), m_value(def), m_min(min), m_max(max) {}
+  OptionSpin(const std::string& name, int min, int max, int def)
+  : Option(name), m_value(def), m_min(min), m_max(max), m_default(def) {}
+  int Value() const { return m_value.load(std::memory_order_relaxed); }
+  virtual std::string ToString() const;
+  virtual bool Set(const std::string& value);
 };
 
+/** One of a list of strings */
 class OptionCombo: public Option {
+private:
+  std::vector<std::string> m_values;
+  std::atomic<int> m_index;
+  int m_default;
+public:
+  OptionCombo(const std::string& name, const std::vector<std::string>& values,
+    const std::string& def);
+  /// Index of the value in the list given to the constructor
+  int Index() const { return m_index.load(std::memory_order_relaxed); }
+  const std::string& Value() const { return m_values[Index()]; }
+  virtual std::string ToString() const;
+  virtual bool Set(const std::string& value);
 };
 
+/** An action without a value, done by Engine::OptionChanged() */
 class OptionButton: public Option {
+public:
+  OptionButton(const std::string& name) : Option(name) {}
+  virtual std::string ToString() const;
+  virtual bool Set(const std::string& value);
 };
 
 class OptionString: public Option {
 private:
   std::string m_value;
+  std::string m_default;
+  mutable std::mutex m_mutex;
 public:
-  OptionCheck(char* name, std::string def)
-  : Option(name), m_value(def) {}
+  OptionString(const std::string& name, const std::string& def)
+  : Option(name), m_value(def), m_default(def) {}
+  /// A copy of the value, since a string can not be read atomically
+  std::string Value() const;
+  virtual std::string ToString() const;
+  virtual bool Set(const std::string& value);
 };
 
 /*
   OptionCheck a("Ponder",true);
   OptionSpin a("range",3,10,3);
-  OptionCombo a("range",{"a","bcd","e"});
+  OptionCombo a("range",{"a","bcd","e"},"a");
   OptionButton b("name");
-  OptionString s("name"."default");
+  OptionString s("name","default");
 */
-#endif
 
 ////////////////////////////////////////////////////////////////
 //
 // Specification of EngineInterface
 //
 
-/** Interface for processing input during search. */
+/** Interface for processing input during search.
+  @deprecated Play() reads input on its own thread, so an engine need not
+  check for input while searching. */
 class InputHandler {
 public:
   /** Check input and return immediately if none is present. If the input
@@ -84,18 +130,127 @@ public:
   virtual void CheckInput() = 0;
 };
 
+/** Progress of a search, reported by the engine while it searches. Fields
+  that are not known are left at their default value, and are not sent. */
+struct SearchInfo {
+  static const int NO_SCORE = -2147483647 - 1;
+  int depth;                 //< Depth completed, or -1
+  int score;                 //< Centi-marbles for the player to move, or NO_SCORE
+  unsigned long long nodes;  //< Nodes searched by all threads, or 0
+  int hashfull;              //< Use of the hash table in permille, or -1
+  std::vector<Board2D::Move> pv; //< Principal variation, may be empty
+  SearchInfo() : depth(-1), score(NO_SCORE), nodes(0), hashfull(-1) {}
+};
+
+/** Interface for receiving the progress of a search. */
+class InfoHandler {
+public:
+  /** Called by Engine::ReportInfo() from any search thread. Must not
+    block the search. */
+  virtual void Info(const SearchInfo& info) = 0;
+};
+
 /** Interface that must be implemented by engine. The AEPWrapper will use
-  it to issue commands. */
+  it to issue commands.
+
+  GetMove() is called on a search thread of the wrapper, while commands
+  are read on another thread. StopSearch() may therefore be called from
+  the input thread while GetMove() runs, and must only tell the search to
+  stop. The other functions are not called during a search, except for
+  SetDebug(). Instead of implementing its own flag, the search may poll
+  StopRequested(), which is a single atomic load.
+
+  When the GUI asks the engine to ponder, GetMove() is called on the
+  position after the move the opponent is expected to play, and
+  Pondering() is true. The search must then ignore its time limits until
+  the opponent plays the move, which calls PonderHit(), or the search is
+  stopped. A search stopped while pondering, by "stop" or a new position,
+  is a ponder miss and its move is not sent. The engine should keep its
+  hash tables and trees between searches, so a search after a missed
+  ponder is not started cold.
+
+  The limits of "go" are given to SetSearchLimits(), which sets Time().
+  RequestStop() and RequestPonderHit() are passed on to Time(), so an
+  engine that polls Time().ShouldStop() needs no flags of its own.
+
+  Options registered with AddOption() are sent to the GUI on "aep". A
+  "setoption" changes the value at once, and calls OptionChanged() on the
+  input thread when no search runs, so the engine can resize its hash
+  table or thread pool there instead of in the search. */
 class Engine {
 private:
   InputHandler* m_inputHandler;
+  InfoHandler* m_infoHandler;
+  std::atomic<bool> m_stopRequested;
+  std::atomic<bool> m_pondering;
+  std::vector<Option*> m_options;
+  TimeManager m_time;
 public:
-  Engine() : m_inputHandler(0) {}
+  Engine()
+  : m_inputHandler(0), m_infoHandler(0), m_stopRequested(false), m_pondering(false)
+  {}
+  virtual ~Engine() {}
+  /// True when the current search must stop as soon as possible
+  inline bool StopRequested() const {
+    return m_stopRequested.load(std::memory_order_relaxed);
+  }
+  /// Set StopRequested() and tell the engine to stop. Thread safe.
+  inline void RequestStop() {
+    m_stopRequested.store(true);
+    m_time.Stop();
+    StopSearch();
+  }
+  /// Clear StopRequested() before a new search
+  inline void ClearStopRequest() {
+    m_stopRequested.store(false);
+  }
+  /// True while searching the reply to the move the opponent is expected to play
+  inline bool Pondering() const {
+    return m_pondering.load(std::memory_order_relaxed);
+  }
+  /// Set Pondering() before a new search
+  inline void SetPondering(bool enable) {
+    m_pondering.store(enable);
+  }
+  /// Clear Pondering() and start the time limits. Thread safe.
+  inline void RequestPonderHit() {
+    m_pondering.store(false);
+    m_time.PonderHit();
+    PonderHit();
+  }
+  /// Deadlines of the search, set by SetSearchLimits()
+  inline TimeManager& Time() {
+    return m_time;
+  }
   /// Set function to call during search
   inline void SetInputHandler(InputHandler* callback) {
     m_inputHandler = callback;
   }
-  /// Check if input should be processed. May call back into the engine.
+  /** Make an option known to the GUI. The option is not owned by the
+    engine, and must live as long as it. */
+  inline void AddOption(Option& option) {
+    m_options.push_back(&option);
+  }
+  inline const std::vector<Option*>& Options() const {
+    return m_options;
+  }
+  /// Find option by name, ignoring case as the GUI may. 0 if not found.
+  Option* FindOption(const std::string& name) const;
+  /** The value of the option was changed by the GUI. Called on the input
+    thread, never during a search. */
+  virtual void OptionChanged(Option&) {}
+  /// Set receiver of the progress of a search
+  inline void SetInfoHandler(InfoHandler* handler) {
+    m_infoHandler = handler;
+  }
+  /** Report the progress of the search. May be called from several search
+    threads, as often as convenient: Play() merges the reports and sends
+    them at most a few times a second. */
+  inline void ReportInfo(const SearchInfo& info) {
+    if (m_infoHandler) m_infoHandler->Info(info);
+  }
+  /** Check if input should be processed. May call back into the engine.
+    Does nothing when the engine is driven by Play(). */
   inline void CheckInput() {
     if (m_inputHandler) m_inputHandler->CheckInput();
   }
@@ -111,16 +266,75 @@ public:
   virtual void GetMove(Board2D::Move& m) =0;
   /// Tell engine to set a flag so it will stop searching.
   virtual void StopSearch() = 0;
+  /** The opponent played the expected move while pondering. Called from
+    the input thread during GetMove(); the search continues with the time
+    limits of the "go" command, counted from now. */
+  virtual void PonderHit() {}
 
-  virtual void ResetSearchParameters() =0;
-  virtual void SetSearchParameter(string name, string value) =0;
+  /** The limits of the next search, from "go". Called before GetMove().
+    Sets Time(), and passes the limits on to SetSearchParameter(). */
+  virtual void SetSearchLimits(const GoParameters& go);
+  /// @deprecated Use SetSearchLimits() or Time()
+  virtual void ResetSearchParameters() {}
+  /** Take one parameter of "go": time1, time2, inc1, inc2, movetime
+    ("inf" if infinite), depth, nodes, mate, ponder and searchmoves.
+    @deprecated Use SetSearchLimits() or Time() */
+  virtual void SetSearchParameter(string, string) {}
 };
 
 
 
-/** Drive engine through the abalone engine protocol (AEP) */
+/** Drive engine through the abalone engine protocol (AEP). Commands are
+  read from stdin on the calling thread, searches run on a worker thread,
+  and replies are written to stdout by a third thread. */
 int Play(Engine& player);
 
+/** As Play(player), with commands read from in and replies written to out.
+  Returns after "quit" or the end of in, when all replies are written. */
+int Play(Engine& player, std::istream& in, std::ostream& out);
+
+/** Drive an engine by direct calls, with the meaning of the commands that
+  Play() handles, but without AEP text on stdin and stdout. The position
+  is passed as a Game and the best move returned as a Board2D::Move, so
+  many games can be played in one process, as in self-play.
+
+  Go() searches on the calling thread, so the drivers of many engines can
+  run on the workers of a ThreadPool. Stop() may be called from any other
+  thread. Pondering is not supported.
+
+  @example
+    Driver driver(engine);
+    driver.SetPosition(game);
+    GoParameters go;
+    go.moveTime = 100;
+    game.DoMove(driver.Go(go));
+*/
+class Driver {
+public:
+  explicit Driver(Engine& engine);
+  Engine& GetEngine() { return m_engine; }
+  /** As "setoption". The engine is told at once, or after the search if
+    one runs. @return false if the option is not known or the value is wrong */
+  bool SetOption(const std::string& name, const std::string& value);
+  /// As "position"
+  void SetPosition(const Game& game);
+  /// As "go", waiting for "bestmove"
+  Board2D::Move Go(const GoParameters& parameters);
+  /// As "stop". Thread safe.
+  void Stop();
+  bool Searching() const { return m_searching.load(); }
+
+private:
+  Driver(const Driver&); // Not implemented
+  void operator = (const Driver&); // Not implemented
+  void ApplyOptions();
+
+  Engine& m_engine;
+  std::atomic<bool> m_searching;
+  std::mutex m_optionMutex;              //< Protects the below
+  std::vector<Option*> m_changedOptions;
+};
+
 } // namespace AbaloneEngineProtocol
 
 #endif
@@ -11,6 +11,8 @@
 
 //#include "config.h"
 
+#include <cstddef>
+#include <iterator>
 #include <string>
 #include <iostream>
 #include <vector>
@@ -73,6 +75,17 @@ inline int Clockwise(int dir) {
 }
 
 
+/** A pair of iterators that can be used in a C++11 range-based for loop */
+template <class Iterator>
+class Range {
+  Iterator m_begin;
+  Iterator m_end;
+public:
+  Range(Iterator b, Iterator e) : m_begin(b), m_end(e) {}
+  Iterator begin() const { return m_begin; }
+  Iterator end() const { return m_end; }
+};
+
 //////////////////////////////////////////////////////////////////////
 
 /* Values used in Board.field */
@@ -94,6 +107,7 @@ class HALIOTIS_EXPORT Board2D {
     const static int PLAYERS = 2;
     struct Pos;
     class Move;
+    class MoveIterator;
     void InitFieldKey();
     // TODO  replace with  int8 playerToMove (range 1..2)
     bool whiteToMove;
@@ -113,12 +127,21 @@ class HALIOTIS_EXPORT Board2D {
     bool FirstMove(Move& M, Board2D& B) const;
     void NextMove(Move& M) const;
     bool NextMove(Move& M, Board2D& B) const;
+    Range<MoveIterator> AllMoves() const &;
+    /// The iterators point to the board, so a temporary board is not allowed
+    Range<MoveIterator> AllMoves() const && = delete;
   private:
     void SuggestNextMove(Move& M) const;
   public:
     bool ValidMove(Move M) const;
     void ExtendTail(Move& M) const;
     int DoMove(Move M);
+    /** What UndoMove() needs to know of M, taken before M is done: the
+      number of own and of opponent pieces in line with an inline move */
+    unsigned char UndoInfo(Move M) const;
+    /** Take back M, the last move done. undo is UndoInfo(M) of the board
+      before M was done. */
+    void UndoMove(Move M, unsigned char undo);
     Board2D AfterMove(Move M) const;
     int Score(int8 player) const;
     void SetScore(int8 player, int count);
@@ -133,11 +156,18 @@ class HALIOTIS_EXPORT Board2D {
     /// @deprecated Remove references to player colour
     int BlackOff() const;
     long HashCode() const;
+    /** 64 bit Zobrist key of the fields and the side to move. The keys are
+      fixed, so the value can be stored in files. */
+    unsigned long long Hash64() const;
     int Compare(const Board2D& aBoard) const;
     bool operator == (const Board2D& aBoard) const;
     bool operator != (const Board2D& aBoard) const { 
       return !(*this == aBoard); };
     bool operator < (const Board2D& aBoard) const;
+    /// Bytes needed to store the 61 fields with 2 bits per field
+    const static int PACKED_FIELDS_SIZE = 16;
+    void PackFields(unsigned char packed[PACKED_FIELDS_SIZE]) const;
+    void UnpackFields(const unsigned char packed[PACKED_FIELDS_SIZE]);
   private:
 
     long currentHashCode;
@@ -183,6 +213,8 @@ struct HALIOTIS_EXPORT Board2D::Pos {
 
   /// Copy constructor
   Pos(const Pos& b) { x=b.x; y=b.y; }
+  /// Assignment, declared with the copy constructor
+  Pos& operator = (const Pos& b) { x=b.x; y=b.y; return *this; }
 
   /// Generate a board position from a coordinate set.
   Pos(int8 ax, int8 ay) { x=ax, y=ay; }
@@ -196,6 +228,28 @@ struct HALIOTIS_EXPORT Board2D::Pos {
           and (4+0<=x+y) and (x+y<=4+8);
   }
 
+  /** Number of the position when all valid positions are counted row by row
+  in the same order as Next() visits them. Range 0..60, or -1 if the position
+  is not valid. */
+  int Index() const {
+    static const int rowStart[9] = { 0, 5, 11, 18, 26, 35, 43, 50, 56 };
+    if (not Valid()) return -1;
+    return rowStart[y] + x - (y<4 ? 4-y : 0);
+  }
+
+  /** Inverse of Index(). An index outside 0..60 gives an invalid position. */
+  static Pos FromIndex(int index) {
+    if (index < 0 or index > 60) return Pos(-1,-1);
+    int8 row = 0;
+    int rowLength = 5;
+    while (index >= rowLength) {
+      index -= rowLength;
+      row ++;
+      rowLength += (row<=4 ? 1 : -1);
+    }
+    return Pos(index + (row<4 ? 4-row : 0), row);
+  }
+
   /** Go to next valid position. If this function is called after default
   construction, it will go to the first valid position. When no more valid
   positions are left, it will stay in an invalid position. */
@@ -301,6 +355,29 @@ class HALIOTIS_EXPORT Board2D::Move {
 
     bool Valid() const; // is move inside board?
 
+    /** Pack the move into 14 bits: head index (6 bits, 63 if invalid),
+      tailDir (3 bits), tailCount (2 bits) and moveDir (3 bits). Two moves
+      with a valid head are equal if and only if their packed values are
+      equal. */
+    unsigned Pack() const {
+      int index = head.Index();
+      return (unsigned)(index < 0 ? 63 : index) << 8
+           | (unsigned)(tailDir & 7) << 5
+           | (unsigned)(tailCount & 3) << 3
+           | (unsigned)(moveDir & 7);
+    }
+    /** Inverse of Pack() */
+    static Move Unpack(unsigned packed) {
+      Move m;
+      m.head = Pos::FromIndex((packed >> 8) & 63);
+      m.tailDir = (packed >> 5) & 7;
+      if (m.tailDir == 7) m.tailDir = dirNone;
+      m.tailCount = (packed >> 3) & 3;
+      m.moveDir = packed & 7;
+      if (m.moveDir == 7) m.moveDir = dirNone;
+      return m;
+    }
+
     /// @deprecated serialisation is handled by Persistence.cpp
     void Read(istream& in);
     /// @deprecated serialisation is handled by Persistence.cpp
@@ -309,6 +386,67 @@ class HALIOTIS_EXPORT Board2D::Move {
 
 //////////////////////////////////////////////////////////////////////
 
+/** Forward iterator over the legal moves of a board, as generated by
+  FirstMove() and NextMove(). Each element holds the move and the board
+  after the move. The iterator does not allocate memory and does not
+  modify the board it iterates, so several iterators may share a board.
+  The iterator points to the board, which must outlive it.
+
+  Example of usage:
+    for (auto& m : board.AllMoves()) {
+      Examine(m.move, m.board);
+    }
+*/
+class HALIOTIS_EXPORT Board2D::MoveIterator {
+public:
+  struct value_type {
+    Board2D::Move move;
+    Board2D board; //< Board after move
+  };
+  typedef std::forward_iterator_tag iterator_category;
+  typedef std::ptrdiff_t difference_type;
+  typedef const value_type* pointer;
+  typedef const value_type& reference;
+
+  /// End of moves
+  MoveIterator() : m_boardBefore(0) {}
+  /// First legal move on board
+  explicit MoveIterator(const Board2D& board) : m_boardBefore(&board) {
+    if (not board.FirstMove(m_current.move, m_current.board)) m_boardBefore = 0;
+  }
+  reference operator * () const { return m_current; }
+  pointer operator -> () const { return &m_current; }
+  MoveIterator& operator ++ () {
+    if (not m_boardBefore->NextMove(m_current.move, m_current.board))
+      m_boardBefore = 0;
+    return *this;
+  }
+  MoveIterator operator ++ (int) {
+    MoveIterator result(*this);
+    ++ *this;
+    return result;
+  }
+  bool operator == (const MoveIterator& other) const {
+    if (m_boardBefore == 0 or other.m_boardBefore == 0)
+      return m_boardBefore == other.m_boardBefore;
+    return m_boardBefore == other.m_boardBefore
+       and m_current.move == other.m_current.move;
+  }
+  bool operator != (const MoveIterator& other) const {
+    return not (*this == other);
+  }
+private:
+  const Board2D* m_boardBefore; //< 0 at end of moves
+  value_type m_current;
+};
+
+/** All legal moves of the board, to be used in a range-based for loop */
+inline Range<Board2D::MoveIterator> Board2D::AllMoves() const & {
+  return Range<MoveIterator>(MoveIterator(*this), MoveIterator());
+}
+
+//////////////////////////////////////////////////////////////////////
+
 /** Interface used to signaling a move */
 class HALIOTIS_EXPORT MoveListener {
 public:
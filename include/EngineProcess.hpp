@@ -0,0 +1,64 @@
+/** @file EngineProcess.hpp
+  Run an engine as a child process and talk to it through pipes.
+*/
+
+#ifndef EngineProcess_hpp
+#define EngineProcess_hpp
+
+#include "abmove.h"
+
+#include <string>
+
+/** A child process whose stdin and stdout are connected to this process.
+  Lines are written to the stdin of the child, and read from its stdout
+  with a timeout, so a hanging engine can not hang the caller.
+
+  The process is run by the shell, so the command may have arguments.
+  Writing to a process that has exited raises SIGPIPE, which a program
+  using this class should ignore.
+
+  Only available on platforms with fork(); elsewhere Start() fails.
+
+  @example
+    EngineProcess engine;
+    engine.Start("./myengine -q");
+    engine.WriteLine("isready");
+    std::string line;
+    if (engine.ReadLine(line, 1000) and line == "readyok") ...
+*/
+class HALIOTIS_EXPORT EngineProcess {
+public:
+  EngineProcess();
+  /// Stop the process
+  ~EngineProcess();
+
+  /// @return false if the process could not be started
+  bool Start(const std::string& command);
+  /// True from Start() until Stop() or the end of its output
+  bool Running() const { return m_pid > 0; }
+  const std::string& Command() const { return m_command; }
+  /// Write a line. @return false if the process does not read it
+  bool WriteLine(const std::string& line);
+  /** Read a line without the line end.
+    @param timeoutMs  longest wait in ms, negative to wait forever
+    @return false on timeout, or if the process closed its output */
+  bool ReadLine(std::string& line, long long timeoutMs);
+  /** Send "quit", and kill the process if it has not exited after
+    waitMs ms. */
+  void Stop(long long waitMs = 1000);
+
+private:
+  EngineProcess(const EngineProcess&); // Not implemented
+  void operator = (const EngineProcess&); // Not implemented
+
+  /// Close the pipes and wait for the process
+  void Close(long long waitMs);
+
+  std::string m_command;
+  int m_pid;
+  int m_input;   //< Write end of the stdin of the process
+  int m_output;  //< Read end of the stdout of the process
+  std::string m_buffer; //< Output read, but not yet returned as a line
+};
+
+#endif
@@ -17,7 +17,162 @@ namespace Haliotis {
 
 //////////////////////////////////////////////////////////////////////
 
-struct GameTreeNode;
+/** Representation of a position in a game tree.
+
+  The children of a node are kept in insertion order, so the first child
+  is the main line and the following are the alternatives. Most nodes only
+  have a few children and are searched linearly. When the fan-out exceeds
+  INDEX_THRESHOLD (typical for merged opening trees) an open-addressing
+  hash index keyed by Move::Pack() is built next to the child vector.
+
+  @bug Note that this is a tree, not
+  a graph, so two equal positions may occur in the same game tree (given that
+  they were reached by different paths).
+*/
+struct HALIOTIS_EXPORT GameTreeNode {
+  /// Comment to current position or move that lead to current position.
+  std::string comment;
+  GameTreeNode* prev;
+  /**
+    Move that lead to the current position. This GameTreeNode represents the
+    position AFTER this move.
+    @note Moves must be normalised before adding to GameTreeNode
+  */
+  Board2D::Move move;
+public:
+  GameTreeNode();
+  // Create copy of other tree
+  GameTreeNode(const GameTreeNode* orig, GameTreeNode* new_prev=0);
+  ~GameTreeNode();
+  /// Main line continues here. Next move is MainLine()->move
+  GameTreeNode* MainLine() const {
+    return children.empty() ? 0 : children[0];
+  }
+  /// All moves from this position, main line first
+  const std::vector<GameTreeNode*>& Children() const { return children; }
+  GameTreeNode* FindNextNode(Board2D::Move move) const;
+  GameTreeNode* GetNextNode(Board2D::Move move);
+private:
+  GameTreeNode(const GameTreeNode&); // Not implemented, use the copy above
+  void operator = (const GameTreeNode&); // Not implemented
+
+  /// Number of children before the hash index is built
+  static const size_t INDEX_THRESHOLD = 8;
+  std::vector<GameTreeNode*> children;
+  /// Open-addressing table: child number + 1, or 0 for an empty slot
+  std::vector<unsigned short> childIndex;
+  /// log2 of childIndex.size()
+  int indexBits;
+
+  size_t FirstSlot(unsigned key) const {
+    // Fibonacci hashing, the high bits of the product are the best mixed
+    return (size_t)((key * 2654435769u) >> (32 - indexBits));
+  }
+  void AddToIndex(size_t child);
+  void Reindex();
+};
+
+/** A position in a game tree: the node and the board after node->move.
+  This is the element type of the game iterators below. */
+struct GamePos {
+  const GameTreeNode* node;
+  Board2D board;
+};
+
+/** Board after the moves from the root to node, done on startPos. Readers
+  use it where they have not kept that board. */
+HALIOTIS_EXPORT Board2D BoardAfter(const GameTreeNode* node,
+  const Board2D& startPos);
+
+/** Forward iterator along the main line of a game tree. The iterator has
+  its own board, so it does not allocate memory and does not move the
+  cursor of the Game.
+  @see Game::MainLine */
+class HALIOTIS_EXPORT MainLineIterator {
+public:
+  typedef GamePos value_type;
+  typedef std::forward_iterator_tag iterator_category;
+  typedef std::ptrdiff_t difference_type;
+  typedef const GamePos* pointer;
+  typedef const GamePos& reference;
+
+  /// End of main line
+  MainLineIterator() { m_pos.node = 0; }
+  /// First move after root, which holds the position before the first move
+  MainLineIterator(const GameTreeNode* root, const Board2D& startPos);
+  reference operator * () const { return m_pos; }
+  pointer operator -> () const { return &m_pos; }
+  MainLineIterator& operator ++ ();
+  MainLineIterator operator ++ (int) {
+    MainLineIterator result(*this);
+    ++ *this;
+    return result;
+  }
+  bool operator == (const MainLineIterator& other) const {
+    return m_pos.node == other.m_pos.node;
+  }
+  bool operator != (const MainLineIterator& other) const {
+    return m_pos.node != other.m_pos.node;
+  }
+private:
+  GamePos m_pos;
+};
+
+/** Forward iterator visiting all moves of a game tree in preorder: a move,
+  then its main line and then the alternatives of each move, as they are
+  written in the .AG format. The iterator does not allocate memory. It goes
+  back up the tree by the prev pointers and takes back one move for each
+  step up, so each step costs O(1) amortized. For this it keeps what
+  Board2D::UndoMove needs for the first MAX_STEPS moves of the path; a node
+  deeper than that is found again by replaying the moves from the start
+  position.
+  @see Game::Preorder */
+class HALIOTIS_EXPORT PreorderIterator {
+public:
+  typedef GamePos value_type;
+  typedef std::forward_iterator_tag iterator_category;
+  typedef std::ptrdiff_t difference_type;
+  typedef const GamePos* pointer;
+  typedef const GamePos& reference;
+
+  /// End of tree
+  PreorderIterator() : m_depth(0), m_childNo(0) { m_pos.node = 0; }
+  /// First move after root, which holds the position before the first move
+  PreorderIterator(const GameTreeNode* root, const Board2D& startPos);
+  reference operator * () const { return m_pos; }
+  pointer operator -> () const { return &m_pos; }
+  PreorderIterator& operator ++ ();
+  PreorderIterator operator ++ (int) {
+    PreorderIterator result(*this);
+    ++ *this;
+    return result;
+  }
+  bool operator == (const PreorderIterator& other) const {
+    return m_pos.node == other.m_pos.node;
+  }
+  bool operator != (const PreorderIterator& other) const {
+    return not (*this == other);
+  }
+  /// Number of moves from the start position to the current node
+  int Depth() const { return m_depth; }
+  /// Index of the current node amongst its siblings, 0 is the main line
+  size_t ChildNo() const { return m_childNo; }
+private:
+  /// A move on the path: its index amongst its siblings and its undo info
+  struct Step {
+    unsigned short childNo;
+    unsigned char undo;
+  };
+  static const int MAX_STEPS = 512;
+  GamePos m_pos;            //< node is 0 at end of tree
+  int m_depth;
+  size_t m_childNo;         //< Index of m_pos.node in its parent's Children()
+  Board2D m_startPos;
+  Step m_step[MAX_STEPS];   //< m_step[d] is the move from depth d to d+1
+  void GoToChild(size_t childNo);
+  void GoToParent();
+  void Replay(const GameTreeNode* node, int depth, Board2D& board) const;
+};
 
 class HALIOTIS_EXPORT Game {
 public:
@@ -25,10 +180,9 @@ public:
   Settings attributes;
 private:
   Board2D startPos;
-  std::string startComment;
   Board2D currentBoard; //< Current board, as seen after move done by currentPosition
-  GameTreeNode* moveTree;
-  GameTreeNode* currentPosition;
+  GameTreeNode* moveTree; //< Root node, holds startPos and its comment
+  GameTreeNode* currentPosition; //< Never 0, moveTree at startPos
 public:
   Game();
   Game(const Game& g);
@@ -62,6 +216,22 @@ public:
   std::string GetComment() const;
   void SetComment(const std::string& comment);
   const Board2D& StartPos() const { return startPos; }
+  /// Node holding the start position, its children are the first moves
+  const GameTreeNode* Root() const { return moveTree; }
+  /** Node holding the start position. Readers use this to build the tree
+    without moving the cursor.
+    @note Moves added directly to the tree must be valid */
+  GameTreeNode* Root() { return moveTree; }
+  /// All moves of the main line, to be used in a range-based for loop
+  Range<MainLineIterator> MainLine() const {
+    return Range<MainLineIterator>(
+      MainLineIterator(moveTree, startPos), MainLineIterator());
+  }
+  /// All moves of the game tree, to be used in a range-based for loop
+  Range<PreorderIterator> Preorder() const {
+    return Range<PreorderIterator>(
+      PreorderIterator(moveTree, startPos), PreorderIterator());
+  }
 };
 
 /////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,114 @@
+/** @file GameArchive.hpp
+  Binary archive holding many games, with an index for random access.
+
+  The archive is much faster to read than the .AG text format, and is meant
+  for large game collections. A file is laid out as
+
+    header   "ABGA", version, 3 reserved bytes
+    games    one record per game, see below
+    index    file offset of each game record (u64)
+    footer   offset of index (u64), number of games (u64), "ABGX"
+
+  and a game record is
+
+    size     bytes in the rest of the record (u32)
+    board    start position as Board2D::PackFields(), side to move,
+             white off, black off
+    attributes  count, then key and value of each (varint length + bytes)
+    tree     stream of u16 tokens, see GameArchiveToken
+
+  All integers are little endian. The tree is written in the same order as
+  the .AG format: the main line, with the alternatives to a move placed in
+  BEGIN/END markers right after it.
+*/
+
+#ifndef GameArchive_hpp
+#define GameArchive_hpp
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Game.hpp"
+
+/** Tokens in the tree of a game record. Values below ARCHIVE_COMMENT are
+  moves as given by Board2D::Move::Pack(). */
+enum GameArchiveToken {
+  /// Followed by varint length and text. Comment to the current node.
+  ARCHIVE_COMMENT = 0x4000,
+  /// The next move is an alternative to the current move
+  ARCHIVE_BEGIN_VARIATION,
+  /// Return to the move the variation was an alternative to
+  ARCHIVE_END_VARIATION,
+  /// End of tree
+  ARCHIVE_END_GAME
+};
+
+/** Write games to a binary archive.
+
+  @example
+    std::ofstream out("games.aga", std::ios::binary);
+    GameArchiveWriter archive(out);
+    archive.Write(game);
+    archive.Close();
+*/
+class HALIOTIS_EXPORT GameArchiveWriter {
+public:
+  /// Write the archive header to the stream
+  GameArchiveWriter(std::ostream& out);
+  /// Close the archive, if not already done
+  ~GameArchiveWriter();
+  /// Append a game to the archive
+  void Write(const Haliotis::Game& game);
+  /** Write the index. The archive is not readable before this is done.
+    No more games can be written after Close(). */
+  void Close();
+  /// Number of games written
+  size_t Size() const { return m_offsets.size(); }
+private:
+  std::ostream& m_out;
+  unsigned long long m_position; //< Bytes written to m_out
+  std::vector<unsigned long long> m_offsets;
+  std::string m_record; //< Buffer reused for each game record
+  bool m_closed;
+};
+
+/** Read games from a binary archive, in any order.
+
+  @example
+    std::ifstream in("games.aga", std::ios::binary);
+    GameArchiveReader archive(in);
+    for (size_t i = 0; i < archive.Size(); i++) {
+      archive.Read(i, game);
+    }
+*/
+class HALIOTIS_EXPORT GameArchiveReader {
+public:
+  /// Read the header and index of the archive
+  GameArchiveReader(std::istream& in);
+  /// False if the stream is not a valid archive
+  bool Valid() const { return m_valid; }
+  /// Number of games in archive
+  size_t Size() const { return m_offsets.size(); }
+  /** Read game number i. The game is positioned at the start position.
+    @return false if the record is corrupt */
+  bool Read(size_t i, Haliotis::Game& game);
+private:
+  std::istream& m_in;
+  std::vector<unsigned long long> m_offsets;
+  std::string m_record; //< Buffer reused for each game record
+  bool m_valid;
+};
+
+/** Encode a game as a record without the leading size field.
+  This is the part of GameArchiveWriter that is shared with other
+  binary formats. */
+HALIOTIS_EXPORT void GameArchive_Encode(const Haliotis::Game& game,
+  std::string& record);
+
+/** Decode a record produced by GameArchive_Encode.
+  @return false if the record is corrupt or holds invalid moves */
+HALIOTIS_EXPORT bool GameArchive_Decode(const char* data, size_t size,
+  Haliotis::Game& game);
+
+#endif
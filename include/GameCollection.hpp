@@ -0,0 +1,82 @@
+/** @file GameCollection.hpp
+  Fast access to files holding many concatenated .AG games.
+*/
+
+#ifndef GameCollection_hpp
+#define GameCollection_hpp
+
+#include <string>
+#include <vector>
+
+#include "Game.hpp"
+#include "MappedFile.hpp"
+
+/** One game in a GameCollection. The view points into the mapped file, so
+  it is cheap to copy, and is valid as long as the collection is open. */
+class HALIOTIS_EXPORT GameView {
+public:
+  GameView(const char* data, size_t size) : m_data(data), m_size(size) {}
+  /// The .AG text of the game
+  const char* Data() const { return m_data; }
+  size_t Size() const { return m_size; }
+  std::string Text() const { return std::string(m_data, m_size); }
+  /** Find an attribute without decoding the game.
+    @return false if the game does not have the attribute */
+  bool GetAttribute(const std::string& key, std::string& value) const;
+  /** Parse the game with AgParser. The game is positioned at the start
+    position.
+    @return false if the game could not be parsed */
+  bool Decode(Haliotis::Game& game) const;
+private:
+  const char* m_data;
+  size_t m_size;
+};
+
+/** A file of concatenated .AG games, as written by repeated calls to
+  AbaloneGameFormat_Write.
+
+  The file is memory mapped and split into games without parsing the moves:
+  a game starts with the first line of an attribute block (a line starting
+  with '['), or at the start of the file. The offsets of the games are saved
+  in a side-car index file, so the next Open() does not need to scan the
+  file again. The index is rebuilt if the size or modification time of the
+  collection has changed.
+
+  @note Since the split is made on lines starting with '[', a multi-line
+  comment must not have a line starting with '['.
+
+  @example
+    GameCollection collection;
+    collection.Open("games.ag");
+    for (size_t i = 0; i < collection.Size(); i++) {
+      Game game;
+      collection[i].Decode(game);
+    }
+*/
+class HALIOTIS_EXPORT GameCollection {
+public:
+  GameCollection();
+  /** Map the file and find the games in it.
+    @param useIndexFile  load and save the side-car index
+    @return false if the file could not be opened */
+  bool Open(const std::string& filename, bool useIndexFile = true);
+  void Close();
+  /// Number of games
+  size_t Size() const { return m_offsets.size(); }
+  GameView operator [] (size_t i) const;
+  /// Give a hint on how the games will be read
+  void Advise(MappedFile::Access access) const { m_file.Advise(access); }
+  /// Name of the side-car index file of a collection
+  static std::string IndexFileName(const std::string& filename) {
+    return filename + ".idx";
+  }
+private:
+  MappedFile m_file;
+  std::vector<unsigned long long> m_offsets; //< Start of each game
+
+  void Scan();
+  bool LoadIndex(const std::string& indexFile, unsigned long long mtime);
+  void SaveIndex(const std::string& indexFile, unsigned long long mtime) const;
+};
+
+#endif
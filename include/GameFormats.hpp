@@ -0,0 +1,94 @@
+/** @file GameFormats.hpp
+  Read and write games in the formats of other Abalone programs.
+*/
+
+#ifndef GameFormats_hpp
+#define GameFormats_hpp
+
+#include <iostream>
+#include <string>
+
+#include "Game.hpp"
+#include "Persistence.hpp"
+
+/** The game file formats known by GameFormatReader and GameFormatWriter */
+enum GameFormat {
+  FORMAT_AG,           //< .ag, see AgParser
+  FORMAT_ABAPRO,       //< .abp, games saved by AbaPro
+  FORMAT_WATERLOO1993, //< .wat, the Waterloo1993 tag/move format
+  FORMAT_UNKNOWN
+};
+
+/// Format with the name "ag", "abapro" or "waterloo1993"
+HALIOTIS_EXPORT GameFormat GameFormatFromName(const std::string& name);
+/// Format given by the extension of filename
+HALIOTIS_EXPORT GameFormat GameFormatOfFile(const std::string& filename);
+HALIOTIS_EXPORT const char* GameFormatName(GameFormat format);
+/// Extension of files in format, including the dot
+HALIOTIS_EXPORT const char* GameFormatExtension(GameFormat format);
+
+/**
+  Read games in any GameFormat from memory, e.g. a MappedFile. The buffers
+  are kept from game to game, so reuse one reader for many games.
+
+  AbaPro games are PGN like: attribute lines followed by numbered moves
+  and a result token (1-0, 0-1, 1/2-1/2 or *). Positions use the standard
+  notation, where the columns are the NW-SE diagonals. An inline move is
+  the rear marble and its destination, e.g. "a1b2", and a broadside move
+  is the two end marbles and the destination of the first, e.g. "a1a3b2".
+  The tag [Position "<apf>"] gives a start position that is not standard.
+
+  Waterloo1993 games have the same attribute lines, but the first player
+  starts at the top, the columns are counted from the left of each row,
+  and a move is "tail[head]-newTail". The board is turned 180 degrees when
+  read, so the first player starts at the bottom as in Board2D.
+  A blank line ends the game, see the EBNF in Persistence.cpp.
+
+  Both formats may have {comments}, and a '[' where a move is expected
+  starts the next game. Only the main line is stored in these formats.
+
+  @example
+    GameFormatReader reader(FORMAT_ABAPRO);
+    const char* p = data;
+    Game game;
+    while (reader.Read(p, data + size, game)) {
+      // use game
+    }
+*/
+class HALIOTIS_EXPORT GameFormatReader {
+public:
+  explicit GameFormatReader(GameFormat format);
+  GameFormat Format() const { return m_format; }
+  /** Read one game and move data to the start of the next game.
+    @return false if the game could not be parsed, then data points at the
+      offending token */
+  bool Read(const char*& data, const char* end, Haliotis::Game& game);
+private:
+  bool ReadMoves(const char*& data, const char* end, Haliotis::Game& game);
+  GameFormat m_format;
+  AgParser m_agParser;
+  Settings m_attributes;
+};
+
+/**
+  Write games in any GameFormat. The text is collected in a buffer that is
+  kept from game to game, so reuse one writer for many games. Variations
+  are not written in the AbaPro and Waterloo1993 formats.
+*/
+class HALIOTIS_EXPORT GameFormatWriter {
+public:
+  explicit GameFormatWriter(GameFormat format);
+  GameFormat Format() const { return m_format; }
+  void Write(std::ostream& out, const Haliotis::Game& game);
+private:
+  /// Size of buffer before it is written to the stream
+  enum { FLUSH_SIZE = 64 * 1024 };
+  void AppendPos(Haliotis::Board2D::Pos pos);
+  void AppendMove(const Haliotis::Board2D::Move& move);
+  GameFormat m_format;
+  AgWriter m_agWriter;
+  Settings m_attributes;
+  std::string m_buffer;
+};
+
+#endif
@@ -0,0 +1,91 @@
+/** @file GameImport.hpp
+  Read many .AG files in parallel.
+*/
+
+#ifndef GameImport_hpp
+#define GameImport_hpp
+
+#include <string>
+#include <vector>
+
+#include "Game.hpp"
+
+/** A game read by GameImporter */
+struct ImportedGame {
+  size_t file;         //< Index of the file in GameImporter::Files()
+  size_t number;       //< Number of the game in the file, from 0
+  Haliotis::Game game; //< Positioned at the start position
+};
+
+/** Outcome of reading one file */
+struct ImportFileResult {
+  std::string filename;
+  size_t games;      //< Games read without error
+  size_t errors;     //< Games that could not be read
+  size_t bytes;      //< Size of the file
+  std::string error; //< First error, empty if there were none
+  ImportFileResult() : games(0), errors(0), bytes(0) {}
+};
+
+/** Totals of an import */
+struct ImportStatistics {
+  size_t files;
+  size_t games;
+  size_t errors;
+  size_t bytes;
+  double seconds;
+  ImportStatistics() : files(0), games(0), errors(0), bytes(0), seconds(0) {}
+  double GamesPerSecond() const { return seconds > 0 ? games / seconds : 0; }
+};
+
+/** Receives the result of GameImporter. The calls are made from the thread
+  that called GameImporter::Run(), one at a time, so the listener does not
+  need to be thread safe. */
+class GameImportListener {
+public:
+  virtual ~GameImportListener() {}
+  /** A batch of games. The games are reused for later batches when the
+    call returns, so move or copy what must be kept. */
+  virtual void Games(std::vector<ImportedGame*>& batch) = 0;
+  /// A file has been read
+  virtual void FileDone(const ImportFileResult& result) { (void)result; }
+};
+
+/** Read .AG files on a ThreadPool and deliver the games in batches.
+
+  Each file may hold several games, see GameCollection. The files are
+  memory mapped and parsed with AgParser, which checks every move with
+  Board2D::DoMove. The workers fill batches of games, and a worker waits
+  when the listener is more than a few batches behind, so the memory used
+  is bounded by the batch size and not by the size of the import.
+
+  A game with an error is skipped, and the file is read from the next game.
+  The games of a file are delivered in order, but the files are not.
+
+  @example
+    GameImporter importer(4);
+    importer.AddDirectory("games");
+    ImportStatistics stat = importer.Run(listener);
+    cout << stat.GamesPerSecond() << " games/s" << endl;
+*/
+class HALIOTIS_EXPORT GameImporter {
+public:
+  /** @param threads  number of workers, 0 for one per hardware thread
+    @param batchSize  number of games per call of GameImportListener::Games
+  */
+  explicit GameImporter(unsigned threads = 0, size_t batchSize = 256);
+  void AddFile(const std::string& filename);
+  /** Add all files with the given extension in dir and its subdirectories.
+    The files are added in sorted order.
+    @return false if dir could not be read */
+  bool AddDirectory(const std::string& dir, const std::string& extension = ".ag");
+  const std::vector<std::string>& Files() const { return m_files; }
+  /// Read all files that have been added
+  ImportStatistics Run(GameImportListener& listener);
+private:
+  unsigned m_threads;
+  size_t m_batchSize;
+  std::vector<std::string> m_files;
+};
+
+#endif
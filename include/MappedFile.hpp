@@ -0,0 +1,63 @@
+/** @file MappedFile.hpp
+  Read-only access to the content of a file through memory mapping.
+*/
+
+#ifndef MappedFile_hpp
+#define MappedFile_hpp
+
+#include "abmove.h"
+
+#include <cstddef>
+#include <istream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+/** A file mapped into memory for reading. On platforms without mmap() the
+  file is read into a buffer instead, so the interface is the same. */
+class HALIOTIS_EXPORT MappedFile {
+public:
+  /// Hints to the operating system about how the data will be read
+  enum Access {
+    ACCESS_NORMAL,
+    ACCESS_SEQUENTIAL,
+    ACCESS_RANDOM
+  };
+
+  MappedFile();
+  ~MappedFile();
+  /// @return false if the file could not be opened
+  bool Open(const std::string& filename);
+  void Close();
+  bool IsOpen() const { return m_open; }
+  const char* Data() const { return m_data; }
+  size_t Size() const { return m_size; }
+  /// Give a hint on how the data will be read (madvise)
+  void Advise(Access access) const;
+private:
+  MappedFile(const MappedFile&); // Not implemented
+  void operator = (const MappedFile&); // Not implemented
+
+  const char* m_data;
+  size_t m_size;
+  bool m_open;
+  bool m_mapped; //< False if data is in m_buffer
+  std::vector<char> m_buffer;
+};
+
+/** Stream buffer reading from memory without copying it. This makes it
+  possible to use stream based readers on a MappedFile.
+
+  @example
+    MemoryStreamBuf buf(data, size);
+    std::istream in(&buf);
+*/
+class MemoryStreamBuf: public std::streambuf {
+public:
+  MemoryStreamBuf(const char* data, size_t size) {
+    char* p = const_cast<char*>(data); // streambuf is never written to
+    setg(p, p, p + size);
+  }
+};
+
+#endif
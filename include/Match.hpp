@@ -0,0 +1,239 @@
+/** @file Match.hpp
+  Play matches between two engines, and tell which one is stronger.
+*/
+
+#ifndef Match_hpp
+#define Match_hpp
+
+#include "abmove.h"
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "AEPWrap.hpp"
+#include "Board2D.hpp"
+#include "EngineProcess.hpp"
+#include "Game.hpp"
+
+/** Set up the start position called name: "Standard", "BelgianDaisy",
+  "GermanDaisy", "SwissDaisy" or "DutchDaisy".
+  @return false if the name is not known */
+HALIOTIS_EXPORT bool StartLayout(const std::string& name, Haliotis::Board2D& board);
+/// Names accepted by StartLayout()
+HALIOTIS_EXPORT std::vector<std::string> StartLayoutNames();
+
+/** Time control of a match game, in ms. The clock of a player starts at
+  base, and inc is added after each of its moves. If moveTime is given,
+  every move gets that time and there is no clock. */
+struct MatchTimeControl {
+  long long base;
+  long long inc;
+  long long moveTime; //< -1 if the clock is used
+  MatchTimeControl() : base(10000), inc(100), moveTime(-1) {}
+};
+
+/// The clocks of both players when a move is asked, in ms
+struct MatchClock {
+  long long time[2]; //< Time left of player 1 and 2, -1 without clock
+  long long inc[2];
+  long long moveTime; //< Time for this move, -1 if the clock is used
+};
+
+/// What became of a request for a move
+enum MatchMoveStatus {
+  MATCH_MOVE_OK,
+  MATCH_MOVE_TIMEOUT,  //< No move within the time limit
+  MATCH_MOVE_ILLEGAL,  //< The move can not be read or is not legal
+  MATCH_MOVE_CRASHED   //< The engine has stopped, or did not start
+};
+
+/** A player of match games. Each player is used by one game at a time,
+  so implementations need not be thread safe. */
+class HALIOTIS_EXPORT MatchPlayer {
+public:
+  virtual ~MatchPlayer() {}
+  /// Name to use in the game files
+  virtual std::string Name() const = 0;
+  /// Prepare for a new game. @return false if the player can not play.
+  virtual bool NewGame() = 0;
+  /** Choose a move in the current position of game. The move is only
+    read; it is checked and played by the match. */
+  virtual MatchMoveStatus GetMove(const Haliotis::Game& game,
+    const MatchClock& clock, Haliotis::Board2D::Move& move) = 0;
+};
+
+/** An engine that runs as a child process and talks the Abalone Engine
+  Protocol. The process is started at the first game, and started again
+  if it has crashed. The whole game is sent in each "position" command,
+  so the engine may reuse its state between moves.
+*/
+class HALIOTIS_EXPORT AepProcessPlayer: public MatchPlayer {
+public:
+  typedef std::vector<std::pair<std::string, std::string> > OptionList;
+
+  /** @param command  command line of the engine, run by the shell
+    @param options  sent with "setoption" after the engine has started */
+  AepProcessPlayer(const std::string& command, const OptionList& options = OptionList());
+  /// Name given by the engine with "id name", or else the command
+  virtual std::string Name() const;
+  virtual bool NewGame();
+  virtual MatchMoveStatus GetMove(const Haliotis::Game& game,
+    const MatchClock& clock, Haliotis::Board2D::Move& move);
+
+  /// Time the engine may use more than its clock, for slow pipes, in ms
+  static const long long TIME_MARGIN = 1000;
+  /// Time to answer "aep" and "isready", in ms
+  static const long long READY_TIMEOUT = 10000;
+
+private:
+  bool Start();
+  /// Send isready and wait for readyok
+  bool WaitReady();
+
+  std::string m_command;
+  OptionList m_options;
+  std::string m_name;
+  EngineProcess m_process;
+};
+
+/** An engine in this process, driven by AbaloneEngineProtocol::Driver.
+  No text is passed between the match and the engine, so many games can
+  be played at the same time at little cost. The engine may set up its
+  options before it is given to the player. A search that overruns the
+  clock is only caught after the move.
+*/
+class HALIOTIS_EXPORT EnginePlayer: public MatchPlayer {
+public:
+  /// @param engine  owned by the player
+  explicit EnginePlayer(AbaloneEngineProtocol::Engine* engine);
+  virtual ~EnginePlayer();
+  virtual std::string Name() const;
+  virtual bool NewGame();
+  virtual MatchMoveStatus GetMove(const Haliotis::Game& game,
+    const MatchClock& clock, Haliotis::Board2D::Move& move);
+  AbaloneEngineProtocol::Driver& GetDriver() { return m_driver; }
+
+private:
+  AbaloneEngineProtocol::Engine* m_engine;
+  AbaloneEngineProtocol::Driver m_driver;
+};
+
+/// Games won, drawn and lost by the first engine
+struct HALIOTIS_EXPORT MatchStatistics {
+  unsigned wins;
+  unsigned draws;
+  unsigned losses;
+  MatchStatistics() : wins(0), draws(0), losses(0) {}
+
+  unsigned Games() const { return wins + draws + losses; }
+  /// Points per game, a draw is half a point
+  double Score() const;
+  /** Elo difference of the first engine from its score, and the margin of
+    the 95% confidence interval. */
+  double Elo(double* margin = 0) const;
+  /** Log likelihood ratio of the sequential probability ratio test of
+    the hypothesis elo1 against elo0, from the normal approximation of
+    the score. When all games have the same result, the variance of the
+    score is taken with half a win and half a loss more, so a match of
+    only wins or losses still comes to a result. */
+  double LLR(double elo0, double elo1) const;
+};
+
+/// Parameters of a match
+struct MatchOptions {
+  unsigned games;        //< Number of games, rounded up to an even number
+  unsigned concurrency;  //< Games played at the same time
+  std::vector<std::string> layouts; //< Start positions, see StartLayout()
+  MatchTimeControl timeControl;
+  int maxPlies;          //< Longest game, then it is drawn
+  bool sprt;             //< Stop when the test below has a result
+  double elo0;
+  double elo1;
+  double alpha;          //< Chance to accept elo1 when elo0 is true
+  double beta;           //< Chance to accept elo0 when elo1 is true
+  MatchOptions()
+  : games(100), concurrency(1), maxPlies(400), sprt(false),
+    elo0(0), elo1(5), alpha(0.05), beta(0.05) {}
+};
+
+/// Result of one match game
+struct MatchGame {
+  unsigned number;      //< Starts at 1
+  std::string layout;
+  bool firstIsWhite;    //< The first engine had the first move
+  int winner;           //< 1 or 2 for the player that won, 0 if drawn
+  std::string reason;   //< How the game ended
+  Haliotis::Game game;
+};
+
+/** Told about the progress of a match. Calls are serialized by the match,
+  but come from its worker threads. */
+class HALIOTIS_EXPORT MatchListener {
+public:
+  virtual ~MatchListener() {}
+  virtual void GameDone(const MatchGame& game, const MatchStatistics& stats) = 0;
+};
+
+/** Play games between two players, on several threads. Each thread has
+  its own pair of players, made by the factories. Each start layout is
+  played twice, with colours swapped. The games are written as .AG files
+  to a stream, and the statistics are updated after each game.
+
+  Players in this process are made the same way:
+    Match match(options,
+      []() { return new EnginePlayer(new MyEngine); }, ...);
+
+  @example
+    Match match(options,
+      []() { return new AepProcessPlayer("./engine-new"); },
+      []() { return new AepProcessPlayer("./engine-old"); });
+    match.SetOutput(&file);
+    match.Run(listener);
+*/
+class HALIOTIS_EXPORT Match {
+public:
+  /// Make a new player, owned by the match
+  typedef std::function<MatchPlayer*()> PlayerFactory;
+
+  Match(const MatchOptions& options, PlayerFactory first, PlayerFactory second);
+  ~Match();
+
+  /// Append the games in .AG format to out, or write no games if 0
+  void SetOutput(std::ostream* out) { m_output = out; }
+  /// Play the games. @return false if a layout is not known
+  bool Run(MatchListener& listener);
+  /// Stop after the games that are being played. Thread safe.
+  void Stop() { m_stop.store(true); }
+
+  MatchStatistics Statistics() const;
+  /** Result of the SPRT: 1 if elo1 is accepted, -1 if elo0 is accepted,
+    0 while the test goes on, or when there is no test */
+  int SprtResult() const;
+
+private:
+  Match(const Match&); // Not implemented
+  void operator = (const Match&); // Not implemented
+
+  typedef std::pair<MatchPlayer*, MatchPlayer*> PlayerPair;
+
+  void PlayGame(unsigned number, PlayerPair& players);
+  void Play(MatchGame& result, MatchPlayer* white, MatchPlayer* black);
+  void Finish(const MatchGame& result);
+
+  MatchOptions m_options;
+  PlayerFactory m_first;
+  PlayerFactory m_second;
+  std::ostream* m_output;
+  MatchListener* m_listener;
+  std::vector<PlayerPair> m_players; //< One pair for each thread
+  std::atomic<bool> m_stop;
+  mutable std::mutex m_mutex;        //< Protects the below
+  MatchStatistics m_stats;
+  int m_sprt;
+};
+
+#endif
@@ -0,0 +1,137 @@
+/** @file OpeningBook.hpp
+  Opening book built from game collections.
+
+  A book file is sorted by the hash of the positions, so a position is
+  found by binary search in the memory mapped file. It is laid out as
+
+    header     "ABOB", version, 3 reserved bytes,
+               number of positions (u64), number of moves (u64)
+    positions  one 32 byte entry per position, sorted by hash:
+                 hash (u64), wins, draws, losses, first move, number of
+                 moves, reserved (u32 each)
+    moves      8 bytes per move, the moves of a position are adjacent and
+               sorted by count, most played first:
+                 move (u16, Board2D::Move::Pack()), reserved (u16), count (u32)
+
+  All integers are little endian. The hash is BookHash() and the moves are
+  stored as seen in the symmetry it selects. Wins, draws and losses are
+  counted for the player to move.
+*/
+
+#ifndef OpeningBook_hpp
+#define OpeningBook_hpp
+
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Game.hpp"
+#include "MappedFile.hpp"
+
+/** Hash of a position that is the same for the 12 symmetric positions:
+  the smallest Board2D::Hash64() of the board rotated and mirrored.
+  @param symmetry  if not 0, set to the symmetry that gave the smallest
+    hash, for BookTransform() */
+HALIOTIS_EXPORT unsigned long long BookHash(const Haliotis::Board2D& board,
+  int* symmetry = 0);
+
+/** Rotate and mirror a move by one of the 12 symmetries of the board.
+  Symmetry 0..5 rotate by 60 degrees at a time, 6..11 mirror first.
+  The result is one of the ways to write the move, so that a move has one
+  Board2D::Move::Pack() value in the book: the tail direction of a single
+  marble is 0, and a line of marbles is given from one of its ends.
+  @param inverse  undo the symmetry instead */
+HALIOTIS_EXPORT Haliotis::Board2D::Move BookTransform(
+  const Haliotis::Board2D::Move& move, int symmetry, bool inverse = false);
+
+/** A move of a book position */
+struct BookMove {
+  Haliotis::Board2D::Move move;
+  unsigned count; //< Games where the move was played
+};
+
+/** A position found in the book */
+struct BookPosition {
+  unsigned wins;   //< Games won by the player to move
+  unsigned draws;
+  unsigned losses;
+  std::vector<BookMove> moves; //< Most played first
+  BookPosition() : wins(0), draws(0), losses(0) {}
+};
+
+/** Options of OpeningBookBuilder */
+struct OpeningBookOptions {
+  int maxPly;        //< Positions after this many moves are not added
+  unsigned minGames; //< Positions seen in fewer games are not written
+  OpeningBookOptions() : maxPly(30), minGames(2) {}
+};
+
+/**
+  Count the results and the moves played of each position in many games,
+  and write them as a book file.
+
+  @example
+    OpeningBookBuilder builder;
+    builder.Add(game);
+    std::ofstream out("openings.abb", std::ios::binary);
+    builder.Write(out);
+*/
+class HALIOTIS_EXPORT OpeningBookBuilder {
+public:
+  explicit OpeningBookBuilder(const OpeningBookOptions& options = OpeningBookOptions());
+  /// Add the main line of a game
+  void Add(const Haliotis::Game& game);
+  /// Number of positions seen
+  size_t Size() const { return m_positions.size(); }
+  /** Write the positions seen in at least minGames games.
+    @return number of positions written */
+  size_t Write(std::ostream& out) const;
+private:
+  struct Node {
+    unsigned games;
+    unsigned wins;
+    unsigned draws;
+    unsigned losses;
+    std::vector<std::pair<unsigned, unsigned> > moves; //< Packed move, count
+    Node() : games(0), wins(0), draws(0), losses(0) {}
+  };
+  OpeningBookOptions m_options;
+  std::unordered_map<unsigned long long, Node> m_positions;
+};
+
+/**
+  Look up positions in a book file. The file is memory mapped and searched
+  in place, so opening a book is fast and a lookup takes a binary search
+  in the positions. An engine can use it in Engine::GetMove().
+
+  @example
+    OpeningBook book;
+    book.Open("openings.abb");
+    Board2D::Move move;
+    if (book.ChooseMove(board, move, random)) return move;
+*/
+class HALIOTIS_EXPORT OpeningBook {
+public:
+  OpeningBook();
+  /// @return false if the file is not a book
+  bool Open(const std::string& filename);
+  void Close();
+  /// Number of positions in the book
+  size_t Size() const { return (size_t)m_positions; }
+  /** Find a position. Moves that are not legal on board are left out, in
+    case two positions have the same hash.
+    @return false if the position is not in the book */
+  bool Find(const Haliotis::Board2D& board, BookPosition& position) const;
+  /** Choose one of the book moves at random, weighted by how often they
+    were played.
+    @return false if the position is not in the book */
+  bool ChooseMove(const Haliotis::Board2D& board, Haliotis::Board2D::Move& move,
+    std::mt19937_64& random) const;
+private:
+  MappedFile m_file;
+  unsigned long long m_positions;
+  unsigned long long m_moves;
+};
+
+#endif
@@ -0,0 +1,187 @@
+/** @file PerfCounters.hpp
+  Count events and time scopes in hot paths, and dump the totals as
+  Settings.
+
+  Counters and timers are static objects, declared at file scope:
+
+    PERF_COUNTER(pushes, "board.push")
+    PERF_TIMER(parseTime, "parse.ag")
+    ...
+    PERF_COUNT(pushes);
+    { PERF_SCOPE(parseTime); ... }
+
+  Each thread adds to a block of its own, aligned to cache lines, so a
+  count is a load and a store to a line that no other thread writes. The
+  blocks are summed when the counters are read. Without USE_PERF_COUNTERS
+  in config.h the macros compile to nothing.
+*/
+
+#ifndef PerfCounters_hpp
+#define PerfCounters_hpp
+
+#include "abmove.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#endif
+
+#include "Settings.hpp"
+
+/** Time stamp counter of the cpu, or ns of the steady clock where there
+  is none. Only differences are used, and converted to ms by
+  PerfCounters. */
+inline unsigned long long PerfCycles()
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+typedef std::atomic<unsigned long long> PerfValue;
+
+/* An extern thread_local is reached through a function that checks if
+  it needs to be constructed, on every count. __thread is a plain load. */
+#if defined(__GNUC__)
+#define PERF_THREAD_LOCAL __thread
+#else
+#define PERF_THREAD_LOCAL thread_local
+#endif
+
+/// Values of the calling thread, 0 until it first counts
+extern HALIOTIS_EXPORT PERF_THREAD_LOCAL PerfValue* perfThreadValues;
+/// Make the values of the calling thread
+HALIOTIS_EXPORT PerfValue* PerfNewThreadValues();
+
+/** Add to a slot of the calling thread. Only the thread writes its
+  values, so there is no need for an atomic add. */
+inline void PerfAdd(unsigned slot, unsigned long long n)
+{
+  PerfValue* values = perfThreadValues;
+  if (values == 0) values = PerfNewThreadValues();
+  values[slot].store(values[slot].load(std::memory_order_relaxed) + n,
+    std::memory_order_relaxed);
+}
+
+/** A number of events */
+class HALIOTIS_EXPORT PerfCounter {
+public:
+  /// @param name  key of the counter in the dump, without "perf."
+  explicit PerfCounter(const char* name);
+  void Add(unsigned long long n = 1) const { PerfAdd(m_slot, n); }
+private:
+  unsigned m_slot;
+};
+
+/** Calls of a scope and the cycles spent in it */
+class HALIOTIS_EXPORT PerfTimer {
+public:
+  explicit PerfTimer(const char* name);
+  void Add(unsigned long long cycles) const {
+    PerfAdd(m_slot, cycles);
+    PerfAdd(m_slot + 1, 1);
+  }
+private:
+  unsigned m_slot; //< Cycles, and calls in the next slot
+};
+
+/** Adds the cycles from its construction to its destruction to a timer */
+class PerfScope {
+public:
+  explicit PerfScope(const PerfTimer& timer) : m_timer(timer), m_start(PerfCycles()) {}
+  ~PerfScope() { m_timer.Add(PerfCycles() - m_start); }
+private:
+  PerfScope(const PerfScope&); // Not implemented
+  void operator = (const PerfScope&); // Not implemented
+  const PerfTimer& m_timer;
+  unsigned long long m_start;
+};
+
+/** The register of counters and timers, and their totals over all threads.
+
+  As a Configurable it gets, for each counter, "perf.name" with the count
+  and for each timer "perf.name.calls" and "perf.name.ms". It is
+  configured by "perf.interval", the ms between dumps to the trace, 0 for
+  none. TraceManager passes the interval on, so it can be set in the trace
+  configuration file.
+
+  @example
+    std::cout << PerfCounters::GetInstance();
+*/
+class HALIOTIS_EXPORT PerfCounters: public Configurable {
+public:
+  static PerfCounters& GetInstance();
+
+  /// Most slots of all counters; a timer takes two
+  static const unsigned MAX_SLOTS = 512;
+
+  /// @return the first of size slots for name
+  unsigned Register(const char* name, unsigned size, bool timer);
+  PerfValue* NewThreadValues();
+  /// Add the values of a thread that exits to the totals, and free them
+  void ThreadDone(PerfValue* values);
+
+  /// Count from zero again. Threads go on counting meanwhile.
+  void Reset();
+  /// Write the totals to the trace every interval ms, 0 to stop
+  void SetInterval(unsigned interval);
+  unsigned Interval() const { return m_interval; }
+
+  virtual void GetConfiguration(Settings& settings) const;
+  virtual void SetConfiguration(const Settings& settings);
+
+private:
+  PerfCounters();
+  /// Totals of all threads, since Reset(). Caller must hold m_mutex.
+  void Totals(std::vector<unsigned long long>& totals) const;
+  void RunDumps();
+  static void Shutdown();
+
+  struct Entry {
+    std::string name;
+    unsigned slot;
+    bool timer;
+  };
+
+  mutable std::mutex m_mutex;                   //< Protects the below
+  std::vector<Entry> m_entries;
+  unsigned m_slots;                             //< Slots given out
+  std::vector<PerfValue*> m_threads;            //< Values of running threads
+  std::vector<unsigned long long> m_retired;    //< Of threads that have exited
+  std::vector<unsigned long long> m_base;       //< Totals at Reset()
+  unsigned long long m_startCycles;             //< To convert cycles to ms
+  std::chrono::steady_clock::time_point m_startTime;
+  unsigned m_interval;
+  bool m_exit;
+  std::condition_variable m_wake;
+  std::thread m_dumper;
+};
+
+#ifdef USE_PERF_COUNTERS
+/// Declare a counter at file scope
+#define PERF_COUNTER(var,name) static PerfCounter var(name);
+/// Declare a timer at file scope
+#define PERF_TIMER(var,name) static PerfTimer var(name);
+#define PERF_COUNT(var) (var).Add(1)
+#define PERF_ADD(var,n) (var).Add(n)
+/// Time the rest of the enclosing scope
+#define PERF_SCOPE(var) PerfScope perfScope__(var)
+#else
+#define PERF_COUNTER(var,name)
+#define PERF_TIMER(var,name)
+#define PERF_COUNT(var) ((void)0)
+#define PERF_ADD(var,n) ((void)0)
+#define PERF_SCOPE(var) ((void)0)
+#endif
+
+#endif
@@ -32,6 +32,70 @@ inline istream& operator >> (std::istream& in, StreamInterface& data) {
 void AbaloneGameFormat_Read(std::istream& in, Haliotis::Game& game);
 void AbaloneGameFormat_Write(std::ostream& out, const Haliotis::Game& game);
 
+/**
+  Fast reader of the .AG format that parses games from memory, e.g. a
+  MappedFile. It builds the same Game as AbaloneGameFormat_Read, but reads
+  the buffer directly and keeps its buffers from game to game, so reuse one
+  parser for many games.
+
+  It also accepts some input that AbaloneGameFormat_Read rejects: several
+  variations after a move and "1. - a1b2" for a variation starting with the
+  second player. A '[' where a move is expected starts the next game.
+
+  @example
+    AgParser parser;
+    const char* p = data;
+    Game game;
+    while (parser.Read(p, data + size, game)) {
+      // use game
+    }
+*/
+class HALIOTIS_EXPORT AgParser {
+public:
+  /** Read one game and move data to the start of the next game.
+    @return false if the game could not be parsed, then data points at the
+      offending token */
+  bool Read(const char*& data, const char* end, Haliotis::Game& game);
+private:
+  struct State {
+    Haliotis::GameTreeNode* node;
+    Haliotis::Board2D board;  //< Board after node->move
+    Haliotis::Board2D before; //< Board before node->move
+    bool beforeKnown;         //< before is not set after '(' until a move
+  };
+  Settings m_attributes;
+  std::string m_key;
+  std::string m_value;
+  std::vector<State> m_variations;
+};
+
+/// Read one game with AgParser
+bool AbaloneGameFormat_Read(const char* data, size_t size, Haliotis::Game& game);
+
+/**
+  Writer of the .AG format. The game tree is walked in place, and the text
+  is collected in a buffer that is kept from game to game, so reuse one
+  writer for many games. AbaloneGameFormat_Write uses a temporary writer.
+
+  The comment of a node is written after its move, and a comment at the
+  start position before the first move. A move of the second player gets a
+  number like "3. - a1b2" when it starts a variation or follows one.
+*/
+class HALIOTIS_EXPORT AgWriter {
+public:
+  void Write(std::ostream& out, const Haliotis::Game& game);
+private:
+  /// Size of buffer before it is written to the stream
+  enum { FLUSH_SIZE = 64 * 1024 };
+  struct Frame {
+    const Haliotis::GameTreeNode* node; //< Node whose children are written
+    size_t nextChild; //< 0 before the main move is written
+    int ply;          //< Number of moves before the children
+  };
+  std::string m_buffer;
+  std::vector<Frame> m_stack;
+};
+
 /**
   Implement a filter that allows you to read an single abalone game from a file.
 
@@ -63,12 +127,21 @@ const StreamInterface& ag_format(const Haliotis::Game& var);
 
 // TODO Sort these pasted functions
 std::string apf(const Haliotis::Game& game);
+std::string apf(const Haliotis::Board2D& board);
+bool parse_apf(const std::string& str, Haliotis::Board2D& board);
 std::string MoveList(const Haliotis::Game& game);
 bool parse_fftl(const std::string&  str,
   const Haliotis::Board2D&        board,
   Haliotis::Board2D::Move&         move);
 bool readMove(std::istream& in, Haliotis::Game& game);
+/// Do the move from-first to-last given by four characters, like "a1b2"
+bool doFFTL(Haliotis::Game& game, char fa, char f1, char ta, char t1);
 void ReadAttributes(Settings& att, istream& in);
+void ReadAttributes(Settings& att, const char*& data, const char* end);
 void WriteAttributes(const Settings& att, ostream& out);
+/// The white space skipped by the game readers
+inline bool IsSpace(char c) {
+  return c==' ' or c=='\t' or c=='\n' or c=='\v' or c=='\f' or c=='\r';
+}
 
 #endif
@@ -0,0 +1,185 @@
+/** @file PositionDataset.hpp
+  Binary files of positions for training evaluation functions.
+
+  The positions are written as fixed size records to one or more shard
+  files named <prefix>-00000.abd, <prefix>-00001.abd and so on. A shard is
+  laid out as
+
+    header   "ABDS", version, record size, 2 reserved bytes
+    blocks   until end of file, each with a 12 byte header:
+               records in block (u32), stored bytes (u32),
+               method (u8, 0 = stored, 1 = zlib), 3 reserved bytes
+             and the stored bytes holding the records
+
+  and a record is PositionRecord::SIZE bytes:
+
+    fields   16 bytes, Board2D::PackFields()
+    turn     player to move, 1 or 2
+    off      marbles pushed off of player 1, then of player 2
+    result   result of the game, see DatasetResult
+    move     move played in the position, Board2D::Move::Pack() (u16)
+    ply      moves played before the position (u16)
+
+  All integers are little endian. Since each record has the same size, a
+  training pipeline can read a stored block directly into an array.
+*/
+
+#ifndef PositionDataset_hpp
+#define PositionDataset_hpp
+
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "Game.hpp"
+
+/** Result of the game a position is taken from */
+enum DatasetResult {
+  RESULT_UNKNOWN = 0,
+  RESULT_FIRST_WINS,  //< Player 1 won
+  RESULT_SECOND_WINS, //< Player 2 won
+  RESULT_DRAW
+};
+
+/** Result of a game from its Result attribute ("1-0", "0-1", "1/2-1/2"),
+  or else from the marbles pushed off in the last position of the main
+  line. */
+HALIOTIS_EXPORT DatasetResult GameResult(const Haliotis::Game& game);
+
+/** One position of a dataset, see PositionDataset.hpp for the layout */
+struct HALIOTIS_EXPORT PositionRecord {
+  enum { SIZE = 24 };
+  unsigned char fields[Haliotis::Board2D::PACKED_FIELDS_SIZE];
+  unsigned char turn;
+  unsigned char off[2];
+  unsigned char result;
+  unsigned move;
+  unsigned ply;
+
+  /// Position on board before move is played
+  void Set(const Haliotis::Board2D& board, const Haliotis::Board2D::Move& move,
+    int ply, DatasetResult result);
+  void GetBoard(Haliotis::Board2D& board) const;
+  void Encode(unsigned char data[SIZE]) const;
+  void Decode(const unsigned char data[SIZE]);
+};
+
+/** Options of PositionDatasetWriter */
+struct PositionDatasetOptions {
+  size_t shardRecords;  //< Records in each shard file, 0 for one shard
+  size_t blockRecords;  //< Records in each block of a shard
+  bool unique;          //< Skip positions already written, see PositionDatasetWriter
+  size_t uniqueLimit;   //< Positions remembered by unique, 8 bytes each
+  size_t shuffleBuffer; //< Records held for shuffling, 0 to keep the order
+  unsigned seed;        //< Seed of the shuffle
+  bool compress;        //< Compress the blocks with zlib, if available
+  PositionDatasetOptions()
+  : shardRecords(1000000), blockRecords(4096), unique(false)
+  , uniqueLimit(1 << 22), shuffleBuffer(0), seed(1), compress(false) {}
+};
+
+/**
+  Write the positions of games to a sharded dataset.
+
+  Shuffling uses a buffer of a fixed number of records: when it is full, a
+  new record takes the place of a random record, which is written. The
+  records left in the buffer are shuffled and written by Close(). So the
+  memory used does not depend on the size of the dataset, and the larger
+  the buffer, the better the shuffle.
+
+  Deduplication keys a position by its Board2D::Hash64() and the marbles
+  pushed off, so the same fields with another score are kept. The keys are
+  remembered in a table of uniqueLimit slots, rounded up to a power of 2,
+  which is allocated by the constructor. A key is looked for in the next
+  few slots after its own, and when they are all used it replaces the key
+  in its own slot. So the memory is fixed, and when more positions than
+  the limit are written, some duplicates are written again. A position is
+  only skipped if its 64 bit key has been seen.
+
+  @example
+    PositionDatasetOptions options;
+    options.shuffleBuffer = 1000000;
+    PositionDatasetWriter dataset("train", options);
+    dataset.Add(game);
+    dataset.Close();
+*/
+class HALIOTIS_EXPORT PositionDatasetWriter {
+public:
+  PositionDatasetWriter(const std::string& prefix,
+    const PositionDatasetOptions& options = PositionDatasetOptions());
+  /// Close the dataset, if not already done
+  ~PositionDatasetWriter();
+  /// Add each position of the main line that has a move
+  void Add(const Haliotis::Game& game);
+  /** Add one position, hash is Board2D::Hash64() of the position. The
+    marbles pushed off in record are added to the key of deduplication */
+  void Add(const PositionRecord& record, unsigned long long hash);
+  /** Write the records left in the shuffle buffer and close the last shard.
+    @return false if a shard could not be written */
+  bool Close();
+
+  /// Records added, except duplicates
+  size_t Records() const { return m_records; }
+  /// Records skipped as duplicates
+  size_t Duplicates() const { return m_duplicates; }
+  const std::vector<std::string>& Shards() const { return m_shards; }
+private:
+  PositionDatasetWriter(const PositionDatasetWriter&); // Not implemented
+  void operator = (const PositionDatasetWriter&); // Not implemented
+
+  /// Remember the key of a position, @return true if it was seen before
+  bool Seen(unsigned long long key);
+  void Emit(const PositionRecord& record);
+  void FlushBlock();
+  void CloseShard();
+
+  std::string m_prefix;
+  PositionDatasetOptions m_options;
+  std::vector<unsigned long long> m_seen; //< Keys, 0 for an empty slot
+  std::vector<PositionRecord> m_shuffle;
+  std::mt19937_64 m_random;
+  std::ofstream m_out;
+  std::string m_block;      //< Encoded records of the block being filled
+  std::string m_compressed; //< Buffer reused for compression
+  size_t m_blockRecords;    //< Records in m_block
+  size_t m_shardRecords;    //< Records in the open shard
+  size_t m_records;
+  size_t m_duplicates;
+  std::vector<std::string> m_shards;
+  bool m_ok;
+  bool m_closed;
+};
+
+/** Read the records of one shard in order.
+
+  @example
+    PositionDatasetReader shard;
+    shard.Open("train-00000.abd");
+    PositionRecord record;
+    while (shard.Next(record)) {
+      // use record
+    }
+*/
+class HALIOTIS_EXPORT PositionDatasetReader {
+public:
+  PositionDatasetReader();
+  /// @return false if the file is not a dataset shard
+  bool Open(const std::string& filename);
+  /** Read the next record.
+    @return false at the end of the shard or if a block is corrupt,
+      see Valid() */
+  bool Next(PositionRecord& record);
+  /// False if the shard could not be read
+  bool Valid() const { return m_valid; }
+private:
+  bool ReadBlock();
+
+  std::ifstream m_in;
+  std::string m_stored;
+  std::string m_block;
+  size_t m_next; //< Offset in m_block of the next record
+  bool m_valid;
+};
+
+#endif
@@ -0,0 +1,123 @@
+/** @file PositionIndex.hpp
+  Index of the positions in game collections, to find the games that
+  reached a position.
+
+  An index file is memory mapped when it is searched. It is laid out as
+
+    header   "ABPI", version, 3 reserved bytes, number of records,
+             number of games, number of files, offset of the games,
+             offset of the files (u64 each)
+    records  16 bytes per position, sorted by hash, game and ply:
+               Board2D::Hash64() (u64), game id (u32), ply (u16),
+               reserved (u16)
+    games    8 bytes per game id: file number (u32), number of the game
+             in the file counted from 0 (u32)
+    files    per file: length of name (u32) and name
+
+  All integers are little endian. A position is found by its hash, so two
+  positions with the same 64 bit hash can not be told apart.
+*/
+
+#ifndef PositionIndex_hpp
+#define PositionIndex_hpp
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Game.hpp"
+#include "MappedFile.hpp"
+
+/** Collect the positions of games and write them as an index file.
+
+  @example
+    PositionIndexBuilder builder;
+    size_t file = builder.AddFile("games.ag");
+    builder.Add(game, file, 0);
+    std::ofstream out("games.abi", std::ios::binary);
+    builder.Write(out);
+*/
+class HALIOTIS_EXPORT PositionIndexBuilder {
+public:
+  /** @param threads  threads used to sort the positions, 0 for one per
+    hardware thread */
+  explicit PositionIndexBuilder(unsigned threads = 0);
+  /// @return the file number used by Add()
+  size_t AddFile(const std::string& filename);
+  /** Add the start position and each position of the main line.
+    @param file  number returned by AddFile()
+    @param number  number of the game in the file */
+  void Add(const Haliotis::Game& game, size_t file, size_t number);
+  /// Number of games added
+  size_t Games() const { return m_games.size(); }
+  /// Number of positions added
+  size_t Size() const { return m_records.size(); }
+  /** Sort the positions on a ThreadPool and write the index.
+    The positions are kept, so more games may be added. */
+  void Write(std::ostream& out);
+
+  struct Record {
+    unsigned long long hash;
+    unsigned game;
+    unsigned ply;
+    bool operator < (const Record& other) const {
+      return hash != other.hash ? hash < other.hash
+           : game != other.game ? game < other.game
+           : ply < other.ply;
+    }
+  };
+private:
+  unsigned m_threads;
+  std::vector<Record> m_records;
+  std::vector<std::pair<unsigned, unsigned> > m_games; //< File and number
+  std::vector<std::string> m_files;
+  bool m_sorted;
+};
+
+/** A game that reached a position */
+struct PositionHit {
+  std::string filename;
+  size_t number; //< Number of the game in the file, from 0
+  int ply;       //< Moves played before the position
+};
+
+/** Search an index file written by PositionIndexBuilder.
+
+  @example
+    PositionIndex index;
+    index.Open("games.abi");
+    std::vector<PositionHit> hits;
+    index.Find(board, hits);
+*/
+class HALIOTIS_EXPORT PositionIndex {
+public:
+  PositionIndex();
+  /// @return false if the file is not a position index
+  bool Open(const std::string& filename);
+  void Close();
+  /// Number of positions in the index
+  size_t Size() const { return (size_t)m_records; }
+  /// Number of games in the index
+  size_t Games() const { return (size_t)m_games; }
+  /** Number of times the position occurs in the games. This is a binary
+    search, and does not read the hits. */
+  size_t Count(const Haliotis::Board2D& board) const;
+  /** Find the games that reached the position, ordered by game id.
+    @param limit  the most hits to return
+    @return number of times the position occurs, which may be more than
+      the hits returned */
+  size_t Find(const Haliotis::Board2D& board, std::vector<PositionHit>& hits,
+    size_t limit = (size_t)-1) const;
+private:
+  /// Range of records with the hash of board
+  void Range(const Haliotis::Board2D& board,
+    unsigned long long& first, unsigned long long& last) const;
+
+  MappedFile m_file;
+  unsigned long long m_records;
+  unsigned long long m_games;
+  unsigned long long m_gamesOffset;
+  std::vector<std::string> m_files;
+};
+
+#endif
@@ -0,0 +1,145 @@
+/** @file SelfPlay.hpp
+  Generate training games by letting an evaluation function play itself.
+*/
+
+#ifndef SelfPlay_hpp
+#define SelfPlay_hpp
+
+#include "abmove.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "Board2D.hpp"
+#include "Game.hpp"
+#include "GameFormats.hpp"
+#include "PositionDataset.hpp"
+
+/** Evaluates the positions of self-play games, many at a time. */
+class HALIOTIS_EXPORT SelfPlayEvaluator {
+public:
+  virtual ~SelfPlayEvaluator() {}
+  /** Set values[i] to the value of positions[i] for the player to move,
+    from -1 for a lost to 1 for a won position. Called with the positions
+    of many games at once. With more than one thread in SelfPlayOptions,
+    calls are made by several threads at the same time. */
+  virtual void Evaluate(const Haliotis::Board2D* positions, size_t count, float* values) = 0;
+};
+
+/// Parameters of SelfPlay
+struct SelfPlayOptions {
+  unsigned games;          //< Games to play
+  unsigned concurrentGames;//< Games in play at the same time, on all threads
+  unsigned threads;        //< Threads playing games
+  size_t maxBatch;         //< Most positions in one call of Evaluate()
+  std::vector<std::string> layouts; //< Start positions, see StartLayout()
+  int maxPlies;            //< Longer games are drawn
+  int samplePlies;         //< Moves are sampled in the first plies
+  double temperature;      //< Of the sampling, in units of the value
+  unsigned seed;
+  size_t queueGames;       //< Games waiting to be written before play waits
+  SelfPlayOptions()
+  : games(1000), concurrentGames(1024), threads(1), maxBatch(8192),
+    maxPlies(300), samplePlies(30), temperature(0.1), seed(1),
+    queueGames(256) {}
+};
+
+/// Counts of a self-play run
+struct SelfPlayStatistics {
+  unsigned games;
+  unsigned wins[2];                 //< Games won by player 1 and 2
+  unsigned draws;
+  unsigned long long positions;     //< Moves played
+  unsigned long long evaluations;   //< Positions passed to Evaluate()
+  unsigned long long batches;       //< Calls of Evaluate()
+  SelfPlayStatistics() : games(0), draws(0), positions(0), evaluations(0), batches(0) {
+    wins[0] = wins[1] = 0;
+  }
+};
+
+/** Told about each game written, on the thread writing the games */
+class HALIOTIS_EXPORT SelfPlayListener {
+public:
+  virtual ~SelfPlayListener() {}
+  virtual void GameWritten(const Haliotis::Game& game, const SelfPlayStatistics& stats) = 0;
+};
+
+/** Play many games of an evaluation function against itself.
+
+  Each thread keeps its share of the games in play. A game is only a
+  board and the moves so far. In each round the positions after every
+  legal move of all games of the thread are collected, and passed to the
+  evaluator in as few calls as maxBatch allows, so that a neural network
+  evaluates them together. Positions that end the game are not
+  evaluated. Each game then plays the move that leaves the opponent the
+  lowest value. In the first samplePlies plies the move is sampled, with
+  chances by exp(-value / temperature), so the games differ.
+
+  A game ends when six marbles are pushed off, a position is repeated
+  three times, or after maxPlies. A finished game is put on a queue, and a
+  thread of its own writes it as .AG and adds its positions to a dataset.
+  When queueGames games wait to be written, play waits for the writer,
+  so memory does not grow with a slow disk.
+
+  @example
+    SelfPlay selfPlay(options, evaluator);
+    selfPlay.SetGameOutput(&agFile);
+    selfPlay.SetDatasetOutput(&dataset);
+    SelfPlayStatistics stats = selfPlay.Run();
+*/
+class HALIOTIS_EXPORT SelfPlay {
+public:
+  SelfPlay(const SelfPlayOptions& options, SelfPlayEvaluator& evaluator);
+  ~SelfPlay();
+
+  /// Write the games in .AG format to out
+  void SetGameOutput(std::ostream* out) { m_gameOutput = out; }
+  /// Add the positions of the games to dataset
+  void SetDatasetOutput(PositionDatasetWriter* dataset) { m_dataset = dataset; }
+  void SetListener(SelfPlayListener* listener) { m_listener = listener; }
+
+  /** Play the games and wait until they are written.
+    @return the counts, with games 0 if a layout is not known */
+  SelfPlayStatistics Run();
+  /// Finish the games in play, and start no more. Thread safe.
+  void Stop() { m_stop.store(true); }
+
+private:
+  SelfPlay(const SelfPlay&); // Not implemented
+  void operator = (const SelfPlay&); // Not implemented
+
+  struct GameState;
+  class Player;
+
+  /// Take the number of a game to start. @return false if none is left
+  bool NextGame(unsigned& number);
+  /// Queue a finished game for the writer, waiting while the queue is full
+  void Finished(Haliotis::Game* game);
+  /// Add the evaluations of a player that is done
+  void AddEvaluations(unsigned long long evaluations, unsigned long long batches);
+  /// Body of the writer thread
+  void WriteGames();
+
+  SelfPlayOptions m_options;
+  SelfPlayEvaluator& m_evaluator;
+  std::ostream* m_gameOutput;
+  PositionDatasetWriter* m_dataset;
+  SelfPlayListener* m_listener;
+  GameFormatWriter m_writer;
+  std::atomic<unsigned> m_nextGame;
+  std::atomic<bool> m_stop;
+
+  std::mutex m_mutex;              //< Protects the below
+  std::condition_variable m_notFull;
+  std::condition_variable m_notEmpty;
+  std::deque<Haliotis::Game*> m_queue;
+  bool m_playing;                  //< False when no more games are queued
+  SelfPlayStatistics m_stats;
+};
+
+#endif
@@ -0,0 +1,76 @@
+/** @file ThreadPool.hpp
+  A pool of worker threads that steal work from each other.
+*/
+
+#ifndef ThreadPool_hpp
+#define ThreadPool_hpp
+
+#include "abmove.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/** Run tasks on a fixed number of worker threads.
+
+  Each worker has its own queue. A task submitted from a worker is put on
+  the queue of that worker, other tasks are spread round robin. A worker
+  takes the newest task from its own queue, and when that is empty it
+  steals the oldest task from another worker. This keeps the queues short
+  and the workers busy, even if the tasks take very different time.
+
+  Tasks must not throw.
+
+  @example
+    ThreadPool pool;
+    for (size_t i = 0; i < files.size(); i++) {
+      pool.Submit([&files, i]() { Import(files[i]); });
+    }
+    pool.Wait();
+*/
+class HALIOTIS_EXPORT ThreadPool {
+public:
+  typedef std::function<void()> Task;
+
+  /** Start the workers.
+    @param threads  number of workers, 0 for one per hardware thread */
+  explicit ThreadPool(unsigned threads = 0);
+  /// Wait for all tasks and stop the workers
+  ~ThreadPool();
+
+  unsigned Size() const { return (unsigned)m_workers.size(); }
+  void Submit(Task task);
+  /// Wait until all submitted tasks are done
+  void Wait();
+  /** Number of the calling worker in the range 0..Size()-1, or -1 if
+    the caller is not a worker of this pool. */
+  int WorkerIndex() const;
+
+private:
+  ThreadPool(const ThreadPool&); // Not implemented
+  void operator = (const ThreadPool&); // Not implemented
+
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  void Run(unsigned index);
+  bool Pop(unsigned index, Task& task);
+
+  std::vector<std::thread> m_workers;
+  std::vector<Queue*> m_queues;
+  std::atomic<unsigned> m_next;    //< Queue for next task from outside
+  std::atomic<size_t> m_queued;    //< Tasks waiting in a queue
+  std::mutex m_mutex;              //< Protects the sleep/wake up below
+  std::condition_variable m_work;  //< Signalled when a task is submitted
+  std::condition_variable m_idle;  //< Signalled when a task is done
+  size_t m_pending;                //< Tasks submitted but not done
+  bool m_stop;
+};
+
+#endif
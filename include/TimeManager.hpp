@@ -0,0 +1,142 @@
+/** @file TimeManager.hpp
+  Decide how long an engine may search a move.
+*/
+
+#ifndef TimeManager_hpp
+#define TimeManager_hpp
+
+#include "abmove.h"
+
+#include <atomic>
+#include <chrono>
+#include <string>
+
+#include "Board2D.hpp"
+
+/** Parameters of the AEP "go" command, filled by the AEP wrapper and by
+  Driver. Times are in ms, and limits that are not given are -1. */
+struct GoParameters {
+  long long time[2];  //< Clock of player 1 and 2
+  long long inc[2];
+  long long moveTime;
+  int depth;
+  long long nodes;
+  int mate;           //< Search a mate in this many moves
+  bool infinite;      //< Search until stopped
+  bool ponder;        //< Search the reply to the expected move of the opponent
+  std::string searchMoves; //< Moves the search is limited to, as sent
+  GoParameters() : moveTime(-1), depth(-1), nodes(-1), mate(-1)
+  , infinite(false), ponder(false) {
+    time[0] = time[1] = inc[0] = inc[1] = -1;
+  }
+};
+
+/** The limits of a search, from the parameters of the AEP "go" command.
+
+  Engine::SetSearchLimits() gives the parameters to the TimeManager of the
+  engine with Set(), and the engine calls Start() when the search begins,
+  see Engine::Time(). Two deadlines
+  are computed from the clock of the player to move, the increment and the
+  game phase:
+  - the soft deadline, after which no new iteration should be started.
+    It is extended while the best move changes between iterations.
+  - the hard deadline, where the search must stop.
+  The game phase is estimated from the marbles pushed off the board; the
+  closer a player is to losing six, the fewer moves are left to budget for.
+
+  ShouldStop() is meant to be called in the inner loop of the search, by
+  any number of threads. It reads the clock only every CHECK_CALLS calls.
+
+  @example
+    void MyEngine::GetMove(Board2D::Move& m) {
+      TimeManager& time = Time();
+      time.Start(m_board, Pondering());
+      for (int depth = 1; time.CanStartIteration(depth); depth++) {
+        bool changed = Search(depth);  // polls time.ShouldStop(nodes)
+        if (time.ShouldStop()) break;
+        time.IterationDone(changed);
+      }
+    }
+*/
+class HALIOTIS_EXPORT TimeManager {
+public:
+  /// Calls of ShouldStop() between reads of the clock. A power of 2.
+  static const unsigned CHECK_CALLS = 1024;
+  /// Time kept in hand for communication with the GUI, in ms
+  static const long long MOVE_OVERHEAD = 30;
+
+  TimeManager();
+
+  /// Forget the parameters and the stop of the previous search
+  void Reset();
+  /// Take the limits of a new search, as Reset() and SetParameter() do
+  void Set(const GoParameters& go);
+  /** Take one limit by name: time1, time2, inc1, inc2 and movetime in ms,
+    depth, nodes. A movetime of "inf" searches until stopped.
+    @return false if the parameter is not a limit, or the value is wrong */
+  bool SetParameter(const std::string& name, const std::string& value);
+
+  /** Start the clock and compute the deadlines for the player to move.
+    While pondering there are no deadlines until PonderHit(). A Stop()
+    since Set() or Reset() is kept, as it may come before the search. */
+  void Start(const Haliotis::Board2D& board, bool pondering = false);
+  /// Restart the clock under the limits of the search. Thread safe.
+  void PonderHit();
+  /// Stop at the next ShouldStop(). Thread safe.
+  void Stop() { m_stopped.store(true); }
+
+  /** True when the search must stop: the hard deadline or the node limit
+    is reached, or Stop() was called. Cheap enough for the inner loop. */
+  inline bool ShouldStop(unsigned long long nodes = 0) const {
+    if (m_stopped.load(std::memory_order_relaxed)) return true;
+    if (nodes >= m_maxNodes) return Expire();
+    static thread_local unsigned calls = 0;
+    if ((++calls & (CHECK_CALLS - 1)) != 0) return false;
+    return CheckClock();
+  }
+  /// True if iteration depth may be started: within depth limit and soft deadline
+  bool CanStartIteration(int depth) const;
+  /** Tell whether the best move changed in the iteration that has been
+    completed. While it changes the soft deadline is extended, up to the
+    hard deadline. */
+  void IterationDone(bool bestMoveChanged);
+
+  /// Time since Start() or PonderHit(), in ms
+  long long Elapsed() const;
+  /// Soft deadline, in ms from start, including extension. -1 if none.
+  long long SoftLimit() const;
+  /// Hard deadline, in ms from start. -1 if none.
+  long long HardLimit() const;
+  int MaxDepth() const { return m_maxDepth; }
+  unsigned long long MaxNodes() const { return m_maxNodes; }
+
+private:
+  typedef std::chrono::steady_clock Clock;
+  static const long long NO_LIMIT = -1;
+
+  bool CheckClock() const;
+  bool Expire() const { m_stopped.store(true); return true; }
+  long long Now() const;
+  void ComputeLimits();
+
+  // Parameters of the go command, in ms. -1 if not given.
+  long long m_time[2];
+  long long m_inc[2];
+  long long m_moveTime;
+  bool m_infinite;
+  int m_maxDepth;
+  unsigned long long m_maxNodes;
+
+  int m_player;       //< Player to move, 1 or 2
+  int m_maxOut;       //< Most marbles pushed off for a player
+  long long m_soft;   //< Soft deadline without extension, ms
+  long long m_hard;   //< Hard deadline, ms
+  int m_instability;  //< Grows when the best move changes
+
+  std::atomic<long long> m_start;    //< Clock at start, ns
+  std::atomic<long long> m_softEnd;  //< Clock at soft deadline, ns
+  std::atomic<long long> m_hardEnd;  //< Clock at hard deadline, ns
+  mutable std::atomic<bool> m_stopped;
+};
+
+#endif
@@ -14,10 +14,16 @@ of TRACE_FILE
 
 #include "abmove.h"
 
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
 #include <ctime>
 #include <fstream>
+#include <mutex>
 #include <string>
 #include <sstream>
+#include <thread>
+#include <vector>
 
 // Provoke a segmentation fault - make the debugger stop here
 #ifndef SKIP__builtin_trap
@@ -32,17 +38,202 @@ HALIOTIS_EXPORT std::string TimeStamp();
 // TRACE
 //
 
-// Warning, this implementation has no mutex protection
+class TraceSite;
+
+/** Collects the trace of all threads in one file.
+
+  A message is the id of its TraceSite and the bytes of its arguments,
+  see TraceMessage. It is copied with a timestamp from the steady clock
+  into a ring buffer of the thread that traces it. The thread takes no
+  lock and does no I/O. A flusher thread drains the rings every
+  FLUSH_INTERVAL ms. It turns the messages of all threads into text and
+  writes them in time order, one line per message. If a ring is full, its
+  messages are dropped and counted, and the count is written instead; the
+  traced thread never waits.
+
+  A binary trace file gets the messages as they are, and each site once,
+  so that tracing costs little more than a copy of the arguments. It is
+  turned into text by the tracedump tool, see TraceFile.hpp.
+
+  Flush() writes all messages at once. It is called by TRACE_ASSERT before
+  the program stops, and at exit.
+*/
 class HALIOTIS_EXPORT TraceCollector {
 private:
   TraceCollector();
 
 public:
+  /// Bytes in the ring buffer of each thread
+  static const size_t RING_SIZE = 1 << 20;
+  /// Longest time a message waits in a ring, in ms
+  static const unsigned FLUSH_INTERVAL = 50;
+
   static void SetTraceFile(const char* filename);
+  /// Write the trace in the binary format of TraceFile.hpp to filename
+  static void SetBinaryTraceFile(const char* filename);
   static TraceCollector& GetInstance();
 
+  /** Record a message of the calling thread.
+    @param site  id of the TraceSite, or 0 if data is text
+    @param data  the arguments written by TraceMessage
+    @param stamp  prefix the line with time and thread when written
+
+    Does not wait: if the ring of the thread is full, the message is
+    dropped and counted. */
+  void Record(unsigned site, const char* data, size_t size, bool stamp);
+  /// Write all recorded messages to the file
+  void Flush();
+
+  /// Only written while holding mutex
   std::ofstream traceStream;
-  void TraceTimeStamp();
+  /// Recursive, since SetTraceFile() may be called while writing
+  std::recursive_mutex mutex;
+
+private:
+  friend struct RingOwner;
+  struct Ring;
+  struct Entry;
+  Ring* ThreadRing();
+  /// Open the file and write its first lines. Caller must hold mutex.
+  void Open(const char* filename, bool binary);
+  /// Write the messages in the rings. Caller must hold mutex.
+  void Drain();
+  /// Append the records of m_entries to m_output in the binary format
+  void WriteBinary();
+  void Run();
+  static void Shutdown();
+
+  std::mutex m_ringMutex;           //< Protects m_rings
+  std::vector<Ring*> m_rings;
+  std::atomic<unsigned> m_threads;  //< Threads that have traced
+  std::atomic<bool> m_stopped;      //< No flusher, Record() writes at once
+  std::vector<Entry> m_entries;     //< Reused by Drain()
+  std::string m_line;               //< Reused by Drain()
+  std::string m_output;             //< Reused by Drain()
+  bool m_binary;                    //< The file is in the binary format
+  std::vector<const TraceSite*> m_sites; //< Known sites, by id
+  std::vector<bool> m_siteWritten;  //< Sites in the binary file, by id
+  long long m_startSystem;          //< System clock at start, us
+  long long m_startSteady;          //< Steady clock at start, ns
+  std::mutex m_wakeMutex;
+  std::condition_variable m_wake;
+  bool m_exit;
+  std::thread m_flusher;
+};
+
+/** A statement that traces. It is registered the first time it is run,
+  and gets an id that is recorded with each message instead of the file,
+  line and text of the statement. It has no destructor, so it can be found
+  while static objects are destroyed. */
+class HALIOTIS_EXPORT TraceSite {
+public:
+  /// @param statement  the arguments of the TRACE, as text
+  TraceSite(const char* file, int line, const char* statement);
+  unsigned Id() const { return m_id; }
+  const char* File() const { return m_file; }
+  int Line() const { return m_line; }
+  const char* Statement() const { return m_statement; }
+  /// Append the sites from id first on to sites
+  static void GetSites(unsigned first, std::vector<const TraceSite*>& sites);
+private:
+  const char* m_file;
+  int m_line;
+  const char* m_statement;
+  unsigned m_id; //< From 1
+};
+
+/** Type of an argument of a message, written before its value */
+enum TraceArgument {
+  TRACE_ARG_TEXT = 's',    //< Length (u32) and bytes
+  TRACE_ARG_CHAR = 'c',    //< 1 byte
+  TRACE_ARG_BOOL = 'b',    //< 1 byte, 0 or 1
+  TRACE_ARG_INT = 'i',     //< 8 bytes
+  TRACE_ARG_UINT = 'u',    //< 8 bytes
+  TRACE_ARG_DOUBLE = 'd',  //< 8 bytes, IEEE 754
+  TRACE_ARG_POINTER = 'p'  //< 8 bytes
+};
+
+/** One message, as the bytes of its arguments in a buffer that the thread
+  reuses. Numbers, characters and strings are copied as they are, and
+  turned into text when the message is written. Other types are formatted
+  with their operator<< at once, and copied as text. After a manipulator
+  other than endl and flush, the rest of the message is formatted at
+  once, so that the manipulator has its effect. All integers are little
+  endian.
+
+  A message traced while another is recorded, by an operator<< that
+  traces, gets a buffer of its own. */
+class HALIOTIS_EXPORT TraceMessage {
+public:
+  TraceMessage();
+  ~TraceMessage();
+
+  TraceMessage& operator << (bool value) { return m_formatted ? Format(value) : Put(TRACE_ARG_BOOL, value ? 1 : 0, 1); }
+  TraceMessage& operator << (char value) { return m_formatted ? Format(value) : Put(TRACE_ARG_CHAR, (unsigned char)value, 1); }
+  TraceMessage& operator << (signed char value) { return m_formatted ? Format(value) : Put(TRACE_ARG_CHAR, (unsigned char)value, 1); }
+  TraceMessage& operator << (unsigned char value) { return m_formatted ? Format(value) : Put(TRACE_ARG_CHAR, value, 1); }
+  TraceMessage& operator << (short value) { return m_formatted ? Format(value) : Int(value); }
+  TraceMessage& operator << (int value) { return m_formatted ? Format(value) : Int(value); }
+  TraceMessage& operator << (long value) { return m_formatted ? Format(value) : Int(value); }
+  TraceMessage& operator << (long long value) { return m_formatted ? Format(value) : Int(value); }
+  TraceMessage& operator << (unsigned short value) { return m_formatted ? Format(value) : Put(TRACE_ARG_UINT, value, 8); }
+  TraceMessage& operator << (unsigned int value) { return m_formatted ? Format(value) : Put(TRACE_ARG_UINT, value, 8); }
+  TraceMessage& operator << (unsigned long value) { return m_formatted ? Format(value) : Put(TRACE_ARG_UINT, value, 8); }
+  TraceMessage& operator << (unsigned long long value) { return m_formatted ? Format(value) : Put(TRACE_ARG_UINT, value, 8); }
+  TraceMessage& operator << (float value) { return m_formatted ? Format(value) : Double(value); }
+  TraceMessage& operator << (double value) { return m_formatted ? Format(value) : Double(value); }
+  TraceMessage& operator << (long double value) { return m_formatted ? Format(value) : Double((double)value); }
+  TraceMessage& operator << (const char* value) { return m_formatted ? Format(value) : Text(value, value ? strlen(value) : 0); }
+  TraceMessage& operator << (char* value) { return *this << (const char*)value; }
+  TraceMessage& operator << (const std::string& value) { return m_formatted ? Format(value) : Text(value.data(), value.size()); }
+  TraceMessage& operator << (const void* value) { return m_formatted ? Format(value) : Put(TRACE_ARG_POINTER, (unsigned long long)(size_t)value, 8); }
+  TraceMessage& operator << (void* value) { return *this << (const void*)value; }
+  TraceMessage& operator << (std::ostream& (*manipulator)(std::ostream&));
+  TraceMessage& operator << (std::ios_base& (*manipulator)(std::ios_base&));
+  /// Any other type is formatted at once
+  template<class T> TraceMessage& operator << (const T& value) { return Format(value); }
+
+  /// Hand the message to the TraceCollector
+  void Record(const TraceSite& site, bool stamp);
+  /// Largest message, larger ones are cut
+  static const size_t MAX_SIZE = TraceCollector::RING_SIZE / 4;
+
+private:
+  TraceMessage(const TraceMessage&); // Not implemented
+  void operator = (const TraceMessage&); // Not implemented
+  friend struct BufferOwner;
+  struct Buffer;
+
+  TraceMessage& Put(char type, unsigned long long value, int size) {
+    if (m_end - m_pos < 9) Reserve(9);
+    m_pos[0] = type;
+    for (int i = 0; i < size; i++) m_pos[i+1] = (char)(value >> 8*i);
+    m_pos += size + 1;
+    return *this;
+  }
+  TraceMessage& Int(long long value) { return Put(TRACE_ARG_INT, (unsigned long long)value, 8); }
+  TraceMessage& Double(double value) {
+    unsigned long long bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return Put(TRACE_ARG_DOUBLE, bits, 8);
+  }
+  TraceMessage& Text(const char* text, size_t size);
+  template<class T> TraceMessage& Format(const T& value) {
+    Stream() << value;
+    return Formatted();
+  }
+  /// The stream of the buffer, for arguments formatted at once
+  std::ostream& Stream();
+  /// Copy what was formatted as a text argument
+  TraceMessage& Formatted();
+  /// Make room for size more bytes of arguments
+  void Reserve(size_t size);
+
+  Buffer* m_buffer;
+  char* m_pos;          //< End of the arguments in the buffer
+  char* m_end;          //< End of the buffer
+  bool m_formatted;     //< Format all arguments at once
+  bool m_owned;
 };
 
 #if defined(DEB1) && !defined(_CONFIG_H_)
@@ -61,27 +252,28 @@ public:
 /// Select a trace file to use
 #define DEFINE_TRACE_FILE(filename) \
   TraceCollector::GetInstance().SetTraceFile(filename);
-
-/// Send something to the trace stream
-#define TRACE__(x) { \
-  TraceCollector::GetInstance().traceStream << x; \
+/// Select a trace file to write in the binary format
+#define DEFINE_BINARY_TRACE_FILE(filename) \
+  TraceCollector::GetInstance().SetBinaryTraceFile(filename);
+
+/// Record a message at a site that is registered once
+#define TRACE_RECORD__(x,stamp,end) { \
+  static TraceSite traceSite__(__FILE__, __LINE__, #x); \
+  TraceMessage traceMessage__; \
+  traceMessage__ << x end; \
+  traceMessage__.Record(traceSite__, stamp); \
 }
-/// Send to trace stream and flush it
-#define TRACE_(x) TRACE__(x << ::std::flush)
-/// Send to trace stream, but prefix with timestamp
-#define TRACE_NO_ENDL(x) { \
-  TraceCollector::GetInstance().TraceTimeStamp(); \
-  TRACE_THREAD__ \
+/// Send something to the trace file, without time stamp
+#define TRACE__(x) TRACE_RECORD__(x, false, )
+/// Send to the trace file and flush it
+#define TRACE_(x) { \
   TRACE__(x) \
+  TraceCollector::GetInstance().Flush(); \
 }
-/// Send to trace stream, but prefix with timestamp and postfix with endl
-#define TRACE(x) TRACE_NO_ENDL(x << ::std::endl)
-// Trace thread ID if in an wxWidget environment
-#ifdef _WX_THREAD_H_
-#define TRACE_THREAD__ TRACE__(wxThread::GetCurrentId() << ' ')
-#else
-#define TRACE_THREAD__
-#endif
+/// Send to the trace file, but prefix with timestamp
+#define TRACE_NO_ENDL(x) TRACE_RECORD__(x, true, )
+/// Send to the trace file, but prefix with timestamp and postfix with endl
+#define TRACE(x) TRACE_RECORD__(x, true, << '\n')
 // This macro is for temporary search of a failure
 #define TRACE_CHECKPOINT TRACE(__FILE__ << ":" << __LINE__ << " "<< __func__)
 
@@ -123,6 +315,7 @@ inline void SetAssertFailureListener(AssertFailureListener* listener)
     {::std::ofstream assertFile("assert.log"); \
     assertFile << msg.str() << ::std::endl;} \
     TRACE(msg.str()); \
+    TraceCollector::GetInstance().Flush(); \
     if (assertListener) assertListener->AssertFailure(msg.str()); \
     SEGV; \
   } \
@@ -139,6 +332,7 @@ inline void SetAssertFailureListener(AssertFailureListener* listener)
     {::std::ofstream assertFile("assert.log"); \
     assertFile << msg.str() << ::std::endl;} \
     TRACE(msg.str()); \
+    TraceCollector::GetInstance().Flush(); \
     if (assertListener) assertListener->AssertFailure(msg.str()); \
     SEGV; \
   } \
@@ -201,13 +395,54 @@ extern HALIOTIS_EXPORT const char * level_name[];
 
 #include "TraceFlag.hpp"
 
+// Flags of a higher level are compiled out, as in config.h
+#ifndef TRACE_MAX_LEVEL
+#define TRACE_MAX_LEVEL 2
+#endif
+
+#if defined(__GNUC__)
+#define TRACE_UNLIKELY(x) __builtin_expect(!!(x), 0)
+#else
+#define TRACE_UNLIKELY(x) (x)
+#endif
+
+// The flags share the cache lines of a section that holds only flags
+#if defined(__GNUC__) && defined(__ELF__)
+#define TRACE_FLAG_SECTION __attribute__((section("trace_flags")))
+#else
+#define TRACE_FLAG_SECTION
+#endif
+/*
+  Declare flags at file scope, where they cost no guard when checked:
+
+    TRACE_FLAG(traceSearch)
+    TRACE_FLAG_LEVEL(traceMoves, 3)
+    ...
+    TRACE_IF(traceSearch, "depth " << depth);
+    if (TRACE_ENABLED(traceMoves)) { ... }
+
+  A check of a flag that is off is a relaxed load of the byte of the flag
+  and a branch that is not taken. A flag with a level above TRACE_MAX_LEVEL is always off, so
+  the trace is compiled out.
+*/
 #ifdef NDEBUG
 #define TRACE_FLAG(trace_flag)
+#define TRACE_FLAG_LEVEL(trace_flag,level)
 #define TRACE_ENABLED(trace_flag) false
 #else
-#define TRACE_FLAG(trace_flag) static TraceFlag trace_flag(#trace_flag,__FILE__);
-#define TRACE_ENABLED(trace_flag) trace_flag.IsTraceEnabled()
+/// Declare a flag of level 1
+#define TRACE_FLAG(trace_flag) TRACE_FLAG_LEVEL(trace_flag,1)
+#define TRACE_FLAG_LEVEL(trace_flag,level) \
+  TRACE_FLAG_SECTION static TraceFlag trace_flag(#trace_flag,__FILE__); \
+  static const int trace_flag##_level = level;
+#define TRACE_ENABLED(trace_flag) \
+  (trace_flag##_level <= TRACE_MAX_LEVEL \
+   and TRACE_UNLIKELY(trace_flag.IsTraceEnabled()))
 #endif
+/// Send to the trace file if the flag is set
+#define TRACE_IF(trace_flag,x) { \
+  if (TRACE_ENABLED(trace_flag)) { TRACE(x) } \
+}
 
 //
 // Helper class
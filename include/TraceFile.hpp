@@ -0,0 +1,106 @@
+/** @file TraceFile.hpp
+  Turn trace messages into text, and read binary trace files.
+
+  A binary trace file, see TraceCollector::SetBinaryTraceFile(), is laid
+  out as
+
+    header    "ABTR", version, 3 reserved bytes, system clock at start in
+              us (i64), steady clock at start in ns (i64)
+    records   a type byte and
+      'S'     a TraceSite, before its first message: id (u32), line (u32),
+              length (u32) and bytes of the file name, length (u32) and
+              bytes of the statement
+      'M'     a message: steady clock in ns (i64), thread (u32), site id
+              (u32), 1 if the line is stamped (u8), length (u32) and bytes
+              of the arguments
+
+  The arguments of a message are written by TraceMessage, each a
+  TraceArgument byte and a value. A message of site 0 is text. All
+  integers are little endian.
+*/
+
+#ifndef TraceFile_hpp
+#define TraceFile_hpp
+
+#include "abmove.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+/** Append the text of the arguments of a message to text, as operator<<
+  of a std::ostream would have formatted them.
+  @return false if the arguments are corrupt */
+HALIOTIS_EXPORT bool RenderTraceArguments(const char* data, size_t size, std::string& text);
+
+/** Formats the "date.uuuuuu Tn " prefix of a stamped line. The date is
+  only formatted when the second changes. */
+class HALIOTIS_EXPORT TraceStampFormat {
+public:
+  TraceStampFormat() : m_second(-1) {}
+  /// @param us  system clock, us since 1970
+  void Append(long long us, unsigned thread, std::string& text);
+private:
+  long long m_second;
+  char m_date[40];
+};
+
+/// A message read from a binary trace file
+struct TraceFileMessage {
+  long long time;         //< System clock, us since 1970
+  unsigned thread;        //< Number of the thread, from 1
+  bool stamp;             //< Prefix the line with time and thread
+  unsigned site;          //< 0 for a message that was text
+  std::string file;       //< Of the site
+  int line;
+  std::string statement;
+  std::string text;       //< The arguments as text
+};
+
+/** Read the messages of a binary trace file in the order written.
+
+  @example
+    std::ifstream in("app.abt", std::ios::binary);
+    TraceFileReader reader(in);
+    TraceFileMessage message;
+    while (reader.Next(message)) std::cout << message.text;
+*/
+class HALIOTIS_EXPORT TraceFileReader {
+public:
+  explicit TraceFileReader(std::istream& in);
+  /// False if the file does not start with a header
+  bool Valid() const { return m_valid; }
+  /// System clock when the trace started, us since 1970
+  long long StartTime() const { return m_startSystem; }
+  /** Read the next message. The ids and lengths of the records are
+    checked against the sites read and the bytes left in the file.
+    @return false at the end of the file, or if it is corrupt */
+  bool Next(TraceFileMessage& message);
+  /// True if Next() stopped at a record that could not be read
+  bool Corrupt() const { return m_corrupt; }
+
+private:
+  struct Site {
+    std::string file;
+    int line;
+    std::string statement;
+    bool known;   //< The site was read
+    Site() : line(0), known(false) {}
+  };
+  /// Read size bytes, false if fewer are left
+  bool Read(char* data, size_t size);
+  /// Read a field of size bytes, false if fewer are left
+  bool Read(std::string& data, unsigned long size);
+  bool ReadSite();
+
+  std::istream& m_in;
+  bool m_valid;
+  bool m_corrupt;
+  long long m_startSystem;
+  long long m_startSteady;
+  unsigned long long m_left; //< Bytes left in the stream, ~0 if not known
+  std::vector<Site> m_sites; //< By id, 0 is not used
+  std::string m_data;
+};
+
+#endif
@@ -5,26 +5,38 @@
 
 #include "abmove.h"
 
+#include <atomic>
+
 class TraceFlag;
 
 HALIOTIS_EXPORT void RegisterTraceFlag(TraceFlag& trace_flag);
 HALIOTIS_EXPORT bool SetTraceFlag(const char* flag_name, const char* file_name, bool enable);
 
+/** A trace flag is a byte of its own, that the call site loads directly.
+  IsTraceEnabled() is one relaxed load and a branch, since a flag set on
+  another thread only has to be seen soon. A flag is off until it is set.
+  A flag in static storage is zero-initialized before its constructor
+  runs, so it is also off for a static initializer in another file.
+
+  TRACE_FLAG puts the flags in a section of their own where the compiler
+  allows it, so the flags that are checked in hot paths share a few cache
+  lines that hold nothing else, and are only written when a flag is set. */
 class TraceFlag {
 public:
   TraceFlag(const char* name, const char* source_file)
-  : m_flagname(name)
+  : m_enabled(false)
+  , m_flagname(name)
   , m_filename(source_file) {
     RegisterTraceFlag(*this);
   }
-  bool IsTraceEnabled() const { return m_enabled; }
-  void SetTraceEnabled(bool enabled) { m_enabled = enabled; }
+  bool IsTraceEnabled() const { return m_enabled.load(std::memory_order_relaxed); }
+  void SetTraceEnabled(bool enabled) { m_enabled.store(enabled, std::memory_order_relaxed); }
   const char * GetFlagName() const { return m_flagname; }
   const char * GetFileName() const { return m_filename; }
 private:
+  std::atomic<bool> m_enabled;
   const char * m_flagname;
   const char * m_filename;
-  volatile bool m_enabled;
 };
 
 #endif
@@ -21,8 +21,16 @@
 #include "AEPWrap.hpp"
 namespace AEP = AbaloneEngineProtocol;
 
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <climits>
+#include <cstdlib>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
 #include <sstream>
-#include "CheckInput.h"
+#include <thread>
 #include "Persistence.hpp"
 #define DEB1
 #include "Trace.hpp"
@@ -41,6 +49,126 @@ string to_aep(const Board2D::Move& m) {
   return str.str();
 }
 
+////////////////////////////////////////////////////////////////
+//
+//  Options
+//
+
+static bool EqualNoCase(const string& a, const string& b) {
+  if (a.size() != b.size()) return false;
+  for (size_t i = 0; i < a.size(); i++) {
+    if (tolower((unsigned char)a[i]) != tolower((unsigned char)b[i])) return false;
+  }
+  return true;
+}
+
+string AEP::OptionCheck::ToString() const {
+  return "option name "+m_name+" type check default "+(m_default ? "true" : "false");
+}
+
+bool AEP::OptionCheck::Set(const string& value) {
+  if (value == "true") m_value.store(true);
+  else if (value == "false") m_value.store(false);
+  else return false;
+  return true;
+}
+
+string AEP::OptionSpin::ToString() const {
+  std::ostringstream str;
+  str << "option name " << m_name << " type spin default " << m_default
+      << " min " << m_min << " max " << m_max;
+  return str.str();
+}
+
+bool AEP::OptionSpin::Set(const string& value) {
+  const char* text = value.c_str();
+  char* end = 0;
+  const long n = strtol(text, &end, 10);
+  if (end == text or *end != '\0' or n < m_min or n > m_max) return false;
+  m_value.store((int)n);
+  return true;
+}
+
+AEP::OptionCombo::OptionCombo(const string& name, const std::vector<string>& values,
+  const string& def)
+: Option(name), m_values(values), m_index(0), m_default(0)
+{
+  TRACE_ASSERT(not m_values.empty());
+  for (size_t i = 0; i < m_values.size(); i++) {
+    if (m_values[i] == def) m_default = (int)i;
+  }
+  m_index.store(m_default);
+}
+
+string AEP::OptionCombo::ToString() const {
+  string str = "option name "+m_name+" type combo default "+m_values[m_default];
+  for (size_t i = 0; i < m_values.size(); i++) str += " var "+m_values[i];
+  return str;
+}
+
+bool AEP::OptionCombo::Set(const string& value) {
+  for (size_t i = 0; i < m_values.size(); i++) {
+    if (EqualNoCase(m_values[i], value)) {
+      m_index.store((int)i);
+      return true;
+    }
+  }
+  return false;
+}
+
+string AEP::OptionButton::ToString() const {
+  return "option name "+m_name+" type button";
+}
+
+bool AEP::OptionButton::Set(const string& value) {
+  return value.empty();
+}
+
+string AEP::OptionString::Value() const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_value;
+}
+
+string AEP::OptionString::ToString() const {
+  return "option name "+m_name+" type string default "
+    +(m_default.empty() ? "<empty>" : m_default);
+}
+
+bool AEP::OptionString::Set(const string& value) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_value = value == "<empty>" ? string() : value;
+  return true;
+}
+
+AEP::Option* AEP::Engine::FindOption(const string& name) const {
+  for (size_t i = 0; i < m_options.size(); i++) {
+    if (EqualNoCase(m_options[i]->Name(), name)) return m_options[i];
+  }
+  return 0;
+}
+
+/// Pass a limit to SetSearchParameter(), if it is given
+static void SetLimit(AEP::Engine& engine, const char* name, long long value) {
+  if (value >= 0) engine.SetSearchParameter(name, std::to_string(value));
+}
+
+void AEP::Engine::SetSearchLimits(const GoParameters& go) {
+  m_time.Set(go);
+  // For engines that take the parameters as text
+  ResetSearchParameters();
+  SetLimit(*this, "time1", go.time[0]);
+  SetLimit(*this, "time2", go.time[1]);
+  SetLimit(*this, "inc1", go.inc[0]);
+  SetLimit(*this, "inc2", go.inc[1]);
+  SetLimit(*this, "movetime", go.moveTime);
+  SetLimit(*this, "depth", go.depth);
+  SetLimit(*this, "nodes", go.nodes);
+  SetLimit(*this, "mate", go.mate);
+  if (go.infinite) SetSearchParameter("movetime", "inf");
+  if (go.ponder) SetSearchParameter("ponder", "1");
+  if (not go.searchMoves.empty()) SetSearchParameter("searchmoves", go.searchMoves);
+}
+
 ////////////////////////////////////////////////////////////////
 //
 //  Commands in AEP
@@ -81,42 +209,349 @@ string to_aep(const Board2D::Move& m) {
   }
 
 
+////////////////////////////////////////////////////////////////
+//
+//  Replies
+//
+
+/** Lock-free queue of reply lines, with many producers and one consumer.
+  A push is an exchange and a store, so a search thread never blocks on
+  another thread when it replies. This is the intrusive queue of Dmitry
+  Vyukov.
+*/
+class ReplyQueue {
+private:
+  struct Node {
+    std::atomic<Node*> next;
+    string text;
+    Node() : next(0) {}
+  };
+  std::atomic<Node*> m_head; //< Last node pushed
+  Node* m_tail;              //< Next node to pop, only used by the consumer
+  Node m_stub;               //< Keeps the queue non-empty
+
+  void Push(Node* node) {
+    node->next.store(0);
+    Node* prev = m_head.exchange(node);
+    prev->next.store(node);
+  }
+
+public:
+  ReplyQueue() : m_head(&m_stub), m_tail(&m_stub) {}
+  ~ReplyQueue() {
+    string text;
+    while (Pop(text)) {}
+  }
+  /// Add a line. May be called from any thread.
+  void Push(const string& text) {
+    Node* node = new Node;
+    node->text = text;
+    Push(node);
+  }
+  /** Remove the oldest line. Must only be called by the consumer.
+    @return false if the queue is empty, or a push is not yet complete */
+  bool Pop(string& text) {
+    Node* tail = m_tail;
+    Node* next = tail->next.load();
+    if (tail == &m_stub) {
+      if (next == 0) return false;
+      m_tail = next;
+      tail = next;
+      next = next->next.load();
+    }
+    if (next == 0) {
+      if (tail != m_head.load()) return false;
+      Push(&m_stub);
+      next = tail->next.load();
+      if (next == 0) return false;
+    }
+    m_tail = next;
+    text.swap(tail->text);
+    delete tail;
+    return true;
+  }
+};
+
+/** Write replies to a stream on a thread of its own. Replies are pushed
+  without locking; the writer only takes a lock to sleep when there is
+  nothing to write, and a producer only takes it to wake up the writer.
+  Lines that are queued together are written with a single flush.
+*/
+class ReplyWriter {
+private:
+  std::ostream& m_out;
+  ReplyQueue m_queue;
+  std::atomic<bool> m_waiting; //< Writer is, or is about to be, asleep
+  bool m_closed;
+  std::mutex m_mutex;
+  std::condition_variable m_wake;
+  std::thread m_thread;
+
+  void Run() {
+    string text;
+    for (;;) {
+      if (m_queue.Pop(text)) {
+        m_out << text << '\n';
+        continue;
+      }
+      m_out << std::flush;
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_waiting.store(true);
+      // A reply pushed before m_waiting was set is seen here
+      if (m_queue.Pop(text)) {
+        m_waiting.store(false);
+        lock.unlock();
+        m_out << text << '\n';
+        continue;
+      }
+      if (m_closed) break;
+      m_wake.wait(lock, [this]() { return not m_waiting.load(); });
+    }
+  }
+
+public:
+  ReplyWriter(std::ostream& out) : m_out(out), m_waiting(false), m_closed(false) {
+    m_thread = std::thread(&ReplyWriter::Run, this);
+  }
+  /// Write all replies and stop the writer
+  ~ReplyWriter() {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_closed = true;
+      m_waiting.store(false);
+    }
+    m_wake.notify_one();
+    m_thread.join();
+  }
+  /// Queue a line for the stream. May be called from any thread.
+  void Write(const string& text) {
+    m_queue.Push(text);
+    if (m_waiting.load()) {
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_waiting.store(false);
+      }
+      m_wake.notify_one();
+    }
+  }
+};
+
+////////////////////////////////////////////////////////////////
+//
+//  Search progress
+//
+
+/** Turn the progress reported by the search threads into "info" replies.
+  Reports are merged, and a line is sent at most every INTERVAL_MS. A
+  thread that finds another thread merging drops its report, unless it
+  has a principal variation, so heavy reporting never makes a search
+  thread wait for more than one merge.
+*/
+class InfoReporter: public AEP::InfoHandler {
+private:
+  typedef std::chrono::steady_clock Clock;
+  static const long long INTERVAL_MS = 100;
+
+  ReplyWriter& m_writer;
+  std::mutex m_mutex;
+  Clock::time_point m_start; //< Start of the search
+  long long m_next;          //< Time of next reply, in ms since m_start
+  bool m_pending;            //< m_info has not been sent
+  AEP::SearchInfo m_info;
+
+  long long Elapsed() const {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+      Clock::now() - m_start).count();
+  }
+
+  /// Keep the deepest variation, and the latest counters
+  void Merge(const AEP::SearchInfo& info) {
+    if (info.depth >= m_info.depth) {
+      if (info.depth >= 0) m_info.depth = info.depth;
+      if (info.score != AEP::SearchInfo::NO_SCORE) m_info.score = info.score;
+      if (not info.pv.empty()) m_info.pv = info.pv;
+    }
+    if (info.nodes > m_info.nodes) m_info.nodes = info.nodes;
+    if (info.hashfull >= 0) m_info.hashfull = info.hashfull;
+    m_pending = true;
+  }
+
+  static string Format(const AEP::SearchInfo& info, long long ms) {
+    std::ostringstream str;
+    str << "info";
+    if (info.depth >= 0) str << " depth " << info.depth;
+    if (info.score != AEP::SearchInfo::NO_SCORE) str << " score cp " << info.score;
+    str << " time " << ms;
+    if (info.nodes > 0) {
+      str << " nodes " << info.nodes;
+      str << " nps " << (ms > 0 ? info.nodes * 1000 / ms : info.nodes);
+    }
+    if (info.hashfull >= 0) str << " hashfull " << info.hashfull;
+    if (not info.pv.empty()) {
+      str << " pv";
+      for (size_t i = 0; i < info.pv.size(); i++) str << ' ' << to_aep(info.pv[i]);
+    }
+    return str.str();
+  }
+
+public:
+  InfoReporter(ReplyWriter& writer)
+  : m_writer(writer), m_next(0), m_pending(false) {}
+
+  /// Reset before a search. Must not be called while searching.
+  void Start() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_start = Clock::now();
+    m_next = 0;
+    m_pending = false;
+    m_info = AEP::SearchInfo();
+  }
+
+  /// Send what has not been sent, when the search has ended
+  void Finish() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (not m_pending) return;
+    m_pending = false;
+    const long long ms = Elapsed();
+    const string line = Format(m_info, ms);
+    lock.unlock();
+    m_writer.Write(line);
+  }
+
+  virtual void Info(const AEP::SearchInfo& info) {
+    std::unique_lock<std::mutex> lock(m_mutex, std::try_to_lock);
+    if (not lock.owns_lock()) {
+      if (info.pv.empty()) return;
+      lock.lock();
+    }
+    Merge(info);
+    const long long ms = Elapsed();
+    if (ms < m_next) return;
+    m_next = ms + INTERVAL_MS;
+    m_pending = false;
+    const AEP::SearchInfo copy = m_info;
+    lock.unlock();
+    m_writer.Write(Format(copy, ms));
+  }
+};
+
 ////////////////////////////////////////////////////////////////
 //
 //  Abalone Engine Protocol interface
 //
 
-//strtok() {};
 /** Generic wrapper of an engine that allows it to communicate through the
-  Abalone Engine Protocol (AEP). The engine must implement the EngineInterface
-  and at least once pr second call the InputHandler provided.
+  Abalone Engine Protocol (AEP). The engine must implement the EngineInterface.
 
-  The wrapper provides functions that can check stdin for commands and act
-  on commands from the client.
+  Commands are read by blocking reads of the input, and handled on the
+  thread calling Play(). A search runs on a worker thread, so "stop" and "quit" are
+  handled while the engine searches, without the engine checking for input.
 */
-class EngineWrapper: public AEP::InputHandler {
+class EngineWrapper {
 private:
   AEP::Engine* m_engine;
-  bool m_searching;
+  std::istream& m_in;
+  /// Set by the input thread when a search is started, and cleared by the
+  /// search thread before it replies with the best move
+  std::atomic<bool> m_searching;
   bool m_quit;
-  /// Buffer used when reading from stdin
+  /// Buffer used when reading from the input
   /// During parsing and handling of a command it is illegal to change
   string m_commandLine;
   Command m_command;
 
+  ReplyWriter m_writer;
+  InfoReporter m_info;
+  /// Protects the hand over of a search to the search thread
+  std::mutex m_searchMutex;
+  std::condition_variable m_searchWake;
+  /// Signalled when m_searching is cleared
+  std::condition_variable m_searchDone;
+  bool m_searchPending;
+  bool m_searchExit;
+  /// The best move of the current search is not wanted, since the GUI
+  /// set up a new position while pondering
+  bool m_discardMove;
+  std::thread m_searchThread;
+  /// Options set during a search, which the engine has not been told of
+  std::vector<AEP::Option*> m_changedOptions;
+  bool m_debug;
+  /// The game of the last position command, which is also in the engine
+  Game m_game;
+  string m_lastPosition;
+  bool m_lastHadMoves;
+  bool m_positionValid;
+
+  /// Body of the search thread. Runs one search for each "go".
+  void SearchLoop() {
+    std::unique_lock<std::mutex> lock(m_searchMutex);
+    for (;;) {
+      m_searchWake.wait(lock, [this]() { return m_searchPending or m_searchExit; });
+      if (not m_searchPending) break;
+      m_searchPending = false;
+      lock.unlock();
+      Board2D::Move m;
+      m_engine->GetMove(m);
+      lock.lock();
+      // A ponder search must not reply before "ponderhit" or "stop"
+      m_searchWake.wait(lock, [this]() {
+        return not m_engine->Pondering() or m_engine->StopRequested();
+      });
+      const bool discard = m_discardMove;
+      lock.unlock();
+      if (not discard) m_info.Finish();
+      m_searching.store(false);
+      if (not discard) reply("bestmove "+to_aep(m));
+      lock.lock();
+      m_searchDone.notify_all();
+    }
+  }
+
+  /** Tell the search thread that the engine state changed. The flags are
+    atomics, but the lock is needed to not lose the wake up. */
+  void WakeSearch() {
+    { std::lock_guard<std::mutex> lock(m_searchMutex); }
+    m_searchWake.notify_one();
+  }
+
+  /** Stop a ponder search, when the opponent did not play the expected
+    move, and wait for it to end. Its best move is not sent. */
+  void AbortPonder() {
+    TRACE("Ponder miss, stop the ponder search");
+    std::unique_lock<std::mutex> lock(m_searchMutex);
+    m_discardMove = true;
+    m_engine->RequestStop();
+    m_searchWake.notify_one();
+    m_searchDone.wait(lock, [this]() { return not m_searching.load(); });
+  }
+
 public:
 
   bool MustQuit() const { return m_quit; }
   Command GetCommand() const { return m_command; }
 
-  EngineWrapper(AEP::Engine* engine)
-  : m_engine(engine), m_searching(false), m_quit(false)
+  EngineWrapper(AEP::Engine* engine, std::istream& in, std::ostream& out)
+  : m_engine(engine), m_in(in), m_searching(false), m_quit(false),
+    m_writer(out), m_info(m_writer), m_searchPending(false), m_searchExit(false),
+    m_discardMove(false), m_debug(false), m_lastHadMoves(false),
+    m_positionValid(false)
   {
-    m_engine->SetInputHandler(this);
+    m_engine->SetInfoHandler(&m_info);
+    m_searchThread = std::thread(&EngineWrapper::SearchLoop, this);
   }
 
+  /// Stop any search, and write all replies
   virtual ~EngineWrapper()
-  {}
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_searchMutex);
+      if (m_searching.load()) m_engine->RequestStop();
+      m_searchExit = true;
+    }
+    m_searchWake.notify_one();
+    m_searchThread.join();
+    m_engine->SetInfoHandler(0);
+  }
 
   unsigned m_first;
   // TODO: read up on strtok() for std::string or boost-tokenizer
@@ -139,37 +574,62 @@ public:
     return m_first < m_commandLine.size();
   }
 
+  /** Find the next token without copying it.
+    @return false if there are no more tokens */
+  bool next_token(unsigned& first, unsigned& last) {
+    unsigned i = m_first;
+    while (i < m_commandLine.size() and m_commandLine[i] == ' ') i++;
+    if (i >= m_commandLine.size()) {
+      m_first = i;
+      return false;
+    }
+    unsigned j = i;
+    while (j < m_commandLine.size() and m_commandLine[j] != ' ') j++;
+    first = i;
+    last = j;
+    // find next token
+    m_first = j;
+    while (m_first < m_commandLine.size() and m_commandLine[m_first] == ' ') m_first++;
+    return true;
+  }
+
   string get_tail() const {
     return m_commandLine.substr(m_first,string::npos);
   }
 
-  /** Blocking read of stdin. If a command is read, it is also handled. */
+  /** Read the value of a limit of "go", in ms or a count.
+    @return false with a warning if it is not a number, then value is -1 */
+  bool get_limit(const string& cmd, long long& value) {
+    const string token = get_token();
+    const char* text = token.c_str();
+    char* end = 0;
+    value = strtoll(text, &end, 10);
+    if (end == text or *end != '\0' or value < 0) {
+      APP_WARNING("Invalid value '"<<token<<"' for 'go "<<cmd<<"'");
+      value = -1;
+      return false;
+    }
+    return true;
+  }
+
+  /** Blocking read of a line from the input, which is then handled.
+    End of input is handled as "quit". */
   void WaitInput() {
-    int c = std::cin.get();
-    if (c==-1) return;
-    const unsigned MAX_COMMAND_LENGTH = 4000;
-    if (m_commandLine.size() > MAX_COMMAND_LENGTH) {
-      c = '\n';
-      APP_ERROR("Command line exceeded "<<MAX_COMMAND_LENGTH<<" chars");
-    }
-    if (c!='\n') m_commandLine += static_cast<char>(c);
-    else HandleCommand();
-  }
-  /** Nonblocking read of stdin. If a command is read, it is also handled.
-  @note Should be called from the Engine while
-  searching to make it possible to interrupt search. */
-  void CheckInput() {
-    while (::CheckInput()) WaitInput();
-  }
-  /** True, if the input functions WaitInput() or CheckInput() some not yet
-  processed data */
-  bool InputReady() {
-    return m_commandLine.size() > 0;
-  }
-  /** Send the string to the GUI (through stdout), and add a newline '\n' to
-  indicate end-of-reply. */
+    if (not std::getline(m_in, m_commandLine)) {
+      TRACE("End of input");
+      cmd_quit();
+      return;
+    }
+    // Lines from a GUI on Windows may end with CR LF
+    if (not m_commandLine.empty() and m_commandLine[m_commandLine.size()-1] == '\r') {
+      m_commandLine.erase(m_commandLine.size()-1);
+    }
+    HandleCommand();
+  }
+  /** Send the string to the GUI (through the output), and add a newline '\n' to
+  indicate end-of-reply. May be called from any thread. */
   void reply(string str) {
-    std::cout << str << std::endl << std::flush;
+    m_writer.Write(str);
   }
   /** Process the command in input buffer and clear the buffer */
   void HandleCommand() {
@@ -200,13 +660,15 @@ public:
     if (s!="") reply("id name "+s);
     s = m_engine->GetAuthor();
     if (s!="") reply("id author "+s);
-    // TODO: Return options of engine
+    const std::vector<AEP::Option*>& options = m_engine->Options();
+    for (size_t i = 0; i < options.size(); i++) reply(options[i]->ToString());
     reply("readyok");
   }
   void cmd_debug() {
     string direction = get_token();
-    if (direction == "on") m_engine->SetDebug(true);
-    else if (direction == "off") m_engine->SetDebug(false);
+    if (direction == "on") m_debug = true;
+    else if (direction == "off") m_debug = false;
+    if (direction == "on" or direction == "off") m_engine->SetDebug(m_debug);
     else {
       TRACE("Error: Valid values for debug command are 'on' or 'off' : "<<m_commandLine);
     }
@@ -222,13 +684,55 @@ public:
     This command must always be answered with "readyok"
   */
   void cmd_isready() {
+    ApplyOptions();
     reply("readyok");
   }
   /**
-    This command is used to configure the engine
+    This command is used to configure the engine. The name may contain
+    spaces, and so may the value of a string option.
+
+    @example
+    setoption name Hash value 256
   */
   void cmd_setoption() {
-    APP_WARNING("command 'setoption' not implemented.");
+    string t = get_token();
+    if (t != "name") {
+      APP_ERROR("command 'setoption' starts with '"<<t<<"' instead of 'name'");
+      return;
+    }
+    string name, value;
+    while (more_tokens()) {
+      t = get_token();
+      if (t == "value") {
+        value = get_tail();
+        break;
+      }
+      if (name != "") name += ' ';
+      name += t;
+    }
+    AEP::Option* option = m_engine->FindOption(name);
+    if (option == 0) {
+      APP_WARNING("command 'setoption', unknown option '"<<name<<"'");
+      return;
+    }
+    if (not option->Set(value)) {
+      APP_WARNING("command 'setoption', invalid value '"<<value<<"' for option '"<<name<<"'");
+      return;
+    }
+    for (size_t i = 0; i < m_changedOptions.size(); i++) {
+      if (m_changedOptions[i] == option) return;
+    }
+    m_changedOptions.push_back(option);
+    ApplyOptions();
+  }
+  /** Tell the engine about changed options, unless it is searching. The
+    engine may then do slow work like resizing its hash table. */
+  void ApplyOptions() {
+    if (m_searching.load()) return;
+    for (size_t i = 0; i < m_changedOptions.size(); i++) {
+      m_engine->OptionChanged(*m_changedOptions[i]);
+    }
+    m_changedOptions.clear();
   }
   /**
     Define starting position and moves up to current position. Use this command
@@ -243,60 +747,147 @@ public:
     position abp 00000 000000 0000000 00000000 000000000 00000000 00000000 000000 00000 moves a2a3 b7b6
   */
   void cmd_position() {
-    if (m_searching) {
+    if (m_searching.load() and m_engine->Pondering()) {
+      // Any position but the one pondered on means the ponder missed
+      AbortPonder();
+    }
+    if (m_searching.load()) {
       APP_ERROR("Cannot set up new position while searching");
+      return;
     }
-    Game game;
-    string start_pos;
-    string t = get_token();
-    if (t != "abp") {
-      APP_FATAL("command 'position' starts with '"<<t<<"' instead of 'abp'");
-      exit(1);
+    ApplyOptions();
+    typedef std::chrono::steady_clock Clock;
+    const Clock::time_point start = Clock::now();
+    // GUIs send the whole game before each search, so usually only the
+    // last moves are new
+    const bool incremental = ExtendsLastPosition();
+    unsigned first = 0, last = 0;
+    if (incremental) {
+      m_first = m_lastPosition.size();
+      if (not m_lastHadMoves) next_token(first, last); // "moves"
     }
-    // Parse start position
-    while (more_tokens()) {
-      t = get_token();
-      if (t == "moves") break;
-      start_pos += t; // Concatenate startpos
-    }
-    // Set up start position
-    {
+    else {
+      m_positionValid = false;
+      if (not next_token(first, last)) {
+        APP_FATAL("command 'position' without a position");
+        exit(1);
+      }
+      if (m_commandLine.compare(first, last - first, "abp") != 0) {
+        APP_FATAL("command 'position' starts with '"
+          <<m_commandLine.substr(first, last - first)<<"' instead of 'abp'");
+        exit(1);
+      }
+      // Find start position, up to "moves"
+      const unsigned fieldsFirst = m_first;
+      unsigned fieldsLast = m_commandLine.size();
+      m_lastHadMoves = false;
+      while (next_token(first, last)) {
+        if (m_commandLine.compare(first, last - first, "moves") == 0) {
+          fieldsLast = first;
+          m_lastHadMoves = true;
+          break;
+        }
+      }
       Board startPos;
-      std::istringstream s(start_pos);
-      startPos.Read(s);
-      // Adjust number of pieces out - since Read assumes more data
-      for (int player = 1; player <= 2; player ++) {
-        int marbles = 0;
-        Board2D::Pos pos;
-        pos.Next();
-        do {
-          if (startPos.At(pos) == player) marbles ++;
-          pos.Next();
-        } while (pos.Valid());
-        int missing = 14 - marbles;
-        int opponent = 3 - player;
-        startPos.SetScore(opponent,missing);
+      if (not ParseFields(m_commandLine.data() + fieldsFirst,
+        m_commandLine.data() + fieldsLast, startPos))
+      {
+        startPos = Board();
+        ReadStartPos(m_commandLine.substr(fieldsFirst, fieldsLast - fieldsFirst), startPos);
       }
-      game.RestartFrom(startPos);
+      m_game.RestartFrom(startPos);
     }
     // Parse moves
-    int moveNr = 0;
-    while (more_tokens()) {
+    int moveNr = incremental ? m_game.CurrentBoardNumber() : 0;
+    int newMoves = 0;
+    while (next_token(first, last)) {
       moveNr++;
-      t = get_token();
-      //TRACE(__func__ <<" parsing move #"<<moveNr<<" '"<<t<<"'");
-      std::istringstream s(t);
-      Move m;
-      if (!readMove(s, game)) {
+      newMoves++;
+      m_lastHadMoves = true;
+      const char* t = m_commandLine.data() + first;
+      if (last - first < 4 or not doFFTL(m_game, t[0], t[1], t[2], t[3])) {
         APP_FATAL("command 'position', move #"<<moveNr
-          <<" '"<<m<<"' is invalid."<<std::endl
+          <<" '"<<m_commandLine.substr(first, last - first)<<"' is invalid."<<std::endl
           <<"Board=\n"
-          <<game.board);
+          <<m_game.board);
         exit(1);
       }
     }
+    m_lastPosition.assign(m_commandLine);
+    m_positionValid = true;
+    const long long us = std::chrono::duration_cast<std::chrono::microseconds>(
+      Clock::now() - start).count();
+    TRACE("position with "<<moveNr<<" moves, "<<newMoves<<" parsed, in "<<us<<" us"
+      <<(incremental ? " (incremental)" : ""));
+    if (m_debug) {
+      std::ostringstream str;
+      str<<"info string position with "<<moveNr<<" moves, "<<newMoves
+         <<" parsed, in "<<us<<" us"<<(incremental ? " (incremental)" : "");
+      reply(str.str());
+    }
     // Transfer game to engine
-    m_engine->SetGame(game);
+    m_engine->SetGame(m_game);
+  }
+  /** True if the command line is the last position command followed by
+    more moves, or the same command again */
+  bool ExtendsLastPosition() const {
+    const size_t n = m_lastPosition.size();
+    if (not m_positionValid or m_commandLine.size() < n
+    or m_commandLine.compare(0, n, m_lastPosition) != 0) return false;
+    if (m_commandLine.size() == n) return true;
+    if (m_lastHadMoves) return m_commandLine[n] == ' ';
+    return m_commandLine.compare(n, 7, " moves ") == 0;
+  }
+  /** Set up the board from the 61 fields of the abp string, row i first.
+    '1' and '2' are marbles of a player, other characters empty fields.
+    The marbles missing from the board have been pushed off.
+    @return false if there are not exactly 61 fields */
+  static bool ParseFields(const char* first, const char* last, Board2D& board) {
+    int marbles[3] = { 0, 0, 0 };
+    for (int y=0; y<=8; y++) {
+      for (int x=0; x<=8; x++) {
+        if (not Board2D::Pos(x,y).Valid()) continue;
+        while (first != last and *first == ' ') first++;
+        if (first == last) return false;
+        const int player = *first++ - '0';
+        if (1 <= player and player <= 2) {
+          board.field[x][y] = player;
+          marbles[player]++;
+        }
+        else board.field[x][y] = fEmpty;
+      }
+    }
+    while (first != last and *first == ' ') first++;
+    if (first != last) return false;
+    // The abp string has no side to move, which Board::Read leaves at 2
+    board.SetTurn(fPieceBlack);
+    for (int player = 1; player <= 2; player ++) {
+      board.SetScore(3 - player, 14 - marbles[player]);
+    }
+    return true;
+  }
+  /** Set up a start position that is not just the 61 fields, like the
+    output of Board::Write */
+  static void ReadStartPos(const string& fields, Board2D& startPos) {
+    string start_pos;
+    for (size_t i = 0; i < fields.size(); i++) {
+      if (fields[i] != ' ') start_pos += fields[i]; // Concatenate startpos
+    }
+    std::istringstream s(start_pos);
+    startPos.Read(s);
+    // Adjust number of pieces out - since Read assumes more data
+    for (int player = 1; player <= 2; player ++) {
+      int marbles = 0;
+      Board2D::Pos pos;
+      pos.Next();
+      do {
+        if (startPos.At(pos) == player) marbles ++;
+        pos.Next();
+      } while (pos.Valid());
+      int missing = 14 - marbles;
+      int opponent = 3 - player;
+      startPos.SetScore(opponent,missing);
+    }
   }
   /**
     Begin searching the current position. This starts the engine and it may
@@ -310,55 +901,82 @@ public:
   void cmd_go() {
     // Begin searching
 
-    if (m_searching) {
+    if (m_searching.load()) {
       APP_ERROR("Cannot start new search while searching");
       return;
     }
-    m_engine->ResetSearchParameters();
+    ApplyOptions();
+    GoParameters go;
+    long long n;
     while (more_tokens()) {
       // Parse subcommand
       string cmd = get_token();
       if (cmd == "searchmoves") {
-        m_engine->SetSearchParameter(cmd,get_tail());
+        // The moves are the rest of the command
+        go.searchMoves = get_tail();
+        break;
       } else if (cmd == "ponder") {
-        m_engine->SetSearchParameter(cmd,"1");
+        go.ponder = true;
       } else if (cmd == "time") {
-        m_engine->SetSearchParameter(cmd+"1",get_token());
-        m_engine->SetSearchParameter(cmd+"2",get_token());
+        get_limit(cmd, go.time[0]);
+        get_limit(cmd, go.time[1]);
       } else if (cmd == "inc") {
-        m_engine->SetSearchParameter(cmd+"1",get_token());
-        m_engine->SetSearchParameter(cmd+"2",get_token());
+        get_limit(cmd, go.inc[0]);
+        get_limit(cmd, go.inc[1]);
       } else if (cmd == "depth") {
-        m_engine->SetSearchParameter(cmd,get_token());
+        if (get_limit(cmd, n)) go.depth = (int)std::min(n, (long long)INT_MAX);
       } else if (cmd == "mate") {
-        m_engine->SetSearchParameter(cmd,get_token());
+        if (get_limit(cmd, n)) go.mate = (int)std::min(n, (long long)INT_MAX);
       } else if (cmd == "movetime") {
-        m_engine->SetSearchParameter(cmd,get_token());
+        get_limit(cmd, go.moveTime);
       } else if (cmd == "infinite") {
-        m_engine->SetSearchParameter("movetime","inf");
+        go.infinite = true;
       } else if (cmd == "nodes") {
-        m_engine->SetSearchParameter(cmd,get_token());
+        get_limit(cmd, go.nodes);
       } else {
         APP_WARNING("Unknown 'go' subcommand: '"<<cmd<<"'");
       }
     }
-    // Make engine begin search of current position
-    m_searching = true;
-    Board2D::Move m;
-    m_engine->GetMove(m);
-    // TODO: Make engine emit final statistics
-    reply("bestmove "+to_aep(m));
-    m_searching = false;
+    m_engine->SetSearchLimits(go);
+    // Hand the search of the current position to the search thread
+    m_engine->ClearStopRequest();
+    m_engine->SetPondering(go.ponder);
+    m_info.Start();
+    m_searching.store(true);
+    {
+      std::lock_guard<std::mutex> lock(m_searchMutex);
+      m_discardMove = false;
+      m_searchPending = true;
+    }
+    m_searchWake.notify_one();
   }
+  /**
+    Stop the search and reply with its best move. A stop while pondering,
+    before "ponderhit", is a ponder miss: the search ends without a reply.
+  */
   void cmd_stop() {
-    // Note: This command may be called from inside the search
-    // thus m_engine->GetMove(m) should allow this callback
-    // Correct engine implementation of StopSearch, should
-    // exit search as fast as possible when returning from CheckInput()
-    m_engine->StopSearch();
+    if (m_searching.load() and m_engine->Pondering()) {
+      AbortPonder();
+      return;
+    }
+    // The search runs on another thread, which must return from
+    // m_engine->GetMove(m) as fast as possible
+    if (m_searching.load()) {
+      m_engine->RequestStop();
+      WakeSearch();
+    }
   }
+  /**
+    The opponent played the move the engine is pondering on. The search
+    goes on, but now under the time limits of the "go ponder" command.
+  */
   void cmd_ponderhit() {
-    APP_WARNING("command 'ponderhit' not implemented.");
+    if (not m_searching.load() or not m_engine->Pondering()) {
+      APP_WARNING("command 'ponderhit' while not pondering.");
+      return;
+    }
+    m_engine->RequestPonderHit();
+    WakeSearch();
   }
   void cmd_quit() {
     m_quit = true;
@@ -369,13 +987,80 @@ public:
 /** Drive engine through the abalone engine protocol (AEP)
   @return Error Code. 0 if exit without errors */
 int AEP::Play(Engine& player) {
-  // Disable buffering of stdout and stdin
+  return Play(player, std::cin, std::cout);
+}
+
+int AEP::Play(Engine& player, std::istream& in, std::ostream& out) {
   // Initialise engine
   TRACE("Initialise engine");
-  EngineWrapper aep(&player);
+  // out is only used by the reply thread, so in must not flush it
+  in.tie(0);
+  EngineWrapper aep(&player, in, out);
   TRACE("Read input");
   while (not aep.MustQuit()) {
     aep.WaitInput();
   }
   return 0;
 }
+
+////////////////////////////////////////////////////////////////
+//
+//  In-process driver
+//
+
+AEP::Driver::Driver(Engine& engine)
+: m_engine(engine)
+, m_searching(false)
+{
+}
+
+bool AEP::Driver::SetOption(const string& name, const string& value) {
+  AEP::Option* option = m_engine.FindOption(name);
+  if (option == 0 or not option->Set(value)) return false;
+  {
+    std::lock_guard<std::mutex> lock(m_optionMutex);
+    for (size_t i = 0; i < m_changedOptions.size(); i++) {
+      if (m_changedOptions[i] == option) return true;
+    }
+    m_changedOptions.push_back(option);
+  }
+  ApplyOptions();
+  return true;
+}
+
+/** Tell the engine about changed options, unless it is searching */
+void AEP::Driver::ApplyOptions() {
+  std::lock_guard<std::mutex> lock(m_optionMutex);
+  if (m_searching.load()) return;
+  for (size_t i = 0; i < m_changedOptions.size(); i++) {
+    m_engine.OptionChanged(*m_changedOptions[i]);
+  }
+  m_changedOptions.clear();
+}
+
+void AEP::Driver::SetPosition(const Game& game) {
+  ApplyOptions();
+  m_engine.SetGame(game);
+}
+
+Board2D::Move AEP::Driver::Go(const GoParameters& parameters) {
+  ApplyOptions();
+  m_engine.SetSearchLimits(parameters);
+  // A stop before this point is for the previous search
+  m_engine.ClearStopRequest();
+  m_engine.SetPondering(false);
+  {
+    // Options set from now on wait until the search is done
+    std::lock_guard<std::mutex> lock(m_optionMutex);
+    m_searching.store(true);
+  }
+  Board2D::Move m;
+  m_engine.GetMove(m);
+  m_searching.store(false);
+  ApplyOptions();
+  return m;
+}
+
+void AEP::Driver::Stop() {
+  if (m_searching.load()) m_engine.RequestStop();
+}
@@ -37,6 +37,8 @@ using std::vector;
 #include "Trace.hpp"
 #define TRACE1(x) // TRACE(x)
 
+#include "PerfCounters.hpp"
+
 #ifdef HAVE_CPPUNIT
 #include <cppunit/TestSuite.h>
 #include <cppunit/extensions/HelperMacros.h>
@@ -49,6 +51,21 @@ using std::stringstream;
 
 namespace Haliotis {
 
+#ifdef USE_PERF_COUNTERS
+/// Results of Board::Push, by result code + 1
+static PerfCounter pushResults[6] = {
+  PerfCounter("board.push.illegal"), PerfCounter("board.push.ok"),
+  PerfCounter("board.push.too_long"), PerfCounter("board.push.too_short"),
+  PerfCounter("board.push.blocked"), PerfCounter("board.push.suicide")
+};
+/// Results of Board::MoveSeveral, by result code
+static PerfCounter severalResults[2] = {
+  PerfCounter("board.several.ok"), PerfCounter("board.several.blocked")
+};
+#endif
+PERF_COUNTER(moveCandidates, "movegen.candidates")
+PERF_COUNTER(movesAccepted, "movegen.accepted")
+
 
 
 
@@ -340,12 +357,74 @@ int Board::DoMove(Move M) {
   else
     Result=MoveSeveral(M.FromFirst(),M.FromLast(),M.ToFirst());
 
+#ifdef USE_PERF_COUNTERS
+  if (M.tailCount==1 or Parallel(M.tailDir,M.moveDir))
+    pushResults[Result+1].Add();
+  else
+    severalResults[Result].Add();
+#endif
+
   /* If move was successfull, switch sides */
   if (Result==0) whiteToMove=not whiteToMove;
 
   return Result;
 }
 
+/* The piece of an inline move that pushes the others: the tail end when
+the move goes away from the tail, as in DoMove */
+static BoardPos PushingPiece(Move M)
+{
+  if (M.tailCount>1 and Opposite(M.tailDir) == M.moveDir) return M.FromLast();
+  return M.FromFirst();
+}
+
+/* Own pieces in the low two bits, opponent pieces above them. 0 for a
+broadside move, which can be taken back without it. */
+unsigned char Board::UndoInfo(Move M) const
+{
+  if (M.tailCount>1 and not Parallel(M.tailDir,M.moveDir)) return 0;
+  BoardPos B=PushingPiece(M);
+  const int8 own=At(B);
+  int Alen=0, Blen=0;
+  while (B.Valid() and At(B)==own) { Alen++; B.Step(M.moveDir); }
+  while (B.Valid() and At(B)==3-own) { Blen++; B.Step(M.moveDir); }
+  return Alen + 4*Blen;
+}
+
+void Board::UndoMove(Move M, unsigned char undo)
+{
+  TRACE1("Board::UndoMove");
+  whiteToMove=not whiteToMove;
+  if (undo==0) {
+    // Broadside: move the pieces back
+    BoardPos from=M.FromFirst(), to=M.ToFirst();
+    for (int i=0; i<M.tailCount; i++) {
+      field[from.x][from.y]=field[to.x][to.y];
+      field[to.x][to.y]=fEmpty;
+      from.Step(M.tailDir); to.Step(M.tailDir);
+    }
+    return;
+  }
+  // Inline: the first own piece comes back, the first pushed opponent
+  // piece takes the place of the last own piece, and the last pushed
+  // opponent piece leaves its place or comes back onto the board
+  const int Alen=undo & 3, Blen=undo >> 2;
+  const BoardPos A=PushingPiece(M);
+  BoardPos B=A;
+  for (int i=0; i<Alen; i++) B.Step(M.moveDir);
+  const int8 own=field[B.x][B.y];
+  field[A.x][A.y]=own;
+  if (Blen==0) {
+    field[B.x][B.y]=fEmpty;
+    return;
+  }
+  field[B.x][B.y]=3-own;
+  BoardPos C=B;
+  for (int i=0; i<Blen; i++) C.Step(M.moveDir);
+  if (C.Valid()) field[C.x][C.y]=fEmpty;
+  else DeltaOut(3-own,-1);
+}
+
 void Board::DeltaOut(int PieceType, int Delta)
 {
   if (PieceType==fPieceWhite)
@@ -637,6 +716,14 @@ ostream& operator << (ostream& out, const Move& m) {
 #else
 /// FFTL notation
 ostream& operator << (ostream& out, const Move& m) {
+  // A broadside move can be written from either end. The parser expects
+  // the end where tail and move are 60 degrees apart; from the other end
+  // a move of two looks like an inline move of one.
+  const int angle = (m.moveDir - m.tailDir + 6) % 6;
+  if (m.tailCount > 1 and (angle == 2 or angle == 4)) {
+    out << m.FromLast() << m.ToFirst();
+    return out;
+  }
   out << m.FromFirst() << m.ToLast();
   // @bug This is only unique if the move is expanded. It is valid to
   // have FromLast == FromFirst even if moving more than 1 of own pieces.
@@ -863,6 +950,61 @@ int Board::Compare(const Board& aBoard) const
   return result;
 }
 
+/** Store the content of the 61 fields with 2 bits per field, in the order
+  of Board2D::Pos::Next(). Side to move and pieces off board are not stored.
+*/
+void Board::PackFields(unsigned char packed[PACKED_FIELDS_SIZE]) const
+{
+  for (int i=0; i<PACKED_FIELDS_SIZE; i++) packed[i] = 0;
+  int fieldNr = 0;
+  for (BoardPos p = BoardPos::FromIndex(0); p.Valid(); p.Next(), fieldNr++) {
+    packed[fieldNr/4] |= (unsigned char)(At(p) << (2*(fieldNr%4)));
+  }
+}
+
+/** Set the 61 fields from the result of PackFields(). Side to move and
+  pieces off board are not changed. */
+void Board::UnpackFields(const unsigned char packed[PACKED_FIELDS_SIZE])
+{
+  int fieldNr = 0;
+  for (BoardPos p = BoardPos::FromIndex(0); p.Valid(); p.Next(), fieldNr++) {
+    field[p.x][p.y] = (packed[fieldNr/4] >> (2*(fieldNr%4))) & 3;
+  }
+}
+
+/** Zobrist keys of Hash64(). They are made by splitmix64 from a fixed
+  seed, so a hash is the same on all platforms and in all runs. */
+struct Zobrist64 {
+  unsigned long long field[61][3];
+  unsigned long long secondToMove;
+  Zobrist64() {
+    unsigned long long seed = 0x416261;
+    for (int i=0; i<61; i++) {
+      field[i][fEmpty] = 0;
+      field[i][fPieceWhite] = Next(seed);
+      field[i][fPieceBlack] = Next(seed);
+    }
+    secondToMove = Next(seed);
+  }
+  static unsigned long long Next(unsigned long long& seed) {
+    unsigned long long z = (seed += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+  }
+};
+
+unsigned long long Board::Hash64() const
+{
+  static const Zobrist64 keys;
+  unsigned long long result = whiteToMove ? 0 : keys.secondToMove;
+  int fieldNr = 0;
+  for (BoardPos p = BoardPos::FromIndex(0); p.Valid(); p.Next(), fieldNr++) {
+    result ^= keys.field[fieldNr][At(p)];
+  }
+  return result;
+}
+
 /** Compare two boards */
 bool Board::operator == (const Board& aBoard) const
 {
@@ -961,7 +1103,9 @@ void Board::FirstMove(Move& M) const
 {
   M.head.x=4; M.head.y=0;
   M.moveDir=0; M.tailDir=0; M.tailCount=1;
-  if (not ValidMove(M)) NextMove(M);
+  PERF_COUNT(moveCandidates);
+  if (ValidMove(M)) PERF_COUNT(movesAccepted);
+  else NextMove(M);
 }
 
 /** Return the first valid move. If this is NoMove, then there is no valid
@@ -972,7 +1116,11 @@ bool Board::FirstMove(Move& M, Board& B) const
   M.moveDir=0; M.tailDir=0; M.tailCount=1;
 
   B=*this;
-  if (B.DoMove(M)==0) return true;
+  PERF_COUNT(moveCandidates);
+  if (B.DoMove(M)==0) {
+    PERF_COUNT(movesAccepted);
+    return true;
+  }
   return NextMove(M,B);
 }
 
@@ -1055,7 +1203,11 @@ bool Board::NextMove(Move& M, Board& B) const
     SuggestNextMove(M);
     if (not ValidBoardPos(M.head)) return false;
     B=*this;
-    if (B.DoMove(M)==0) return true;
+    PERF_COUNT(moveCandidates);
+    if (B.DoMove(M)==0) {
+      PERF_COUNT(movesAccepted);
+      return true;
+    }
   };
 }
 
@@ -1070,13 +1222,14 @@ void Board::NextMove(Move& M) const
   }
   do {
     SuggestNextMove(M);
-    if (ValidMove(M)) return;
+    PERF_COUNT(moveCandidates);
+    if (ValidMove(M)) {
+      PERF_COUNT(movesAccepted);
+      return;
+    }
   } while (ValidBoardPos(M.head));
 }
 
-/// HACK
-Board BoardAfterTestMove;
-
 /** Determines if the move is valid for the player to move */
 bool Board::ValidMove(Move M) const
 {
@@ -1084,11 +1237,10 @@ bool Board::ValidMove(Move M) const
     return false;
   }
 
-  // This global variable is used for the temporary board, since
-  // some part of the code wants the board in case the move was
-  // valid.
-  BoardAfterTestMove=*this;
-  return BoardAfterTestMove.DoMove(M)==0;
+  // The move is tried on a local board, so boards can be used from
+  // several threads at once.
+  Board boardAfterTestMove(*this);
+  return boardAfterTestMove.DoMove(M)==0;
 }
 
 /** Extend the tail of the move. For generated push-moves, the tail
@@ -0,0 +1,222 @@
+/** @file EngineProcess.cpp
+
+  This library is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#include "EngineProcess.hpp"
+
+//// Headers ///////////////////////////////////////////////////
+
+#include "config.h"
+
+#define DEB1
+#include "Trace.hpp"
+#define TRACE1(x) // TRACE(x)
+
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+#ifdef HAVE_FORK
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+static long long MillisecondsSince(Clock::time_point start)
+{
+  return chrono::duration_cast<chrono::milliseconds>(Clock::now() - start).count();
+}
+
+EngineProcess::EngineProcess()
+: m_pid(0)
+, m_input(-1)
+, m_output(-1)
+{
+}
+
+EngineProcess::~EngineProcess()
+{
+  Stop();
+}
+
+#ifdef HAVE_FORK
+
+/** Pipes are created and marked close-on-exec under this lock, so a
+  process started by another thread does not inherit them and keep them
+  open. */
+static mutex& ForkMutex()
+{
+  static mutex m;
+  return m;
+}
+
+bool EngineProcess::Start(const string& command)
+{
+  Stop();
+  m_command = command;
+  m_buffer.clear();
+  int toChild[2], fromChild[2];
+  lock_guard<mutex> lock(ForkMutex());
+  if (pipe(toChild) != 0) return false;
+  if (pipe(fromChild) != 0) {
+    close(toChild[0]);
+    close(toChild[1]);
+    return false;
+  }
+  const pid_t pid = fork();
+  if (pid == 0) {
+    // Child
+    dup2(toChild[0], 0);
+    dup2(fromChild[1], 1);
+    close(toChild[0]);
+    close(toChild[1]);
+    close(fromChild[0]);
+    close(fromChild[1]);
+    execl("/bin/sh", "sh", "-c", command.c_str(), (char*)0);
+    _exit(127);
+  }
+  close(toChild[0]);
+  close(fromChild[1]);
+  if (pid < 0) {
+    TRACE("EngineProcess - fork failed for " << command);
+    close(toChild[1]);
+    close(fromChild[0]);
+    return false;
+  }
+  fcntl(toChild[1], F_SETFD, FD_CLOEXEC);
+  fcntl(fromChild[0], F_SETFD, FD_CLOEXEC);
+  m_pid = pid;
+  m_input = toChild[1];
+  m_output = fromChild[0];
+  TRACE1("EngineProcess - started " << pid << ": " << command);
+  return true;
+}
+
+bool EngineProcess::WriteLine(const string& line)
+{
+  if (m_input < 0) return false;
+  TRACE1("EngineProcess " << m_pid << " < " << line);
+  const string text = line + '\n';
+  size_t written = 0;
+  while (written < text.size()) {
+    const ssize_t n = write(m_input, text.data() + written, text.size() - written);
+    if (n < 0 and errno == EINTR) continue;
+    if (n <= 0) return false;
+    written += n;
+  }
+  return true;
+}
+
+bool EngineProcess::ReadLine(string& line, long long timeoutMs)
+{
+  const Clock::time_point start = Clock::now();
+  for (;;) {
+    const size_t end = m_buffer.find('\n');
+    if (end != string::npos) {
+      line.assign(m_buffer, 0, end);
+      m_buffer.erase(0, end + 1);
+      if (not line.empty() and line[line.size()-1] == '\r') line.erase(line.size()-1);
+      TRACE1("EngineProcess " << m_pid << " > " << line);
+      return true;
+    }
+    if (m_output < 0) return false;
+    int wait = -1;
+    if (timeoutMs >= 0) {
+      const long long left = timeoutMs - MillisecondsSince(start);
+      if (left <= 0) return false;
+      wait = (int)left;
+    }
+    struct pollfd fd;
+    fd.fd = m_output;
+    fd.events = POLLIN;
+    fd.revents = 0;
+    const int ready = poll(&fd, 1, wait);
+    if (ready < 0 and errno == EINTR) continue;
+    if (ready <= 0) return false;
+    char buffer[4096];
+    const ssize_t n = read(m_output, buffer, sizeof(buffer));
+    if (n < 0 and errno == EINTR) continue;
+    if (n <= 0) {
+      // The process closed its output, most likely it has exited
+      TRACE("EngineProcess - end of output from " << m_command);
+      Close(0);
+      return false;
+    }
+    m_buffer.append(buffer, n);
+  }
+}
+
+void EngineProcess::Stop(long long waitMs)
+{
+  if (m_pid <= 0) return;
+  WriteLine("quit");
+  Close(waitMs);
+}
+
+void EngineProcess::Close(long long waitMs)
+{
+  if (m_input >= 0) close(m_input);
+  if (m_output >= 0) close(m_output);
+  m_input = m_output = -1;
+  if (m_pid <= 0) return;
+  const Clock::time_point start = Clock::now();
+  int status;
+  while (waitpid(m_pid, &status, WNOHANG) == 0) {
+    if (MillisecondsSince(start) >= waitMs) {
+      TRACE("EngineProcess - killing " << m_pid << ": " << m_command);
+      kill(m_pid, SIGKILL);
+      waitpid(m_pid, &status, 0);
+      break;
+    }
+    this_thread::sleep_for(chrono::milliseconds(5));
+  }
+  m_pid = 0;
+}
+
+#else
+
+bool EngineProcess::Start(const string& command)
+{
+  m_command = command;
+  TRACE("EngineProcess - not supported on this platform");
+  return false;
+}
+
+bool EngineProcess::WriteLine(const string&)
+{
+  return false;
+}
+
+bool EngineProcess::ReadLine(string&, long long)
+{
+  return false;
+}
+
+void EngineProcess::Stop(long long)
+{
+}
+
+void EngineProcess::Close(long long)
+{
+}
+
+#endif
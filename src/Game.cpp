@@ -22,6 +22,7 @@
 */
 
 #include "Game.hpp"
+#include <algorithm>
 #include <cctype> // isspace, isalnum
 #include <iostream>
 using std::istream;
@@ -46,6 +47,7 @@ using std::stringstream;
 #endif
 
 #include "Persistence.hpp"
+#include "PerfCounters.hpp"
 
 //// implementation ////////////////////////////////////////////
 
@@ -131,116 +133,55 @@ public:
   int MovesFromStart() const;
 };
 
-/** Representation of a position in a game tree.
-
-  @bug Note that this is a tree, not
-  a graph, so two equal positions may occur in the same game tree (given that
-  they were reached by different paths).
-*/
-struct GameTreeNode {
-  /// Comment to current position or move that lead to current position.
-  ::std::string comment;
-  GameTreeNode* prev;
-  /// Main line continues here. Next move is next->move
-  GameTreeNode* next;
-  /// Alternative moves
-  GameTreeNode* alt;
-  /**
-    Move that lead to the current position. This GameTreeNode represents the
-    position AFTER this move.
-    @note Moves must be normalised before adding to GameTreeNode
-  */
-  Board2D::Move move;
-public:
-  GameTreeNode();
-  // Create copy of other tree
-  GameTreeNode(const GameTreeNode* orig, GameTreeNode* new_prev=0);
-  ~GameTreeNode();
-  GameTreeNode* FindNode(Move move);
-  GameTreeNode* GetNode(Move move);
-  GameTreeNode* FindNextNode(Move move);
-  GameTreeNode* GetNextNode(Move move);
-  static void RemoveNode(GameTreeNode*& nodePtr);
-  Board2D::Move UndoMove() const;
-  #if 0
-  GameTreeNavigator MovePath();
-  // The following two should probably not be here but belong in
-  // separate functions in Persistence.cpp
-  void Read(istream& in);
-  void Write(ostream& out) const;
-  #endif
-};
+PERF_COUNTER(nodesMade, "game.nodes")
+PERF_COUNTER(nodesFreed, "game.nodes.freed")
 
 GameTreeNode::GameTreeNode()
-  : prev(0), next(0), alt(0)
+  : prev(0), indexBits(0)
 {
+  PERF_COUNT(nodesMade);
 }
 
 GameTreeNode::GameTreeNode(const GameTreeNode* orig, GameTreeNode* new_prev)
-  : prev(0), next(0), alt(0)
+  : prev(new_prev), indexBits(0)
 {
+  PERF_COUNT(nodesMade);
   move = orig->move;
   comment = orig->comment;
-  prev = new_prev;
-  if (orig->next) next = new GameTreeNode(orig->next, this);
-  if (orig->alt) alt = new GameTreeNode(orig->alt, new_prev);
+  children.reserve(orig->children.size());
+  for (size_t i = 0; i < orig->children.size(); i++) {
+    children.push_back(new GameTreeNode(orig->children[i], this));
+  }
+  if (not orig->childIndex.empty()) Reindex();
 }
 
 GameTreeNode::~GameTreeNode()
 {
+  PERF_COUNT(nodesFreed);
   prev = 0;
-  delete alt; alt = 0;
-  delete next; next = 0;
-}
-
-/**
-  Usage: curPos->next->FindNode(move) --
-  since curPos is the position AFTER the current move was done
-*/
-GameTreeNode* GameTreeNode::FindNode(Move move)
-{
-  for (GameTreeNode* i = this; i != 0; i = i->alt) {
-    if (i->move == move) return i;
+  for (size_t i = 0; i < children.size(); i++) {
+    delete children[i];
   }
-  return 0;
+  children.clear();
 }
 
-#if 0
-/** Find the move that led to this node */
-Board2D::Move GameTreeNode::UndoMove() const
+/** Insert child number i into the hash index.
+  @pre The index has room for the child */
+void GameTreeNode::AddToIndex(size_t i)
 {
-  if (prev == 0) return Board2D::Move::Move(); // invalid move
-  return prev->FindMove(this);
+  const size_t mask = childIndex.size() - 1;
+  size_t slot = FirstSlot(children[i]->move.Pack());
+  while (childIndex[slot] != 0) slot = (slot + 1) & mask;
+  childIndex[slot] = (unsigned short)(i + 1);
 }
-#endif
 
-/**
-  Find move amongst alternatives, after previous position. If move is new, it
-  is added to the tree.
-  Usage: curPos->next->GetNode(move) --
-  since curPos is the position AFTER the current move was done
-*/
-GameTreeNode* GameTreeNode::GetNode(Move move)
-{
-  TRACE1("+GetNode");
-  for (GameTreeNode* i = this; i != 0; i = i->alt) {
-    TRACE1("GetNode - at "<< i<<" move="<<i->move);
-    if (i->move == move) {
-      TRACE1("-GetNode - Found move");
-      return i;
-    }
-    if (i->alt == 0) {
-      TRACE1("-GetNode - New alternative move");
-      GameTreeNode* result = new GameTreeNode();
-      TRACE_ASSERT(result != 0);
-      result->move = move;
-      result->prev = prev;
-      i->alt = result;
-      return result;
-    }
-  }
-  // You have called this function on a null pointer
-  return 0;
+/** Rebuild the hash index, so it is at most half full */
+void GameTreeNode::Reindex()
+{
+  indexBits = 4;
+  while (((size_t)1 << indexBits) < 2 * children.size()) indexBits++;
+  childIndex.assign((size_t)1 << indexBits, 0);
+  for (size_t i = 0; i < children.size(); i++) AddToIndex(i);
 }
 
 /**
@@ -248,44 +189,167 @@ GameTreeNode* GameTreeNode::GetNode(Move move)
   If move is new, it is not added to the tree.
   Usage: curPos->FindNextNode(move)
 */
-GameTreeNode* GameTreeNode::FindNextNode(Move move)
+GameTreeNode* GameTreeNode::FindNextNode(Move move) const
 {
   TRACE1("+FindNextNode");
-  if (next == 0) {
-    // No next move
-    TRACE1("-FindNextNode - no next move");
+  if (childIndex.empty()) {
+    for (size_t i = 0; i < children.size(); i++) {
+      if (children[i]->move == move) return children[i];
+    }
+    TRACE1("-FindNextNode - not found");
     return 0;
   }
-  return next->FindNode(move);
+  const size_t mask = childIndex.size() - 1;
+  for (size_t slot = FirstSlot(move.Pack()); childIndex[slot] != 0;
+       slot = (slot + 1) & mask)
+  {
+    GameTreeNode* child = children[childIndex[slot] - 1];
+    if (child->move == move) return child;
+  }
+  TRACE1("-FindNextNode - not found");
+  return 0;
 }
 
 /**
   Go to position that follows the given move. If move is new, it is added
-  to the tree.
+  to the tree as the last alternative.
   Usage: curPos->GetNextNode(move)
 */
 GameTreeNode* GameTreeNode::GetNextNode(Move move)
 {
   TRACE1("+GetNextNode");
-  if (next == 0) {
-    // No next move - append move
-    TRACE1("-GetNextNode - New next move");
-    GameTreeNode* result = new GameTreeNode();
-    TRACE_ASSERT(result != 0);
-    result->move = move;
-    result->prev = this;
-    next = result;
-    return result;
+  GameTreeNode* result = FindNextNode(move);
+  if (result != 0) return result;
+
+  TRACE1("-GetNextNode - New move");
+  result = new GameTreeNode();
+  TRACE_ASSERT(result != 0);
+  result->move = move;
+  result->prev = this;
+  children.push_back(result);
+  if (not childIndex.empty() and 2 * children.size() <= childIndex.size()) {
+    AddToIndex(children.size() - 1);
+  }
+  else if (children.size() > INDEX_THRESHOLD) {
+    Reindex();
+  }
+  return result;
+}
+
+Board2D BoardAfter(const GameTreeNode* node, const Board2D& startPos)
+{
+  if (node->prev == 0) return startPos;
+  Board2D board = BoardAfter(node->prev, startPos);
+  int DoMove_error = board.DoMove(node->move);
+  TRACE_ASSERT(DoMove_error == 0);
+  return board;
+}
+
+
+MainLineIterator::MainLineIterator(const GameTreeNode* root,
+  const Board2D& startPos)
+{
+  m_pos.node = root->MainLine();
+  m_pos.board = startPos;
+  if (m_pos.node != 0) {
+    int DoMove_error = m_pos.board.DoMove(m_pos.node->move);
+    TRACE_ASSERT(DoMove_error == 0);
+  }
+}
+
+MainLineIterator& MainLineIterator::operator ++ ()
+{
+  m_pos.node = m_pos.node->MainLine();
+  if (m_pos.node != 0) {
+    int DoMove_error = m_pos.board.DoMove(m_pos.node->move);
+    TRACE_ASSERT(DoMove_error == 0);
+  }
+  return *this;
+}
+
+PreorderIterator::PreorderIterator(const GameTreeNode* root,
+  const Board2D& startPos)
+: m_depth(0), m_childNo(0), m_startPos(startPos)
+{
+  m_pos.node = root;
+  m_pos.board = startPos;
+  if (root->Children().empty()) m_pos.node = 0;
+  else GoToChild(0);
+}
+
+/** Go to child number childNo of the current node. Within the first
+  MAX_STEPS moves, what is needed to go back is kept. */
+void PreorderIterator::GoToChild(size_t childNo)
+{
+  m_pos.node = m_pos.node->Children()[childNo];
+  m_childNo = childNo;
+  if (m_depth < MAX_STEPS) {
+    m_step[m_depth].childNo = (unsigned short)childNo;
+    m_step[m_depth].undo = m_pos.board.UndoInfo(m_pos.node->move);
   }
-  return next->GetNode(move);
+  m_depth++;
+  int DoMove_error = m_pos.board.DoMove(m_pos.node->move);
+  TRACE_ASSERT(DoMove_error == 0);
 }
 
-void GameTreeNode::RemoveNode(GameTreeNode*& nodePtr)
+/** Go to the parent of the current node, which is not the root. The move is
+  taken back, or the parent is replayed when it is deeper than MAX_STEPS. */
+void PreorderIterator::GoToParent()
 {
-  if (nodePtr == 0) return;
-  GameTreeNode* p = nodePtr;
-  nodePtr = nodePtr->alt;
-  delete p;
+  const GameTreeNode* node = m_pos.node;
+  m_pos.node = node->prev;
+  m_depth--;
+  if (m_depth < MAX_STEPS) {
+    m_pos.board.UndoMove(node->move, m_step[m_depth].undo);
+  }
+  else {
+    Replay(m_pos.node, m_depth, m_pos.board);
+  }
+  if (m_depth == 0) {
+    m_childNo = 0;
+  }
+  else if (m_depth <= MAX_STEPS) {
+    m_childNo = m_step[m_depth - 1].childNo;
+  }
+  else {
+    const std::vector<GameTreeNode*>& siblings = m_pos.node->prev->Children();
+    m_childNo = std::find(siblings.begin(), siblings.end(), m_pos.node) - siblings.begin();
+  }
+}
+
+/** Board after the moves from the root to node, which is depth moves from
+  the root. The moves are found from node by the prev pointers, so each
+  is found again for each move done. Only used below MAX_STEPS. */
+void PreorderIterator::Replay(const GameTreeNode* node, int depth,
+  Board2D& board) const
+{
+  board = m_startPos;
+  for (int d = 1; d <= depth; d++) {
+    const GameTreeNode* step = node;
+    for (int up = depth; up > d; up--) step = step->prev;
+    int DoMove_error = board.DoMove(step->move);
+    TRACE_ASSERT(DoMove_error == 0);
+  }
+}
+
+PreorderIterator& PreorderIterator::operator ++ ()
+{
+  // Go down the main line if possible
+  if (not m_pos.node->Children().empty()) {
+    GoToChild(0);
+    return *this;
+  }
+  // Otherwise go up until a node has a next sibling
+  while (m_pos.node->prev != 0) {
+    const size_t childNo = m_childNo;
+    GoToParent();
+    if (childNo + 1 < m_pos.node->Children().size()) {
+      GoToChild(childNo + 1);
+      return *this;
+    }
+  }
+  m_pos.node = 0; // Back at root - no more moves
+  return *this;
 }
 
 
@@ -305,8 +369,8 @@ visualises the board with an attaches list of moves. This means
 
 Game::Game() /* Create */
 : board(currentBoard)
-, moveTree(0)
-, currentPosition(0)
+, moveTree(new GameTreeNode())
+, currentPosition(moveTree)
 {
   currentBoard.SetUpStartPos();
   startPos=board;
@@ -314,16 +378,16 @@ Game::Game() /* Create */
 
 Game::Game(const Game& orig) /* Copy */
 : board(currentBoard)
-, moveTree(0)
-, currentPosition(0)
+, moveTree(new GameTreeNode())
+, currentPosition(moveTree)
 {
   *this = orig;
 }
 
 Game::Game(Board aBoard) // RestartFrom
 : board(currentBoard)
-, moveTree(0)
-, currentPosition(0)
+, moveTree(new GameTreeNode())
+, currentPosition(moveTree)
 {
   startPos=aBoard;
   currentBoard=startPos;
@@ -337,21 +401,23 @@ Game::~Game()
 }
 
 const Game& Game::operator = (const Game& orig) {
+  if (this == &orig) return *this;
+
   // Set up initial board
   RestartFrom(orig.startPos);
 
-  // Copy nodes in game tree
-  if (orig.moveTree) {
-    moveTree = new GameTreeNode(orig.moveTree);
-
-    // Find position in game
-    vector<Board2D::Move> movePath = orig.CurrentMoves();
-    for (vector<Board2D::Move>::iterator i
-      = movePath.begin(); i != movePath.end(); i ++)
-    {
-      int DoMove_error = DoMove(*i);
-      TRACE_ASSERT_MSG(DoMove_error == 0, "move="<< *i << endl<<board);
-    }
+  // Copy nodes in game tree, including the comment at startPos
+  delete moveTree;
+  moveTree = new GameTreeNode(orig.moveTree);
+  currentPosition = moveTree;
+
+  // Find position in game
+  vector<Board2D::Move> movePath = orig.CurrentMoves();
+  for (vector<Board2D::Move>::iterator i
+    = movePath.begin(); i != movePath.end(); i ++)
+  {
+    int DoMove_error = DoMove(*i);
+    TRACE_ASSERT_MSG(DoMove_error == 0, "move="<< *i << endl<<board);
   }
 
   // Copy attributes
@@ -365,8 +431,8 @@ void Game::RestartFrom(Board aBoard) {
   startPos = aBoard;
   currentBoard = startPos;
   delete moveTree;
-  moveTree = 0;
-  currentPosition = 0;
+  moveTree = new GameTreeNode();
+  currentPosition = moveTree;
   attributes.clear();
 }
 
@@ -374,7 +440,7 @@ void Game::RestartFrom(Board aBoard) {
 int Game::CurrentBoardNumber() const
 {
   int movesFromStart = 0;
-  for (GameTreeNode* p = currentPosition; p != 0; p = p->prev) {
+  for (GameTreeNode* p = currentPosition; p != moveTree; p = p->prev) {
     movesFromStart ++;
   }
   return movesFromStart;
@@ -387,7 +453,7 @@ int Game::CurrentBoardNumber() const
 {
   int moves = CurrentBoardNumber();
   ::std::vector<Board2D::Move> moveList(moves);
-  for (GameTreeNode* p = currentPosition; p != 0; p = p->prev) {
+  for (GameTreeNode* p = currentPosition; p != moveTree; p = p->prev) {
     moveList[--moves] = p->move;
   }
   return moveList;
@@ -439,22 +505,7 @@ int Game::DoMove(Move move)
   // Update move tree
   //
 
-  if (currentPosition != 0) {
-    // Inside the move tree
-    TRACE1("Game::DoMove - moveTree = " << moveTree);
-    currentPosition = currentPosition->GetNextNode(move);
-  }
-  else if (moveTree != 0) {
-    // At game start
-    currentPosition = moveTree->GetNode(move);
-  }
-  else {
-    // Empty moveTree
-    moveTree = new GameTreeNode();
-    moveTree->move = move;
-    currentPosition = moveTree;
-  }
-  // We are not a game start, so we must be inside the moveTree
+  currentPosition = currentPosition->GetNextNode(move);
   TRACE_ASSERT(currentPosition != 0);
 
   TRACE1("-Game::DoMove - moveTree = " << moveTree);
@@ -475,24 +526,14 @@ int Game::RedoMove(Move move)
   TRACE1("+Game::RedoMove");
 
   //
-  // Update move tree
+  // Find move in move tree
   //
 
-  if (currentPosition != 0) {
-    // Inside the move tree
-    TRACE1("Game::RedoMove - moveTree = " << moveTree);
-    currentPosition = currentPosition->GetNextNode(move);
-  }
-  else if (moveTree != 0) {
-    // At game start
-    currentPosition = moveTree->GetNode(move);
-  }
-  else {
-    // Empty moveTree
+  GameTreeNode* next = currentPosition->FindNextNode(move);
+  if (next == 0) {
+    TRACE1("-Game::RedoMove - move not in tree");
     return 1;
   }
-  // We are not a game start, so we must be inside the moveTree
-  TRACE_ASSERT(currentPosition != 0);
 
   //
   // Validate move and update board
@@ -503,6 +544,7 @@ int Game::RedoMove(Move move)
     TRACE1("-Game::DoMove - invalid move rejected (code "<<err<<")");
     return -2;
   }
+  currentPosition = next;
 
   TRACE1("-Game::DoMove - moveTree = " << moveTree);
   return 0;
@@ -510,15 +552,14 @@ int Game::RedoMove(Move move)
 
 Move Game::PrevMove() const
 {
-  if (currentPosition == 0) return Move();
+  if (currentPosition == moveTree) return Move();
   return currentPosition->move;
 }
 
 Move Game::NextMove() const
 {
   if (not MoreMovesToRedo()) return Move();
-  if (currentPosition == 0) return moveTree->move;
-  return currentPosition->next->move;
+  return currentPosition->MainLine()->move;
 }
 
 /**
@@ -527,12 +568,10 @@ Move Game::NextMove() const
 */
 vector<Board2D::Move> Game::AlternateMoves() const
 {
-  ::std::vector<Board2D::Move> moveList;
-  GameTreeNode* first;
-  if (currentPosition == 0) first = moveTree;
-  else first = currentPosition->next;
-  for (GameTreeNode* p = first; p != 0; p = p->alt) {
-    moveList.push_back(p->move);
+  const ::std::vector<GameTreeNode*>& children = currentPosition->Children();
+  ::std::vector<Board2D::Move> moveList(children.size());
+  for (size_t i = 0; i < children.size(); i++) {
+    moveList[i] = children[i]->move;
   }
   return moveList;
 }
@@ -543,9 +582,7 @@ vector<Board2D::Move> Game::AlternateMoves() const
 */
 void Game::RedoMove()
 {
-  GameTreeNode* next;
-  if (currentPosition == 0) next = moveTree;
-  else next = currentPosition->next;
+  GameTreeNode* next = currentPosition->MainLine();
   if (next == 0) return;
   currentPosition = next;
   int DoMove_error = currentBoard.DoMove(currentPosition->move);
@@ -555,7 +592,7 @@ void Game::RedoMove()
 
 void Game::UndoMove()
 {
-  if (currentPosition == 0) return;
+  if (currentPosition == moveTree) return;
   // board.UndoMove(currentPosition->move); -- not possible, see below
   currentPosition = currentPosition->prev;
 
@@ -575,18 +612,17 @@ void Game::UndoMove()
 void Game::UndoAllMoves()
 {
   currentBoard = startPos;
-  currentPosition = 0;
+  currentPosition = moveTree;
 }
 
 bool Game::MoreMovesToUndo() const
 {
-  return currentPosition != 0;
+  return currentPosition != moveTree;
 }
 
 bool Game::MoreMovesToRedo() const
 {
-  if (currentPosition == 0) return moveTree != 0;
-  return currentPosition->next != 0;
+  return currentPosition->MainLine() != 0;
 }
 
 /**
@@ -594,7 +630,7 @@ bool Game::MoreMovesToRedo() const
 */
 int Game::Length() const {
   int len=0;
-  for (GameTreeNode* p = moveTree; p != 0; p = p->next) {
+  for (GameTreeNode* p = moveTree->MainLine(); p != 0; p = p->MainLine()) {
     len ++;
   }
   return len;
@@ -610,14 +646,12 @@ bool Game::WhiteMovesFirst() const
 */
 string Game::GetComment() const
 {
-  if (currentPosition==0) return startComment;
-  else return currentPosition->comment;
+  return currentPosition->comment;
 }
 
 void Game::SetComment(const string& comment)
 {
-  if (currentPosition==0) startComment = comment;
-  else currentPosition->comment = comment;
+  currentPosition->comment = comment;
 }
 
 /**
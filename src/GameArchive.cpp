@@ -0,0 +1,371 @@
+/** @file GameArchive.cpp
+
+  This library is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#include "GameArchive.hpp"
+
+//// Headers ///////////////////////////////////////////////////
+
+#include "config.h"
+
+#define DEB1
+#include "Trace.hpp"
+#define TRACE1(x) // TRACE(x)
+
+#include <cstring>
+using namespace std;
+using namespace Haliotis;
+
+//// Encoding helpers //////////////////////////////////////////
+
+static const char ARCHIVE_MAGIC[4] = { 'A','B','G','A' };
+static const char INDEX_MAGIC[4] = { 'A','B','G','X' };
+static const unsigned char ARCHIVE_VERSION = 1;
+static const size_t HEADER_SIZE = 8;
+static const size_t FOOTER_SIZE = 20;
+
+static void PutU8(string& out, unsigned value) {
+  out += (char)(value & 0xFF);
+}
+
+static void PutU16(string& out, unsigned value) {
+  PutU8(out, value);
+  PutU8(out, value >> 8);
+}
+
+static void PutU32(string& out, unsigned long value) {
+  for (int i=0; i<4; i++) PutU8(out, (unsigned)(value >> (8*i)));
+}
+
+static void PutU64(string& out, unsigned long long value) {
+  for (int i=0; i<8; i++) PutU8(out, (unsigned)(value >> (8*i)));
+}
+
+/// Unsigned LEB128: 7 bits per byte, high bit set on all but the last byte
+static void PutVarint(string& out, size_t value) {
+  while (value >= 0x80) {
+    PutU8(out, (unsigned)(value | 0x80));
+    value >>= 7;
+  }
+  PutU8(out, (unsigned)value);
+}
+
+static void PutString(string& out, const string& str) {
+  PutVarint(out, str.size());
+  out += str;
+}
+
+/** Read integers from a buffer. Reading past the end returns 0 and clears
+  ok, so the caller only needs to check ok once in a while. */
+struct ByteReader {
+  const unsigned char* p;
+  const unsigned char* end;
+  bool ok;
+
+  ByteReader(const char* data, size_t size)
+  : p((const unsigned char*)data), end(p + size), ok(true) {}
+
+  bool Has(size_t n) {
+    if ((size_t)(end - p) < n) ok = false;
+    return ok;
+  }
+  unsigned U8() {
+    if (not Has(1)) return 0;
+    return *p++;
+  }
+  unsigned U16() {
+    unsigned lo = U8();
+    return lo | U8() << 8;
+  }
+  size_t Varint() {
+    size_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      unsigned b = U8();
+      value |= (size_t)(b & 0x7F) << shift;
+      if ((b & 0x80) == 0) return value;
+    }
+    ok = false;
+    return 0;
+  }
+  void String(string& str) {
+    size_t n = Varint();
+    if (not Has(n)) return;
+    str.assign((const char*)p, n);
+    p += n;
+  }
+};
+
+static unsigned long long GetU64(const char* data) {
+  unsigned long long value = 0;
+  for (int i=7; i>=0; i--) value = value << 8 | (unsigned char)data[i];
+  return value;
+}
+
+//// Game record ///////////////////////////////////////////////
+
+static void EncodeNode(const GameTreeNode* node, string& out) {
+  PutU16(out, node->move.Pack());
+  if (not node->comment.empty()) {
+    PutU16(out, ARCHIVE_COMMENT);
+    PutString(out, node->comment);
+  }
+}
+
+/** Encode the main line following node, with the alternatives of each
+  move in variation markers */
+static void EncodeLine(const GameTreeNode* node, string& out) {
+  while (node->MainLine() != 0) {
+    const vector<GameTreeNode*>& children = node->Children();
+    EncodeNode(children[0], out);
+    for (size_t i = 1; i < children.size(); i++) {
+      PutU16(out, ARCHIVE_BEGIN_VARIATION);
+      EncodeNode(children[i], out);
+      EncodeLine(children[i], out);
+      PutU16(out, ARCHIVE_END_VARIATION);
+    }
+    node = children[0];
+  }
+}
+
+void GameArchive_Encode(const Game& game, string& record) {
+  record.clear();
+
+  // Start position
+  unsigned char fields[Board2D::PACKED_FIELDS_SIZE];
+  const Board2D& start = game.StartPos();
+  start.PackFields(fields);
+  record.append((const char*)fields, sizeof(fields));
+  PutU8(record, start.GetTurn());
+  PutU8(record, start.WhiteOff());
+  PutU8(record, start.BlackOff());
+
+  // Attributes
+  PutVarint(record, game.attributes.size());
+  for (Settings::const_iterator i = game.attributes.begin();
+       i != game.attributes.end(); i++)
+  {
+    PutString(record, i->first);
+    PutString(record, i->second);
+  }
+
+  // Tree
+  const GameTreeNode* root = game.Root();
+  if (not root->comment.empty()) {
+    PutU16(record, ARCHIVE_COMMENT);
+    PutString(record, root->comment);
+  }
+  EncodeLine(root, record);
+  PutU16(record, ARCHIVE_END_GAME);
+}
+
+/** True if the fields of an unpacked move are in range and its marbles
+  are on the board, so Board2D::DoMove() does not read outside the fields.
+  A corrupt record can hold any token. */
+static bool MoveInRange(const Board2D::Move& move) {
+  return move.head.Valid()
+     and 0 <= move.tailDir and move.tailDir < 6
+     and 1 <= move.tailCount and move.tailCount <= 3
+     and 0 <= move.moveDir and move.moveDir < 6
+     and move.Valid();
+}
+
+bool GameArchive_Decode(const char* data, size_t size, Game& game) {
+  ByteReader in(data, size);
+
+  // Start position
+  if (not in.Has(Board2D::PACKED_FIELDS_SIZE + 3)) return false;
+  Board2D start;
+  start.SetUpStartPos(); // clears the fields that are not on the board
+  start.UnpackFields(in.p);
+  in.p += Board2D::PACKED_FIELDS_SIZE;
+  start.SetTurn(in.U8());
+  start.SetOutOfBoard(true, in.U8());
+  start.SetOutOfBoard(false, in.U8());
+  game.RestartFrom(start);
+
+  // Attributes
+  size_t attributeCount = in.Varint();
+  string key, value;
+  for (size_t i = 0; i < attributeCount and in.ok; i++) {
+    in.String(key);
+    in.String(value);
+    game.attributes[key] = value;
+  }
+
+  // Tree. Each move is validated on the board it is done on.
+  struct State {
+    GameTreeNode* node;
+    Board2D board;  //< Board after node->move
+    Board2D before; //< Board before node->move
+    bool beforeKnown; //< before is not set after BEGIN until a move
+  };
+  State cur;
+  cur.node = game.Root();
+  cur.board = start;
+  cur.beforeKnown = false;
+  vector<State> variations;
+  while (in.ok) {
+    unsigned token = in.U16();
+    if (token < ARCHIVE_COMMENT) {
+      Board2D::Move move = Board2D::Move::Unpack(token);
+      if (not MoveInRange(move)) {
+        TRACE("GameArchive_Decode - corrupt move " << token);
+        return false;
+      }
+      cur.before = cur.board;
+      cur.beforeKnown = true;
+      if (cur.board.DoMove(move) != 0) {
+        TRACE("GameArchive_Decode - invalid move " << move);
+        return false;
+      }
+      cur.node = cur.node->GetNextNode(move);
+    }
+    else if (token == ARCHIVE_COMMENT) {
+      in.String(cur.node->comment);
+    }
+    else if (token == ARCHIVE_BEGIN_VARIATION) {
+      if (cur.node == game.Root()) return false;
+      if (not cur.beforeKnown) {
+        // Nested BEGIN: an alternative to a move of a variation
+        cur.before = BoardAfter(cur.node->prev, start);
+        cur.beforeKnown = true;
+      }
+      variations.push_back(cur);
+      cur.node = cur.node->prev;
+      cur.board = cur.before;
+      cur.beforeKnown = false;
+    }
+    else if (token == ARCHIVE_END_VARIATION) {
+      if (variations.empty()) return false;
+      cur = variations.back();
+      variations.pop_back();
+    }
+    else if (token == ARCHIVE_END_GAME) {
+      return in.ok and variations.empty();
+    }
+    else {
+      TRACE("GameArchive_Decode - unknown token " << token);
+      return false;
+    }
+  }
+  TRACE("GameArchive_Decode - record truncated");
+  return false;
+}
+
+//// GameArchiveWriter /////////////////////////////////////////
+
+GameArchiveWriter::GameArchiveWriter(ostream& out)
+: m_out(out)
+, m_position(HEADER_SIZE)
+, m_closed(false)
+{
+  string header(ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC));
+  PutU8(header, ARCHIVE_VERSION);
+  header.append(3, '\0');
+  m_out.write(header.data(), header.size());
+}
+
+GameArchiveWriter::~GameArchiveWriter()
+{
+  Close();
+}
+
+void GameArchiveWriter::Write(const Game& game)
+{
+  TRACE_ASSERT_MSG(not m_closed, "GameArchiveWriter::Write after Close");
+  GameArchive_Encode(game, m_record);
+  string size;
+  PutU32(size, m_record.size());
+  m_out.write(size.data(), size.size());
+  m_out.write(m_record.data(), m_record.size());
+  m_offsets.push_back(m_position);
+  m_position += size.size() + m_record.size();
+}
+
+void GameArchiveWriter::Close()
+{
+  if (m_closed) return;
+  m_closed = true;
+  string index;
+  index.reserve(8 * m_offsets.size() + FOOTER_SIZE);
+  for (size_t i = 0; i < m_offsets.size(); i++) {
+    PutU64(index, m_offsets[i]);
+  }
+  PutU64(index, m_position);
+  PutU64(index, m_offsets.size());
+  index.append(INDEX_MAGIC, sizeof(INDEX_MAGIC));
+  m_out.write(index.data(), index.size());
+  m_out.flush();
+}
+
+//// GameArchiveReader /////////////////////////////////////////
+
+GameArchiveReader::GameArchiveReader(istream& in)
+: m_in(in)
+, m_valid(false)
+{
+  m_in.seekg(0, ios::end);
+  unsigned long long fileSize = m_in.tellg();
+  if (not m_in or fileSize < HEADER_SIZE + FOOTER_SIZE) return;
+
+  char header[HEADER_SIZE];
+  m_in.seekg(0);
+  m_in.read(header, sizeof(header));
+  if (not m_in or memcmp(header, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC)) != 0
+  or (unsigned char)header[4] != ARCHIVE_VERSION)
+  {
+    TRACE("GameArchiveReader - not an archive");
+    return;
+  }
+
+  char footer[FOOTER_SIZE];
+  m_in.seekg(fileSize - FOOTER_SIZE);
+  m_in.read(footer, sizeof(footer));
+  unsigned long long indexOffset = GetU64(footer);
+  unsigned long long count = GetU64(footer + 8);
+  if (not m_in or memcmp(footer + 16, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0
+  or indexOffset < HEADER_SIZE
+  or (fileSize - FOOTER_SIZE - indexOffset) / 8 != count)
+  {
+    TRACE("GameArchiveReader - archive has no valid index");
+    return;
+  }
+
+  string index(8 * count, '\0');
+  m_in.seekg(indexOffset);
+  m_in.read(&index[0], index.size());
+  if (not m_in) return;
+  m_offsets.resize(count);
+  for (size_t i = 0; i < count; i++) {
+    m_offsets[i] = GetU64(&index[8 * i]);
+  }
+  m_valid = true;
+}
+
+bool GameArchiveReader::Read(size_t i, Game& game)
+{
+  if (not m_valid or i >= m_offsets.size()) return false;
+  m_in.clear();
+  m_in.seekg(m_offsets[i]);
+  char size[4];
+  m_in.read(size, sizeof(size));
+  if (not m_in) return false;
+  unsigned long recordSize = 0;
+  for (int j=3; j>=0; j--) recordSize = recordSize << 8 | (unsigned char)size[j];
+  m_record.resize(recordSize);
+  if (recordSize > 0) m_in.read(&m_record[0], recordSize);
+  if (not m_in) return false;
+  return GameArchive_Decode(m_record.data(), m_record.size(), game);
+}
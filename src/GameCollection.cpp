@@ -0,0 +1,200 @@
+/** @file GameCollection.cpp
+
+  This library is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#include "GameCollection.hpp"
+
+//// Headers ///////////////////////////////////////////////////
+
+#include "config.h"
+
+#define DEB1
+#include "Trace.hpp"
+#define TRACE1(x) // TRACE(x)
+
+#include <cstring>
+#include <fstream>
+#include <sys/stat.h>
+
+#include "Persistence.hpp"
+
+using namespace std;
+using namespace Haliotis;
+
+static const char INDEX_MAGIC[4] = { 'A','G','C','X' };
+
+//// GameView //////////////////////////////////////////////////
+
+bool GameView::GetAttribute(const string& key, string& value) const
+{
+  const char* p = m_data;
+  const char* end = m_data + m_size;
+  while (p < end and (*p==' ' or *p=='\n' or *p=='\r' or *p=='\t')) p++;
+  // Attribute lines look like: [Key "Value"]
+  while (p < end and *p == '[') {
+    const char* eol = (const char*)memchr(p, '\n', end - p);
+    if (eol == 0) eol = end;
+    if ((size_t)(eol - p) > key.size() + 1
+    and memcmp(p + 1, key.data(), key.size()) == 0
+    and (p[key.size() + 1] == ' ' or p[key.size() + 1] == '"'))
+    {
+      // Let the normal reader handle escapes
+      string line(p, eol);
+      istringstream in(line);
+      Settings att;
+      ReadAttributes(att, in);
+      return Get(att, key, value);
+    }
+    p = eol + 1;
+  }
+  return false;
+}
+
+bool GameView::Decode(Game& game) const
+{
+  return AbaloneGameFormat_Read(m_data, m_size, game);
+}
+
+//// GameCollection ////////////////////////////////////////////
+
+GameCollection::GameCollection()
+{
+}
+
+bool GameCollection::Open(const string& filename, bool useIndexFile)
+{
+  Close();
+  if (not m_file.Open(filename)) return false;
+
+  unsigned long long mtime = 0;
+  struct stat st;
+  if (stat(filename.c_str(), &st) == 0) mtime = st.st_mtime;
+
+  const string indexFile = IndexFileName(filename);
+  if (useIndexFile and LoadIndex(indexFile, mtime)) return true;
+
+  m_file.Advise(MappedFile::ACCESS_SEQUENTIAL);
+  Scan();
+  if (useIndexFile) SaveIndex(indexFile, mtime);
+  return true;
+}
+
+void GameCollection::Close()
+{
+  m_file.Close();
+  m_offsets.clear();
+}
+
+GameView GameCollection::operator [] (size_t i) const
+{
+  TRACE_ASSERT(i < m_offsets.size());
+  size_t begin = (size_t)m_offsets[i];
+  size_t end = i+1 < m_offsets.size() ? (size_t)m_offsets[i+1] : m_file.Size();
+  return GameView(m_file.Data() + begin, end - begin);
+}
+
+/** Find the start of each game. Only the first character of each line is
+  examined, the lines are found with memchr. */
+void GameCollection::Scan()
+{
+  m_offsets.clear();
+  const char* data = m_file.Data();
+  const char* end = data + m_file.Size();
+  const char* p = data;
+
+  // The first game starts at the first non-blank character
+  while (p < end and (*p==' ' or *p=='\n' or *p=='\r' or *p=='\t')) p++;
+  if (p == end) return;
+  m_offsets.push_back(p - data);
+  bool inAttributes = (*p == '[');
+
+  while (true) {
+    p = (const char*)memchr(p, '\n', end - p);
+    if (p == 0 or ++p == end) break;
+    if (*p == '[') {
+      if (not inAttributes) m_offsets.push_back(p - data);
+      inAttributes = true;
+    }
+    else if (*p != '\n' and *p != '\r') {
+      inAttributes = false;
+    }
+  }
+  TRACE1("GameCollection::Scan found " << m_offsets.size() << " games");
+}
+
+/* Index file layout, all integers are u64 in native byte order since the
+  index is a cache local to the machine:
+    "AGCX" 4 reserved bytes, size of collection, mtime of collection,
+    number of games, offset of each game
+*/
+
+bool GameCollection::LoadIndex(const string& indexFile, unsigned long long mtime)
+{
+  ifstream in(indexFile.c_str(), ios::binary);
+  if (not in) return false;
+  char magic[8];
+  unsigned long long header[3];
+  in.read(magic, sizeof(magic));
+  in.read((char*)header, sizeof(header));
+  if (not in or memcmp(magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0
+  or header[0] != m_file.Size() or header[1] != mtime)
+  {
+    TRACE("GameCollection - index " << indexFile << " is out of date");
+    return false;
+  }
+  // The count must match the bytes left before anything is allocated,
+  // and each game must start inside the collection after the previous one
+  const streamoff headerSize = in.tellg();
+  in.seekg(0, ios::end);
+  const unsigned long long offsetBytes = (unsigned long long)(in.tellg() - headerSize);
+  in.seekg(headerSize);
+  if (not in or header[2] > m_file.Size()
+  or header[2] * sizeof(m_offsets[0]) != offsetBytes)
+  {
+    TRACE("GameCollection - index " << indexFile << " has a bad game count");
+    return false;
+  }
+  m_offsets.resize((size_t)header[2]);
+  if (not m_offsets.empty()) {
+    in.read((char*)&m_offsets[0], m_offsets.size() * sizeof(m_offsets[0]));
+  }
+  for (size_t i = 0; i < m_offsets.size(); i++) {
+    if (not in or m_offsets[i] >= m_file.Size()
+    or (i > 0 and m_offsets[i] <= m_offsets[i-1]))
+    {
+      TRACE("GameCollection - index " << indexFile << " has a bad offset");
+      m_offsets.clear();
+      return false;
+    }
+  }
+  return true;
+}
+
+void GameCollection::SaveIndex(const string& indexFile, unsigned long long mtime) const
+{
+  ofstream out(indexFile.c_str(), ios::binary);
+  if (not out) {
+    TRACE("GameCollection - cannot write index " << indexFile);
+    return;
+  }
+  char magic[8] = { 0 };
+  memcpy(magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+  unsigned long long header[3] = { m_file.Size(), mtime, m_offsets.size() };
+  out.write(magic, sizeof(magic));
+  out.write((const char*)header, sizeof(header));
+  if (not m_offsets.empty()) {
+    out.write((const char*)&m_offsets[0], m_offsets.size() * sizeof(m_offsets[0]));
+  }
+}
@@ -0,0 +1,370 @@
+/** @file GameFormats.cpp
+
+  This library is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#include "GameFormats.hpp"
+
+//// Headers ///////////////////////////////////////////////////
+
+#include "config.h"
+
+#define DEB1
+#include "Trace.hpp"
+#define TRACE1(x) // TRACE(x)
+
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+using namespace Haliotis;
+
+/// Attribute holding the start position, when it is not the standard one
+static const char* POSITION_TAG = "Position";
+
+//// Format names //////////////////////////////////////////////
+
+struct FormatInfo {
+  GameFormat format;
+  const char* name;
+  const char* extension;
+};
+
+static const FormatInfo formats[] = {
+  { FORMAT_AG,           "ag",           ".ag"  },
+  { FORMAT_ABAPRO,       "abapro",       ".abp" },
+  { FORMAT_WATERLOO1993, "waterloo1993", ".wat" },
+};
+static const int FORMATS = sizeof(formats) / sizeof(formats[0]);
+
+static bool EqualNoCase(const char* a, const char* b, size_t n)
+{
+  for (size_t i = 0; i < n; i++) {
+    if (tolower((unsigned char)a[i]) != tolower((unsigned char)b[i])) return false;
+  }
+  return true;
+}
+
+GameFormat GameFormatFromName(const string& name)
+{
+  for (int i = 0; i < FORMATS; i++) {
+    if (name.size() == strlen(formats[i].name)
+    and EqualNoCase(name.c_str(), formats[i].name, name.size())) {
+      return formats[i].format;
+    }
+  }
+  // Short name of Waterloo1993
+  if (name.size() == 8 and EqualNoCase(name.c_str(), "waterloo", 8)) {
+    return FORMAT_WATERLOO1993;
+  }
+  return FORMAT_UNKNOWN;
+}
+
+GameFormat GameFormatOfFile(const string& filename)
+{
+  for (int i = 0; i < FORMATS; i++) {
+    const size_t n = strlen(formats[i].extension);
+    if (filename.size() > n
+    and EqualNoCase(filename.c_str() + filename.size() - n, formats[i].extension, n)) {
+      return formats[i].format;
+    }
+  }
+  return FORMAT_UNKNOWN;
+}
+
+const char* GameFormatName(GameFormat format)
+{
+  for (int i = 0; i < FORMATS; i++) {
+    if (formats[i].format == format) return formats[i].name;
+  }
+  return "unknown";
+}
+
+const char* GameFormatExtension(GameFormat format)
+{
+  for (int i = 0; i < FORMATS; i++) {
+    if (formats[i].format == format) return formats[i].extension;
+  }
+  return "";
+}
+
+//// Positions and moves ///////////////////////////////////////
+
+/* In the standard notation used by AbaPro the column is the NW-SE diagonal,
+  as in Board2D, and row 'a' is at the bottom, where Board2D has y = 8 and
+  the first player starts. In Waterloo1993 the column is counted from the
+  left end of the row, and the first player starts at the top, see
+  Waterloo1993Pos in Persistence.cpp. So a Waterloo1993 position is turned
+  180 degrees, which keeps the first player at the bottom of Board2D. */
+
+static bool ParsePos(GameFormat format, char row, char col, Board2D::Pos& pos)
+{
+  if (not ('a' <= row and row <= 'i' and '1' <= col and col <= '9')) return false;
+  pos.y = 'i' - row;
+  pos.x = col - '1';
+  if (format == FORMAT_WATERLOO1993) {
+    if (pos.y < 4) pos.x += 4 - pos.y;
+    if (not pos.Valid()) return false;
+    pos.x = 8 - pos.x;
+    pos.y = 8 - pos.y;
+  }
+  return pos.Valid();
+}
+
+void GameFormatWriter::AppendPos(Board2D::Pos pos)
+{
+  if (m_format == FORMAT_WATERLOO1993) {
+    pos.x = 8 - pos.x;
+    pos.y = 8 - pos.y;
+  }
+  int col = pos.x + 1;
+  if (m_format == FORMAT_WATERLOO1993 and pos.y < 4) col -= 4 - pos.y;
+  m_buffer += char('i' - pos.y);
+  m_buffer += char('0' + col);
+}
+
+/** Make a move from the marbles written in a game. For an inline move
+  first is the rear marble and last is not used, so a single marble moves
+  and pushes the marbles in front of it, as Board2D::DoMove does.
+  @return false if the marbles do not give a move */
+static bool MakeMove(Board2D::Pos first, Board2D::Pos last, Board2D::Pos to,
+  bool inline_, Board2D::Move& move)
+{
+  if (Dist(first, to) != 1) return false;
+  if (inline_) {
+    move = Board2D::Move(first, to);
+    return true;
+  }
+  const int count = LineLength(first, last);
+  if (count < 1 or 3 < count) return false;
+  move = Board2D::Move(first, last, to);
+  return move.Valid();
+}
+
+/** Append a move in the notation of the format. Inline moves are written
+  as the rear marble and its destination, whichever way the move is stored */
+void GameFormatWriter::AppendMove(const Board2D::Move& move)
+{
+  const char* separator = m_format == FORMAT_WATERLOO1993 ? "-" : "";
+  if (move.tailCount == 1 or move.tailDir == move.moveDir) {
+    AppendPos(move.FromFirst());
+    m_buffer += separator;
+    AppendPos(move.ToFirst());
+  }
+  else if (Opposite(move.tailDir) == move.moveDir) {
+    AppendPos(move.FromLast());
+    m_buffer += separator;
+    AppendPos(move.ToLast());
+  }
+  else {
+    AppendPos(move.FromFirst());
+    AppendPos(move.FromLast());
+    m_buffer += separator;
+    AppendPos(move.ToFirst());
+  }
+}
+
+static bool IsResult(const char* tok, size_t n)
+{
+  return (n == 3 and (memcmp(tok, "1-0", 3) == 0 or memcmp(tok, "0-1", 3) == 0))
+      or (n == 7 and memcmp(tok, "1/2-1/2", 7) == 0)
+      or (n == 1 and *tok == '*');
+}
+
+//// GameFormatReader //////////////////////////////////////////
+
+GameFormatReader::GameFormatReader(GameFormat format)
+: m_format(format)
+{
+}
+
+bool GameFormatReader::Read(const char*& data, const char* end, Game& game)
+{
+  if (m_format == FORMAT_AG) return m_agParser.Read(data, end, game);
+  if (m_format == FORMAT_UNKNOWN) return false;
+
+  const char* p = data;
+  m_attributes.clear();
+  ReadAttributes(m_attributes, p, end);
+
+  Board2D start;
+  start.SetUpStartPos();
+  Settings::iterator position = m_attributes.find(POSITION_TAG);
+  if (position != m_attributes.end()) {
+    if (not parse_apf(position->second, start)) {
+      TRACE("GameFormatReader::Read - bad position \"" << position->second << "\"");
+      data = p;
+      return false;
+    }
+    m_attributes.erase(position);
+  }
+  game.RestartFrom(start);
+  game.attributes.swap(m_attributes);
+
+  data = p;
+  return ReadMoves(data, end, game);
+}
+
+/** Read the main line. The moves are checked with Board2D::DoMove, and
+  the tree is built directly as AgParser does. */
+bool GameFormatReader::ReadMoves(const char*& data, const char* end, Game& game)
+{
+  const bool waterloo = (m_format == FORMAT_WATERLOO1993);
+  const char* p = data;
+  GameTreeNode* node = game.Root();
+  Board2D board = game.StartPos();
+  bool moves = false; //< Seen a move or move number
+  bool ok = true;
+  while (ok) {
+    // White space, a blank line ends a Waterloo1993 game
+    int newlines = 0;
+    while (p < end and IsSpace(*p)) {
+      if (*p == '\n') newlines++;
+      p++;
+    }
+    if (p == end) break;
+    if (waterloo and moves and newlines >= 2) break;
+    if (*p == '[') break; // Next game
+
+    const char* tok = p;
+    if (*p == '{') {
+      const char* close = (const char*)memchr(p, '}', end - p);
+      if (close == 0) {
+        TRACE("GameFormatReader::Read - WARNING: Reached end without '}'");
+        close = end;
+      }
+      node->comment.assign(p + 1, close);
+      p = close < end ? close + 1 : end;
+      continue;
+    }
+
+    while (p < end and not IsSpace(*p) and *p != '{' and *p != '[') p++;
+    const size_t n = p - tok;
+    if (IsResult(tok, n)) {
+      if (*tok != '*' and game.attributes.find("Result") == game.attributes.end()) {
+        game.attributes["Result"] = string(tok, n);
+      }
+      break;
+    }
+    if ('0' <= *tok and *tok <= '9') {
+      // Move number "12." or "12..."
+      const char* q = tok;
+      while (q < p and '0' <= *q and *q <= '9') q++;
+      ok = q < p and *q == '.';
+      while (q < p and *q == '.') q++;
+      p = ok ? q : tok; // A move may follow the dot directly
+      moves = true;
+      continue;
+    }
+    if (n == 3 and memcmp(tok, "...", 3) == 0) continue;
+    if (n == 1 and *tok == '-') continue; // Place holder as in "1. - a1b2"
+
+    // tail [head] newTail, Waterloo1993 has '-' before newTail
+    const size_t fromLength = waterloo ? n - 3 : n - 2;
+    Board2D::Pos pos[3];
+    Board2D::Move move;
+    ok = n >= 4 and (fromLength == 2 or fromLength == 4)
+      and (not waterloo or tok[fromLength] == '-')
+      and ParsePos(m_format, tok[0], tok[1], pos[0])
+      and (fromLength == 2 or ParsePos(m_format, tok[2], tok[3], pos[1]))
+      and ParsePos(m_format, p[-2], p[-1], pos[2])
+      and MakeMove(pos[0], pos[1], pos[2], fromLength == 2, move)
+      and board.DoMove(move) == 0;
+    if (ok) {
+      node = node->GetNextNode(move);
+      moves = true;
+    }
+    else {
+      TRACE("GameFormatReader::Read - unexpected \"" << string(tok, n) << "\"");
+      p = tok;
+    }
+  }
+  data = p;
+  return ok;
+}
+
+//// GameFormatWriter //////////////////////////////////////////
+
+GameFormatWriter::GameFormatWriter(GameFormat format)
+: m_format(format)
+{
+}
+
+void GameFormatWriter::Write(ostream& out, const Game& game)
+{
+  if (m_format == FORMAT_AG) {
+    m_agWriter.Write(out, game);
+    return;
+  }
+  TRACE_ASSERT(m_format != FORMAT_UNKNOWN);
+
+  m_attributes = game.attributes;
+  m_attributes.erase(POSITION_TAG);
+  Board2D standard;
+  standard.SetUpStartPos();
+  if (not (game.StartPos() == standard)) {
+    m_attributes[POSITION_TAG] = apf(game.StartPos());
+  }
+  WriteAttributes(m_attributes, out);
+
+  m_buffer.clear();
+  const GameTreeNode* node = game.Root();
+  if (not node->comment.empty()) {
+    m_buffer += '{';
+    m_buffer += node->comment;
+    m_buffer += "}\n";
+  }
+  // Ply 0 is the first player, so a game may start with "1. ..."
+  int ply = game.StartPos().GetTurn() == fPieceWhite ? 0 : 1;
+  bool lineStart = true;
+  bool showNumber = true;
+  for (node = node->MainLine(); node != 0; node = node->MainLine(), ply++) {
+    if (ply % 2 == 0 or showNumber) {
+      // Ten moves on a line
+      if (ply % 2 == 0 and ply > 0 and ply % 20 == 0) {
+        m_buffer += '\n';
+        lineStart = true;
+      }
+      if (not lineStart) m_buffer += ' ';
+      char number[16];
+      snprintf(number, sizeof(number), ply % 2 == 0 ? "%d." : "%d. ...", ply/2 + 1);
+      m_buffer += number;
+      lineStart = false;
+    }
+    if (not lineStart) m_buffer += ' ';
+    AppendMove(node->move);
+    lineStart = false;
+    showNumber = false;
+    if (not node->comment.empty()) {
+      m_buffer += " {";
+      m_buffer += node->comment;
+      m_buffer += '}';
+      showNumber = true;
+    }
+    if (m_buffer.size() >= FLUSH_SIZE) {
+      out.write(m_buffer.data(), m_buffer.size());
+      m_buffer.clear();
+    }
+  }
+
+  if (m_format == FORMAT_ABAPRO) {
+    Settings::const_iterator result = game.attributes.find("Result");
+    const string& token = result != game.attributes.end() ? result->second : "*";
+    if (not lineStart) m_buffer += ' ';
+    m_buffer += IsResult(token.data(), token.size()) ? token : string("*");
+  }
+  m_buffer += "\n\n"; // A blank line ends the game
+  out.write(m_buffer.data(), m_buffer.size());
+}
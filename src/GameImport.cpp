@@ -0,0 +1,299 @@
+/** @file GameImport.cpp
+
+  This library is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#include "GameImport.hpp"
+
+//// Headers ///////////////////////////////////////////////////
+
+#include "config.h"
+
+#define DEB1
+#include "Trace.hpp"
+#define TRACE1(x) // TRACE(x)
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+
+#ifdef HAVE_OPENDIR
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+#include "MappedFile.hpp"
+#include "Persistence.hpp"
+#include "ThreadPool.hpp"
+
+using namespace std;
+using namespace Haliotis;
+
+//// Shared state of an import /////////////////////////////////
+
+namespace {
+
+/** Games filled by a worker. The ImportedGame objects are kept when the
+  batch is reused, so their Game can be reused too. */
+struct Batch {
+  vector<ImportedGame*> games;
+  size_t used;
+  Batch() : used(0) {}
+  ~Batch() {
+    for (size_t i = 0; i < games.size(); i++) delete games[i];
+  }
+  ImportedGame& Next() {
+    if (used == games.size()) games.push_back(new ImportedGame());
+    return *games[used];
+  }
+};
+
+/** Batches and file results on their way from the workers to the thread
+  calling the listener. A worker waits in Deliver() while maxReady
+  batches are waiting. */
+struct ImportQueue {
+  mutex lock;
+  condition_variable changed;
+  deque<Batch*> ready;
+  deque<ImportFileResult> results;
+  vector<Batch*> spare;
+  size_t maxReady;
+  size_t filesLeft;
+  size_t batches; //< All batches ever allocated
+
+  ImportQueue(size_t maxReady, size_t files)
+  : maxReady(maxReady), filesLeft(files), batches(0) {}
+  ~ImportQueue() {
+    for (size_t i = 0; i < ready.size(); i++) delete ready[i];
+    for (size_t i = 0; i < spare.size(); i++) delete spare[i];
+  }
+
+  Batch* GetBatch() {
+    lock_guard<mutex> guard(lock);
+    if (spare.empty()) {
+      batches++;
+      return new Batch();
+    }
+    Batch* batch = spare.back();
+    spare.pop_back();
+    return batch;
+  }
+  void Deliver(Batch* batch) {
+    unique_lock<mutex> guard(lock);
+    while (ready.size() >= maxReady) changed.wait(guard);
+    ready.push_back(batch);
+    changed.notify_all();
+  }
+  void FileDone(const ImportFileResult& result) {
+    lock_guard<mutex> guard(lock);
+    results.push_back(result);
+    filesLeft--;
+    changed.notify_all();
+  }
+};
+
+} // namespace
+
+static const char* SkipBlank(const char* p, const char* end) {
+  while (p < end and isspace((unsigned char)*p)) p++;
+  return p;
+}
+
+/** Find the next line starting with '[' */
+static const char* NextGame(const char* p, const char* end) {
+  while (p < end) {
+    p = (const char*)memchr(p, '\n', end - p);
+    if (p == 0) return end;
+    if (++p < end and *p == '[') return p;
+  }
+  return end;
+}
+
+/** Read all games of one file. Runs on a worker. */
+static void ImportFile(size_t fileNo, const string& filename,
+  size_t batchSize, ImportQueue& queue)
+{
+  ImportFileResult result;
+  result.filename = filename;
+  MappedFile file;
+  if (not file.Open(filename)) {
+    result.errors = 1;
+    result.error = "cannot open file";
+    queue.FileDone(result);
+    return;
+  }
+  file.Advise(MappedFile::ACCESS_SEQUENTIAL);
+  result.bytes = file.Size();
+
+  AgParser parser;
+  Batch* batch = queue.GetBatch();
+  const char* begin = file.Data();
+  const char* end = begin + file.Size();
+  const char* p = SkipBlank(begin, end);
+  size_t number = 0;
+  while (p < end) {
+    ImportedGame& imported = batch->Next();
+    if (parser.Read(p, end, imported.game)) {
+      imported.file = fileNo;
+      imported.number = number;
+      batch->used++;
+      result.games++;
+      if (batch->used == batchSize) {
+        queue.Deliver(batch);
+        batch = queue.GetBatch();
+      }
+    }
+    else {
+      if (result.errors == 0) {
+        ostringstream msg;
+        msg << "game " << number + 1
+            << ": parse error at offset " << (p - begin);
+        result.error = msg.str();
+      }
+      result.errors++;
+      p = NextGame(p, end);
+    }
+    number++;
+    p = SkipBlank(p, end);
+  }
+
+  if (batch->used > 0) {
+    queue.Deliver(batch);
+  }
+  else {
+    lock_guard<mutex> guard(queue.lock);
+    queue.spare.push_back(batch);
+  }
+  TRACE1("ImportFile " << filename << ": " << result.games << " games");
+  queue.FileDone(result);
+}
+
+//// GameImporter //////////////////////////////////////////////
+
+GameImporter::GameImporter(unsigned threads, size_t batchSize)
+: m_threads(threads)
+, m_batchSize(batchSize > 0 ? batchSize : 1)
+{
+}
+
+void GameImporter::AddFile(const string& filename)
+{
+  m_files.push_back(filename);
+}
+
+static bool HasExtension(const string& name, const string& extension)
+{
+  if (name.size() < extension.size()) return false;
+  for (size_t i = 0; i < extension.size(); i++) {
+    char a = name[name.size() - extension.size() + i];
+    if (tolower((unsigned char)a) != tolower((unsigned char)extension[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool GameImporter::AddDirectory(const string& dir, const string& extension)
+{
+#ifdef HAVE_OPENDIR
+  DIR* d = opendir(dir.c_str());
+  if (d == 0) {
+    TRACE("GameImporter::AddDirectory - cannot read " << dir);
+    return false;
+  }
+  vector<string> names;
+  while (dirent* entry = readdir(d)) {
+    if (strcmp(entry->d_name, ".") == 0 or strcmp(entry->d_name, "..") == 0) {
+      continue;
+    }
+    names.push_back(entry->d_name);
+  }
+  closedir(d);
+  sort(names.begin(), names.end());
+
+  for (size_t i = 0; i < names.size(); i++) {
+    string path = dir + "/" + names[i];
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) continue;
+    if (S_ISDIR(st.st_mode)) AddDirectory(path, extension);
+    else if (HasExtension(names[i], extension)) AddFile(path);
+  }
+  return true;
+#else
+  (void)extension;
+  TRACE("GameImporter::AddDirectory - not supported, cannot read " << dir);
+  return false;
+#endif
+}
+
+ImportStatistics GameImporter::Run(GameImportListener& listener)
+{
+  typedef chrono::steady_clock Clock;
+  const Clock::time_point start = Clock::now();
+  ImportStatistics stat;
+
+  ThreadPool pool(m_threads);
+  ImportQueue queue(2 * pool.Size(), m_files.size());
+  for (size_t i = 0; i < m_files.size(); i++) {
+    const string& filename = m_files[i];
+    const size_t batchSize = m_batchSize;
+    pool.Submit([i, &filename, batchSize, &queue]() {
+      ImportFile(i, filename, batchSize, queue);
+    });
+  }
+
+  // Deliver the results on this thread
+  vector<ImportedGame*> games;
+  unique_lock<mutex> guard(queue.lock);
+  while (true) {
+    if (not queue.ready.empty()) {
+      Batch* batch = queue.ready.front();
+      queue.ready.pop_front();
+      queue.changed.notify_all();
+      guard.unlock();
+      games.assign(batch->games.begin(), batch->games.begin() + batch->used);
+      listener.Games(games);
+      batch->used = 0;
+      guard.lock();
+      queue.spare.push_back(batch);
+    }
+    else if (not queue.results.empty()) {
+      ImportFileResult result = queue.results.front();
+      queue.results.pop_front();
+      guard.unlock();
+      stat.files++;
+      stat.games += result.games;
+      stat.errors += result.errors;
+      stat.bytes += result.bytes;
+      listener.FileDone(result);
+      guard.lock();
+    }
+    else if (queue.filesLeft == 0) {
+      break;
+    }
+    else {
+      queue.changed.wait(guard);
+    }
+  }
+  guard.unlock();
+  pool.Wait();
+
+  stat.seconds = chrono::duration<double>(Clock::now() - start).count();
+  TRACE1("GameImporter::Run used " << queue.batches << " batches");
+  return stat;
+}
@@ -0,0 +1,129 @@
+/** @file MappedFile.cpp
+
+  This library is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#include "MappedFile.hpp"
+
+#include "config.h"
+
+#define DEB1
+#include "Trace.hpp"
+
+#include <fstream>
+
+#ifdef HAVE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile()
+: m_data(0)
+, m_size(0)
+, m_open(false)
+, m_mapped(false)
+{
+}
+
+MappedFile::~MappedFile()
+{
+  Close();
+}
+
+#ifdef HAVE_MMAP
+
+bool MappedFile::Open(const std::string& filename)
+{
+  Close();
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    TRACE("MappedFile::Open - cannot open " << filename);
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    ::close(fd);
+    return false;
+  }
+  m_size = (size_t)st.st_size;
+  if (m_size > 0) {
+    void* p = mmap(0, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+      TRACE("MappedFile::Open - mmap failed for " << filename);
+      ::close(fd);
+      m_size = 0;
+      return false;
+    }
+    m_data = static_cast<const char*>(p);
+    m_mapped = true;
+  }
+  ::close(fd); // The mapping stays valid
+  m_open = true;
+  return true;
+}
+
+void MappedFile::Close()
+{
+  if (m_mapped) munmap(const_cast<char*>(m_data), m_size);
+  m_data = 0;
+  m_size = 0;
+  m_open = false;
+  m_mapped = false;
+}
+
+#else
+
+bool MappedFile::Open(const std::string& filename)
+{
+  Close();
+  std::ifstream in(filename.c_str(), std::ios::binary);
+  if (not in) {
+    TRACE("MappedFile::Open - cannot open " << filename);
+    return false;
+  }
+  in.seekg(0, std::ios::end);
+  m_buffer.resize((size_t)in.tellg());
+  in.seekg(0);
+  if (not m_buffer.empty()) in.read(&m_buffer[0], m_buffer.size());
+  if (not in) return false;
+  m_data = m_buffer.empty() ? 0 : &m_buffer[0];
+  m_size = m_buffer.size();
+  m_open = true;
+  return true;
+}
+
+void MappedFile::Close()
+{
+  std::vector<char>().swap(m_buffer);
+  m_data = 0;
+  m_size = 0;
+  m_open = false;
+}
+
+#endif
+
+void MappedFile::Advise(Access access) const
+{
+#ifdef HAVE_MADVISE
+  if (not m_mapped) return;
+  int advice = MADV_NORMAL;
+  if (access == ACCESS_SEQUENTIAL) advice = MADV_SEQUENTIAL;
+  if (access == ACCESS_RANDOM) advice = MADV_RANDOM;
+  madvise(const_cast<char*>(m_data), m_size, advice);
+#else
+  (void)access;
+#endif
+}
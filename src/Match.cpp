@@ -0,0 +1,480 @@
+/** @file Match.cpp
+
+  This library is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#include "Match.hpp"
+
+//// Headers ///////////////////////////////////////////////////
+
+#include "config.h"
+
+#define DEB1
+#include "Trace.hpp"
+#define TRACE1(x) // TRACE(x)
+
+#include <chrono>
+#include <cmath>
+#include <map>
+#include <sstream>
+
+#include "GameFormats.hpp"
+#include "Persistence.hpp"
+#include "ThreadPool.hpp"
+
+using namespace std;
+using namespace Haliotis;
+
+typedef chrono::steady_clock Clock;
+
+static long long MillisecondsSince(Clock::time_point start)
+{
+  return chrono::duration_cast<chrono::milliseconds>(Clock::now() - start).count();
+}
+
+////////////////////////////////////////////////////////////////
+//
+//  Start layouts
+//
+
+bool StartLayout(const string& name, Board2D& board)
+{
+  if (name == "Standard") board.SetUpStartPos();
+  else if (name == "BelgianDaisy") board.SetUp(BelgianDaisy);
+  else if (name == "GermanDaisy") board.SetUp(GermanDaisy);
+  else if (name == "SwissDaisy") board.SetUp(SwissDaisy);
+  else if (name == "DutchDaisy") board.SetUp(DutchDaisy);
+  else return false;
+  return true;
+}
+
+vector<string> StartLayoutNames()
+{
+  vector<string> names;
+  names.push_back("Standard");
+  names.push_back("BelgianDaisy");
+  names.push_back("GermanDaisy");
+  names.push_back("SwissDaisy");
+  names.push_back("DutchDaisy");
+  return names;
+}
+
+////////////////////////////////////////////////////////////////
+//
+//  AepProcessPlayer
+//
+
+AepProcessPlayer::AepProcessPlayer(const string& command, const OptionList& options)
+: m_command(command)
+, m_options(options)
+{
+}
+
+string AepProcessPlayer::Name() const
+{
+  return m_name.empty() ? m_command : m_name;
+}
+
+bool AepProcessPlayer::WaitReady()
+{
+  if (not m_process.WriteLine("isready")) return false;
+  const Clock::time_point start = Clock::now();
+  string line;
+  while (m_process.ReadLine(line, READY_TIMEOUT - MillisecondsSince(start))) {
+    if (line == "readyok") return true;
+  }
+  return false;
+}
+
+bool AepProcessPlayer::Start()
+{
+  if (not m_process.Start(m_command)) {
+    APP_ERROR("Cannot start engine: " << m_command);
+    return false;
+  }
+  // The engine lists its name and options after "aep", and ends with readyok
+  if (not m_process.WriteLine("aep")) return false;
+  const Clock::time_point start = Clock::now();
+  string line;
+  for (;;) {
+    if (not m_process.ReadLine(line, READY_TIMEOUT - MillisecondsSince(start))) {
+      TRACE("AepProcessPlayer - no reply to aep from " << m_command);
+      m_process.Stop(0);
+      return false;
+    }
+    if (line.compare(0, 8, "id name ") == 0) m_name = line.substr(8);
+    else if (line == "readyok") break;
+  }
+  for (size_t i = 0; i < m_options.size(); i++) {
+    m_process.WriteLine("setoption name " + m_options[i].first
+      + " value " + m_options[i].second);
+  }
+  return true;
+}
+
+bool AepProcessPlayer::NewGame()
+{
+  if (not m_process.Running() and not Start()) return false;
+  if (WaitReady()) return true;
+  TRACE("AepProcessPlayer - not ready: " << m_command);
+  m_process.Stop(0);
+  return false;
+}
+
+MatchMoveStatus AepProcessPlayer::GetMove(const Game& game,
+  const MatchClock& clock, Board2D::Move& move)
+{
+  if (not m_process.Running()) return MATCH_MOVE_CRASHED;
+  // A bare list of fields is read with the wrong side to move, so the
+  // start position is sent with its side to move
+  string position = "position abp " + apf(game.StartPos());
+  if (game.CurrentBoardNumber() > 0) position += " moves " + MoveList(game);
+  ostringstream go;
+  long long timeout;
+  if (clock.moveTime >= 0) {
+    go << "go movetime " << clock.moveTime;
+    timeout = clock.moveTime;
+  }
+  else {
+    go << "go time " << clock.time[0] << ' ' << clock.time[1]
+       << " inc " << clock.inc[0] << ' ' << clock.inc[1];
+    timeout = clock.time[game.CurrentBoard().GetTurn() - 1];
+  }
+  if (not m_process.WriteLine(position) or not m_process.WriteLine(go.str())) {
+    return MATCH_MOVE_CRASHED;
+  }
+  const Clock::time_point start = Clock::now();
+  string line;
+  for (;;) {
+    const long long left = timeout + TIME_MARGIN - MillisecondsSince(start);
+    if (not m_process.ReadLine(line, left)) {
+      if (not m_process.Running()) return MATCH_MOVE_CRASHED;
+      // Kill the engine, so its late move is not taken for the next one
+      TRACE("AepProcessPlayer - no move in time from " << Name());
+      m_process.Stop(0);
+      return MATCH_MOVE_TIMEOUT;
+    }
+    if (line.compare(0, 9, "bestmove ") == 0) break;
+  }
+  istringstream in(line.substr(9));
+  string text;
+  in >> text;
+  if (not parse_fftl(text, game.CurrentBoard(), move)) {
+    TRACE("AepProcessPlayer - cannot read move from " << Name() << ": " << line);
+    return MATCH_MOVE_ILLEGAL;
+  }
+  return MATCH_MOVE_OK;
+}
+
+////////////////////////////////////////////////////////////////
+//
+//  EnginePlayer
+//
+
+EnginePlayer::EnginePlayer(AbaloneEngineProtocol::Engine* engine)
+: m_engine(engine)
+, m_driver(*engine)
+{
+}
+
+EnginePlayer::~EnginePlayer()
+{
+  delete m_engine;
+}
+
+string EnginePlayer::Name() const
+{
+  return m_engine->GetName();
+}
+
+bool EnginePlayer::NewGame()
+{
+  return true;
+}
+
+MatchMoveStatus EnginePlayer::GetMove(const Game& game,
+  const MatchClock& clock, Board2D::Move& move)
+{
+  m_driver.SetPosition(game);
+  AbaloneEngineProtocol::GoParameters go;
+  for (int p = 0; p < 2; p++) {
+    go.time[p] = clock.time[p];
+    go.inc[p] = clock.inc[p];
+  }
+  go.moveTime = clock.moveTime;
+  move = m_driver.Go(go);
+  return MATCH_MOVE_OK;
+}
+
+////////////////////////////////////////////////////////////////
+//
+//  MatchStatistics
+//
+
+/// Expected score of an Elo difference
+static double ExpectedScore(double elo)
+{
+  return 1 / (1 + pow(10.0, -elo / 400));
+}
+
+static double EloOfScore(double score)
+{
+  return -400 * log10(1 / score - 1);
+}
+
+double MatchStatistics::Score() const
+{
+  const unsigned n = Games();
+  return n == 0 ? 0.5 : (wins + 0.5 * draws) / n;
+}
+
+/// Variance of the score of one game, with the results given
+static double ScoreVariance(double wins, double draws, double losses)
+{
+  const double n = wins + draws + losses;
+  const double s = (wins + 0.5 * draws) / n;
+  return (wins * (1 - s) * (1 - s) + draws * (0.5 - s) * (0.5 - s)
+    + losses * s * s) / n;
+}
+
+/** Variance of the score of one game. When all games have the same result
+  it is 0, then half a win and half a loss are added, as Elo() takes half a
+  game less for a score of 0 or 1. */
+static double ScoreVariance(const MatchStatistics& stats)
+{
+  const double variance = ScoreVariance(stats.wins, stats.draws, stats.losses);
+  if (variance > 0) return variance;
+  return ScoreVariance(stats.wins + 0.5, stats.draws, stats.losses + 0.5);
+}
+
+double MatchStatistics::Elo(double* margin) const
+{
+  const unsigned n = Games();
+  if (margin) *margin = 0;
+  if (n == 0) return 0;
+  // A score of 0 or 1 has an infinite Elo; take half a game less
+  const double bound = 0.5 / n;
+  const double s = min(max(Score(), bound), 1 - bound);
+  if (margin) {
+    const double deviation = 1.96 * sqrt(ScoreVariance(*this) / n);
+    const double low = max(s - deviation, bound);
+    const double high = min(s + deviation, 1 - bound);
+    *margin = (EloOfScore(high) - EloOfScore(low)) / 2;
+  }
+  return EloOfScore(s);
+}
+
+double MatchStatistics::LLR(double elo0, double elo1) const
+{
+  const unsigned n = Games();
+  if (n == 0) return 0;
+  const double variance = ScoreVariance(*this);
+  const double s0 = ExpectedScore(elo0);
+  const double s1 = ExpectedScore(elo1);
+  return n * (s1 - s0) * (2 * Score() - s0 - s1) / (2 * variance);
+}
+
+////////////////////////////////////////////////////////////////
+//
+//  Match
+//
+
+Match::Match(const MatchOptions& options, PlayerFactory first, PlayerFactory second)
+: m_options(options)
+, m_first(first)
+, m_second(second)
+, m_output(0)
+, m_listener(0)
+, m_stop(false)
+, m_sprt(0)
+{
+  if (m_options.concurrency == 0) m_options.concurrency = 1;
+  if (m_options.layouts.empty()) m_options.layouts.push_back("Standard");
+}
+
+Match::~Match()
+{
+  for (size_t i = 0; i < m_players.size(); i++) {
+    delete m_players[i].first;
+    delete m_players[i].second;
+  }
+}
+
+MatchStatistics Match::Statistics() const
+{
+  lock_guard<mutex> lock(m_mutex);
+  return m_stats;
+}
+
+int Match::SprtResult() const
+{
+  lock_guard<mutex> lock(m_mutex);
+  return m_sprt;
+}
+
+bool Match::Run(MatchListener& listener)
+{
+  Board2D board;
+  for (size_t i = 0; i < m_options.layouts.size(); i++) {
+    if (not StartLayout(m_options.layouts[i], board)) {
+      APP_ERROR("Unknown start layout: " << m_options.layouts[i]);
+      return false;
+    }
+  }
+  m_listener = &listener;
+  m_stop.store(false);
+  // Players are made here, so the factories are only called by one thread
+  ThreadPool pool(m_options.concurrency);
+  while (m_players.size() < pool.Size()) {
+    m_players.push_back(PlayerPair(m_first(), m_second()));
+  }
+  const unsigned games = (m_options.games + 1) / 2 * 2;
+  for (unsigned i = 0; i < games; i++) {
+    pool.Submit([this, i, &pool]() {
+      if (m_stop.load()) return;
+      PlayGame(i, m_players[pool.WorkerIndex()]);
+    });
+  }
+  pool.Wait();
+  m_listener = 0;
+  return true;
+}
+
+/** Game i is played from layout i/2, and the first engine moves first
+  in the even games */
+void Match::PlayGame(unsigned i, PlayerPair& players)
+{
+  MatchGame result;
+  result.number = i + 1;
+  result.layout = m_options.layouts[(i / 2) % m_options.layouts.size()];
+  result.firstIsWhite = i % 2 == 0;
+  if (result.firstIsWhite) Play(result, players.first, players.second);
+  else Play(result, players.second, players.first);
+  Finish(result);
+}
+
+void Match::Play(MatchGame& result, MatchPlayer* white, MatchPlayer* black)
+{
+  Board2D start;
+  StartLayout(result.layout, start);
+  Game& game = result.game;
+  game.RestartFrom(start);
+  result.winner = 0;
+  result.reason = "maximum length";
+
+  MatchPlayer* players[2] = { white, black };
+  for (int p = 0; p < 2; p++) {
+    if (not players[p]->NewGame()) {
+      result.winner = 2 - p;
+      result.reason = players[p]->Name() + " does not start";
+      break;
+    }
+  }
+  const MatchTimeControl& tc = m_options.timeControl;
+  MatchClock clock;
+  clock.moveTime = tc.moveTime;
+  for (int p = 0; p < 2; p++) {
+    clock.time[p] = tc.moveTime >= 0 ? -1 : tc.base;
+    clock.inc[p] = tc.moveTime >= 0 ? -1 : tc.inc;
+  }
+  map<unsigned long long, int> seen;
+  seen[start.Hash64()] = 1;
+  for (int ply = 0; result.winner == 0 and ply < m_options.maxPlies; ply++) {
+    const Board2D& board = game.CurrentBoard();
+    const int player = board.GetTurn();
+    MatchPlayer* mover = players[player - 1];
+    const int other = 3 - player;
+    Board2D::Move move;
+    const Clock::time_point started = Clock::now();
+    const MatchMoveStatus status = mover->GetMove(game, clock, move);
+    const long long used = MillisecondsSince(started);
+    if (status != MATCH_MOVE_OK) {
+      result.winner = other;
+      result.reason = mover->Name()
+        + (status == MATCH_MOVE_TIMEOUT ? " loses on time"
+          : status == MATCH_MOVE_ILLEGAL ? " makes an illegal move"
+          : " crashed");
+      break;
+    }
+    if (clock.moveTime < 0) {
+      clock.time[player - 1] -= used;
+      if (clock.time[player - 1] < -AepProcessPlayer::TIME_MARGIN) {
+        result.winner = other;
+        result.reason = mover->Name() + " loses on time";
+        break;
+      }
+      clock.time[player - 1] = max(clock.time[player - 1], 0LL) + clock.inc[player - 1];
+    }
+    // The move must give one of the positions of the legal moves
+    Board2D after = board;
+    bool legal = after.DoMove(move) == 0;
+    if (legal) {
+      legal = false;
+      const unsigned long long hash = after.Hash64();
+      for (auto& m : board.AllMoves()) {
+        if (m.board.Hash64() == hash) {
+          legal = true;
+          break;
+        }
+      }
+    }
+    if (not legal or game.DoMove(move) != 0) {
+      result.winner = other;
+      result.reason = mover->Name() + " makes an illegal move";
+      break;
+    }
+    const Board2D& now = game.CurrentBoard();
+    if (now.OutOfBoard(true) >= 6) {
+      result.winner = 2;
+      result.reason = "six marbles pushed off";
+    }
+    else if (now.OutOfBoard(false) >= 6) {
+      result.winner = 1;
+      result.reason = "six marbles pushed off";
+    }
+    else if (++seen[now.Hash64()] >= 3) {
+      result.reason = "threefold repetition";
+      break;
+    }
+  }
+
+  Settings& att = game.attributes;
+  att["Event"] = "abmatch";
+  att["Round"] = to_string(result.number);
+  att["White"] = white->Name();
+  att["Black"] = black->Name();
+  att["Result"] = result.winner == 1 ? "1-0" : result.winner == 2 ? "0-1" : "1/2-1/2";
+  att["Termination"] = result.reason;
+  att["Layout"] = result.layout;
+}
+
+void Match::Finish(const MatchGame& result)
+{
+  lock_guard<mutex> lock(m_mutex);
+  if (result.winner == 0) m_stats.draws++;
+  else if ((result.winner == 1) == result.firstIsWhite) m_stats.wins++;
+  else m_stats.losses++;
+  if (m_output) {
+    GameFormatWriter writer(FORMAT_AG);
+    writer.Write(*m_output, result.game);
+    m_output->flush();
+  }
+  if (m_options.sprt and m_sprt == 0) {
+    const double llr = m_stats.LLR(m_options.elo0, m_options.elo1);
+    if (llr >= log((1 - m_options.beta) / m_options.alpha)) m_sprt = 1;
+    else if (llr <= log(m_options.beta / (1 - m_options.alpha))) m_sprt = -1;
+    if (m_sprt != 0) m_stop.store(true);
+  }
+  m_listener->GameDone(result, m_stats);
+}
@@ -0,0 +1,342 @@
+/** @file OpeningBook.cpp
+
+  This library is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#include "OpeningBook.hpp"
+
+//// Headers ///////////////////////////////////////////////////
+
+#include "config.h"
+
+#define DEB1
+#include "Trace.hpp"
+#define TRACE1(x) // TRACE(x)
+
+#include <algorithm>
+#include <cstring>
+
+#include "PositionDataset.hpp"
+
+using namespace std;
+using namespace Haliotis;
+
+static const char BOOK_MAGIC[4] = { 'A','B','O','B' };
+static const unsigned char BOOK_VERSION = 1;
+static const size_t HEADER_SIZE = 24;
+static const size_t ENTRY_SIZE = 32;
+static const size_t MOVE_SIZE = 8;
+static const int SYMMETRIES = 12;
+
+static void PutU16(string& out, unsigned value) {
+  out += (char)(value & 0xFF);
+  out += (char)((value >> 8) & 0xFF);
+}
+
+static void PutU32(string& out, unsigned long value) {
+  for (int i=0; i<4; i++) out += (char)((value >> (8*i)) & 0xFF);
+}
+
+static void PutU64(string& out, unsigned long long value) {
+  for (int i=0; i<8; i++) out += (char)((value >> (8*i)) & 0xFF);
+}
+
+static unsigned GetU16(const char* data) {
+  const unsigned char* p = (const unsigned char*)data;
+  return p[0] | p[1] << 8;
+}
+
+static unsigned long GetU32(const char* data) {
+  const unsigned char* p = (const unsigned char*)data;
+  return p[0] | p[1] << 8 | p[2] << 16 | (unsigned long)p[3] << 24;
+}
+
+static unsigned long long GetU64(const char* data) {
+  unsigned long long value = 0;
+  for (int i=7; i>=0; i--) value = value << 8 | (unsigned char)data[i];
+  return value;
+}
+
+//// Symmetry //////////////////////////////////////////////////
+
+/* With the centre of the board at (0,0), q = x-4 and r = y-4, the board
+  is rotated 60 degrees by (q,r) -> (-r,q+r), which turns direction d into
+  d+1, and mirrored by (q,r) -> (r,q), which turns d into 1-d. */
+
+static Board2D::Pos TransformPos(Board2D::Pos pos, int symmetry)
+{
+  int q = pos.x - 4, r = pos.y - 4;
+  if (symmetry >= 6) swap(q, r);
+  for (int i = 0; i < symmetry % 6; i++) {
+    const int t = q;
+    q = -r;
+    r = t + r;
+  }
+  return Board2D::Pos(q + 4, r + 4);
+}
+
+static Direction TransformDir(Direction dir, int symmetry)
+{
+  if (dir < 0) return dir;
+  if (symmetry >= 6) dir = (7 - dir) % 6;
+  return (dir + symmetry) % 6;
+}
+
+/** Where each field goes in each symmetry */
+struct SymmetryTable {
+  Board2D::Pos pos[SYMMETRIES][61];
+  SymmetryTable() {
+    for (int s = 0; s < SYMMETRIES; s++) {
+      for (int i = 0; i <= 60; i++) {
+        pos[s][i] = TransformPos(Board2D::Pos::FromIndex(i), s);
+        TRACE_ASSERT(pos[s][i].Valid());
+      }
+    }
+  }
+};
+
+static const SymmetryTable& GetSymmetryTable() {
+  static const SymmetryTable table;
+  return table;
+}
+
+unsigned long long BookHash(const Board2D& board, int* symmetry)
+{
+  const SymmetryTable& table = GetSymmetryTable();
+  unsigned long long best = board.Hash64();
+  int bestSymmetry = 0;
+  Board2D rotated = board;
+  for (int s = 1; s < SYMMETRIES; s++) {
+    Board2D::Pos from;
+    int i = 0;
+    for (from.Next(); from.Valid(); from.Next(), i++) {
+      const Board2D::Pos& to = table.pos[s][i];
+      rotated.field[to.x][to.y] = board.field[from.x][from.y];
+    }
+    const unsigned long long hash = rotated.Hash64();
+    if (hash < best) {
+      best = hash;
+      bestSymmetry = s;
+    }
+  }
+  if (symmetry != 0) *symmetry = bestSymmetry;
+  return best;
+}
+
+/** One of the ways to write a move, so that a move has one Pack() key.
+  The tail direction of a single marble is not used and is set to 0. A
+  line of marbles is given from the rear marble of an inline move, and
+  from the end with tail direction 0..2 of a broadside move. */
+static Board2D::Move Canonical(Board2D::Move move)
+{
+  if (move.tailCount == 1) {
+    move.tailDir = 0;
+  }
+  else if (Opposite(move.tailDir) == move.moveDir) {
+    move.head = move.FromLast();
+    move.tailDir = move.moveDir;
+  }
+  else if (move.tailDir != move.moveDir and move.tailDir >= 3) {
+    move.head = move.FromLast();
+    move.tailDir = Opposite(move.tailDir);
+  }
+  return move;
+}
+
+Board2D::Move BookTransform(const Board2D::Move& move, int symmetry, bool inverse)
+{
+  // A mirror is its own inverse
+  if (inverse and symmetry < 6) symmetry = (6 - symmetry) % 6;
+  Board2D::Move result = move;
+  result.head = TransformPos(move.head, symmetry);
+  result.tailDir = TransformDir(move.tailDir, symmetry);
+  result.moveDir = TransformDir(move.moveDir, symmetry);
+  return Canonical(result);
+}
+
+//// OpeningBookBuilder ////////////////////////////////////////
+
+OpeningBookBuilder::OpeningBookBuilder(const OpeningBookOptions& options)
+: m_options(options)
+{
+}
+
+void OpeningBookBuilder::Add(const Game& game)
+{
+  const DatasetResult result = GameResult(game);
+  Board2D board = game.StartPos();
+  int ply = 0;
+  for (auto& pos : game.MainLine()) {
+    if (ply++ >= m_options.maxPly) break;
+    int symmetry;
+    Node& node = m_positions[BookHash(board, &symmetry)];
+    node.games++;
+    const int player = board.GetTurn();
+    if (result == RESULT_DRAW) node.draws++;
+    else if (result == RESULT_FIRST_WINS) (player == 1 ? node.wins : node.losses)++;
+    else if (result == RESULT_SECOND_WINS) (player == 2 ? node.wins : node.losses)++;
+
+    const unsigned move = BookTransform(pos.node->move, symmetry).Pack();
+    size_t i = 0;
+    while (i < node.moves.size() and node.moves[i].first != move) i++;
+    if (i == node.moves.size()) node.moves.push_back(make_pair(move, 0u));
+    node.moves[i].second++;
+    board = pos.board;
+  }
+}
+
+static bool MorePlayed(const pair<unsigned, unsigned>& a, const pair<unsigned, unsigned>& b) {
+  return a.second > b.second;
+}
+
+size_t OpeningBookBuilder::Write(ostream& out) const
+{
+  vector<unsigned long long> hashes;
+  for (auto i = m_positions.begin(); i != m_positions.end(); ++i) {
+    if (i->second.games >= m_options.minGames) hashes.push_back(i->first);
+  }
+  sort(hashes.begin(), hashes.end());
+
+  string entries, moves;
+  unsigned long long moveCount = 0;
+  for (size_t i = 0; i < hashes.size(); i++) {
+    const Node& node = m_positions.find(hashes[i])->second;
+    vector<pair<unsigned, unsigned> > sorted = node.moves;
+    stable_sort(sorted.begin(), sorted.end(), MorePlayed);
+    PutU64(entries, hashes[i]);
+    PutU32(entries, node.wins);
+    PutU32(entries, node.draws);
+    PutU32(entries, node.losses);
+    PutU32(entries, (unsigned long)moveCount);
+    PutU32(entries, sorted.size());
+    PutU32(entries, 0);
+    for (size_t j = 0; j < sorted.size(); j++) {
+      PutU16(moves, sorted[j].first);
+      PutU16(moves, 0);
+      PutU32(moves, sorted[j].second);
+    }
+    moveCount += sorted.size();
+  }
+
+  string header(BOOK_MAGIC, sizeof(BOOK_MAGIC));
+  header += (char)BOOK_VERSION;
+  header.append(3, '\0');
+  PutU64(header, hashes.size());
+  PutU64(header, moveCount);
+  out.write(header.data(), header.size());
+  out.write(entries.data(), entries.size());
+  out.write(moves.data(), moves.size());
+  TRACE1("OpeningBookBuilder wrote " << hashes.size() << " positions");
+  return hashes.size();
+}
+
+//// OpeningBook ///////////////////////////////////////////////
+
+OpeningBook::OpeningBook()
+: m_positions(0)
+, m_moves(0)
+{
+}
+
+bool OpeningBook::Open(const string& filename)
+{
+  Close();
+  if (not m_file.Open(filename)) return false;
+  const char* data = m_file.Data();
+  if (m_file.Size() < HEADER_SIZE
+  or memcmp(data, BOOK_MAGIC, sizeof(BOOK_MAGIC)) != 0
+  or data[4] != BOOK_VERSION)
+  {
+    TRACE("OpeningBook - " << filename << " is not a book");
+    Close();
+    return false;
+  }
+  m_positions = GetU64(data + 8);
+  m_moves = GetU64(data + 16);
+  if ((m_file.Size() - HEADER_SIZE) / ENTRY_SIZE < m_positions
+  or m_file.Size() != HEADER_SIZE + m_positions * ENTRY_SIZE + m_moves * MOVE_SIZE)
+  {
+    TRACE("OpeningBook - " << filename << " has the wrong size");
+    Close();
+    return false;
+  }
+  m_file.Advise(MappedFile::ACCESS_RANDOM);
+  return true;
+}
+
+void OpeningBook::Close()
+{
+  m_file.Close();
+  m_positions = 0;
+  m_moves = 0;
+}
+
+bool OpeningBook::Find(const Board2D& board, BookPosition& position) const
+{
+  position.moves.clear();
+  if (m_positions == 0) return false;
+  int symmetry;
+  const unsigned long long hash = BookHash(board, &symmetry);
+
+  const char* entries = m_file.Data() + HEADER_SIZE;
+  unsigned long long low = 0, high = m_positions;
+  while (low < high) {
+    const unsigned long long middle = low + (high - low) / 2;
+    if (GetU64(entries + middle * ENTRY_SIZE) < hash) low = middle + 1;
+    else high = middle;
+  }
+  if (low == m_positions or GetU64(entries + low * ENTRY_SIZE) != hash) return false;
+
+  const char* entry = entries + low * ENTRY_SIZE;
+  position.wins = GetU32(entry + 8);
+  position.draws = GetU32(entry + 12);
+  position.losses = GetU32(entry + 16);
+  const unsigned long long first = GetU32(entry + 20);
+  const unsigned long long count = GetU32(entry + 24);
+  if (first + count > m_moves) {
+    TRACE("OpeningBook - corrupt entry for hash " << hash);
+    return false;
+  }
+  const char* moves = entries + m_positions * ENTRY_SIZE + first * MOVE_SIZE;
+  for (unsigned long long i = 0; i < count; i++) {
+    BookMove book;
+    const Board2D::Move stored = Board2D::Move::Unpack(GetU16(moves + i * MOVE_SIZE));
+    book.move = BookTransform(stored, symmetry, true);
+    book.count = GetU32(moves + i * MOVE_SIZE + 4);
+    Board2D after = board;
+    if (book.move.Valid() and after.DoMove(book.move) == 0) {
+      position.moves.push_back(book);
+    }
+  }
+  return true;
+}
+
+bool OpeningBook::ChooseMove(const Board2D& board, Board2D::Move& move,
+  mt19937_64& random) const
+{
+  BookPosition position;
+  if (not Find(board, position)) return false;
+  unsigned long long total = 0;
+  for (size_t i = 0; i < position.moves.size(); i++) total += position.moves[i].count;
+  if (total == 0) return false;
+  unsigned long long pick = random() % total;
+  for (size_t i = 0; i < position.moves.size(); i++) {
+    if (pick < position.moves[i].count) {
+      move = position.moves[i].move;
+      return true;
+    }
+    pick -= position.moves[i].count;
+  }
+  return false;
+}
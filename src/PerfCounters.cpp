@@ -0,0 +1,231 @@
+/** @file PerfCounters.cpp
+
+  This library is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#include "PerfCounters.hpp"
+
+//// Headers ///////////////////////////////////////////////////
+
+#include "config.h"
+
+#define DEB1
+#include "Trace.hpp"
+#define TRACE1(x) // TRACE(x)
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <sstream>
+
+using namespace std;
+
+const unsigned PerfCounters::MAX_SLOTS;
+
+static const size_t CACHE_LINE = 64;
+/// Bytes of the values of a thread, a whole number of cache lines
+static const size_t BLOCK_SIZE =
+  (PerfCounters::MAX_SLOTS * sizeof(PerfValue) + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+
+PERF_THREAD_LOCAL PerfValue* perfThreadValues = 0;
+
+/** Hands the values of a thread back when it exits */
+struct PerfThreadOwner {
+  PerfValue* values;
+  PerfThreadOwner() : values(0) {}
+  ~PerfThreadOwner() {
+    perfThreadValues = 0;
+    if (values) PerfCounters::GetInstance().ThreadDone(values);
+    values = 0;
+  }
+};
+static thread_local PerfThreadOwner threadOwner;
+
+PerfValue* PerfNewThreadValues()
+{
+  PerfValue* values = PerfCounters::GetInstance().NewThreadValues();
+  threadOwner.values = values;
+  perfThreadValues = values;
+  return values;
+}
+
+PerfCounter::PerfCounter(const char* name)
+: m_slot(PerfCounters::GetInstance().Register(name, 1, false))
+{
+}
+
+PerfTimer::PerfTimer(const char* name)
+: m_slot(PerfCounters::GetInstance().Register(name, 2, true))
+{
+}
+
+////////////////////////////////////////////////////////////////
+//
+//  PerfCounters
+//
+
+/// Never deleted, so that threads can count while static objects are destroyed
+PerfCounters& PerfCounters::GetInstance()
+{
+  static PerfCounters* instance = new PerfCounters;
+  return *instance;
+}
+
+PerfCounters::PerfCounters()
+: m_slots(0)
+, m_retired(MAX_SLOTS)
+, m_base(MAX_SLOTS)
+, m_startCycles(PerfCycles())
+, m_startTime(chrono::steady_clock::now())
+, m_interval(0)
+, m_exit(false)
+{
+}
+
+unsigned PerfCounters::Register(const char* name, unsigned size, bool timer)
+{
+  lock_guard<mutex> lock(m_mutex);
+  // The last slots are shared by those that do not fit, and not written
+  if (m_slots + size > MAX_SLOTS - 2) {
+    TRACE("PerfCounters::Register - no slot left for " << name);
+    return MAX_SLOTS - 2;
+  }
+  Entry entry;
+  entry.name = name;
+  entry.slot = m_slots;
+  entry.timer = timer;
+  m_entries.push_back(entry);
+  m_slots += size;
+  return entry.slot;
+}
+
+PerfValue* PerfCounters::NewThreadValues()
+{
+  // Aligned to a cache line, so that no other thread writes its lines.
+  // The pointer to free is kept in front of the values.
+  char* memory = new char[sizeof(char*) + BLOCK_SIZE + CACHE_LINE];
+  const size_t start = (size_t)(memory + sizeof(char*));
+  char* aligned = memory + sizeof(char*) + (CACHE_LINE - start % CACHE_LINE) % CACHE_LINE;
+  memcpy(aligned - sizeof(char*), &memory, sizeof(char*));
+  PerfValue* values = (PerfValue*)aligned;
+  for (unsigned i = 0; i < MAX_SLOTS; i++) new (&values[i]) PerfValue(0);
+  lock_guard<mutex> lock(m_mutex);
+  m_threads.push_back(values);
+  return values;
+}
+
+void PerfCounters::ThreadDone(PerfValue* values)
+{
+  {
+    lock_guard<mutex> lock(m_mutex);
+    for (unsigned i = 0; i < MAX_SLOTS; i++) m_retired[i] += values[i].load();
+    m_threads.erase(find(m_threads.begin(), m_threads.end(), values));
+  }
+  char* memory;
+  memcpy(&memory, (char*)values - sizeof(char*), sizeof(char*));
+  delete[] memory;
+}
+
+void PerfCounters::Totals(vector<unsigned long long>& totals) const
+{
+  totals = m_retired;
+  for (size_t t = 0; t < m_threads.size(); t++) {
+    for (unsigned i = 0; i < m_slots; i++) {
+      totals[i] += m_threads[t][i].load(memory_order_relaxed);
+    }
+  }
+  for (unsigned i = 0; i < m_slots; i++) totals[i] -= m_base[i];
+}
+
+void PerfCounters::Reset()
+{
+  lock_guard<mutex> lock(m_mutex);
+  vector<unsigned long long> totals;
+  Totals(totals);
+  for (unsigned i = 0; i < m_slots; i++) m_base[i] += totals[i];
+}
+
+void PerfCounters::GetConfiguration(Settings& settings) const
+{
+  lock_guard<mutex> lock(m_mutex);
+  vector<unsigned long long> totals;
+  Totals(totals);
+  // Cycles per ms since the start, when the cycles are from the cpu
+  const double ms = chrono::duration<double, milli>(
+    chrono::steady_clock::now() - m_startTime).count();
+  const double cyclesPerMs = ms > 0 ? (PerfCycles() - m_startCycles) / ms : 1;
+  Set(settings, "perf.interval", m_interval);
+  for (size_t i = 0; i < m_entries.size(); i++) {
+    const Entry& entry = m_entries[i];
+    const string key = "perf." + entry.name;
+    if (entry.timer) {
+      Set(settings, key + ".calls", totals[entry.slot + 1]);
+      Set(settings, key + ".ms", totals[entry.slot] / cyclesPerMs);
+    }
+    else {
+      Set(settings, key, totals[entry.slot]);
+    }
+  }
+}
+
+void PerfCounters::SetConfiguration(const Settings& settings)
+{
+  int interval = m_interval;
+  if (Get(settings, "perf.interval", interval)) SetInterval(max(interval, 0));
+}
+
+void PerfCounters::SetInterval(unsigned interval)
+{
+  unique_lock<mutex> lock(m_mutex);
+  m_interval = interval;
+  m_wake.notify_one();
+  if (interval == 0 or m_dumper.joinable()) return;
+  // Started once, and stopped at exit
+  m_dumper = thread(&PerfCounters::RunDumps, this);
+  atexit(&PerfCounters::Shutdown);
+}
+
+void PerfCounters::RunDumps()
+{
+  unique_lock<mutex> lock(m_mutex);
+  while (not m_exit) {
+    // Without an interval, wait until one is set
+    if (m_interval == 0) m_wake.wait(lock);
+    else if (m_wake.wait_for(lock, chrono::milliseconds(m_interval)) == cv_status::timeout) {
+      lock.unlock();
+      Settings settings;
+      GetConfiguration(settings);
+      ostringstream text;
+      text << "Performance counters";
+      for (Settings::const_iterator i = settings.begin(); i != settings.end(); i++) {
+        text << '\n' << i->first << '=' << i->second;
+      }
+      TRACE(text.str());
+      lock.lock();
+    }
+  }
+}
+
+/** Stop the dumps at exit */
+void PerfCounters::Shutdown()
+{
+  PerfCounters& counters = GetInstance();
+  {
+    lock_guard<mutex> lock(counters.m_mutex);
+    counters.m_exit = true;
+  }
+  counters.m_wake.notify_one();
+  if (counters.m_dumper.joinable()) counters.m_dumper.join();
+}
@@ -33,10 +33,13 @@
 #include <cppunit/ui/text/TestRunner.h>
 #endif
 
+#include <cstdio>
+#include <cstring>
 #include <iostream>
 using namespace std;
 
 #include "Board2D.hpp"
+#include "PerfCounters.hpp"
 
 //// interface /////////////////////////////////////////////////
 
@@ -536,7 +539,7 @@ void WriteAttribute(const string& key, const string& value, ostream& out)
 {
   out << '[' << key << ' ';
   WriteEscaped(value,out);
-  out << ']' << endl;
+  out << ']' << '\n';
 }
 
 void WriteAttributes(const Settings& att, ostream& out)
@@ -561,7 +564,7 @@ void WriteAttributes(const Settings& att, ostream& out)
   }
 
   // Print blank line (if any attributes were printed)
-  if (att.size() > 0) out << endl;
+  if (att.size() > 0) out << '\n';
 }
 
 // Convert Abalone standard coordinate to BoardPos=Board2D::Pos
@@ -573,33 +576,18 @@ bool parse_ab_pos(char row, char col, Board2D::Pos& bp) {
   return true;
 }
 
-/** convert a FFTL move to Board2D::Move.
-  @param board  Board before move is done
-  @param from_first  First marble to move
-  @param to_last  Destination of last player marble.
-    Note that some opponent marbles may also be moved, in which case this
-    is the first opponetn marble to push.
-  @param move  Resulting Board2D::Move
-  @return false, if it was not possible to do a valid move. */
-bool convert_ab_move(
-  const Board2D& board,
-  const Board2D::Pos from_first,
-  const Board2D::Pos to_last,
-  Board2D::Move& move)
+/** Find the shape of a FFTL move from the offset between from-first and
+  to-last. For short broadside moves moveDir is -2 and tailDir is the
+  left-most direction, since only the board can tell which way it goes.
+  @return false, if no move has this offset. */
+static bool fftl_shape(int dx, int dy, Board2D::Move& move)
 {
-  move.head = from_first;
-  int8 dx, dy;
-  dx = to_last.x - from_first.x;
-  dy = to_last.y - from_first.y;
-  if (not (-4 <= dx and dx <= 4 and -4 <= dy and dy <= 4)) {
-    TRACE("convert_ab_move dx,dy="<<dx<<","<<dy<<" -> invalid move");
-    return false;
-  }
+  if (not (-4 <= dx and dx <= 4 and -4 <= dy and dy <= 4)) return false;
 
   const int x = -1; // invalid move
   const int y = -2; // small broadside move
   // For small broadside moves, initialise tail with left-most direction
-  const int tailDir[9][9] = {
+  static const int tailDir[9][9] = {
   {x,x,x,x,x,x,x,x,x        },
   { x,x,x,x,4,4,5,5,x       },
   {  x,x,x,4,4,4,5,5,x      },
@@ -610,7 +598,7 @@ bool convert_ab_move(
   {       x,2,2,1,1,x,x,x,x },
   {        x,x,x,x,x,x,x,x,x}
   };
-  const int tailCount[9][9] = {
+  static const int tailCount[9][9] = {
   {x,x,x,x,x,x,x,x,x        },
   { x,x,x,x,3,3,3,3,x       },
   {  x,x,x,3,2,2,2,3,x      },
@@ -621,7 +609,7 @@ bool convert_ab_move(
   {       x,3,3,3,3,x,x,x,x },
   {        x,x,x,x,x,x,x,x,x}
   };
-  const int moveDir[9][9] = {
+  static const int moveDir[9][9] = {
   {x,x,x,x,x,x,x,x,x        },
   { x,x,x,x,4,5,4,5,x       },
   {  x,x,x,3,4,y,5,0,x      },
@@ -633,31 +621,54 @@ bool convert_ab_move(
   {        x,x,x,x,x,x,x,x,x}
   };
 
-
   move.tailDir   = tailDir  [dy+4][dx+4];
   move.tailCount = tailCount[dy+4][dx+4];
   move.moveDir   = moveDir  [dy+4][dx+4];
-  if (move.moveDir == -2) {
-    // short broadside move - must check board
-    Board2D::Pos p = move.head;
-    p.Step(move.tailDir);
-    if (board.At(p) != fEmpty) {
-      // Tail is to the left, movedir to the right
-      move.moveDir = Clockwise(move.tailDir);
-    }
-    else {
-      // movedir is to the left, tail is to the right
-      move.moveDir = move.tailDir;
-      move.tailDir = Clockwise(move.tailDir);
-    }
+  return move.tailDir != -1 and move.moveDir != -1;
+}
+
+/** Decide the direction of a short broadside move from the board */
+static void fftl_broadside(const Board2D& board, Board2D::Move& move)
+{
+  Board2D::Pos p = move.head;
+  p.Step(move.tailDir);
+  if (board.At(p) != fEmpty) {
+    // Tail is to the left, movedir to the right
+    move.moveDir = Clockwise(move.tailDir);
   }
-  if (not (move.tailDir != -1 and move.moveDir != -1)) {
-    TRACE("convert_ab_move "
-    <<"dx,dy="<<dx<<","<<dy<<" -> "
-    <<"tailDir="<<move.tailDir<<",moveDir="<<move.moveDir
-    <<" -> invalid move");
+  else {
+    // movedir is to the left, tail is to the right
+    move.moveDir = move.tailDir;
+    move.tailDir = Clockwise(move.tailDir);
+  }
+}
+
+/** convert a FFTL move to Board2D::Move.
+  @param board  Board before move is done
+  @param from_first  First marble to move
+  @param to_last  Destination of last player marble.
+    Note that some opponent marbles may also be moved, in which case this
+    is the first opponetn marble to push.
+  @param move  Resulting Board2D::Move
+  @return false, if it was not possible to do a valid move. */
+bool convert_ab_move(
+  const Board2D& board,
+  const Board2D::Pos from_first,
+  const Board2D::Pos to_last,
+  Board2D::Move& move)
+{
+  move.head = from_first;
+  int8 dx, dy;
+  dx = to_last.x - from_first.x;
+  dy = to_last.y - from_first.y;
+  if (not fftl_shape(dx, dy, move)) {
+    TRACE("convert_ab_move dx,dy="<<dx<<","<<dy<<" -> invalid move");
     return false;
   }
+  if (move.moveDir == -2) {
+    // short broadside move - must check board
+    fftl_broadside(board, move);
+  }
   // This should never happen. tailCount is -1 only when tailDir is -1
   TRACE_ASSERT_MSG(move.tailCount != -1, "convert_ab_move "
     <<"dx,dy="<<dx<<","<<dy<<" -> "
@@ -827,65 +838,365 @@ void AbaloneGameFormat_Read(istream& in, Game& game) {
 
   GameParser parser(in);
   parser.next_tok(); // get first token
+  if (parser.cur_tok() == "{") {
+    // Comment of the start position, written before the first move
+    parser.next_tok("}");
+    game.SetComment(parser.cur_tok());
+    parser.next_tok();
+  }
   AbaloneGameFormat_ReadGameTree(game, parser);
   // Rewind game to start
   game.UndoAllMoves();
 }
 
-void WriteMoveNumber(ostream& out, int ply, bool& show_move) {
-  if (!show_move) return;
-  int next_round = ply / 2 + 1;
-  out << next_round << ". ";
-  if (ply % 2 == 1) {
-    out << "- ";
+//// Fast .AG parser ///////////////////////////////////////////
+
+/** FFTL moves looked up by the index of from-first and to-last, see
+  Board2D::Pos::Index(). Short broadside moves have moveDir -2 and must be
+  resolved against the board. Positions are looked up by row and column
+  letter, so a move is converted without any arithmetic on the board. */
+struct FftlTable {
+  signed char pos[9][9];      //< Index of 'a'+row, '1'+col, -1 if invalid
+  Board2D::Move move[61][61]; //< tailDir is -1 if no such move
+  bool valid[61][61];
+
+  FftlTable() {
+    for (int row = 0; row < 9; row++) {
+      for (int col = 0; col < 9; col++) {
+        Board2D::Pos bp;
+        parse_ab_pos('a'+row, '1'+col, bp);
+        pos[row][col] = bp.Index();
+      }
+    }
+    for (int from = 0; from < 61; from++) {
+      for (int to = 0; to < 61; to++) {
+        Board2D::Pos ff = Board2D::Pos::FromIndex(from);
+        Board2D::Pos tl = Board2D::Pos::FromIndex(to);
+        Board2D::Move& m = move[from][to];
+        m.head = ff;
+        valid[from][to] = fftl_shape(tl.x - ff.x, tl.y - ff.y, m);
+      }
+    }
   }
-  show_move = false;
+};
+
+static const FftlTable& GetFftlTable() {
+  static const FftlTable table;
+  return table;
+}
+
+static inline bool IsAlnum(char c) {
+  return ('a'<=c and c<='z') or ('0'<=c and c<='9') or ('A'<=c and c<='Z');
 }
 
-void WriteMove(ostream& out, Move move) {
-  out << move;
+static inline const char* SkipSpace(const char* p, const char* end) {
+  while (p < end and IsSpace(*p)) p++;
+  return p;
+}
+
+/** Read one attribute line as ReadAttribute does.
+  @return 0 = success, 1 = no more attributes, 3 = parse error */
+static int ParseAttribute(const char*& p, const char* end,
+  string& key, string& value)
+{
+  while (p < end and (*p==' ' or *p=='\n' or *p=='\r' or *p=='\t')) p++;
+  if (p == end or *p != '[') return 1;
+  const char* eol = (const char*)memchr(p, '\n', end - p);
+  if (eol == 0) eol = end;
+  const char* line = p;
+  p = eol < end ? eol + 1 : end;
+
+  const char* k = line + 1;
+  while (k < eol and *k != ' ' and *k != '"') k++;
+  if (k == eol) return 3;
+  key.assign(line + 1, k);
+  while (k < eol and *k == ' ') k++;
+  if (k == eol or *k != '"') return 3;
+  value.clear();
+  for (k++; k < eol; k++) {
+    if (*k == '"') return 0;
+    if (*k == '\\' and k+1 < eol) k++;
+    value += *k;
+  }
+  return 3;
 }
 
-/** Write the rest of the game tree to the stream.
-  @param out  Stream to write to
-  @param game  Game to write. All moves from the current board are written, including their followers.
-  @param ply  Number of moves printed so far.
-  @param show_move
+/**
+  Read attribute lines from memory into att, see ReadAttributes.
+  @param data  Moved to the first line that is not an attribute
 */
-void AbaloneGameFormat_WriteGameTree(ostream& out, Game game, int ply=0, bool show_move=true) {
-  bool first_move = true;
-  while (game.MoreMovesToRedo()) {
-    if (!first_move) out << " ";
-    first_move = false;
-    if (ply % 2 == 0) show_move = true;
-    WriteMoveNumber(out, ply, show_move);
-    WriteMove(out, game.NextMove());
-    std::string comment = game.GetComment();
-    if (comment != "") {
-      out << " {" << comment << "}";
+void ReadAttributes(Settings& att, const char*& data, const char* end)
+{
+  string key, value;
+  const char* p = data;
+  const char* line = p;
+  while (ParseAttribute(p, end, key, value) == 0) {
+    att[key] = value;
+    line = p;
+  }
+  data = line;
+}
+
+/** Read the start position as Board2D::Read does */
+static bool ParseBoard(const char*& p, const char* end, Board2D& board)
+{
+  Board2D::Pos bp;
+  for (bp.Next(); bp.Valid(); bp.Next()) {
+    p = SkipSpace(p, end);
+    if (p == end) return false;
+    int player = *p++ - '0';
+    board.field[bp.x][bp.y] = (1 <= player and player <= 2) ? player : fEmpty;
+  }
+
+  p = SkipSpace(p, end);
+  const char* digits = p;
+  if (p < end and (*p == '+' or *p == '-')) p++;
+  int sideToMove = 0;
+  while (p < end and '0' <= *p and *p <= '9') sideToMove = 10*sideToMove + *p++ - '0';
+  if (p == digits or not ('0' <= p[-1] and p[-1] <= '9')) return false;
+  if (*digits == '-') sideToMove = -sideToMove;
+  board.whiteToMove = (sideToMove == fPieceWhite);
+
+  for (int i = 0; i < Board2D::PLAYERS; i++) {
+    p = SkipSpace(p, end);
+    const char* word = p;
+    while (p < end and not IsSpace(*p)) p++;
+    if (p == word) return false;
+    const int lost = (p - word > 2 ? word[2] : 0) - '0';
+    // Note: hardcoded to handle two players
+    if      (word[0]=='0'+fPieceWhite) board.SetOutOfBoard(true, lost);
+    else if (word[0]=='0'+fPieceBlack) board.SetOutOfBoard(false,lost);
+  }
+  return true;
+}
+
+/** Convert a 4 character FFTL move on board. */
+static bool ParseFftl(const char* s, const Board2D& board, Board2D::Move& move)
+{
+  const FftlTable& table = GetFftlTable();
+  const unsigned fr = s[0]-'a', fc = s[1]-'1', tr = s[2]-'a', tc = s[3]-'1';
+  if (fr >= 9 or fc >= 9 or tr >= 9 or tc >= 9) return false;
+  const int from = table.pos[fr][fc];
+  const int to = table.pos[tr][tc];
+  if (from < 0 or to < 0 or not table.valid[from][to]) return false;
+  move = table.move[from][to];
+  if (move.moveDir == -2) fftl_broadside(board, move);
+  return true;
+}
+
+/// Calls are games read, so with the bytes they give the throughput
+PERF_TIMER(parseTime, "parse.ag")
+PERF_COUNTER(parsedBytes, "parse.ag.bytes")
+
+bool AgParser::Read(const char*& data, const char* end, Game& game)
+{
+  PERF_SCOPE(parseTime);
+  const char* p = data;
+
+  // Attributes
+  m_attributes.clear();
+  while (ParseAttribute(p, end, m_key, m_value) == 0) {
+    m_attributes[m_key] = m_value;
+  }
+
+  // Start position
+  Board2D start;
+  if (not ParseBoard(p, end, start)) {
+    TRACE("AgParser::Read - no start position");
+    PERF_ADD(parsedBytes, p - data);
+    data = p;
+    return false;
+  }
+  game.RestartFrom(start);
+  game.attributes.swap(m_attributes);
+
+  // Game tree. The tree is built directly, so the cursor of the game does
+  // not have to be moved back and forth.
+  m_variations.clear();
+  State cur;
+  cur.node = game.Root();
+  cur.board = start;
+  cur.beforeKnown = false;
+  bool ok = true;
+  while (ok) {
+    p = SkipSpace(p, end);
+    if (p == end) break;
+    const char* tok = p;
+    if (*p == '[') break; // Next game
+    if (*p == '{') {
+      const char* close = (const char*)memchr(p, '}', end - p);
+      if (close == 0) {
+        TRACE("AgParser::Read - WARNING: Reached end without '}'");
+        close = end;
+      }
+      cur.node->comment.assign(p + 1, close);
+      p = close < end ? close + 1 : end;
+    }
+    else if (*p == '(') {
+      p++;
+      if (cur.node == game.Root()) ok = false;
+      else if (not cur.beforeKnown) {
+        // "((": the variation is an alternative to a move of a variation
+        cur.before = BoardAfter(cur.node->prev, start);
+        cur.beforeKnown = true;
+      }
+      m_variations.push_back(cur);
+      cur.node = cur.node->prev;
+      cur.board = cur.before;
+      cur.beforeKnown = false;
+    }
+    else if (*p == ')') {
+      p++;
+      if (m_variations.empty()) break; // End of game tree
+      cur = m_variations.back();
+      m_variations.pop_back();
+    }
+    else if (*p == '-') {
+      p++; // Place holder for white move in "1. - a1b2"
+    }
+    else {
+      bool number = true;
+      while (p < end and IsAlnum(*p)) {
+        if (*p < '0' or '9' < *p) number = false;
+        p++;
+      }
+      if (p == tok) {
+        ok = false;
+      }
+      else if (number) {
+        if (p < end and *p == '.') p++;
+      }
+      else {
+        Board2D::Move move;
+        ok = p - tok == 4 and ParseFftl(tok, cur.board, move);
+        if (ok) {
+          cur.before = cur.board;
+          cur.beforeKnown = true;
+          ok = cur.board.DoMove(move) == 0;
+        }
+        if (ok) cur.node = cur.node->GetNextNode(move);
+      }
     }
-    auto altMoves = game.AlternateMoves();
-    bool pv = true;
-    for (auto i = altMoves.begin(); i != altMoves.end(); i ++)
-    {
-      if (pv) { pv=false; continue; }
-      out << " (";
-      show_move = true;
-      WriteMoveNumber(out, ply, show_move);
-      WriteMove(out, *i);
-      game.RedoMove(*i);
-      ply ++;
-      if (ply % 2 == 0) show_move = true;
-      AbaloneGameFormat_WriteGameTree(out, game, ply, show_move);
-      ply --;
-      game.UndoMove();
-      out << ")";
+    if (not ok) {
+      TRACE("AgParser::Read - unexpected \"" << string(tok, p - tok + 1) << "\"");
+      p = tok;
     }
-    game.RedoMove();
-    ply ++;
+  }
+  PERF_ADD(parsedBytes, p - data);
+  data = p;
+  return ok and m_variations.empty();
+}
+
+bool AbaloneGameFormat_Read(const char* data, size_t size, Game& game)
+{
+  AgParser parser;
+  return parser.Read(data, data + size, game);
+}
+
+/** FFTL text of every move, indexed by Board2D::Move::Pack(), so writing a
+  move is a copy of a few characters. */
+struct FftlNames {
+  enum { MOVES = 1 << 14, LENGTH = 8 };
+  char name[MOVES][LENGTH]; //< Zero terminated
+
+  FftlNames() {
+    for (unsigned packed = 0; packed < MOVES; packed++) {
+      name[packed][0] = '\0';
+      Board2D::Move move = Board2D::Move::Unpack(packed);
+      if (not move.head.Valid()) continue;
+      ostringstream out;
+      out << move;
+      strncpy(name[packed], out.str().c_str(), LENGTH - 1);
+      name[packed][LENGTH - 1] = '\0';
+    }
+  }
+};
+
+static const FftlNames& GetFftlNames() {
+  static const FftlNames names;
+  return names;
+}
+
+/// Append the number of the move at ply, e.g. "3. " or "3. - "
+static void AppendMoveNumber(string& buffer, int ply) {
+  char number[16];
+  snprintf(number, sizeof(number), ply % 2 == 0 ? "%d. " : "%d. - ", ply/2 + 1);
+  buffer += number;
+}
+
+/** Append the move leading to node, with its comment */
+static void AppendMove(string& buffer, const GameTreeNode* node) {
+  buffer += GetFftlNames().name[node->move.Pack()];
+  if (not node->comment.empty()) {
+    buffer += " {";
+    buffer += node->comment;
+    buffer += '}';
   }
 }
 
+void AgWriter::Write(ostream& out, const Game& game)
+{
+  WriteAttributes(game.attributes, out);
+  game.StartPos().Write(out);
+
+  m_buffer.clear();
+  m_stack.clear();
+  const GameTreeNode* root = game.Root();
+  if (not root->comment.empty()) {
+    m_buffer += '{';
+    m_buffer += root->comment;
+    m_buffer += "} ";
+  }
+
+  // Walk the tree in the order it is written: the main move, then each
+  // alternative in parentheses with its line, then the rest of the main
+  // line. Frame f is the node whose children are being written.
+  Frame f = { root, 0, 0 };
+  bool showNumber = true; //< Number the move even if second player moves
+  bool lineStart = true;  //< No space before the next move
+  while (true) {
+    const vector<GameTreeNode*>& children = f.node->Children();
+    if (f.nextChild == 0) {
+      if (children.empty()) {
+        // End of line
+        if (m_stack.empty()) break;
+        m_buffer += ')';
+        f = m_stack.back();
+        m_stack.pop_back();
+        continue;
+      }
+      if (not lineStart) m_buffer += ' ';
+      if (f.ply % 2 == 0 or showNumber) AppendMoveNumber(m_buffer, f.ply);
+      AppendMove(m_buffer, children[0]);
+      lineStart = false;
+      f.nextChild = 1;
+    }
+    if (f.nextChild < children.size()) {
+      // Alternative move
+      const GameTreeNode* alternative = children[f.nextChild++];
+      m_buffer += " (";
+      AppendMoveNumber(m_buffer, f.ply);
+      AppendMove(m_buffer, alternative);
+      m_stack.push_back(f);
+      Frame line = { alternative, 0, f.ply + 1 };
+      f = line;
+      showNumber = false;
+      continue;
+    }
+    // Main line goes on
+    showNumber = children.size() > 1;
+    Frame next = { children[0], 0, f.ply + 1 };
+    f = next;
+
+    if (m_buffer.size() >= FLUSH_SIZE) {
+      out.write(m_buffer.data(), m_buffer.size());
+      m_buffer.clear();
+    }
+  }
+  m_buffer += '\n'; // extra newline to mark end of game
+  out.write(m_buffer.data(), m_buffer.size());
+}
+
 #ifdef HAVE_CPPUNIT
 
 class GameTreeNodeTest : public CppUnit::TestCase {
@@ -979,13 +1290,9 @@ CPPUNIT_TEST_SUITE_REGISTRATION( GameTreeNodeTest );
 
 #endif
 
-void AbaloneGameFormat_Write(ostream& out, const Game& const_game) {
-  WriteAttributes(const_game.attributes,out);
-  const_game.StartPos().Write(out);
-  Game game(const_game);
-  game.UndoAllMoves();
-  AbaloneGameFormat_WriteGameTree(out, game);
-  out << endl; // extra newline to mark end of game
+void AbaloneGameFormat_Write(ostream& out, const Game& game) {
+  AgWriter writer;
+  writer.Write(out, game);
 }
 
 
@@ -1034,6 +1341,11 @@ CPPUNIT_TEST_SUITE_REGISTRATION( APN_Test );
   @todo Move this function to abmove
 */
 string apf(const Game& game) {
+  return apf(game.board);
+}
+
+/** Build a string of a board using the AbalonePositionFormat. */
+string apf(const Board2D& board) {
   // Exploit that Board2D::Pos::Next() will run through positions in the same
   // order as is needed for apf. For safety I have added a TRACE_ASSERT that
   // will discover buffer overflows as result of a changed algorithm, but not
@@ -1045,14 +1357,14 @@ string apf(const Game& game) {
   unsigned i = 0;
   while (pos.Valid()) {
     if (pos.y != last_y) result[i++] = ' ';
-    switch (game.board.At(pos)) {
+    switch (board.At(pos)) {
       case 0: result[i++] = '.'; break;
       case 1: result[i++] = '1'; break;
       case 2: result[i++] = '2'; break;
       default:
         bool board_At_in_range = false;
         TRACE_ASSERT_MSG(board_At_in_range,
-          result << endl << i << endl << game.board.At(pos)
+          result << endl << i << endl << board.At(pos)
         );
     }
     last_y = pos.y;
@@ -1060,12 +1372,40 @@ string apf(const Game& game) {
     TRACE_ASSERT(i < result.size());
   }
   result[i++] = ' ';
-  result[i++] = '0' + game.board.GetTurn();
+  result[i++] = '0' + board.GetTurn();
   TRACE_ASSERT(i == result.size());
   return result;
   //return "22.11 222111 .22.11. ........ ......... ........ .11.22. 111222 11.22 1";
 }
 
+/** Parse a board in the AbalonePositionFormat, as written by apf(). The
+  marbles not on the board are counted as pushed off.
+  @return false if str is not a valid position */
+bool parse_apf(const string& str, Board2D& board) {
+  const int MARBLES = 14;
+  board.SetUpStartPos(); // clears the fields that are not on the board
+  int onBoard[3] = { 0, 0, 0 };
+  size_t i = 0;
+  Board2D::Pos pos;
+  for (pos.Next(); pos.Valid(); pos.Next()) {
+    while (i < str.size() and str[i] == ' ') i++;
+    if (i == str.size()) return false;
+    switch (str[i++]) {
+      case '.': board.field[pos.x][pos.y] = fEmpty; break;
+      case '1': board.field[pos.x][pos.y] = 1; onBoard[1]++; break;
+      case '2': board.field[pos.x][pos.y] = 2; onBoard[2]++; break;
+      default: return false;
+    }
+  }
+  while (i < str.size() and str[i] == ' ') i++;
+  if (i + 1 != str.size() or (str[i] != '1' and str[i] != '2')) return false;
+  board.SetTurn(str[i] - '0');
+  if (onBoard[1] > MARBLES or onBoard[2] > MARBLES) return false;
+  board.SetOutOfBoard(true, MARBLES - onBoard[fPieceWhite]);
+  board.SetOutOfBoard(false, MARBLES - onBoard[fPieceBlack]);
+  return true;
+}
+
 /** Print a move using the from-first-to-last notation
  @note  The notation used is selected in Board.cpp
 */
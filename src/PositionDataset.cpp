@@ -0,0 +1,358 @@
+/** @file PositionDataset.cpp
+
+  This library is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#include "PositionDataset.hpp"
+
+//// Headers ///////////////////////////////////////////////////
+
+#include "config.h"
+
+#define DEB1
+#include "Trace.hpp"
+#define TRACE1(x) // TRACE(x)
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+using namespace std;
+using namespace Haliotis;
+
+static const char DATASET_MAGIC[4] = { 'A','B','D','S' };
+static const unsigned char DATASET_VERSION = 1;
+static const size_t HEADER_SIZE = 8;
+static const size_t BLOCK_HEADER_SIZE = 12;
+enum { METHOD_STORED = 0, METHOD_ZLIB = 1 };
+/// Slots searched for a key by deduplication
+static const size_t SEEN_PROBES = 8;
+
+/// Marbles pushed off that end a game
+static const int MARBLES_TO_WIN = 6;
+
+static void PutU32(unsigned char* p, unsigned long value) {
+  for (int i=0; i<4; i++) p[i] = (unsigned char)(value >> (8*i));
+}
+
+static unsigned long GetU32(const unsigned char* p) {
+  return p[0] | p[1] << 8 | p[2] << 16 | (unsigned long)p[3] << 24;
+}
+
+//// Records ///////////////////////////////////////////////////
+
+DatasetResult GameResult(const Game& game)
+{
+  Settings::const_iterator result = game.attributes.find("Result");
+  if (result != game.attributes.end()) {
+    if (result->second == "1-0") return RESULT_FIRST_WINS;
+    if (result->second == "0-1") return RESULT_SECOND_WINS;
+    if (result->second == "1/2-1/2") return RESULT_DRAW;
+  }
+  Board2D last = game.StartPos();
+  for (auto& pos : game.MainLine()) last = pos.board;
+  if (last.OutOfBoard(true) >= MARBLES_TO_WIN) return RESULT_SECOND_WINS;
+  if (last.OutOfBoard(false) >= MARBLES_TO_WIN) return RESULT_FIRST_WINS;
+  return RESULT_UNKNOWN;
+}
+
+void PositionRecord::Set(const Board2D& board, const Board2D::Move& move,
+  int ply, DatasetResult result)
+{
+  board.PackFields(fields);
+  turn = (unsigned char)board.GetTurn();
+  off[0] = (unsigned char)board.OutOfBoard(true);
+  off[1] = (unsigned char)board.OutOfBoard(false);
+  this->result = (unsigned char)result;
+  this->move = move.Pack();
+  this->ply = ply < 0xFFFF ? ply : 0xFFFF;
+}
+
+void PositionRecord::GetBoard(Board2D& board) const
+{
+  board.UnpackFields(fields);
+  board.SetTurn(turn);
+  board.SetOutOfBoard(true, off[0]);
+  board.SetOutOfBoard(false, off[1]);
+}
+
+void PositionRecord::Encode(unsigned char data[SIZE]) const
+{
+  memcpy(data, fields, sizeof(fields));
+  unsigned char* p = data + sizeof(fields);
+  p[0] = turn;
+  p[1] = off[0];
+  p[2] = off[1];
+  p[3] = result;
+  p[4] = (unsigned char)move;
+  p[5] = (unsigned char)(move >> 8);
+  p[6] = (unsigned char)ply;
+  p[7] = (unsigned char)(ply >> 8);
+}
+
+void PositionRecord::Decode(const unsigned char data[SIZE])
+{
+  memcpy(fields, data, sizeof(fields));
+  const unsigned char* p = data + sizeof(fields);
+  turn = p[0];
+  off[0] = p[1];
+  off[1] = p[2];
+  result = p[3];
+  move = p[4] | p[5] << 8;
+  ply = p[6] | p[7] << 8;
+}
+
+//// PositionDatasetWriter /////////////////////////////////////
+
+PositionDatasetWriter::PositionDatasetWriter(const string& prefix,
+  const PositionDatasetOptions& options)
+: m_prefix(prefix)
+, m_options(options)
+, m_random(options.seed)
+, m_blockRecords(0)
+, m_shardRecords(0)
+, m_records(0)
+, m_duplicates(0)
+, m_ok(true)
+, m_closed(false)
+{
+  if (m_options.blockRecords == 0) m_options.blockRecords = 1;
+#ifndef HAVE_ZLIB
+  if (m_options.compress) {
+    TRACE("PositionDatasetWriter - zlib is not available, blocks are stored");
+    m_options.compress = false;
+  }
+#endif
+  m_shuffle.reserve(m_options.shuffleBuffer);
+  if (m_options.unique) {
+    size_t slots = SEEN_PROBES;
+    while (slots < m_options.uniqueLimit) slots *= 2;
+    m_seen.assign(slots, 0);
+  }
+}
+
+PositionDatasetWriter::~PositionDatasetWriter()
+{
+  Close();
+}
+
+void PositionDatasetWriter::Add(const Game& game)
+{
+  const DatasetResult result = GameResult(game);
+  Board2D board = game.StartPos();
+  PositionRecord record;
+  int ply = 0;
+  for (auto& pos : game.MainLine()) {
+    record.Set(board, pos.node->move, ply++, result);
+    Add(record, board.Hash64());
+    board = pos.board;
+  }
+}
+
+void PositionDatasetWriter::Add(const PositionRecord& record, unsigned long long hash)
+{
+  TRACE_ASSERT(not m_closed);
+  // Hash64() has only the fields and the turn, so add the marbles pushed off
+  const unsigned long long key =
+    hash ^ (record.off[0] | record.off[1] << 4) * 0x9E3779B97F4A7C15ULL;
+  if (m_options.unique and Seen(key)) {
+    m_duplicates++;
+    return;
+  }
+  m_records++;
+  if (m_options.shuffleBuffer == 0) {
+    Emit(record);
+  }
+  else if (m_shuffle.size() < m_options.shuffleBuffer) {
+    m_shuffle.push_back(record);
+  }
+  else {
+    // Write a random record and keep the new one in its place
+    size_t i = (size_t)(m_random() % m_shuffle.size());
+    Emit(m_shuffle[i]);
+    m_shuffle[i] = record;
+  }
+}
+
+bool PositionDatasetWriter::Seen(unsigned long long key)
+{
+  if (key == 0) key = 1; // 0 marks an empty slot
+  const size_t mask = m_seen.size() - 1;
+  const size_t first = (size_t)key & mask;
+  for (size_t i = 0; i < SEEN_PROBES; i++) {
+    unsigned long long& slot = m_seen[(first + i) & mask];
+    if (slot == key) return true;
+    if (slot == 0) {
+      slot = key;
+      return false;
+    }
+  }
+  // Table is full here, forget the key in the first slot
+  m_seen[first] = key;
+  return false;
+}
+
+bool PositionDatasetWriter::Close()
+{
+  if (m_closed) return m_ok;
+  shuffle(m_shuffle.begin(), m_shuffle.end(), m_random);
+  for (size_t i = 0; i < m_shuffle.size(); i++) Emit(m_shuffle[i]);
+  m_shuffle.clear();
+  CloseShard();
+  m_closed = true;
+  TRACE1("PositionDatasetWriter " << m_records << " records in "
+    << m_shards.size() << " shards");
+  return m_ok;
+}
+
+void PositionDatasetWriter::Emit(const PositionRecord& record)
+{
+  if (not m_out.is_open()) {
+    char number[16];
+    snprintf(number, sizeof(number), "-%05u.abd", (unsigned)m_shards.size());
+    const string name = m_prefix + number;
+    m_shards.push_back(name);
+    m_out.open(name.c_str(), ios::binary);
+    if (not m_out) {
+      TRACE("PositionDatasetWriter - cannot write " << name);
+      m_ok = false;
+    }
+    char header[HEADER_SIZE] = { 0 };
+    memcpy(header, DATASET_MAGIC, sizeof(DATASET_MAGIC));
+    header[4] = DATASET_VERSION;
+    header[5] = PositionRecord::SIZE;
+    m_out.write(header, sizeof(header));
+    m_shardRecords = 0;
+  }
+
+  unsigned char data[PositionRecord::SIZE];
+  record.Encode(data);
+  m_block.append((const char*)data, sizeof(data));
+  m_blockRecords++;
+  m_shardRecords++;
+  if (m_blockRecords == m_options.blockRecords) FlushBlock();
+  if (m_shardRecords == m_options.shardRecords) CloseShard();
+}
+
+void PositionDatasetWriter::FlushBlock()
+{
+  if (m_blockRecords == 0) return;
+  const string* stored = &m_block;
+  unsigned char method = METHOD_STORED;
+#ifdef HAVE_ZLIB
+  if (m_options.compress) {
+    uLongf size = compressBound(m_block.size());
+    m_compressed.resize(size);
+    if (compress2((Bytef*)&m_compressed[0], &size,
+      (const Bytef*)m_block.data(), m_block.size(), Z_DEFAULT_COMPRESSION) == Z_OK
+    and size < m_block.size())
+    {
+      m_compressed.resize(size);
+      stored = &m_compressed;
+      method = METHOD_ZLIB;
+    }
+  }
+#endif
+  unsigned char header[BLOCK_HEADER_SIZE] = { 0 };
+  PutU32(header, m_blockRecords);
+  PutU32(header + 4, stored->size());
+  header[8] = method;
+  m_out.write((const char*)header, sizeof(header));
+  m_out.write(stored->data(), stored->size());
+  m_block.clear();
+  m_blockRecords = 0;
+}
+
+void PositionDatasetWriter::CloseShard()
+{
+  if (not m_out.is_open()) return;
+  FlushBlock();
+  m_out.close();
+  if (m_out.fail()) {
+    TRACE("PositionDatasetWriter - cannot write " << m_shards.back());
+    m_ok = false;
+  }
+  m_out.clear();
+}
+
+//// PositionDatasetReader /////////////////////////////////////
+
+PositionDatasetReader::PositionDatasetReader()
+: m_next(0)
+, m_valid(false)
+{
+}
+
+bool PositionDatasetReader::Open(const string& filename)
+{
+  if (m_in.is_open()) m_in.close();
+  m_in.clear();
+  m_block.clear();
+  m_next = 0;
+  m_in.open(filename.c_str(), ios::binary);
+  char header[HEADER_SIZE];
+  m_in.read(header, sizeof(header));
+  m_valid = m_in and memcmp(header, DATASET_MAGIC, sizeof(DATASET_MAGIC)) == 0
+    and header[4] == DATASET_VERSION and header[5] == PositionRecord::SIZE;
+  if (not m_valid) TRACE("PositionDatasetReader - " << filename << " is not a dataset");
+  return m_valid;
+}
+
+bool PositionDatasetReader::Next(PositionRecord& record)
+{
+  if (not m_valid) return false;
+  if (m_next == m_block.size() and not ReadBlock()) return false;
+  record.Decode((const unsigned char*)m_block.data() + m_next);
+  m_next += PositionRecord::SIZE;
+  return true;
+}
+
+bool PositionDatasetReader::ReadBlock()
+{
+  unsigned char header[BLOCK_HEADER_SIZE];
+  m_in.read((char*)header, sizeof(header));
+  if (m_in.gcount() == 0) return false; // End of shard
+  const size_t records = GetU32(header);
+  const size_t size = GetU32(header + 4);
+  m_stored.resize(size);
+  if (size > 0) m_in.read(&m_stored[0], size);
+  m_valid = m_in and records > 0;
+  m_block.clear();
+  m_next = 0;
+  if (m_valid and header[8] == METHOD_STORED) {
+    m_block.swap(m_stored);
+  }
+#ifdef HAVE_ZLIB
+  else if (m_valid and header[8] == METHOD_ZLIB) {
+    m_block.resize(records * PositionRecord::SIZE);
+    uLongf length = m_block.size();
+    m_valid = uncompress((Bytef*)&m_block[0], &length,
+      (const Bytef*)m_stored.data(), size) == Z_OK
+      and length == m_block.size();
+  }
+#endif
+  else {
+    m_valid = false;
+  }
+  m_valid = m_valid and m_block.size() == records * PositionRecord::SIZE;
+  if (not m_valid) {
+    TRACE("PositionDatasetReader - corrupt block");
+    m_block.clear();
+  }
+  return m_valid;
+}
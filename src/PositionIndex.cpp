@@ -0,0 +1,296 @@
+/** @file PositionIndex.cpp
+
+  This library is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#include "PositionIndex.hpp"
+
+//// Headers ///////////////////////////////////////////////////
+
+#include "config.h"
+
+#define DEB1
+#include "Trace.hpp"
+#define TRACE1(x) // TRACE(x)
+
+#include <algorithm>
+#include <cstring>
+
+#include "ThreadPool.hpp"
+
+using namespace std;
+using namespace Haliotis;
+
+static const char INDEX_MAGIC[4] = { 'A','B','P','I' };
+static const unsigned char INDEX_VERSION = 1;
+static const size_t HEADER_SIZE = 48;
+static const size_t RECORD_SIZE = 16;
+static const size_t GAME_SIZE = 8;
+
+/// Largest ply stored in a record
+static const unsigned MAX_PLY = 0xFFFF;
+
+static void PutU16(string& out, unsigned value) {
+  out += (char)(value & 0xFF);
+  out += (char)((value >> 8) & 0xFF);
+}
+
+static void PutU32(string& out, unsigned long value) {
+  for (int i=0; i<4; i++) out += (char)((value >> (8*i)) & 0xFF);
+}
+
+static void PutU64(string& out, unsigned long long value) {
+  for (int i=0; i<8; i++) out += (char)((value >> (8*i)) & 0xFF);
+}
+
+static unsigned GetU16(const char* data) {
+  const unsigned char* p = (const unsigned char*)data;
+  return p[0] | p[1] << 8;
+}
+
+static unsigned long GetU32(const char* data) {
+  const unsigned char* p = (const unsigned char*)data;
+  return p[0] | p[1] << 8 | p[2] << 16 | (unsigned long)p[3] << 24;
+}
+
+static unsigned long long GetU64(const char* data) {
+  unsigned long long value = 0;
+  for (int i=7; i>=0; i--) value = value << 8 | (unsigned char)data[i];
+  return value;
+}
+
+//// PositionIndexBuilder //////////////////////////////////////
+
+PositionIndexBuilder::PositionIndexBuilder(unsigned threads)
+: m_threads(threads)
+, m_sorted(true)
+{
+}
+
+size_t PositionIndexBuilder::AddFile(const string& filename)
+{
+  m_files.push_back(filename);
+  return m_files.size() - 1;
+}
+
+void PositionIndexBuilder::Add(const Game& game, size_t file, size_t number)
+{
+  TRACE_ASSERT(file < m_files.size());
+  Record record;
+  record.game = (unsigned)m_games.size();
+  record.ply = 0;
+  record.hash = game.StartPos().Hash64();
+  m_records.push_back(record);
+  for (auto& pos : game.MainLine()) {
+    if (record.ply == MAX_PLY) break;
+    record.ply++;
+    record.hash = pos.board.Hash64();
+    m_records.push_back(record);
+  }
+  m_games.push_back(make_pair((unsigned)file, (unsigned)number));
+  m_sorted = false;
+}
+
+/** Sort records on a pool: each worker sorts a slice, and then pairs of
+  sorted runs are merged until one is left. */
+static void ParallelSort(vector<PositionIndexBuilder::Record>& records, unsigned threads)
+{
+  typedef PositionIndexBuilder::Record Record;
+  ThreadPool pool(threads);
+  const size_t slices = pool.Size();
+  if (slices <= 1 or records.size() < 2 * slices) {
+    sort(records.begin(), records.end());
+    return;
+  }
+
+  vector<size_t> bounds;
+  for (size_t i = 0; i <= slices; i++) bounds.push_back(records.size() * i / slices);
+  Record* data = &records[0];
+  for (size_t i = 0; i < slices; i++) {
+    Record* first = data + bounds[i];
+    Record* last = data + bounds[i+1];
+    pool.Submit([first, last]() { sort(first, last); });
+  }
+  pool.Wait();
+
+  while (bounds.size() > 2) {
+    vector<size_t> merged;
+    for (size_t i = 0; i + 2 < bounds.size(); i += 2) {
+      Record* first = data + bounds[i];
+      Record* middle = data + bounds[i+1];
+      Record* last = data + bounds[i+2];
+      pool.Submit([first, middle, last]() { inplace_merge(first, middle, last); });
+      merged.push_back(bounds[i]);
+    }
+    if (bounds.size() % 2 == 0) merged.push_back(bounds[bounds.size() - 2]);
+    merged.push_back(bounds.back());
+    pool.Wait();
+    bounds.swap(merged);
+  }
+}
+
+void PositionIndexBuilder::Write(ostream& out)
+{
+  if (not m_sorted) ParallelSort(m_records, m_threads);
+  m_sorted = true;
+
+  string buffer;
+  string names;
+  for (size_t i = 0; i < m_files.size(); i++) {
+    PutU32(names, m_files[i].size());
+    names += m_files[i];
+  }
+  const unsigned long long gamesOffset = HEADER_SIZE + m_records.size() * RECORD_SIZE;
+  const unsigned long long filesOffset = gamesOffset + m_games.size() * GAME_SIZE;
+  buffer.append(INDEX_MAGIC, sizeof(INDEX_MAGIC));
+  buffer += (char)INDEX_VERSION;
+  buffer.append(3, '\0');
+  PutU64(buffer, m_records.size());
+  PutU64(buffer, m_games.size());
+  PutU64(buffer, m_files.size());
+  PutU64(buffer, gamesOffset);
+  PutU64(buffer, filesOffset);
+
+  const size_t FLUSH_SIZE = 64 * 1024;
+  for (size_t i = 0; i < m_records.size(); i++) {
+    PutU64(buffer, m_records[i].hash);
+    PutU32(buffer, m_records[i].game);
+    PutU16(buffer, m_records[i].ply);
+    PutU16(buffer, 0);
+    if (buffer.size() >= FLUSH_SIZE) {
+      out.write(buffer.data(), buffer.size());
+      buffer.clear();
+    }
+  }
+  for (size_t i = 0; i < m_games.size(); i++) {
+    PutU32(buffer, m_games[i].first);
+    PutU32(buffer, m_games[i].second);
+  }
+  buffer += names;
+  out.write(buffer.data(), buffer.size());
+  TRACE1("PositionIndexBuilder wrote " << m_records.size() << " positions");
+}
+
+//// PositionIndex /////////////////////////////////////////////
+
+PositionIndex::PositionIndex()
+: m_records(0)
+, m_games(0)
+, m_gamesOffset(0)
+{
+}
+
+bool PositionIndex::Open(const string& filename)
+{
+  Close();
+  if (not m_file.Open(filename)) return false;
+  const char* data = m_file.Data();
+  const unsigned long long size = m_file.Size();
+  bool ok = size >= HEADER_SIZE
+    and memcmp(data, INDEX_MAGIC, sizeof(INDEX_MAGIC)) == 0
+    and data[4] == INDEX_VERSION;
+  unsigned long long files = 0, filesOffset = 0;
+  if (ok) {
+    m_records = GetU64(data + 8);
+    m_games = GetU64(data + 16);
+    files = GetU64(data + 24);
+    m_gamesOffset = GetU64(data + 32);
+    filesOffset = GetU64(data + 40);
+    ok = (size - HEADER_SIZE) / RECORD_SIZE >= m_records
+      and m_gamesOffset == HEADER_SIZE + m_records * RECORD_SIZE
+      and (size - m_gamesOffset) / GAME_SIZE >= m_games
+      and filesOffset == m_gamesOffset + m_games * GAME_SIZE;
+  }
+  // The file names
+  unsigned long long p = filesOffset;
+  for (unsigned long long i = 0; ok and i < files; i++) {
+    ok = size - p >= 4;
+    if (not ok) break;
+    const unsigned long length = GetU32(data + p);
+    p += 4;
+    ok = size - p >= length;
+    if (ok) m_files.push_back(string(data + p, length));
+    p += length;
+  }
+  if (not ok) {
+    TRACE("PositionIndex - " << filename << " is not a valid index");
+    Close();
+    return false;
+  }
+  m_file.Advise(MappedFile::ACCESS_RANDOM);
+  return true;
+}
+
+void PositionIndex::Close()
+{
+  m_file.Close();
+  m_records = 0;
+  m_games = 0;
+  m_gamesOffset = 0;
+  m_files.clear();
+}
+
+void PositionIndex::Range(const Board2D& board,
+  unsigned long long& first, unsigned long long& last) const
+{
+  const unsigned long long hash = board.Hash64();
+  const char* records = m_file.Data() + HEADER_SIZE;
+  unsigned long long low = 0, high = m_records;
+  while (low < high) {
+    const unsigned long long middle = low + (high - low) / 2;
+    if (GetU64(records + middle * RECORD_SIZE) < hash) low = middle + 1;
+    else high = middle;
+  }
+  first = low;
+  high = m_records;
+  while (low < high) {
+    const unsigned long long middle = low + (high - low) / 2;
+    if (GetU64(records + middle * RECORD_SIZE) <= hash) low = middle + 1;
+    else high = middle;
+  }
+  last = low;
+}
+
+size_t PositionIndex::Count(const Board2D& board) const
+{
+  if (m_records == 0) return 0;
+  unsigned long long first, last;
+  Range(board, first, last);
+  return (size_t)(last - first);
+}
+
+size_t PositionIndex::Find(const Board2D& board, vector<PositionHit>& hits,
+  size_t limit) const
+{
+  hits.clear();
+  if (m_records == 0) return 0;
+  unsigned long long first, last;
+  Range(board, first, last);
+  const char* data = m_file.Data();
+  for (unsigned long long i = first; i < last and hits.size() < limit; i++) {
+    const char* record = data + HEADER_SIZE + i * RECORD_SIZE;
+    const unsigned long game = GetU32(record + 8);
+    if (game >= m_games) {
+      TRACE("PositionIndex - corrupt record " << i);
+      continue;
+    }
+    const unsigned long file = GetU32(data + m_gamesOffset + game * GAME_SIZE);
+    PositionHit hit;
+    hit.filename = file < m_files.size() ? m_files[file] : string();
+    hit.number = GetU32(data + m_gamesOffset + game * GAME_SIZE + 4);
+    hit.ply = GetU16(record + 12);
+    hits.push_back(hit);
+  }
+  return (size_t)(last - first);
+}
@@ -0,0 +1,346 @@
+/** @file SelfPlay.cpp
+
+  This library is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#include "SelfPlay.hpp"
+
+//// Headers ///////////////////////////////////////////////////
+
+#include "config.h"
+
+#define DEB1
+#include "Trace.hpp"
+#define TRACE1(x) // TRACE(x)
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <thread>
+
+#include "Match.hpp"
+#include "ThreadPool.hpp"
+
+using namespace std;
+using namespace Haliotis;
+
+/// A game in play: little more than its board and moves
+struct SelfPlay::GameState {
+  unsigned number;
+  size_t layout;
+  Board2D start;
+  Board2D board;
+  vector<Board2D::Move> moves;
+  vector<unsigned long long> seen; //< Hash64() of each position so far
+};
+
+/** Plays a share of the games on one thread, one move of every game in
+  each round */
+class SelfPlay::Player {
+public:
+  Player(SelfPlay& owner, unsigned index, unsigned games);
+  void Run();
+
+private:
+  /// Set up the next game in state. @return false if there is none
+  bool Start(GameState& state);
+  /// Collect the positions after each move of the games, and evaluate them
+  void Evaluate();
+  /// Index of the move to play in game i of the round
+  size_t Choose(size_t i);
+  /// Play move of state. @return true if the game has ended
+  bool Play(GameState& state, const Board2D::Move& move);
+  /** Queue the game for the writer.
+    @param winner  1 or 2, 0 for a draw */
+  void Finish(GameState& state, int winner, const char* reason);
+
+  SelfPlay& m_owner;
+  const SelfPlayOptions& m_options;
+  mt19937 m_random;
+  vector<GameState> m_games;
+  vector<GameState*> m_active;
+
+  // Buffers of a round, kept to avoid allocation
+  vector<Board2D::Move> m_moves;  //< Legal moves of all games
+  vector<size_t> m_first;         //< Index in m_moves of the first move of each game
+  vector<int> m_slot;             //< Index in m_batch of the position after each move, -1 if it ends the game
+  vector<Board2D> m_batch;        //< Positions to evaluate
+  vector<float> m_values;         //< Value of each position in m_batch
+  vector<double> m_weights;
+  unsigned long long m_evaluations;
+  unsigned long long m_batches;
+};
+
+SelfPlay::Player::Player(SelfPlay& owner, unsigned index, unsigned games)
+: m_owner(owner)
+, m_options(owner.m_options)
+, m_games(games)
+, m_evaluations(0)
+, m_batches(0)
+{
+  seed_seq seed = { m_options.seed, index };
+  m_random.seed(seed);
+}
+
+bool SelfPlay::Player::Start(GameState& state)
+{
+  if (not m_owner.NextGame(state.number)) return false;
+  state.layout = (state.number / 2) % m_options.layouts.size();
+  StartLayout(m_options.layouts[state.layout], state.start);
+  state.board = state.start;
+  state.moves.clear();
+  state.seen.clear();
+  state.seen.push_back(state.start.Hash64());
+  return true;
+}
+
+void SelfPlay::Player::Evaluate()
+{
+  m_moves.clear();
+  m_first.clear();
+  m_slot.clear();
+  m_batch.clear();
+  for (size_t i = 0; i < m_active.size(); i++) {
+    m_first.push_back(m_moves.size());
+    for (auto& m : m_active[i]->board.AllMoves()) {
+      m_moves.push_back(m.move);
+      if (m.board.OutOfBoard(true) >= 6 or m.board.OutOfBoard(false) >= 6) {
+        m_slot.push_back(-1);
+      }
+      else {
+        m_slot.push_back((int)m_batch.size());
+        m_batch.push_back(m.board);
+      }
+    }
+  }
+  m_first.push_back(m_moves.size());
+  m_values.resize(m_batch.size());
+  const size_t maxBatch = max(m_options.maxBatch, (size_t)1);
+  for (size_t first = 0; first < m_batch.size(); first += maxBatch) {
+    const size_t count = min(maxBatch, m_batch.size() - first);
+    m_owner.m_evaluator.Evaluate(&m_batch[first], count, &m_values[first]);
+    m_batches++;
+  }
+  m_evaluations += m_batch.size();
+}
+
+size_t SelfPlay::Player::Choose(size_t i)
+{
+  const size_t first = m_first[i], last = m_first[i+1];
+  // The value of a position that ends the game is a loss for the opponent
+  double best = -2;
+  size_t bestMove = first;
+  for (size_t j = first; j < last; j++) {
+    const double score = m_slot[j] < 0 ? 1 : -m_values[m_slot[j]];
+    if (score > best) {
+      best = score;
+      bestMove = j;
+    }
+  }
+  if ((int)m_active[i]->moves.size() >= m_options.samplePlies
+      or m_options.temperature <= 0) {
+    return bestMove;
+  }
+  m_weights.clear();
+  for (size_t j = first; j < last; j++) {
+    const double score = m_slot[j] < 0 ? 1 : -m_values[m_slot[j]];
+    m_weights.push_back(exp((score - best) / m_options.temperature));
+  }
+  discrete_distribution<size_t> sample(m_weights.begin(), m_weights.end());
+  return first + sample(m_random);
+}
+
+bool SelfPlay::Player::Play(GameState& state, const Board2D::Move& move)
+{
+  state.board.DoMove(move);
+  state.moves.push_back(move);
+  if (state.board.OutOfBoard(true) >= 6) {
+    Finish(state, 2, "six marbles pushed off");
+    return true;
+  }
+  if (state.board.OutOfBoard(false) >= 6) {
+    Finish(state, 1, "six marbles pushed off");
+    return true;
+  }
+  const unsigned long long hash = state.board.Hash64();
+  if (count(state.seen.begin(), state.seen.end(), hash) >= 2) {
+    Finish(state, 0, "threefold repetition");
+    return true;
+  }
+  state.seen.push_back(hash);
+  if ((int)state.moves.size() >= m_options.maxPlies) {
+    Finish(state, 0, "maximum length");
+    return true;
+  }
+  return false;
+}
+
+void SelfPlay::Player::Finish(GameState& state, int winner, const char* reason)
+{
+  Game* game = new Game;
+  game->RestartFrom(state.start);
+  for (size_t i = 0; i < state.moves.size(); i++) {
+    game->DoMove(state.moves[i]);
+  }
+  Settings& att = game->attributes;
+  att["Event"] = "Self-play";
+  att["Round"] = to_string(state.number + 1);
+  att["White"] = "self-play";
+  att["Black"] = "self-play";
+  att["Result"] = winner == 1 ? "1-0" : winner == 2 ? "0-1" : "1/2-1/2";
+  att["Termination"] = reason;
+  att["Layout"] = m_options.layouts[state.layout];
+  m_owner.Finished(game);
+}
+
+void SelfPlay::Player::Run()
+{
+  for (size_t i = 0; i < m_games.size(); i++) {
+    if (Start(m_games[i])) m_active.push_back(&m_games[i]);
+  }
+  while (not m_active.empty()) {
+    Evaluate();
+    // Games that end are replaced by a new game, or else removed
+    size_t kept = 0;
+    for (size_t i = 0; i < m_active.size(); i++) {
+      GameState& state = *m_active[i];
+      bool ended;
+      if (m_first[i] == m_first[i+1]) {
+        Finish(state, 0, "no legal move");
+        ended = true;
+      }
+      else {
+        ended = Play(state, m_moves[Choose(i)]);
+      }
+      if (not ended or Start(state)) m_active[kept++] = &state;
+    }
+    m_active.resize(kept);
+  }
+  m_owner.AddEvaluations(m_evaluations, m_batches);
+}
+
+////////////////////////////////////////////////////////////////
+//
+//  SelfPlay
+//
+
+SelfPlay::SelfPlay(const SelfPlayOptions& options, SelfPlayEvaluator& evaluator)
+: m_options(options)
+, m_evaluator(evaluator)
+, m_gameOutput(0)
+, m_dataset(0)
+, m_listener(0)
+, m_writer(FORMAT_AG)
+, m_nextGame(0)
+, m_stop(false)
+, m_playing(false)
+{
+  if (m_options.layouts.empty()) m_options.layouts.push_back("Standard");
+  if (m_options.threads == 0) m_options.threads = 1;
+  if (m_options.queueGames == 0) m_options.queueGames = 1;
+}
+
+SelfPlay::~SelfPlay()
+{
+  for (size_t i = 0; i < m_queue.size(); i++) delete m_queue[i];
+}
+
+bool SelfPlay::NextGame(unsigned& number)
+{
+  if (m_stop.load()) return false;
+  number = m_nextGame.fetch_add(1);
+  return number < m_options.games;
+}
+
+void SelfPlay::Finished(Game* game)
+{
+  unique_lock<mutex> lock(m_mutex);
+  m_notFull.wait(lock, [this]() { return m_queue.size() < m_options.queueGames; });
+  m_queue.push_back(game);
+  m_notEmpty.notify_one();
+}
+
+void SelfPlay::AddEvaluations(unsigned long long evaluations, unsigned long long batches)
+{
+  lock_guard<mutex> lock(m_mutex);
+  m_stats.evaluations += evaluations;
+  m_stats.batches += batches;
+}
+
+void SelfPlay::WriteGames()
+{
+  unique_lock<mutex> lock(m_mutex);
+  for (;;) {
+    m_notEmpty.wait(lock, [this]() { return not m_queue.empty() or not m_playing; });
+    if (m_queue.empty()) break;
+    Game* game = m_queue.front();
+    m_queue.pop_front();
+    m_notFull.notify_one();
+    lock.unlock();
+    // The game is written without the lock, so play goes on meanwhile
+    if (m_gameOutput) m_writer.Write(*m_gameOutput, *game);
+    if (m_dataset) m_dataset->Add(*game);
+    const DatasetResult result = GameResult(*game);
+    lock.lock();
+    m_stats.games++;
+    if (result == RESULT_FIRST_WINS) m_stats.wins[0]++;
+    else if (result == RESULT_SECOND_WINS) m_stats.wins[1]++;
+    else m_stats.draws++;
+    m_stats.positions += game->Length();
+    if (m_listener) {
+      // The listener is told outside the lock, so it may take its time
+      const SelfPlayStatistics stats = m_stats;
+      lock.unlock();
+      m_listener->GameWritten(*game, stats);
+      lock.lock();
+    }
+    delete game;
+  }
+  if (m_gameOutput) m_gameOutput->flush();
+}
+
+SelfPlayStatistics SelfPlay::Run()
+{
+  Board2D board;
+  for (size_t i = 0; i < m_options.layouts.size(); i++) {
+    if (not StartLayout(m_options.layouts[i], board)) {
+      APP_ERROR("Unknown start layout: " << m_options.layouts[i]);
+      return SelfPlayStatistics();
+    }
+  }
+  m_stats = SelfPlayStatistics();
+  m_nextGame.store(0);
+  m_stop.store(false);
+  m_playing = true;
+  thread writer(&SelfPlay::WriteGames, this);
+  {
+    const unsigned threads = m_options.threads;
+    const unsigned games = max(m_options.concurrentGames / threads, 1u);
+    ThreadPool pool(threads);
+    for (unsigned i = 0; i < threads; i++) {
+      pool.Submit([this, i, games]() {
+        Player player(*this, i, games);
+        player.Run();
+      });
+    }
+    pool.Wait();
+  }
+  {
+    lock_guard<mutex> lock(m_mutex);
+    m_playing = false;
+  }
+  m_notEmpty.notify_one();
+  writer.join();
+  return m_stats;
+}
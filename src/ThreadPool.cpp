@@ -0,0 +1,145 @@
+/** @file ThreadPool.cpp
+
+  This library is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#include "ThreadPool.hpp"
+
+//// Headers ///////////////////////////////////////////////////
+
+#include "config.h"
+
+#define DEB1
+#include "Trace.hpp"
+#define TRACE1(x) // TRACE(x)
+
+using namespace std;
+
+/// The pool and worker number of the calling thread
+static thread_local const ThreadPool* currentPool = 0;
+static thread_local int currentWorker = -1;
+
+ThreadPool::ThreadPool(unsigned threads)
+: m_next(0)
+, m_queued(0)
+, m_pending(0)
+, m_stop(false)
+{
+  if (threads == 0) threads = thread::hardware_concurrency();
+  if (threads == 0) threads = 1;
+  for (unsigned i = 0; i < threads; i++) {
+    m_queues.push_back(new Queue());
+  }
+  for (unsigned i = 0; i < threads; i++) {
+    m_workers.push_back(thread(&ThreadPool::Run, this, i));
+  }
+  TRACE1("ThreadPool started " << threads << " workers");
+}
+
+ThreadPool::~ThreadPool()
+{
+  Wait();
+  {
+    lock_guard<mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_work.notify_all();
+  for (size_t i = 0; i < m_workers.size(); i++) {
+    m_workers[i].join();
+  }
+  for (size_t i = 0; i < m_queues.size(); i++) {
+    delete m_queues[i];
+  }
+}
+
+int ThreadPool::WorkerIndex() const
+{
+  return currentPool == this ? currentWorker : -1;
+}
+
+void ThreadPool::Submit(Task task)
+{
+  int index = WorkerIndex();
+  if (index < 0) index = m_next++ % m_queues.size();
+  {
+    lock_guard<mutex> lock(m_mutex);
+    m_pending++;
+  }
+  {
+    Queue& queue = *m_queues[index];
+    lock_guard<mutex> lock(queue.mutex);
+    queue.tasks.push_back(task);
+    m_queued++;
+  }
+  {
+    // Taking the lock makes sure a worker going to sleep sees m_queued
+    lock_guard<mutex> lock(m_mutex);
+  }
+  m_work.notify_one();
+}
+
+void ThreadPool::Wait()
+{
+  TRACE_ASSERT_MSG(WorkerIndex() < 0, "ThreadPool::Wait called from a worker");
+  unique_lock<mutex> lock(m_mutex);
+  while (m_pending > 0) m_idle.wait(lock);
+}
+
+/** Take the newest task of the own queue, or steal the oldest task of
+  another queue. */
+bool ThreadPool::Pop(unsigned index, Task& task)
+{
+  if (m_queued == 0) return false;
+  {
+    Queue& own = *m_queues[index];
+    lock_guard<mutex> lock(own.mutex);
+    if (not own.tasks.empty()) {
+      task.swap(own.tasks.back());
+      own.tasks.pop_back();
+      m_queued--;
+      return true;
+    }
+  }
+  for (size_t i = 1; i < m_queues.size(); i++) {
+    Queue& victim = *m_queues[(index + i) % m_queues.size()];
+    lock_guard<mutex> lock(victim.mutex);
+    if (not victim.tasks.empty()) {
+      task.swap(victim.tasks.front());
+      victim.tasks.pop_front();
+      m_queued--;
+      TRACE1("ThreadPool worker " << index << " stole a task");
+      return true;
+    }
+  }
+  return false;
+}
+
+void ThreadPool::Run(unsigned index)
+{
+  currentPool = this;
+  currentWorker = index;
+  Task task;
+  while (true) {
+    if (Pop(index, task)) {
+      task();
+      task = Task();
+      lock_guard<mutex> lock(m_mutex);
+      if (--m_pending == 0) m_idle.notify_all();
+      continue;
+    }
+    unique_lock<mutex> lock(m_mutex);
+    while (m_queued == 0 and not m_stop) m_work.wait(lock);
+    if (m_stop and m_queued == 0) break;
+  }
+}
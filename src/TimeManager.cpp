@@ -0,0 +1,211 @@
+/** @file TimeManager.cpp
+
+  This library is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#include "TimeManager.hpp"
+
+//// Headers ///////////////////////////////////////////////////
+
+#include "config.h"
+
+#define DEB1
+#include "Trace.hpp"
+#define TRACE1(x) // TRACE(x)
+
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+
+using namespace std;
+using namespace Haliotis;
+
+/// Clock value meaning never
+static const long long NEVER = LLONG_MAX;
+
+/// Moves to budget for when no marbles are lost, and when one is lost
+/// before the game ends
+static const int MOVES_TO_GO_OPENING = 30;
+static const int MOVES_TO_GO_ENDGAME = 10;
+/// Largest extension of the soft deadline, in steps of half the deadline
+static const int MAX_INSTABILITY = 4;
+
+/// Parse a non-negative integer, with nothing after it
+static bool ParseCount(const string& value, long long& result)
+{
+  const char* text = value.c_str();
+  char* end = 0;
+  const long long n = strtoll(text, &end, 10);
+  if (end == text or *end != '\0' or n < 0) return false;
+  result = n;
+  return true;
+}
+
+TimeManager::TimeManager()
+: m_player(1)
+, m_maxOut(0)
+, m_soft(NO_LIMIT)
+, m_hard(NO_LIMIT)
+, m_instability(0)
+, m_start(0)
+, m_softEnd(NEVER)
+, m_hardEnd(NEVER)
+, m_stopped(false)
+{
+  Reset();
+}
+
+void TimeManager::Reset()
+{
+  m_time[0] = m_time[1] = NO_LIMIT;
+  m_inc[0] = m_inc[1] = NO_LIMIT;
+  m_moveTime = NO_LIMIT;
+  m_infinite = false;
+  m_maxDepth = INT_MAX;
+  m_maxNodes = ULLONG_MAX;
+  m_stopped.store(false);
+}
+
+void TimeManager::Set(const GoParameters& go)
+{
+  Reset();
+  for (int p = 0; p < 2; p++) {
+    m_time[p] = go.time[p];
+    m_inc[p] = go.inc[p];
+  }
+  m_moveTime = go.moveTime;
+  m_infinite = go.infinite;
+  if (go.depth >= 0) m_maxDepth = go.depth;
+  if (go.nodes >= 0) m_maxNodes = go.nodes;
+}
+
+bool TimeManager::SetParameter(const string& name, const string& value)
+{
+  long long* limit = 0;
+  if (name == "time1") limit = &m_time[0];
+  else if (name == "time2") limit = &m_time[1];
+  else if (name == "inc1") limit = &m_inc[0];
+  else if (name == "inc2") limit = &m_inc[1];
+  else if (name == "movetime") limit = &m_moveTime;
+  else if (name != "depth" and name != "nodes") return false; // Not a limit
+  long long n;
+  if (name == "movetime" and value == "inf") {
+    m_infinite = true;
+    return true;
+  }
+  if (not ParseCount(value, n)) {
+    TRACE("TimeManager - bad value for " << name << ": '" << value << "'");
+    return false;
+  }
+  if (limit != 0) *limit = n;
+  else if (name == "depth") m_maxDepth = (int)min(n, (long long)INT_MAX);
+  else m_maxNodes = n;
+  return true;
+}
+
+long long TimeManager::Now() const
+{
+  return chrono::duration_cast<chrono::nanoseconds>(
+    Clock::now().time_since_epoch()).count();
+}
+
+/** The budget in ms for the player to move. The moves left are estimated
+  from the marbles lost, and a part of the increment is spent at once. */
+void TimeManager::ComputeLimits()
+{
+  m_soft = m_hard = NO_LIMIT;
+  if (m_infinite) return;
+  if (m_moveTime >= 0) {
+    m_soft = m_hard = max(m_moveTime - MOVE_OVERHEAD, m_moveTime / 2);
+    return;
+  }
+  const long long time = m_time[m_player - 1];
+  if (time < 0) return;
+  const long long inc = max(m_inc[m_player - 1], 0LL);
+  const int lost = min(m_maxOut, 5);
+  const int movesToGo = MOVES_TO_GO_ENDGAME
+    + (MOVES_TO_GO_OPENING - MOVES_TO_GO_ENDGAME) * (5 - lost) / 5;
+  const long long available = max(time - MOVE_OVERHEAD, 1LL);
+  m_soft = available / movesToGo + inc * 3 / 4;
+  m_hard = min(available, min(m_soft * 4, available / 5 + inc));
+  m_soft = min(m_soft, m_hard);
+}
+
+void TimeManager::Start(const Board2D& board, bool pondering)
+{
+  m_player = board.GetTurn();
+  m_maxOut = max(board.OutOfBoard(true), board.OutOfBoard(false));
+  m_instability = 0;
+  ComputeLimits();
+  m_start.store(Now());
+  if (pondering) {
+    m_softEnd.store(NEVER);
+    m_hardEnd.store(NEVER);
+  }
+  else {
+    PonderHit();
+  }
+  TRACE1("TimeManager - player " << m_player << " soft " << m_soft
+    << " ms, hard " << m_hard << " ms");
+}
+
+void TimeManager::PonderHit()
+{
+  const long long now = Now();
+  m_start.store(now);
+  m_softEnd.store(m_soft < 0 ? NEVER : now + m_soft * 1000000);
+  m_hardEnd.store(m_hard < 0 ? NEVER : now + m_hard * 1000000);
+}
+
+bool TimeManager::CheckClock() const
+{
+  const long long end = m_hardEnd.load(memory_order_relaxed);
+  if (end != NEVER and Now() >= end) return Expire();
+  return false;
+}
+
+bool TimeManager::CanStartIteration(int depth) const
+{
+  if (m_stopped.load() or depth > m_maxDepth) return false;
+  if (depth <= 1) return true;
+  const long long end = m_softEnd.load();
+  return end == NEVER or Now() < end;
+}
+
+void TimeManager::IterationDone(bool bestMoveChanged)
+{
+  if (bestMoveChanged) m_instability = min(m_instability + 1, MAX_INSTABILITY);
+  else if (m_instability > 0) m_instability--;
+  if (m_soft < 0 or m_softEnd.load() == NEVER) return;
+  // Each step of instability adds half the soft deadline
+  const long long soft = min(m_soft * (2 + m_instability) / 2, m_hard);
+  m_softEnd.store(m_start.load() + soft * 1000000);
+}
+
+long long TimeManager::Elapsed() const
+{
+  return (Now() - m_start.load()) / 1000000;
+}
+
+long long TimeManager::SoftLimit() const
+{
+  const long long end = m_softEnd.load();
+  return end == NEVER ? NO_LIMIT : (end - m_start.load()) / 1000000;
+}
+
+long long TimeManager::HardLimit() const
+{
+  const long long end = m_hardEnd.load();
+  return end == NEVER ? NO_LIMIT : (end - m_start.load()) / 1000000;
+}
@@ -21,9 +21,15 @@
 #define DEB1
 #include "Trace.hpp"
 
-// This implementation uses STL streams
-// Warning: It has no mutex
+// Messages are recorded in a ring buffer for each thread, and written by
+// a flusher thread
 
+#include "TraceFile.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
 #include <ctime>
 
 // Global variables in this module
@@ -34,37 +40,374 @@ static const char* trace_file = "trace.log";
 extern const char* TRACE_FILE;
 static const char* trace_file = TRACE_FILE;
 #endif
+static bool trace_binary = false;
+
+static std::atomic<TraceCollector*> theTraceCollector(0);
+static std::mutex creationMutex;
+
+const size_t TraceCollector::RING_SIZE;
+const unsigned TraceCollector::FLUSH_INTERVAL;
+const size_t TraceMessage::MAX_SIZE;
+
+static const char TRACE_MAGIC[4] = { 'A','B','T','R' };
+static const unsigned char TRACE_VERSION = 1;
+
+static void PutU32(std::string& out, unsigned long value) {
+  for (int i=0; i<4; i++) out += (char)((value >> (8*i)) & 0xFF);
+}
+
+static void PutU64(std::string& out, unsigned long long value) {
+  for (int i=0; i<8; i++) out += (char)((value >> (8*i)) & 0xFF);
+}
+
+static long long SteadyNanoseconds()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+////////////////////////////////////////////////////////////////
+//
+//  Ring buffers
+//
+
+/** Header of a message in a ring, followed by its arguments */
+struct RecordHeader {
+  long long time;     //< Steady clock, ns
+  unsigned size;      //< Bytes of the arguments
+  unsigned site;      //< Id of the TraceSite, 0 for text
+  unsigned stamp;     //< 1 if the line is prefixed with time and thread
+};
 
-static TraceCollector* theTraceCollector = 0;
+/** Bytes written by one thread and read by the flusher. The producer only
+  moves head and the consumer only moves tail, so neither takes a lock.
+  Records are padded to 8 bytes, and may wrap around the end. */
+struct TraceCollector::Ring {
+  char* data;
+  std::atomic<size_t> head;    //< Bytes written, ever
+  std::atomic<size_t> tail;    //< Bytes read, ever
+  std::atomic<unsigned long long> lost; //< Messages dropped when full
+  std::atomic<bool> closed;    //< The thread has exited
+  std::atomic<bool> woken;     //< The flusher was woken since it drained the ring
+  unsigned thread;             //< Number of the thread, from 1
+
+  Ring(unsigned number)
+  : data(new char[RING_SIZE]), head(0), tail(0), lost(0), closed(false),
+    woken(false), thread(number) {}
+  ~Ring() { delete[] data; }
+
+  void Copy(size_t pos, const void* from, size_t size) {
+    const size_t offset = pos % RING_SIZE;
+    const size_t first = std::min(size, RING_SIZE - offset);
+    memcpy(data + offset, from, first);
+    memcpy(data, (const char*)from + first, size - first);
+  }
+  void Read(size_t pos, void* to, size_t size) const {
+    const size_t offset = pos % RING_SIZE;
+    const size_t first = std::min(size, RING_SIZE - offset);
+    memcpy(to, data + offset, first);
+    memcpy((char*)to + first, data, size - first);
+  }
+  static size_t Padded(size_t size) { return (size + 7) & ~(size_t)7; }
+
+  /** @return bytes in the ring after the message, 0 if there is no room
+    for it */
+  size_t Push(unsigned site, const char* text, size_t size, bool stamp) {
+    RecordHeader header;
+    header.time = SteadyNanoseconds();
+    header.size = (unsigned)size;
+    header.site = site;
+    header.stamp = stamp ? 1 : 0;
+    const size_t need = Padded(sizeof(header) + size);
+    const size_t h = head.load(std::memory_order_relaxed);
+    const size_t used = h - tail.load(std::memory_order_acquire);
+    if (need > RING_SIZE - used) return 0;
+    Copy(h, &header, sizeof(header));
+    Copy(h + sizeof(header), text, size);
+    head.store(h + need, std::memory_order_release);
+    return used + need;
+  }
+};
+
+/** A message taken from a ring by the flusher */
+struct TraceCollector::Entry {
+  long long time;
+  unsigned thread;
+  unsigned site;
+  bool stamp;
+  size_t offset;  //< Of the arguments in m_line
+  size_t size;
+  bool operator < (const Entry& other) const { return time < other.time; }
+};
+
+/** Closes the ring of a thread when it exits. The flusher deletes it when
+  it has been drained. */
+struct RingOwner {
+  TraceCollector::Ring* ring;
+  RingOwner() : ring(0) {}
+  ~RingOwner() {
+    if (ring) ring->closed.store(true);
+    // A message traced later, by a static destructor, gets a new ring
+    ring = 0;
+  }
+};
+static thread_local RingOwner threadRing;
+
+TraceCollector::Ring* TraceCollector::ThreadRing()
+{
+  if (threadRing.ring == 0) {
+    Ring* ring = new Ring(++m_threads);
+    std::lock_guard<std::mutex> lock(m_ringMutex);
+    m_rings.push_back(ring);
+    threadRing.ring = ring;
+  }
+  return threadRing.ring;
+}
 
-// Implementation of TraceCollector
+////////////////////////////////////////////////////////////////
+//
+//  TraceCollector
+//
 
 void TraceCollector::SetTraceFile(const char* filename)
 {
+  std::lock_guard<std::mutex> lock(creationMutex);
+  trace_file = filename;
+  trace_binary = false;
+  TraceCollector* collector = theTraceCollector;
+  if (collector != 0) {
+    std::lock_guard<std::recursive_mutex> traceLock(collector->mutex);
+    collector->Drain();
+    collector->Open(filename, false);
+  }
+}
+
+void TraceCollector::SetBinaryTraceFile(const char* filename)
+{
+  std::lock_guard<std::mutex> lock(creationMutex);
   trace_file = filename;
-  if (theTraceCollector != 0) {
-    GetInstance().traceStream.close();
-    GetInstance().traceStream.open(filename);
+  trace_binary = true;
+  TraceCollector* collector = theTraceCollector;
+  if (collector != 0) {
+    std::lock_guard<std::recursive_mutex> traceLock(collector->mutex);
+    collector->Drain();
+    collector->Open(filename, true);
   }
 }
 
 TraceCollector& TraceCollector::GetInstance()
 {
-  if (theTraceCollector == 0) {
-    theTraceCollector = new TraceCollector();
+  TraceCollector* collector = theTraceCollector;
+  if (collector == 0) {
+    std::lock_guard<std::mutex> lock(creationMutex);
+    collector = theTraceCollector;
+    if (collector == 0) {
+      collector = new TraceCollector();
+      theTraceCollector = collector;
+      atexit(&TraceCollector::Shutdown);
+    }
   }
-  return *theTraceCollector;
+  return *collector;
 }
 
 TraceCollector::TraceCollector()
-: traceStream(trace_file)
+: m_threads(0)
+, m_stopped(false)
+, m_binary(false)
+, m_exit(false)
 {
+  m_startSystem = std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::system_clock::now().time_since_epoch()).count();
+  m_startSteady = SteadyNanoseconds();
+  Open(trace_file, trace_binary);
+  m_flusher = std::thread(&TraceCollector::Run, this);
+}
+
+void TraceCollector::Open(const char* filename, bool binary)
+{
+  traceStream.close();
+  m_binary = binary;
+  m_siteWritten.clear();
+  if (binary) {
+    traceStream.open(filename, std::ios::binary);
+    std::string header(TRACE_MAGIC, 4);
+    header += (char)TRACE_VERSION;
+    header.append(3, '\0');
+    PutU64(header, m_startSystem);
+    PutU64(header, m_startSteady);
+    traceStream.write(header.data(), header.size());
+    traceStream.flush();
+    return;
+  }
+  traceStream.open(filename);
   time_t now = time(0);
   traceStream << '\n'
     << "----------------------------------------------------------------\n"
     << "Trace started at " << ctime(&now) << std::flush;
 }
 
+void TraceCollector::Record(unsigned site, const char* data, size_t size, bool stamp)
+{
+  // A text that can never fit is cut
+  size = std::min(size, TraceMessage::MAX_SIZE);
+  Ring* ring = ThreadRing();
+  const size_t used = ring->Push(site, data, size, stamp);
+  if (used == 0) {
+    // The thread does not wait for the flusher, the message is dropped
+    ring->lost.fetch_add(1, std::memory_order_relaxed);
+    m_wake.notify_one();
+  }
+  else if (used > RING_SIZE / 2 and not ring->woken.load(std::memory_order_relaxed)) {
+    // Drain a ring that fills up before the flush interval is over
+    ring->woken.store(true, std::memory_order_relaxed);
+    m_wake.notify_one();
+  }
+  // Without a flusher, the message is written at once
+  if (m_stopped.load(std::memory_order_relaxed)) Flush();
+}
+
+void TraceCollector::Flush()
+{
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  Drain();
+}
+
+void TraceCollector::Drain()
+{
+  m_entries.clear();
+  m_line.clear();
+  std::vector<Ring*> rings;
+  {
+    std::lock_guard<std::mutex> lock(m_ringMutex);
+    rings = m_rings;
+  }
+  for (size_t r = 0; r < rings.size(); r++) {
+    Ring* ring = rings[r];
+    // A ring closed before its head is read is drained completely
+    const bool closed = ring->closed.load();
+    const size_t head = ring->head.load(std::memory_order_acquire);
+    size_t tail = ring->tail.load(std::memory_order_relaxed);
+    while (tail < head) {
+      RecordHeader header;
+      ring->Read(tail, &header, sizeof(header));
+      Entry entry;
+      entry.time = header.time;
+      entry.thread = ring->thread;
+      entry.site = header.site;
+      entry.stamp = header.stamp != 0;
+      entry.offset = m_line.size();
+      entry.size = header.size;
+      m_line.resize(m_line.size() + header.size);
+      ring->Read(tail + sizeof(header), &m_line[entry.offset], header.size);
+      m_entries.push_back(entry);
+      tail += Ring::Padded(sizeof(header) + header.size);
+    }
+    ring->tail.store(tail, std::memory_order_release);
+    ring->woken.store(false, std::memory_order_relaxed);
+    const unsigned long long lost = ring->lost.exchange(0);
+    if (lost > 0) {
+      std::ostringstream text;
+      text << lost << " trace messages lost, buffer full\n";
+      Entry entry;
+      entry.time = SteadyNanoseconds();
+      entry.thread = ring->thread;
+      entry.site = 0;
+      entry.stamp = true;
+      entry.offset = m_line.size();
+      entry.size = text.str().size();
+      m_line += text.str();
+      m_entries.push_back(entry);
+    }
+    if (closed) {
+      std::lock_guard<std::mutex> lock(m_ringMutex);
+      m_rings.erase(std::find(m_rings.begin(), m_rings.end(), ring));
+      delete ring;
+    }
+  }
+  if (m_entries.empty()) return;
+  std::stable_sort(m_entries.begin(), m_entries.end());
+  m_output.clear();
+  if (m_binary) {
+    WriteBinary();
+  }
+  else {
+    TraceStampFormat stampFormat;
+    for (size_t i = 0; i < m_entries.size(); i++) {
+      const Entry& entry = m_entries[i];
+      if (entry.stamp) {
+        stampFormat.Append(m_startSystem + (entry.time - m_startSteady) / 1000,
+          entry.thread, m_output);
+      }
+      if (entry.site == 0) {
+        m_output.append(m_line, entry.offset, entry.size);
+      }
+      else if (not RenderTraceArguments(m_line.data() + entry.offset, entry.size, m_output)) {
+        m_output += "corrupt trace message\n";
+      }
+    }
+  }
+  traceStream.write(m_output.data(), m_output.size());
+  traceStream.flush();
+}
+
+void TraceCollector::WriteBinary()
+{
+  for (size_t i = 0; i < m_entries.size(); i++) {
+    const Entry& entry = m_entries[i];
+    const unsigned site = entry.site;
+    if (site != 0 and (site >= m_siteWritten.size() or not m_siteWritten[site])) {
+      // A site is written before its first message
+      if (site >= m_sites.size()) {
+        if (m_sites.empty()) m_sites.push_back(0);
+        TraceSite::GetSites((unsigned)m_sites.size(), m_sites);
+      }
+      if (site >= m_siteWritten.size()) m_siteWritten.resize(m_sites.size());
+      m_siteWritten[site] = true;
+      const TraceSite* s = m_sites[site];
+      m_output += 'S';
+      PutU32(m_output, site);
+      PutU32(m_output, s->Line());
+      PutU32(m_output, strlen(s->File()));
+      m_output += s->File();
+      PutU32(m_output, strlen(s->Statement()));
+      m_output += s->Statement();
+    }
+    m_output += 'M';
+    PutU64(m_output, entry.time);
+    PutU32(m_output, entry.thread);
+    PutU32(m_output, site);
+    m_output += (char)(entry.stamp ? 1 : 0);
+    PutU32(m_output, entry.size);
+    m_output.append(m_line, entry.offset, entry.size);
+  }
+}
+
+void TraceCollector::Run()
+{
+  std::unique_lock<std::mutex> wakeLock(m_wakeMutex);
+  while (not m_exit) {
+    m_wake.wait_for(wakeLock, std::chrono::milliseconds(FLUSH_INTERVAL));
+    wakeLock.unlock();
+    Flush();
+    wakeLock.lock();
+  }
+}
+
+/** Stop the flusher at exit. Messages traced later, by destructors of
+  static objects, are written at once. */
+void TraceCollector::Shutdown()
+{
+  TraceCollector* collector = theTraceCollector;
+  {
+    std::lock_guard<std::mutex> lock(collector->m_wakeMutex);
+    collector->m_exit = true;
+  }
+  collector->m_wake.notify_one();
+  collector->m_flusher.join();
+  collector->m_stopped.store(true);
+  collector->Flush();
+}
+
 std::string TimeStamp()
 {
   time_t now = time(0);
@@ -81,9 +424,181 @@ std::string TimeStamp()
   return buf;
 }
 
-void TraceCollector::TraceTimeStamp()
+////////////////////////////////////////////////////////////////
+//
+//  TraceSite
+//
+
+static std::mutex siteMutex;
+
+/// Never deleted, so that sites are found while static objects are destroyed
+static std::vector<const TraceSite*>& Sites()
+{
+  static std::vector<const TraceSite*>* sites = new std::vector<const TraceSite*>(1);
+  return *sites;
+}
+
+TraceSite::TraceSite(const char* file, int line, const char* statement)
+: m_file(file)
+, m_line(line)
+, m_statement(statement)
+{
+  std::lock_guard<std::mutex> lock(siteMutex);
+  m_id = (unsigned)Sites().size();
+  Sites().push_back(this);
+}
+
+void TraceSite::GetSites(unsigned first, std::vector<const TraceSite*>& sites)
 {
-  traceStream << TimeStamp();
+  std::lock_guard<std::mutex> lock(siteMutex);
+  const std::vector<const TraceSite*>& all = Sites();
+  if (first < all.size()) sites.insert(sites.end(), all.begin() + first, all.end());
+}
+
+////////////////////////////////////////////////////////////////
+//
+//  TraceMessage
+//
+
+/** Buffer of a message, that keeps its memory when cleared. Arguments
+  that are formatted at once are written to the stream, whose text is
+  then copied to the arguments. */
+struct TraceMessage::Buffer: public std::streambuf {
+  char* data;       //< The arguments
+  size_t capacity;
+  std::string text;
+  std::ostream stream;
+  std::ios_base::fmtflags flags;
+  bool busy;
+  bool streamUsed;  //< The format of the stream may have changed
+  Buffer()
+  : data(new char[256]), capacity(256), stream(this), flags(stream.flags()),
+    busy(false), streamUsed(false) {}
+  ~Buffer() { delete[] data; }
+  /// Clear the format of the previous message
+  void Reset() {
+    if (not streamUsed) return;
+    text.clear();
+    stream.clear();
+    stream.flags(flags);
+    stream.precision(6);
+    stream.width(0);
+    stream.fill(' ');
+    streamUsed = false;
+  }
+protected:
+  virtual int_type overflow(int_type c) {
+    if (c != traits_type::eof()) text += (char)c;
+    return c;
+  }
+  virtual std::streamsize xsputn(const char* s, std::streamsize n) {
+    text.append(s, (size_t)n);
+    return n;
+  }
+};
+
+/** Deletes the buffer of a thread when it exits */
+struct BufferOwner {
+  TraceMessage::Buffer* buffer;
+  BufferOwner() : buffer(0) {}
+  ~BufferOwner() { delete buffer; buffer = 0; }
+};
+static thread_local BufferOwner threadBuffer;
+
+TraceMessage::TraceMessage()
+: m_formatted(false)
+{
+  if (threadBuffer.buffer == 0) threadBuffer.buffer = new Buffer;
+  m_owned = threadBuffer.buffer->busy;
+  m_buffer = m_owned ? new Buffer : threadBuffer.buffer;
+  m_buffer->busy = true;
+  m_buffer->Reset();
+  m_pos = m_buffer->data;
+  m_end = m_buffer->data + m_buffer->capacity;
+}
+
+TraceMessage::~TraceMessage()
+{
+  if (m_owned) delete m_buffer;
+  else m_buffer->busy = false;
+}
+
+void TraceMessage::Reserve(size_t size)
+{
+  const size_t used = m_pos - m_buffer->data;
+  if (used + size <= m_buffer->capacity) return;
+  const size_t capacity = std::max(2 * m_buffer->capacity, used + size);
+  char* data = new char[capacity];
+  memcpy(data, m_buffer->data, used);
+  delete[] m_buffer->data;
+  m_buffer->data = data;
+  m_buffer->capacity = capacity;
+  m_pos = data + used;
+  m_end = data + capacity;
+}
+
+TraceMessage& TraceMessage::Text(const char* text, size_t size)
+{
+  // Text beyond MAX_SIZE would be cut anyway
+  size = std::min(size, MAX_SIZE);
+  if ((size_t)(m_end - m_pos) < size + 5) Reserve(size + 5);
+  m_pos[0] = TRACE_ARG_TEXT;
+  for (int i = 0; i < 4; i++) m_pos[i+1] = (char)(size >> 8*i);
+  memcpy(m_pos + 5, text, size);
+  m_pos += size + 5;
+  return *this;
+}
+
+std::ostream& TraceMessage::Stream()
+{
+  m_buffer->streamUsed = true;
+  return m_buffer->stream;
+}
+
+TraceMessage& TraceMessage::Formatted()
+{
+  std::string& text = m_buffer->text;
+  if (text.empty()) {
+    // Nothing written, so it was a manipulator such as std::setw
+    m_formatted = true;
+    return *this;
+  }
+  Text(text.data(), text.size());
+  text.clear();
+  return *this;
+}
+
+TraceMessage& TraceMessage::operator << (std::ostream& (*manipulator)(std::ostream&))
+{
+  typedef std::ostream& (*Manipulator)(std::ostream&);
+  if (manipulator == (Manipulator)std::endl) return *this << '\n';
+  if (manipulator == (Manipulator)std::flush) return *this;
+  manipulator(Stream());
+  m_formatted = true;
+  return Formatted();
+}
+
+TraceMessage& TraceMessage::operator << (std::ios_base& (*manipulator)(std::ios_base&))
+{
+  manipulator(Stream());
+  m_formatted = true;
+  return *this;
+}
+
+void TraceMessage::Record(const TraceSite& site, bool stamp)
+{
+  const char* data = m_buffer->data;
+  const size_t size = m_pos - data;
+  if (size <= MAX_SIZE) {
+    TraceCollector::GetInstance().Record(site.Id(), data, size, stamp);
+    return;
+  }
+  // A message that can never fit is cut, as text
+  std::string text;
+  RenderTraceArguments(data, size, text);
+  text.resize(MAX_SIZE - 1);
+  text += '\n';
+  TraceCollector::GetInstance().Record(0, text.data(), text.size(), stamp);
 }
 
 /// The global assert failure instance is stored here
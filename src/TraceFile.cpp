@@ -0,0 +1,257 @@
+/** @file TraceFile.cpp
+
+  This library is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#include "TraceFile.hpp"
+
+//// Headers ///////////////////////////////////////////////////
+
+#include "config.h"
+
+#include "Trace.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+using namespace std;
+
+static const char TRACE_MAGIC[4] = { 'A','B','T','R' };
+static const unsigned char TRACE_VERSION = 1;
+static const size_t HEADER_SIZE = 24;
+/// Bytes read at a time of a field whose length is not checked in advance
+static const size_t READ_CHUNK = 1 << 16;
+
+static unsigned long GetU32(const char* data) {
+  const unsigned char* p = (const unsigned char*)data;
+  return p[0] | p[1] << 8 | p[2] << 16 | (unsigned long)p[3] << 24;
+}
+
+static unsigned long long GetU64(const char* data) {
+  unsigned long long value = 0;
+  for (int i=7; i>=0; i--) value = value << 8 | (unsigned char)data[i];
+  return value;
+}
+
+/// Append value in decimal
+static void AppendUnsigned(string& text, unsigned long long value) {
+  char digits[24];
+  char* p = digits + sizeof(digits);
+  do { *--p = (char)('0' + value % 10); value /= 10; } while (value > 0);
+  text.append(p, digits + sizeof(digits) - p);
+}
+
+bool RenderTraceArguments(const char* data, size_t size, string& text)
+{
+  const char* end = data + size;
+  while (data < end) {
+    const char type = *data++;
+    const size_t valueSize = type == TRACE_ARG_TEXT ? 4
+      : type == TRACE_ARG_CHAR or type == TRACE_ARG_BOOL ? 1 : 8;
+    if ((size_t)(end - data) < valueSize) return false;
+    switch (type) {
+    case TRACE_ARG_TEXT: {
+      const size_t length = GetU32(data);
+      data += 4;
+      if ((size_t)(end - data) < length) return false;
+      text.append(data, length);
+      data += length;
+      continue;
+    }
+    case TRACE_ARG_CHAR:
+      text += *data;
+      break;
+    case TRACE_ARG_BOOL:
+      text += *data ? '1' : '0';
+      break;
+    case TRACE_ARG_INT: {
+      const long long value = (long long)GetU64(data);
+      if (value < 0) {
+        text += '-';
+        AppendUnsigned(text, 0 - (unsigned long long)value);
+      }
+      else AppendUnsigned(text, value);
+      break;
+    }
+    case TRACE_ARG_UINT:
+      AppendUnsigned(text, GetU64(data));
+      break;
+    case TRACE_ARG_DOUBLE: {
+      // As std::ostream with the default precision of 6
+      const unsigned long long bits = GetU64(data);
+      double value;
+      memcpy(&value, &bits, sizeof(value));
+      char number[40];
+      snprintf(number, sizeof(number), "%g", value);
+      text += number;
+      break;
+    }
+    case TRACE_ARG_POINTER: {
+      // As std::ostream: hex with 0x, but 0 without
+      unsigned long long value = GetU64(data);
+      if (value == 0) {
+        text += '0';
+        break;
+      }
+      char digits[24];
+      char* p = digits + sizeof(digits);
+      for (; value > 0; value >>= 4) *--p = "0123456789abcdef"[value & 15];
+      *--p = 'x';
+      *--p = '0';
+      text.append(p, digits + sizeof(digits) - p);
+      break;
+    }
+    default:
+      return false;
+    }
+    data += valueSize;
+  }
+  return true;
+}
+
+void TraceStampFormat::Append(long long us, unsigned thread, string& text)
+{
+  if (us / 1000000 != m_second) {
+    m_second = us / 1000000;
+    const time_t t = (time_t)m_second;
+    tm* now_tm = gmtime(&t);
+    if (now_tm == 0) strcpy(m_date, "--gmtime()==0--");
+    else strftime(m_date, sizeof(m_date), "%Y%m%d %H:%M:%S", now_tm);
+  }
+  // Microseconds and thread, "date.uuuuuu Tn "
+  char prefix[32];
+  char* p = prefix + sizeof(prefix);
+  *--p = ' ';
+  do { *--p = (char)('0' + thread % 10); thread /= 10; } while (thread > 0);
+  *--p = 'T';
+  *--p = ' ';
+  long long fraction = us % 1000000;
+  for (int digit = 0; digit < 6; digit++, fraction /= 10) *--p = (char)('0' + fraction % 10);
+  *--p = '.';
+  text += m_date;
+  text.append(p, prefix + sizeof(prefix) - p);
+}
+
+//// TraceFileReader ///////////////////////////////////////////
+
+TraceFileReader::TraceFileReader(istream& in)
+: m_in(in)
+, m_valid(false)
+, m_corrupt(false)
+, m_startSystem(0)
+, m_startSteady(0)
+, m_left(~0ULL)
+, m_sites(1)
+{
+  // Lengths are checked against the bytes left, if the stream can tell
+  const streampos start = m_in.tellg();
+  if (start != streampos(-1) and m_in.seekg(0, ios::end)) {
+    const streampos end = m_in.tellg();
+    m_in.seekg(start);
+    if (end != streampos(-1) and end >= start) m_left = (unsigned long long)(end - start);
+  }
+  m_in.clear();
+  char header[HEADER_SIZE];
+  if (not Read(header, HEADER_SIZE)) return;
+  if (memcmp(header, TRACE_MAGIC, 4) != 0 or header[4] != (char)TRACE_VERSION) return;
+  m_startSystem = (long long)GetU64(header + 8);
+  m_startSteady = (long long)GetU64(header + 16);
+  m_valid = true;
+}
+
+bool TraceFileReader::Read(char* data, size_t size)
+{
+  if (size > m_left or not m_in.read(data, size)) return false;
+  m_left -= size;
+  return true;
+}
+
+bool TraceFileReader::Read(string& data, unsigned long size)
+{
+  data.clear();
+  if (size > m_left) return false;
+  // A length that is corrupt fails at the end of the stream, before much is allocated
+  while (data.size() < size) {
+    const size_t done = data.size();
+    const size_t chunk = min((size_t)(size - done), READ_CHUNK);
+    data.resize(done + chunk);
+    if (not Read(&data[done], chunk)) return false;
+  }
+  return true;
+}
+
+bool TraceFileReader::ReadSite()
+{
+  char fields[12];
+  if (not Read(fields, sizeof(fields))) return false;
+  const unsigned id = GetU32(fields);
+  // Ids are given in order, but the file only has the sites that traced
+  if (id == 0 or id > 0xFFFFFF) return false;
+  Site site;
+  site.line = (int)GetU32(fields + 4);
+  if (not Read(site.file, GetU32(fields + 8))) return false;
+  if (not Read(fields, 4)) return false;
+  if (not Read(site.statement, GetU32(fields))) return false;
+  site.known = true;
+  if (id >= m_sites.size()) m_sites.resize(id + 1);
+  m_sites[id] = site;
+  return true;
+}
+
+bool TraceFileReader::Next(TraceFileMessage& message)
+{
+  if (not m_valid or m_corrupt) return false;
+  for (;;) {
+    char type;
+    if (m_left == 0 or not m_in.get(type)) {
+      // Only the end of a record is the end of the file
+      if (m_in.bad()) break;
+      return false;
+    }
+    m_left--;
+    if (type == 'S') {
+      if (not ReadSite()) break;
+      continue;
+    }
+    if (type != 'M') break;
+    char fields[21];
+    if (not Read(fields, sizeof(fields))) break;
+    const long long time = (long long)GetU64(fields);
+    message.time = m_startSystem + (time - m_startSteady) / 1000;
+    message.thread = GetU32(fields + 8);
+    message.site = GetU32(fields + 12);
+    message.stamp = fields[16] != 0;
+    if (not Read(m_data, GetU32(fields + 17))) break;
+    message.text.clear();
+    if (message.site == 0) {
+      message.file.clear();
+      message.line = 0;
+      message.statement.clear();
+      message.text = m_data;
+      return true;
+    }
+    // A message comes after its site
+    if (message.site >= m_sites.size() or not m_sites[message.site].known) break;
+    const Site& site = m_sites[message.site];
+    message.file = site.file;
+    message.line = site.line;
+    message.statement = site.statement;
+    if (not RenderTraceArguments(m_data.data(), m_data.size(), message.text)) break;
+    return true;
+  }
+  m_corrupt = true;
+  return false;
+}
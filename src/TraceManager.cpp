@@ -22,9 +22,11 @@
 #include <iso646.h>
 #include <string>
 #include <map>
+#include <mutex>
 #include <fstream>
 using namespace std;
 #include "Settings.hpp"
+#include "PerfCounters.hpp"
 
 // Set to 1 to get trace in file tm.log
 #if 0
@@ -56,8 +58,11 @@ bool SetTraceFlag(const char* flag_name, const char* file_name, bool enable) {
 
 ////////////////////////////////////////////////////////////////
 
+/** Trace flags are registered when first used, which may happen on any
+  thread, so the register is protected by a mutex. */
 struct TraceFlagRegister {
   void Register(TraceFlag& traceFlag) {
+    lock_guard<recursive_mutex> guard(lock);
     TR("Register flag="<<traceFlag.GetFlagName()<<" file="<<traceFlag.GetFileName());
     flag2instance.insert(make_pair(traceFlag.GetFlagName(),&traceFlag));
     file2instance.insert(make_pair(traceFlag.GetFileName(),&traceFlag));
@@ -66,7 +71,7 @@ struct TraceFlagRegister {
     int matches = 0;
 
     TR("SetFlagsInFile before loop of size="<<file2instance.size());
-    for (Str2Flag::iterator i = file2instance.find(flag_name);
+    for (Str2Flag::iterator i = file2instance.find(file_name);
          i != file2instance.end() and i->first == file_name;
          i++)
     {
@@ -97,6 +102,7 @@ struct TraceFlagRegister {
     return matches > 0;
   }
   bool SetTraceFlag(const string flag_name, const string file_name, bool enable) {
+    lock_guard<recursive_mutex> guard(lock);
     if (flag2instance.find(flag_name) != flag2instance.end())
       return SetFlagsWithName(flag_name,file_name,enable);
     else
@@ -107,6 +113,7 @@ struct TraceFlagRegister {
   typedef multimap<string, TraceFlag*> Str2Flag;
   Str2Flag flag2instance;
   Str2Flag file2instance;
+  recursive_mutex lock;
 };
 
 TraceManager::TraceManager()
@@ -131,6 +138,7 @@ bool TraceManager::SetTraceFlag(
 /** Insert class specific configuration into settings.
 Will overwrite those already present silently. */
 void TraceManager::GetConfiguration(Settings& settings) const {
+  lock_guard<recursive_mutex> guard(m_traceFlagRegister->lock);
   for (TraceFlagRegister::Str2Flag::const_iterator i
          = m_traceFlagRegister->flag2instance.begin();
        i != m_traceFlagRegister->flag2instance.end();
@@ -141,11 +149,14 @@ void TraceManager::GetConfiguration(Settings& settings) const {
     bool value = tf.IsTraceEnabled();
     Set(settings,key,value);
   }
+  // Only the interval, the counts are not configuration
+  Set(settings,"perf.interval",PerfCounters::GetInstance().Interval());
 }
 
 /** Configure class according to settings.
 Extra settings are silently ignored. */
 void TraceManager::SetConfiguration(const Settings& settings) {
+  lock_guard<recursive_mutex> guard(m_traceFlagRegister->lock);
   for (TraceFlagRegister::Str2Flag::iterator i
          = m_traceFlagRegister->flag2instance.begin();
        i != m_traceFlagRegister->flag2instance.end();
@@ -157,6 +168,7 @@ void TraceManager::SetConfiguration(const Settings& settings) {
     Get(settings,key,value);
     tf.SetTraceEnabled(value);
   }
+  PerfCounters::GetInstance().SetConfiguration(settings);
 }
 
 void TraceManager::SyncConfigFile(std::string configFile) {
@@ -0,0 +1,449 @@
+/** @file AEPTest.cpp
+  Tests of the AEP front end: the input, search and reply threads of Play().
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <atomic>
+#include <chrono>
+#include <sstream>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "AEPWrap.hpp"
+#include "TimeManager.hpp"
+#include "Check.hpp"
+#include "TestGames.hpp"
+
+using namespace std;
+using namespace Haliotis;
+namespace AEP = AbaloneEngineProtocol;
+
+/// Name of file used for trace messages
+const char* TRACE_FILE = "AEPTest.log";
+
+typedef std::chrono::steady_clock Clock;
+
+/** Input of Play(): lines sent by the test, read with blocking reads as
+  from a GUI */
+class CommandFeed: public std::streambuf {
+private:
+  std::mutex m_mutex;
+  std::condition_variable m_wake;
+  string m_pending;
+  string m_reading;
+  bool m_closed;
+protected:
+  virtual int_type underflow() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_wake.wait(lock, [this]() { return not m_pending.empty() or m_closed; });
+    if (m_pending.empty()) return traits_type::eof();
+    m_reading.swap(m_pending);
+    m_pending.clear();
+    setg(&m_reading[0], &m_reading[0], &m_reading[0] + m_reading.size());
+    return traits_type::to_int_type(m_reading[0]);
+  }
+public:
+  CommandFeed() : m_closed(false) {}
+  void Send(const string& line) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_pending += line + '\n';
+    m_wake.notify_one();
+  }
+  /// End of input
+  void Close() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_closed = true;
+    m_wake.notify_one();
+  }
+};
+
+/** Output of Play(), split into lines. The test may wait for a line while
+  the reply thread writes. */
+class ReplyLog: public std::streambuf {
+private:
+  mutable std::mutex m_mutex;
+  std::condition_variable m_wake;
+  string m_line;
+  vector<string> m_lines;
+protected:
+  virtual int_type overflow(int_type c) {
+    if (traits_type::eq_int_type(c, traits_type::eof())) return 0;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (c == '\n') {
+      m_lines.push_back(m_line);
+      m_line.clear();
+      m_wake.notify_all();
+    }
+    else {
+      m_line += traits_type::to_char_type(c);
+    }
+    return c;
+  }
+public:
+  vector<string> Lines() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_lines;
+  }
+  /// Lines starting with prefix
+  size_t Count(const string& prefix) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    size_t count = 0;
+    for (size_t i = 0; i < m_lines.size(); i++) {
+      if (m_lines[i].compare(0, prefix.size(), prefix) == 0) count++;
+    }
+    return count;
+  }
+  /// Wait until count lines start with prefix. @return false on timeout
+  bool WaitFor(const string& prefix, size_t count = 1, int ms = 10000) {
+    const Clock::time_point end = Clock::now() + std::chrono::milliseconds(ms);
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;) {
+      size_t found = 0;
+      for (size_t i = 0; i < m_lines.size(); i++) {
+        if (m_lines[i].compare(0, prefix.size(), prefix) == 0) found++;
+      }
+      if (found >= count) return true;
+      if (m_wake.wait_until(lock, end) == std::cv_status::timeout) return false;
+    }
+  }
+};
+
+/** Searches until its time is up or it is stopped, and plays the first
+  legal move */
+class TestEngine: public AEP::Engine {
+public:
+  AEP::OptionSpin hash;
+  std::atomic<int> searches;      //< Calls of GetMove()
+  std::atomic<bool> searching;
+  std::atomic<int> optionChanges;
+  std::atomic<unsigned long long> position; //< Hash64() of the last SetGame()
+  Board2D board;
+
+  TestEngine()
+  : hash("Hash", 1, 1024, 16), searches(0), searching(false)
+  , optionChanges(0), position(0)
+  {
+    AddOption(hash);
+  }
+  virtual void SetGame(const Game& game) {
+    board = game.board;
+    position.store(board.Hash64());
+  }
+  virtual string GetName() const { return "TestEngine"; }
+  virtual string GetAuthor() const { return "Haliotis"; }
+  virtual void SetDebug(bool) {}
+  virtual void GetMove(Board2D::Move& m) {
+    searches++;
+    searching.store(true);
+    Time().Start(board, Pondering());
+    while (not Time().ShouldStop()) std::this_thread::yield();
+    board.FirstMove(m);
+    searching.store(false);
+  }
+  virtual void StopSearch() {}
+  virtual void OptionChanged(AEP::Option&) { optionChanges++; }
+};
+
+/// Play() on its own thread, fed by the test
+struct Session {
+  TestEngine engine;
+  CommandFeed feed;
+  ReplyLog log;
+  std::istream in;
+  std::ostream out;
+  std::thread thread;
+  Session() : in(&feed), out(&log) {
+    thread = std::thread([this]() { AEP::Play(engine, in, out); });
+  }
+  ~Session() {
+    feed.Close();
+    if (thread.joinable()) thread.join();
+  }
+  void Send(const string& line) { feed.Send(line); }
+  /// Send "quit" and wait until Play() returns
+  void Quit() {
+    Send("quit");
+    thread.join();
+  }
+  /// Wait until the engine searches. @return false on timeout
+  bool WaitForSearch() {
+    const Clock::time_point end = Clock::now() + std::chrono::seconds(10);
+    while (not engine.searching.load()) {
+      if (Clock::now() > end) return false;
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+  }
+};
+
+/// The "position" command of board, with the fields row by row
+static string Position(const Board2D& board)
+{
+  string command = "position abp";
+  for (int y = 0; y <= 8; y++) {
+    command += ' ';
+    for (int x = 0; x <= 8; x++) {
+      if (Board2D::Pos(x, y).Valid()) command += (char)('0' + board.field[x][y]);
+    }
+  }
+  return command;
+}
+
+static Board2D StartPos()
+{
+  Board2D board;
+  board.SetUpStartPos();
+  return board;
+}
+
+/** The replies of the commands come in the order of the commands, and a
+  search stopped while it runs replies with exactly one bestmove */
+static void TestReplies()
+{
+  Session session;
+  session.Send("aep");
+  session.Send("setoption name Hash value 64");
+  session.Send("isready");
+  session.Send(Position(StartPos()));
+  session.Send("go infinite");
+  CHECK(session.WaitForSearch());
+  session.Send("stop");
+  CHECK(session.log.WaitFor("bestmove"));
+  session.Send("isready");
+  CHECK(session.log.WaitFor("readyok", 3));
+  session.Quit();
+  CHECK(session.engine.searches.load() == 1);
+  CHECK(session.engine.hash.Value() == 64);
+  CHECK(session.engine.optionChanges.load() == 1);
+  const vector<string> lines = session.log.Lines();
+  CHECK(lines.size() == 7);
+  if (lines.size() != 7) return;
+  CHECK(lines[0] == "id name TestEngine");
+  CHECK(lines[1] == "id author Haliotis");
+  CHECK(lines[2].compare(0, 16, "option name Hash") == 0);
+  CHECK(lines[3] == "readyok");
+  CHECK(lines[4] == "readyok");
+  CHECK(lines[5].compare(0, 9, "bestmove ") == 0);
+  CHECK(lines[6] == "readyok");
+}
+
+/** "quit" during a search stops it, and Play() returns after its bestmove
+  is written */
+static void TestQuitDuringSearch()
+{
+  Session session;
+  session.Send(Position(StartPos()));
+  session.Send("go infinite");
+  CHECK(session.WaitForSearch());
+  session.Quit();
+  CHECK(session.log.Count("bestmove") == 1);
+  CHECK(session.engine.searches.load() == 1);
+}
+
+/// Start position after its first legal move
+static Board2D OtherPos()
+{
+  Board2D board = StartPos();
+  Board2D::Move move;
+  board.FirstMove(move);
+  board.DoMove(move);
+  return board;
+}
+
+/// Milliseconds since start
+static long long Since(Clock::time_point start)
+{
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+    Clock::now() - start).count();
+}
+
+/** A ponder search ignores its limits. "ponderhit" keeps the search, which
+  then stops by the limits of "go", counted from the ponderhit. */
+static void TestPonderHit()
+{
+  const long long MOVE_TIME = 100;
+  Session session;
+  session.Send(Position(StartPos()));
+  session.Send("go ponder movetime 100");
+  CHECK(session.WaitForSearch());
+  std::this_thread::sleep_for(std::chrono::milliseconds(3 * MOVE_TIME));
+  CHECK(session.log.Count("bestmove") == 0);
+  CHECK(session.engine.Pondering());
+  const Clock::time_point hit = Clock::now();
+  session.Send("ponderhit");
+  CHECK(session.log.WaitFor("bestmove"));
+  CHECK(Since(hit) >= MOVE_TIME - TimeManager::MOVE_OVERHEAD);
+  CHECK(not session.engine.Pondering());
+  session.Quit();
+  CHECK(session.engine.searches.load() == 1);
+  CHECK(session.log.Count("bestmove") == 1);
+}
+
+/** A new position while pondering is a ponder miss: the search is stopped
+  and its move is not sent. The next search replies as usual. */
+static void TestPonderMissPosition()
+{
+  Session session;
+  session.Send(Position(StartPos()));
+  session.Send("go ponder movetime 100");
+  CHECK(session.WaitForSearch());
+  const unsigned long long pondered = session.engine.position.load();
+  session.Send(Position(OtherPos()));
+  session.Send("isready");
+  CHECK(session.log.WaitFor("readyok"));
+  CHECK(session.log.Count("bestmove") == 0);
+  CHECK(session.engine.position.load() != pondered);
+  session.Send("go movetime 40");
+  CHECK(session.log.WaitFor("bestmove"));
+  session.Quit();
+  CHECK(session.engine.searches.load() == 2);
+  CHECK(session.log.Count("bestmove") == 1);
+}
+
+/// "stop" while pondering is also a ponder miss
+static void TestPonderMissStop()
+{
+  Session session;
+  session.Send(Position(StartPos()));
+  session.Send("go ponder");
+  CHECK(session.WaitForSearch());
+  session.Send("stop");
+  session.Send("isready");
+  CHECK(session.log.WaitFor("readyok"));
+  CHECK(session.log.Count("bestmove") == 0);
+  session.Send("go movetime 40");
+  CHECK(session.log.WaitFor("bestmove"));
+  session.Quit();
+  CHECK(session.engine.searches.load() == 2);
+  CHECK(session.log.Count("bestmove") == 1);
+}
+
+/// Hash64() of the position that a new Play() sets up for command
+static unsigned long long FreshPosition(const string& command)
+{
+  Session session;
+  session.Send(command);
+  session.Send("isready");
+  session.log.WaitFor("readyok");
+  session.Quit();
+  return session.engine.position.load();
+}
+
+/** The command of the start position followed by moves. The abp string
+  has no side to move, so the start position has player 2 to move. */
+static string PositionWithMoves(const vector<Board2D::Move>& moves)
+{
+  string command = Position(StartPos());
+  if (moves.empty()) return command;
+  command += " moves";
+  for (size_t i = 0; i < moves.size(); i++) {
+    ostringstream move;
+    move << moves[i];
+    command += ' ' + move.str();
+  }
+  return command;
+}
+
+/// Moves of a game from the start position of PositionWithMoves()
+static vector<Board2D::Move> Line(int plies, size_t seed)
+{
+  Board2D board = StartPos();
+  board.SetTurn(fPieceBlack);
+  vector<Board2D::Move> moves;
+  for (int i = 0; i < plies; i++) {
+    moves.push_back(NthMove(board, seed + 13 * i));
+    board.DoMove(moves.back());
+  }
+  return moves;
+}
+
+/** A position that extends the last one is parsed from where that one
+  ended. Each position must give the same board as a fresh parse: a longer
+  one, the same again, a shorter one, one that diverges after a common
+  prefix and then one without moves. */
+static void TestIncrementalPosition()
+{
+  const vector<Board2D::Move> line = Line(12, 1);
+  vector<Board2D::Move> diverging(line.begin(), line.begin() + 6);
+  const vector<Board2D::Move> other = Line(7, 2);
+  Board2D board = StartPos();
+  board.SetTurn(fPieceBlack);
+  for (size_t i = 0; i < diverging.size(); i++) board.DoMove(diverging[i]);
+  diverging.push_back(NthMove(board, 5));
+  if (diverging.back() == line[6]) diverging.back() = NthMove(board, 6);
+
+  vector<string> commands;
+  commands.push_back(PositionWithMoves(vector<Board2D::Move>()));
+  commands.push_back(PositionWithMoves(vector<Board2D::Move>(line.begin(), line.begin() + 4)));
+  commands.push_back(PositionWithMoves(line));
+  commands.push_back(PositionWithMoves(line));
+  commands.push_back(PositionWithMoves(vector<Board2D::Move>(line.begin(), line.begin() + 2)));
+  commands.push_back(PositionWithMoves(diverging));
+  commands.push_back(PositionWithMoves(other));
+  commands.push_back(PositionWithMoves(vector<Board2D::Move>()));
+
+  Session session;
+  for (size_t i = 0; i < commands.size(); i++) {
+    session.Send(commands[i]);
+    session.Send("isready");
+    CHECK(session.log.WaitFor("readyok", i + 1));
+    CHECK(session.engine.position.load() == FreshPosition(commands[i]));
+  }
+  // Each position is another board, except the repeated one
+  set<unsigned long long> positions;
+  for (size_t i = 0; i < commands.size(); i++) {
+    positions.insert(FreshPosition(commands[i]));
+  }
+  CHECK(positions.size() == commands.size() - 2);
+}
+
+/** "position" without arguments is a fatal error of the GUI: the engine
+  exits with an error, and does not read uninitialised tokens */
+static void TestPositionWithoutArguments()
+{
+  const pid_t pid = fork();
+  if (pid == 0) {
+    Session session;
+    session.Send("position");
+    session.Send("isready");
+    session.log.WaitFor("readyok");
+    _exit(0);
+  }
+  int status = 0;
+  CHECK(pid > 0 and waitpid(pid, &status, 0) == pid);
+  CHECK(WIFEXITED(status) and WEXITSTATUS(status) == 1);
+}
+
+int main()
+{
+  // First, since a forked child can not stop the trace thread of its parent
+  TestPositionWithoutArguments();
+  TestReplies();
+  TestQuitDuringSearch();
+  TestPonderHit();
+  TestPonderMissPosition();
+  TestPonderMissStop();
+  TestIncrementalPosition();
+  return CHECK_RESULT();
+}
@@ -0,0 +1,24 @@
+/** @file Check.hpp
+  Checks of the behaviour tests. Each test is a program that writes the
+  checks that fail to cerr, and fails if there are any. ctest runs them.
+*/
+
+#ifndef Check_hpp
+#define Check_hpp
+
+#include <iostream>
+
+/// Number of checks that failed
+static int checkFailures = 0;
+
+#define CHECK(x) { \
+  if (not (x)) { \
+    checkFailures++; \
+    std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #x ") failed" << std::endl; \
+  } \
+}
+
+/// Return value of main
+#define CHECK_RESULT() (checkFailures == 0 ? 0 : 1)
+
+#endif
@@ -0,0 +1,146 @@
+/** @file GameArchiveTest.cpp
+  Tests of the game records of the binary game archive.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <string>
+
+#include "GameArchive.hpp"
+#include "Check.hpp"
+#include "TestGames.hpp"
+
+using namespace std;
+using namespace Haliotis;
+
+/// Name of file used for trace messages
+const char* TRACE_FILE = "GameArchiveTest.log";
+
+/// Offset of the first token of a record without attributes or comment
+static const size_t FIRST_TOKEN = Board2D::PACKED_FIELDS_SIZE + 3 + 1;
+
+static void TestRoundTrip()
+{
+  Board2D start;
+  start.SetUpStartPos();
+  Game game(start);
+  PlayLine(game, 40, 1);
+  game.UndoMove();
+  game.UndoMove();
+  PlayLine(game, 5, 2);
+  game.SetComment("alternative");
+  string record;
+  GameArchive_Encode(game, record);
+  Game decoded;
+  CHECK(GameArchive_Decode(record.data(), record.size(), decoded));
+  string again;
+  GameArchive_Encode(decoded, again);
+  CHECK(again == record);
+}
+
+/// Decode a record of one move, with the move token replaced
+static bool DecodeToken(unsigned token)
+{
+  Board2D start;
+  start.SetUpStartPos();
+  Game game(start);
+  PlayLine(game, 1, 1);
+  string record;
+  GameArchive_Encode(game, record);
+  record[FIRST_TOKEN] = (char)(token & 0xFF);
+  record[FIRST_TOKEN + 1] = (char)(token >> 8);
+  Game decoded;
+  return GameArchive_Decode(record.data(), record.size(), decoded);
+}
+
+/** Tokens of moves that are out of range are rejected. Board2D::DoMove
+  would read outside the fields. */
+static void TestCorruptMoves()
+{
+  Board2D start;
+  start.SetUpStartPos();
+  Board2D::Move first;
+  start.FirstMove(first);
+  const unsigned valid = first.Pack();
+  CHECK(DecodeToken(valid));
+  // Head index 61-63
+  for (unsigned head = 61; head < 64; head++) {
+    CHECK(not DecodeToken((valid & 0xFF) | head << 8));
+  }
+  // Move direction 6 and 7
+  CHECK(not DecodeToken((valid & ~7u) | 6));
+  CHECK(not DecodeToken((valid & ~7u) | 7));
+  // Tail direction 6 and 7, tail count 0
+  CHECK(not DecodeToken((valid & ~(7u << 5)) | 6 << 5));
+  CHECK(not DecodeToken((valid & ~(7u << 5)) | 7 << 5));
+  CHECK(not DecodeToken(valid & ~(3u << 3)));
+  // Every token below the markers either decodes or is rejected
+  for (unsigned token = 0; token < ARCHIVE_COMMENT; token++) DecodeToken(token);
+}
+
+/// Append a token as the encoder writes it
+static void AppendToken(string& record, unsigned token)
+{
+  record += (char)(token & 0xFF);
+  record += (char)(token >> 8);
+}
+
+/** Two BEGIN markers in a row: the inner variation is an alternative to the
+  first move, the outer one to the second move. */
+static void TestNestedVariations()
+{
+  Board2D start;
+  start.SetUpStartPos();
+  const Board2D::Move first = NthMove(start, 1);
+  const Board2D::Move firstAlternative = NthMove(start, 2);
+  Board2D afterFirst = start;
+  afterFirst.DoMove(first);
+  const Board2D::Move second = NthMove(afterFirst, 3);
+  const Board2D::Move secondAlternative = NthMove(afterFirst, 4);
+
+  Game line(start);
+  line.DoMove(first);
+  line.DoMove(second);
+  string record;
+  GameArchive_Encode(line, record);
+  record.resize(record.size() - 2); // END_GAME
+  AppendToken(record, ARCHIVE_BEGIN_VARIATION);
+  AppendToken(record, ARCHIVE_BEGIN_VARIATION);
+  AppendToken(record, firstAlternative.Pack());
+  AppendToken(record, ARCHIVE_END_VARIATION);
+  AppendToken(record, secondAlternative.Pack());
+  AppendToken(record, ARCHIVE_END_VARIATION);
+  AppendToken(record, ARCHIVE_END_GAME);
+
+  Game decoded;
+  CHECK(GameArchive_Decode(record.data(), record.size(), decoded));
+  const GameTreeNode* root = decoded.Root();
+  CHECK(root->Children().size() == 2);
+  if (root->Children().size() != 2) return;
+  CHECK(root->Children()[1]->move == firstAlternative);
+  const GameTreeNode* node = root->Children()[0];
+  CHECK(node->Children().size() == 2);
+  if (node->Children().size() != 2) return;
+  CHECK(node->Children()[0]->move == second);
+  CHECK(node->Children()[1]->move == secondAlternative);
+}
+
+int main()
+{
+  TestRoundTrip();
+  TestCorruptMoves();
+  TestNestedVariations();
+  return CHECK_RESULT();
+}
@@ -0,0 +1,116 @@
+/** @file GameFormatsTest.cpp
+  Tests of the readers and writers of the AbaPro and Waterloo1993 formats.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <cstring>
+#include <sstream>
+#include <string>
+
+#include "GameFormats.hpp"
+#include "Check.hpp"
+#include "TestGames.hpp"
+
+using namespace std;
+using namespace Haliotis;
+
+/// Name of file used for trace messages
+const char* TRACE_FILE = "GameFormatsTest.log";
+
+/// Read one game from text
+static bool ReadGame(GameFormat format, const char* text, Game& game)
+{
+  GameFormatReader reader(format);
+  const char* p = text;
+  return reader.Read(p, text + strlen(text), game);
+}
+
+/// Board at the end of the main line
+static Board2D LastBoard(const Game& game)
+{
+  Board2D board = game.StartPos();
+  for (auto& pos : game.MainLine()) board = pos.board;
+  return board;
+}
+
+/** A Waterloo1993 game as written by hand. Black is the first player and
+  starts at the top, rows i, h and g. The columns are counted from the left
+  of each row, so g3 is the left black marble of row g, and c3 the left
+  white marble of row c. The same game in AbaPro notation, where the first
+  player starts at the bottom and the columns are the NW-SE diagonals, is
+  "1. c5d6 g7f7 2. b6c7 h4g3". */
+static const char* WATERLOO_GAME =
+  "[Black \"Black\"]\n"
+  "[White \"White\"]\n"
+  "\n"
+  "1. g3-f3 c3-d3\n"
+  "2. h1-g1 b6-c7\n"
+  "\n";
+
+static const char* ABAPRO_GAME =
+  "[Black \"Black\"]\n"
+  "[White \"White\"]\n"
+  "\n"
+  "1. c5d6 g7f7 2. b6c7 h4g3 *\n";
+
+static void TestWaterlooLayout()
+{
+  Game waterloo, abapro;
+  CHECK(ReadGame(FORMAT_WATERLOO1993, WATERLOO_GAME, waterloo));
+  CHECK(ReadGame(FORMAT_ABAPRO, ABAPRO_GAME, abapro));
+  int moves = 0;
+  for (auto& pos : waterloo.MainLine()) { (void)pos; moves++; }
+  CHECK(moves == 4);
+  CHECK(LastBoard(waterloo) == LastBoard(abapro));
+  // The writer gives back the moves as written by hand
+  ostringstream out;
+  GameFormatWriter(FORMAT_WATERLOO1993).Write(out, waterloo);
+  CHECK(out.str().find("1. g3-f3 c3-d3 2. h1-g1 b6-c7") != string::npos);
+}
+
+/// Games of legal moves are written and read back with the same boards
+static void TestRoundTrip(GameFormat format)
+{
+  GameFormatWriter writer(format);
+  for (unsigned seed = 1; seed <= 10; seed++) {
+    Board2D start;
+    start.SetUpStartPos();
+    Game game(start);
+    PlayLine(game, 80, seed);
+    game.UndoAllMoves();
+    ostringstream out;
+    writer.Write(out, game);
+    const string text = out.str();
+    Game read;
+    CHECK(ReadGame(format, text.c_str(), read));
+    auto expected = game.MainLine().begin();
+    auto actual = read.MainLine().begin();
+    for (; expected != game.MainLine().end() and actual != read.MainLine().end();
+         ++expected, ++actual) {
+      CHECK(actual->board == expected->board);
+    }
+    CHECK(expected == game.MainLine().end());
+    CHECK(actual == read.MainLine().end());
+  }
+}
+
+int main()
+{
+  TestWaterlooLayout();
+  TestRoundTrip(FORMAT_ABAPRO);
+  TestRoundTrip(FORMAT_WATERLOO1993);
+  return CHECK_RESULT();
+}
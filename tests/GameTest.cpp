@@ -0,0 +1,174 @@
+/** @file GameTest.cpp
+  Tests of the game tree iterators.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <vector>
+
+#include "Game.hpp"
+#include "Check.hpp"
+#include "TestGames.hpp"
+
+using namespace std;
+using namespace Haliotis;
+
+/// Name of file used for trace messages
+const char* TRACE_FILE = "GameTest.log";
+
+/// Add a line of length moves after node
+static void AddLine(GameTreeNode* node, Board2D board, int length, size_t seed)
+{
+  for (int i = 0; i < length; i++) {
+    const Board2D::Move move = NthMove(board, seed + 7 * i);
+    board.DoMove(move);
+    node = node->GetNextNode(move);
+  }
+}
+
+struct Visit {
+  const GameTreeNode* node;
+  Board2D board;
+  int depth;
+  size_t childNo;
+};
+
+/// Preorder of the tree by recursion, as the iterator should visit it
+static void Visit(const GameTreeNode* node, const Board2D& board, int depth,
+                  vector<struct Visit>& visits)
+{
+  const vector<GameTreeNode*>& children = node->Children();
+  for (size_t i = 0; i < children.size(); i++) {
+    struct Visit visit = { children[i], board, depth + 1, i };
+    visit.board.DoMove(children[i]->move);
+    visits.push_back(visit);
+    Visit(children[i], visit.board, depth + 1, visits);
+  }
+}
+
+/// Compare the iterator with the recursion
+static void CheckPreorder(const Game& game)
+{
+  vector<struct Visit> expected;
+  Visit(game.Root(), game.StartPos(), 0, expected);
+  size_t i = 0;
+  for (PreorderIterator it = game.Preorder().begin(); it != game.Preorder().end(); ++it, ++i) {
+    CHECK(i < expected.size());
+    if (i >= expected.size()) return;
+    CHECK(it->node == expected[i].node);
+    CHECK(it->board == expected[i].board);
+    CHECK(it.Depth() == expected[i].depth);
+    CHECK(it.ChildNo() == expected[i].childNo);
+  }
+  CHECK(i == expected.size());
+}
+
+static void TestPreorderEmpty()
+{
+  Game game;
+  CHECK(game.Preorder().begin() == game.Preorder().end());
+}
+
+static void TestPreorderLine()
+{
+  Board2D start;
+  start.SetUpStartPos();
+  Game game(start);
+  AddLine(game.Root(), start, 20, 3);
+  CheckPreorder(game);
+}
+
+/** Each move of the main line has an alternative with a line of its own,
+  so more alternatives are open than the iterator keeps boards for */
+static void TestPreorderNested()
+{
+  Board2D start;
+  start.SetUpStartPos();
+  Game game(start);
+  GameTreeNode* node = game.Root();
+  Board2D board = start;
+  for (int i = 0; i < 30; i++) {
+    const Board2D::Move main = NthMove(board, 5 * i);
+    const Board2D::Move alternative = NthMove(board, 5 * i + 1);
+    GameTreeNode* next = node->GetNextNode(main);
+    Board2D other = board;
+    other.DoMove(alternative);
+    AddLine(node->GetNextNode(alternative), other, 2, i);
+    board.DoMove(main);
+    node = next;
+  }
+  CheckPreorder(game);
+  // Postfix increment returns the position before
+  PreorderIterator it = game.Preorder().begin();
+  PreorderIterator before = it++;
+  CHECK(before->node == game.Root()->Children()[0]);
+  CHECK(it->node == game.Root()->Children()[0]->Children()[0]);
+}
+
+/** Every move of a long game is taken back, by the undo info of the board
+  before it. Pushes off the board are included. */
+static void TestUndoMove()
+{
+  Board2D board;
+  board.SetUpStartPos();
+  bool pushedOff = false;
+  for (int ply = 0; ply < 300; ply++) {
+    for (auto& m : board.AllMoves()) {
+      Board2D after = board;
+      const unsigned char undo = after.UndoInfo(m.move);
+      after.DoMove(m.move);
+      CHECK(after == m.board);
+      pushedOff = pushedOff or after.WhiteOff() + after.BlackOff()
+                                 != board.WhiteOff() + board.BlackOff();
+      after.UndoMove(m.move, undo);
+      CHECK(after == board);
+    }
+    board.DoMove(NthMove(board, 11 * ply + 3));
+  }
+  CHECK(pushedOff);
+}
+
+/** A line longer than the moves the iterator keeps undo info for, with
+  alternatives on both sides of that depth */
+static void TestPreorderDeep()
+{
+  Board2D start;
+  start.SetUpStartPos();
+  Game game(start);
+  GameTreeNode* node = game.Root();
+  Board2D board = start;
+  for (int i = 0; i < 600; i++) {
+    const Board2D::Move main = NthMove(board, 3 * i);
+    if (i % 50 == 49) {
+      Board2D other = board;
+      const Board2D::Move alternative = NthMove(board, 3 * i + 1);
+      other.DoMove(alternative);
+      AddLine(node->GetNextNode(alternative), other, 3, i);
+    }
+    node = node->GetNextNode(main);
+    board.DoMove(main);
+  }
+  CheckPreorder(game);
+}
+
+int main()
+{
+  TestUndoMove();
+  TestPreorderDeep();
+  TestPreorderEmpty();
+  TestPreorderLine();
+  TestPreorderNested();
+  return CHECK_RESULT();
+}
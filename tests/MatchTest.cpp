@@ -0,0 +1,137 @@
+/** @file MatchTest.cpp
+  Tests of the match statistics, and of the errors of an engine process.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <cmath>
+#include <csignal>
+#include <string>
+
+#include "Match.hpp"
+#include "EngineProcess.hpp"
+#include "Check.hpp"
+
+using namespace std;
+
+/// Name of file used for trace messages
+const char* TRACE_FILE = "MatchTest.log";
+
+static bool Near(double a, double b)
+{
+  return fabs(a - b) < 1e-3;
+}
+
+/** Score, Elo, its margin and the LLR of elo0 = 0 against elo1 = 5 for
+  known results. All wins and all losses have a score variance of 0. */
+static void TestStatistics()
+{
+  struct Row {
+    unsigned wins, draws, losses;
+    double score, elo, margin, llr;
+  };
+  const Row table[] = {
+    {  50,  0,  50, 0.5,    0,        68.9901, -0.0104 },
+    {  60, 20,  20, 0.7,  147.1907,   66.0146,  0.8832 },
+    {  20, 20,  60, 0.3, -147.1907,   66.0146, -0.9156 },
+    {  30, 40,  30, 0.5,    0,        53.1590, -0.0173 },
+    {   0, 10,   0, 0.5,    0,        65.7004, -0.0114 },
+    { 100,  0,   0, 1.0,  919.5412,  116.0448, 72.5064 },
+    {   0,  0, 100, 0.0, -919.5412,  116.0448, -73.5573 },
+    {   1,  0,   0, 1.0,    0,         0,       0.0190 },
+  };
+  for (size_t i = 0; i < sizeof(table) / sizeof(table[0]); i++) {
+    MatchStatistics stats;
+    stats.wins = table[i].wins;
+    stats.draws = table[i].draws;
+    stats.losses = table[i].losses;
+    double margin = -1;
+    CHECK(Near(stats.Score(), table[i].score));
+    CHECK(Near(stats.Elo(&margin), table[i].elo));
+    CHECK(Near(margin, table[i].margin));
+    CHECK(Near(stats.LLR(0, 5), table[i].llr));
+  }
+  // No games
+  MatchStatistics none;
+  double margin = -1;
+  CHECK(none.Score() == 0.5);
+  CHECK(none.Elo(&margin) == 0);
+  CHECK(margin == 0);
+  CHECK(none.LLR(0, 5) == 0);
+}
+
+/// A process that exits at once: no output, and writing fails
+static void TestProcessDies()
+{
+  EngineProcess process;
+  CHECK(process.Start("exit 3"));
+  string line;
+  CHECK(not process.ReadLine(line, 5000));
+  CHECK(not process.Running());
+  CHECK(not process.WriteLine("isready"));
+  CHECK(not process.ReadLine(line, 0));
+  // Killed by a signal
+  CHECK(process.Start("kill -9 $$"));
+  CHECK(not process.ReadLine(line, 5000));
+  CHECK(not process.Running());
+}
+
+/** The lines written before the end of the output are read, then reading
+  fails at the end of the pipe. A line without a line end is lost. */
+static void TestProcessEndOfOutput()
+{
+  EngineProcess process;
+  CHECK(process.Start("printf 'id name Test\\nreadyok\\r\\nno line end'"));
+  string line;
+  CHECK(process.ReadLine(line, 5000));
+  CHECK(line == "id name Test");
+  CHECK(process.ReadLine(line, 5000));
+  CHECK(line == "readyok");
+  CHECK(not process.ReadLine(line, 5000));
+  CHECK(not process.Running());
+  // The process reads one line and exits while the caller writes
+  CHECK(process.Start("read line; echo \"$line\""));
+  CHECK(process.WriteLine("first"));
+  CHECK(process.ReadLine(line, 5000));
+  CHECK(line == "first");
+  CHECK(not process.ReadLine(line, 5000));
+  CHECK(not process.WriteLine("second"));
+}
+
+/// A process that does not answer times out, but keeps running
+static void TestProcessTimeout()
+{
+  EngineProcess process;
+  CHECK(process.Start("cat 2>/dev/null"));
+  string line;
+  CHECK(not process.ReadLine(line, 50));
+  CHECK(process.Running());
+  CHECK(process.WriteLine("isready"));
+  CHECK(process.ReadLine(line, 5000));
+  CHECK(line == "isready");
+  process.Stop(100);
+  CHECK(not process.Running());
+}
+
+int main()
+{
+  // Writing to a process that has exited must fail, not end the test
+  signal(SIGPIPE, SIG_IGN);
+  TestStatistics();
+  TestProcessDies();
+  TestProcessEndOfOutput();
+  TestProcessTimeout();
+  return CHECK_RESULT();
+}
@@ -0,0 +1,145 @@
+/** @file OpeningBookTest.cpp
+  Tests of the symmetries of the opening book.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <cstdio>
+#include <fstream>
+#include <set>
+#include <vector>
+
+#include "OpeningBook.hpp"
+#include "Check.hpp"
+#include "TestGames.hpp"
+
+using namespace std;
+using namespace Haliotis;
+
+/// Name of file used for trace messages
+const char* TRACE_FILE = "OpeningBookTest.log";
+
+static const char* BOOK_FILE = "OpeningBookTest.abb";
+static const int SYMMETRIES = 12;
+
+/// Board turned by a symmetry, found from the head of single marble moves
+static Board2D TransformBoard(const Board2D& board, int symmetry)
+{
+  Board2D result = board;
+  for (int x = 0; x < 9; x++) {
+    for (int y = 0; y < 9; y++) {
+      Board2D::Move marble;
+      marble.head = Board2D::Pos(x, y);
+      if (not marble.head.Valid()) continue;
+      marble.tailCount = 1;
+      marble.tailDir = 0;
+      marble.moveDir = 0;
+      const Board2D::Pos to = BookTransform(marble, symmetry).head;
+      result.field[to.x][to.y] = board.field[x][y];
+    }
+  }
+  return result;
+}
+
+/// Positions of a game, to test the symmetries on
+static vector<Board2D> Positions()
+{
+  Board2D start;
+  start.SetUpStartPos();
+  Game game(start);
+  PlayLine(game, 12, 7);
+  vector<Board2D> positions(1, start);
+  for (auto& pos : game.MainLine()) positions.push_back(pos.board);
+  return positions;
+}
+
+/** A move transformed and transformed back is the same move, and the two
+  ways to write a line of marbles give the same move */
+static void TestInverse()
+{
+  vector<Board2D> positions = Positions();
+  for (size_t i = 0; i < positions.size(); i++) {
+    const Board2D& board = positions[i];
+    for (auto& m : board.AllMoves()) {
+      Board2D::Move reversed = m.move;
+      if (reversed.tailCount > 1) {
+        reversed.head = m.move.FromLast();
+        reversed.tailDir = (m.move.tailDir + 3) % 6;
+      }
+      for (int s = 0; s < SYMMETRIES; s++) {
+        const Board2D::Move turned = BookTransform(m.move, s);
+        CHECK(turned.tailCount > 1 or turned.tailDir == 0);
+        CHECK(BookTransform(reversed, s).Pack() == turned.Pack());
+        const Board2D::Move back = BookTransform(turned, s, true);
+        CHECK(back.tailCount > 1 or back.tailDir == 0);
+        CHECK(board.AfterMove(back) == m.board);
+        CHECK(TransformBoard(board, s).AfterMove(turned)
+          == TransformBoard(m.board, s));
+      }
+    }
+  }
+}
+
+/** Each move played once in a position and once in the position turned by
+  a symmetry is one book move played twice, whatever the symmetry */
+static void TestSymmetricGames()
+{
+  vector<Board2D> positions = Positions();
+  for (size_t i = 0; i < positions.size(); i++) {
+    const Board2D& board = positions[i];
+    set<Board2D> after;
+    for (auto& m : board.AllMoves()) after.insert(m.board);
+    for (int s = 1; s < SYMMETRIES; s++) {
+      const Board2D turned = TransformBoard(board, s);
+      CHECK(BookHash(turned) == BookHash(board));
+      OpeningBookOptions options;
+      options.maxPly = 1;
+      OpeningBookBuilder builder(options);
+      for (auto& m : board.AllMoves()) {
+        Game game(board);
+        game.DoMove(m.move);
+        builder.Add(game);
+        Game turnedGame(turned);
+        turnedGame.DoMove(BookTransform(m.move, s));
+        builder.Add(turnedGame);
+      }
+      {
+        ofstream out(BOOK_FILE, ios::binary);
+        builder.Write(out);
+      }
+      OpeningBook book;
+      CHECK(book.Open(BOOK_FILE));
+      BookPosition position;
+      CHECK(book.Find(board, position));
+      CHECK(position.moves.size() == after.size());
+      for (size_t j = 0; j < position.moves.size(); j++) {
+        CHECK(position.moves[j].count == 2);
+        CHECK(after.count(board.AfterMove(position.moves[j].move)) == 1);
+      }
+      BookPosition turnedPosition;
+      CHECK(book.Find(turned, turnedPosition));
+      CHECK(turnedPosition.moves.size() == position.moves.size());
+      book.Close();
+    }
+  }
+  remove(BOOK_FILE);
+}
+
+int main()
+{
+  TestInverse();
+  TestSymmetricGames();
+  return CHECK_RESULT();
+}
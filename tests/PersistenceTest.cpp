@@ -0,0 +1,275 @@
+/** @file PersistenceTest.cpp
+  Tests of the .AG reader and writer.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "GameCollection.hpp"
+#include "Persistence.hpp"
+#include "Check.hpp"
+#include "TestGames.hpp"
+
+using namespace std;
+using namespace Haliotis;
+
+/// Name of file used for trace messages
+const char* TRACE_FILE = "PersistenceTest.log";
+
+/// Write game as .AG text
+static string WriteAg(const Game& game)
+{
+  ostringstream out;
+  AbaloneGameFormat_Write(out, game);
+  return out.str();
+}
+
+/** Every legal move of the positions of some games is written in FFTL
+  notation and read back as the same move. Each position is written as one
+  game with all its moves as variations of the first move. */
+static void TestEveryMoveRoundTrips()
+{
+  size_t moves = 0;
+  size_t failures = 0;
+  for (unsigned seed = 1; seed <= 30; seed++) {
+    Board2D start;
+    start.SetUpStartPos();
+    Game line(start);
+    PlayLine(line, 100, seed);
+    for (auto& pos : line.MainLine()) {
+      Game game(pos.board);
+      for (auto& m : pos.board.AllMoves()) {
+        game.DoMove(m.move);
+        game.UndoMove();
+      }
+      const string text = WriteAg(game);
+      Game read;
+      if (not AbaloneGameFormat_Read(text.data(), text.size(), read)) {
+        failures += game.Root()->Children().size();
+        continue;
+      }
+      const auto& written = game.Root()->Children();
+      const auto& parsed = read.Root()->Children();
+      moves += written.size();
+      if (parsed.size() != written.size()) {
+        failures += written.size();
+        continue;
+      }
+      for (size_t i = 0; i < written.size(); i++) {
+        Board2D expected = pos.board;
+        expected.DoMove(written[i]->move);
+        Board2D actual = read.StartPos();
+        actual.DoMove(parsed[i]->move);
+        if (not (actual == expected)) failures++;
+      }
+    }
+  }
+  if (failures > 0) {
+    cout << failures << " of " << moves << " moves did not round-trip" << endl;
+  }
+  CHECK(moves > 100000);
+  CHECK(failures == 0);
+}
+
+/** A broadside move 120 degrees away from its line is written from the end
+  of its tail (FromLast, ToFirst). Before the parser was added it was
+  written FromFirst, ToLast, which did not read back. */
+static void TestBroadsideNotation()
+{
+  Board2D start;
+  start.SetUpStartPos();
+  Game line(start);
+  PlayLine(line, 40, 7);
+  size_t checked = 0;
+  for (auto& pos : line.MainLine()) {
+    for (auto& m : pos.board.AllMoves()) {
+      const int angle = (m.move.moveDir - m.move.tailDir + 6) % 6;
+      ostringstream written, expected;
+      written << m.move;
+      if (m.move.tailCount > 1 and (angle == 2 or angle == 4)) {
+        expected << m.move.FromLast() << m.move.ToFirst();
+        checked++;
+      }
+      else {
+        expected << m.move.FromFirst() << m.move.ToLast();
+      }
+      CHECK(written.str() == expected.str());
+    }
+  }
+  CHECK(checked > 100);
+}
+
+/** A game with variations and comments reads back as the same game tree.
+  The parser may pick another encoding of a move, e.g. the tail direction
+  of a single marble, so the trees are compared by their boards. */
+static void TestGameRoundTrips()
+{
+  Board2D start;
+  start.SetUpStartPos();
+  Game game(start);
+  PlayLine(game, 30, 3);
+  game.SetComment("main line");
+  for (int i = 0; i < 10; i++) game.UndoMove();
+  PlayLine(game, 6, 4);
+  game.SetComment("first variation");
+  for (int i = 0; i < 9; i++) game.UndoMove();
+  PlayLine(game, 3, 5);
+  const string text = WriteAg(game);
+  Game read;
+  CHECK(AbaloneGameFormat_Read(text.data(), text.size(), read));
+  CHECK(WriteAg(read) == text);
+  CHECK(read.GetComment() == game.GetComment());
+  auto expected = game.Preorder().begin();
+  auto actual = read.Preorder().begin();
+  for (; expected != game.Preorder().end() and actual != read.Preorder().end();
+       ++expected, ++actual) {
+    CHECK(actual->board == expected->board);
+    CHECK(actual->node->comment == expected->node->comment);
+  }
+  CHECK(expected == game.Preorder().end());
+  CHECK(actual == read.Preorder().end());
+}
+
+/** The stream reader reads what the writer writes for a main line,
+  including the comment of the start position before the first move. */
+static void TestStreamReadsComments()
+{
+  Board2D start;
+  start.SetUpStartPos();
+  Game game(start);
+  PlayLine(game, 20, 6);
+  game.SetComment("end of game");
+  for (int i = 0; i < 10; i++) game.UndoMove();
+  game.SetComment("middle game");
+  game.UndoAllMoves();
+  game.SetComment("opening");
+  const string text = WriteAg(game);
+  CHECK(text.find("{opening}") != string::npos);
+  istringstream in(text);
+  Game read;
+  AbaloneGameFormat_Read(in, read);
+  CHECK(read.GetComment() == "opening");
+  CHECK(WriteAg(read) == text);
+}
+
+/// Text of move on board, as the .AG writer writes it
+static string MoveText(const Board2D& board, Board2D::Move move)
+{
+  Game game(board);
+  game.DoMove(move);
+  string text = WriteAg(game);
+  text.erase(text.find_last_not_of(" \r\n") + 1);
+  return text.substr(text.find_last_of(' ') + 1);
+}
+
+/** "((" starts a variation of a move of a variation. The inner variation
+  is an alternative to the first move, the outer one to the second. */
+static void TestNestedVariations()
+{
+  Board2D start;
+  start.SetUpStartPos();
+  const Board2D::Move first = NthMove(start, 1);
+  const Board2D::Move firstAlternative = NthMove(start, 2);
+  Board2D afterFirst = start;
+  afterFirst.DoMove(first);
+  const Board2D::Move second = NthMove(afterFirst, 3);
+  const Board2D::Move secondAlternative = NthMove(afterFirst, 4);
+
+  Game expected(start);
+  expected.DoMove(first);
+  expected.DoMove(second);
+  expected.UndoMove();
+  expected.DoMove(secondAlternative);
+  expected.UndoAllMoves();
+  expected.DoMove(firstAlternative);
+
+  const string text = "1. " + MoveText(start, first) + " "
+    + MoveText(afterFirst, second) + " ((1. " + MoveText(start, firstAlternative)
+    + ") 1. - " + MoveText(afterFirst, secondAlternative) + ")\n";
+  const string all = WriteAg(Game(start)) + text;
+  Game read;
+  CHECK(AbaloneGameFormat_Read(all.data(), all.size(), read));
+  auto want = expected.Preorder().begin();
+  auto actual = read.Preorder().begin();
+  for (; want != expected.Preorder().end() and actual != read.Preorder().end();
+       ++want, ++actual) {
+    CHECK(actual->board == want->board);
+    CHECK(actual.Depth() == want.Depth());
+  }
+  CHECK(want == expected.Preorder().end());
+  CHECK(actual == read.Preorder().end());
+}
+
+/// Overwrite the u64 at offset of file
+static void PatchU64(const char* file, streamoff offset, unsigned long long value)
+{
+  fstream io(file, ios::in | ios::out | ios::binary);
+  io.seekp(offset);
+  io.write((const char*)&value, sizeof(value));
+}
+
+/** A side-car index whose count or offsets do not fit the files is not
+  used, the collection is scanned again. */
+static void TestCollectionIndex()
+{
+  const char* COLLECTION_FILE = "PersistenceTest.ag";
+  const string indexFile = GameCollection::IndexFileName(COLLECTION_FILE);
+  {
+    ofstream out(COLLECTION_FILE, ios::binary);
+    for (unsigned seed = 1; seed <= 3; seed++) {
+      Board2D start;
+      start.SetUpStartPos();
+      Game game(start);
+      game.attributes["Round"] = string(1, (char)('0' + seed));
+      PlayLine(game, 10, seed);
+      out << WriteAg(game);
+    }
+  }
+  remove(indexFile.c_str());
+  const streamoff COUNT = 24, FIRST_OFFSET = 32;
+  for (int corruption = 0; corruption < 5; corruption++) {
+    switch (corruption) {
+    case 1: PatchU64(indexFile.c_str(), COUNT, 1ULL << 60); break;
+    case 2: PatchU64(indexFile.c_str(), COUNT, 2); break;
+    case 3: PatchU64(indexFile.c_str(), FIRST_OFFSET + 8, 1ULL << 40); break;
+    case 4: PatchU64(indexFile.c_str(), FIRST_OFFSET + 8, 0); break;
+    }
+    GameCollection collection;
+    CHECK(collection.Open(COLLECTION_FILE));
+    CHECK(collection.Size() == 3);
+    for (size_t i = 0; i < collection.Size(); i++) {
+      Game game;
+      CHECK(collection[i].Decode(game));
+    }
+  }
+  remove(indexFile.c_str());
+  remove(COLLECTION_FILE);
+}
+
+int main()
+{
+  TestEveryMoveRoundTrips();
+  TestBroadsideNotation();
+  TestGameRoundTrips();
+  TestStreamReadsComments();
+  TestNestedVariations();
+  TestCollectionIndex();
+  return CHECK_RESULT();
+}
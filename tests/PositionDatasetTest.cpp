@@ -0,0 +1,133 @@
+/** @file PositionDatasetTest.cpp
+  Tests of the deduplication of the position dataset writer.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <cstdio>
+#include <fstream>
+
+#include "PositionDataset.hpp"
+#include "Check.hpp"
+
+using namespace std;
+using namespace Haliotis;
+
+/// Name of file used for trace messages
+const char* TRACE_FILE = "PositionDatasetTest.log";
+
+/// Record of the start position with the marbles pushed off
+static PositionRecord StartRecord(int off1, int off2)
+{
+  Board2D board;
+  board.SetUpStartPos();
+  Board2D::Move move;
+  board.FirstMove(move);
+  PositionRecord record;
+  record.Set(board, move, 0, RESULT_UNKNOWN);
+  record.off[0] = (unsigned char)off1;
+  record.off[1] = (unsigned char)off2;
+  return record;
+}
+
+static void RemoveShards(const PositionDatasetWriter& dataset)
+{
+  for (size_t i = 0; i < dataset.Shards().size(); i++) {
+    remove(dataset.Shards()[i].c_str());
+  }
+}
+
+/// The same position is skipped, but not with another score
+static void TestDuplicates()
+{
+  PositionDatasetOptions options;
+  options.unique = true;
+  options.uniqueLimit = 64;
+  PositionDatasetWriter dataset("PositionDatasetTest", options);
+  dataset.Add(StartRecord(0, 0), 12345);
+  dataset.Add(StartRecord(0, 0), 12345);
+  dataset.Add(StartRecord(1, 0), 12345);
+  dataset.Add(StartRecord(0, 1), 12345);
+  dataset.Add(StartRecord(0, 0), 0);
+  dataset.Add(StartRecord(0, 0), 0);
+  CHECK(dataset.Close());
+  CHECK(dataset.Records() == 4);
+  CHECK(dataset.Duplicates() == 2);
+  RemoveShards(dataset);
+}
+
+/** More positions than the limit are all written, and a position added
+  again right away is still found */
+static void TestLimit()
+{
+  PositionDatasetOptions options;
+  options.unique = true;
+  options.uniqueLimit = 16;
+  PositionDatasetWriter dataset("PositionDatasetTest", options);
+  const PositionRecord record = StartRecord(0, 0);
+  for (unsigned long long i = 1; i <= 1000; i++) {
+    const unsigned long long hash = i * 0x9E3779B97F4A7C15ULL;
+    dataset.Add(record, hash);
+    dataset.Add(record, hash);
+  }
+  CHECK(dataset.Close());
+  CHECK(dataset.Records() == 1000);
+  CHECK(dataset.Duplicates() == 1000);
+  RemoveShards(dataset);
+}
+
+/** A block whose header claims more records than it holds is corrupt, also
+  when the compressed data is valid */
+static void TestShortBlock()
+{
+  PositionDatasetOptions options;
+  options.compress = true;
+  PositionDatasetWriter dataset("PositionDatasetTest", options);
+  const PositionRecord record = StartRecord(0, 0);
+  for (unsigned long long i = 1; i <= 100; i++) dataset.Add(record, i);
+  CHECK(dataset.Close());
+  CHECK(dataset.Shards().size() == 1);
+  const string shard = dataset.Shards()[0];
+  {
+    PositionDatasetReader reader;
+    CHECK(reader.Open(shard));
+    PositionRecord read;
+    size_t records = 0;
+    while (reader.Next(read)) records++;
+    CHECK(records == 100);
+    CHECK(reader.Valid());
+  }
+  {
+    // Record count of the first block, after the 8 byte shard header
+    fstream io(shard.c_str(), ios::in | ios::out | ios::binary);
+    io.seekp(8);
+    const char records[4] = { (char)200, 0, 0, 0 };
+    io.write(records, sizeof(records));
+  }
+  PositionDatasetReader reader;
+  CHECK(reader.Open(shard));
+  PositionRecord read;
+  CHECK(not reader.Next(read));
+  CHECK(not reader.Valid());
+  RemoveShards(dataset);
+}
+
+int main()
+{
+  TestDuplicates();
+  TestLimit();
+  TestShortBlock();
+  return CHECK_RESULT();
+}
@@ -0,0 +1,30 @@
+/** @file TestGames.hpp
+  Games of legal moves for the tests, the same on every run.
+*/
+
+#ifndef TestGames_hpp
+#define TestGames_hpp
+
+#include <vector>
+
+#include "Game.hpp"
+
+/// Move number n of the legal moves of board, wrapping around
+inline Haliotis::Board2D::Move NthMove(const Haliotis::Board2D& board, size_t n)
+{
+  std::vector<Haliotis::Board2D::Move> moves;
+  for (auto& m : board.AllMoves()) moves.push_back(m.move);
+  return moves[n % moves.size()];
+}
+
+/// Play plies moves from the current position of game, chosen by seed
+inline void PlayLine(Haliotis::Game& game, int plies, unsigned seed)
+{
+  unsigned long long state = seed;
+  for (int i = 0; i < plies; i++) {
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    game.DoMove(NthMove(game.board, (size_t)(state >> 33)));
+  }
+}
+
+#endif
@@ -0,0 +1,229 @@
+/** @file TimeManagerTest.cpp
+  Tests of the deadlines of TimeManager.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include "TimeManager.hpp"
+#include "AEPWrap.hpp"
+#include "Check.hpp"
+
+using namespace std;
+using namespace Haliotis;
+
+/// Name of file used for trace messages
+const char* TRACE_FILE = "TimeManagerTest.log";
+
+/// Start position with player to move and the marbles player 1 has lost
+static Board2D Position(int player, int lost)
+{
+  Board2D board;
+  board.SetUpStartPos();
+  board.SetTurn(player);
+  board.SetScore(2, lost);
+  return board;
+}
+
+static void TestMoveTime()
+{
+  TimeManager time;
+  GoParameters go;
+  go.moveTime = 1000;
+  time.Set(go);
+  time.Start(Position(1, 0));
+  // The overhead is kept in hand, but at most half the time
+  CHECK(time.SoftLimit() == 1000 - TimeManager::MOVE_OVERHEAD);
+  CHECK(time.HardLimit() == 1000 - TimeManager::MOVE_OVERHEAD);
+  go.moveTime = 40;
+  time.Set(go);
+  time.Start(Position(1, 0));
+  CHECK(time.HardLimit() == 20);
+  go.moveTime = -1;
+  go.infinite = true;
+  time.Set(go);
+  time.Start(Position(1, 0));
+  CHECK(time.SoftLimit() == -1);
+  CHECK(time.HardLimit() == -1);
+}
+
+/** The clock of the player to move is divided by the moves to go: 30 in
+  the opening, down to 10 when 5 marbles are lost. Three quarters of the
+  increment are added. The hard deadline is 4 times the soft one, but
+  at most a fifth of the clock and the increment. */
+static void TestClock()
+{
+  TimeManager time;
+  GoParameters go;
+  go.time[0] = 60000 + TimeManager::MOVE_OVERHEAD;
+  go.time[1] = 3000 + TimeManager::MOVE_OVERHEAD;
+  time.Set(go);
+  time.Start(Position(1, 0));
+  CHECK(time.SoftLimit() == 2000);
+  CHECK(time.HardLimit() == 8000);
+  go.inc[0] = 1000;
+  time.Set(go);
+  time.Start(Position(1, 0));
+  CHECK(time.SoftLimit() == 2750);
+  CHECK(time.HardLimit() == 11000);
+  // Endgame: fewer moves to go, and the hard deadline is a fifth of the clock
+  go.inc[0] = -1;
+  time.Set(go);
+  time.Start(Position(1, 5));
+  CHECK(time.SoftLimit() == 6000);
+  CHECK(time.HardLimit() == 12000);
+  time.Start(Position(1, 3));
+  CHECK(time.SoftLimit() == 60000 / 18);
+  // Player 2 uses the second clock
+  time.Start(Position(2, 0));
+  CHECK(time.SoftLimit() == 100);
+  CHECK(time.HardLimit() == 400);
+  // No clock for the player to move
+  go.time[1] = -1;
+  time.Set(go);
+  time.Start(Position(2, 0));
+  CHECK(time.SoftLimit() == -1);
+  CHECK(time.HardLimit() == -1);
+}
+
+/** Each iteration where the best move changes adds half the soft deadline,
+  up to 4 halves, and each stable iteration takes one away. The soft
+  deadline never passes the hard one. */
+static void TestExtension()
+{
+  TimeManager time;
+  GoParameters go;
+  go.time[0] = 60000 + TimeManager::MOVE_OVERHEAD;
+  time.Set(go);
+  time.Start(Position(1, 0));
+  time.IterationDone(true);
+  CHECK(time.SoftLimit() == 3000);
+  time.IterationDone(true);
+  CHECK(time.SoftLimit() == 4000);
+  time.IterationDone(true);
+  time.IterationDone(true);
+  CHECK(time.SoftLimit() == 6000);
+  time.IterationDone(true);
+  CHECK(time.SoftLimit() == 6000);
+  time.IterationDone(false);
+  CHECK(time.SoftLimit() == 5000);
+  time.IterationDone(false);
+  time.IterationDone(false);
+  time.IterationDone(false);
+  time.IterationDone(false);
+  CHECK(time.SoftLimit() == 2000);
+  // Capped by the hard deadline of a fifth of the clock
+  time.Start(Position(1, 5));
+  for (int i = 0; i < 4; i++) time.IterationDone(true);
+  CHECK(time.SoftLimit() == 12000);
+  CHECK(time.HardLimit() == 12000);
+}
+
+static void TestPonder()
+{
+  TimeManager time;
+  GoParameters go;
+  go.moveTime = 1000;
+  time.Set(go);
+  time.Start(Position(1, 0), true);
+  CHECK(time.SoftLimit() == -1);
+  CHECK(time.HardLimit() == -1);
+  CHECK(not time.ShouldStop());
+  time.PonderHit();
+  CHECK(time.HardLimit() == 1000 - TimeManager::MOVE_OVERHEAD);
+}
+
+static void TestLimits()
+{
+  TimeManager time;
+  GoParameters go;
+  go.depth = 3;
+  go.nodes = 500;
+  time.Set(go);
+  time.Start(Position(1, 0));
+  CHECK(time.CanStartIteration(3));
+  CHECK(not time.CanStartIteration(4));
+  CHECK(not time.ShouldStop(499));
+  CHECK(time.ShouldStop(500));
+  CHECK(time.ShouldStop());
+  // A stop before Start() is kept, Set() forgets it
+  time.Set(go);
+  time.Stop();
+  time.Start(Position(1, 0));
+  CHECK(time.ShouldStop());
+  time.Set(go);
+  time.Start(Position(1, 0));
+  CHECK(not time.ShouldStop());
+}
+
+/// The parameters by name give the same limits as Set()
+static void TestSetParameter()
+{
+  TimeManager time;
+  time.Reset();
+  CHECK(time.SetParameter("time1", "60030"));
+  CHECK(time.SetParameter("inc1", "1000"));
+  CHECK(time.SetParameter("depth", "7"));
+  CHECK(not time.SetParameter("time2", "-5"));
+  CHECK(not time.SetParameter("ponder", "1"));
+  CHECK(not time.SetParameter("searchmoves", "a1b2 c3c4"));
+  time.Start(Position(1, 0));
+  CHECK(time.SoftLimit() == 2750);
+  CHECK(time.MaxDepth() == 7);
+}
+
+/** An engine that keeps the deadlines of its last search */
+class DeadlineEngine: public AbaloneEngineProtocol::Engine {
+public:
+  long long hardLimit;
+  DeadlineEngine() : hardLimit(0) {}
+  virtual void SetGame(const Game& game) { m_board = game.CurrentBoard(); }
+  virtual string GetName() const { return "deadline"; }
+  virtual string GetAuthor() const { return "test"; }
+  virtual void SetDebug(bool) {}
+  virtual void GetMove(Board2D::Move& m) {
+    Time().Start(m_board, Pondering());
+    hardLimit = Time().HardLimit();
+    m_board.FirstMove(m);
+  }
+  virtual void StopSearch() {}
+private:
+  Board2D m_board;
+};
+
+/// The driver gives the limits of "go" to the time manager of the engine
+static void TestDriver()
+{
+  DeadlineEngine engine;
+  AbaloneEngineProtocol::Driver driver(engine);
+  Board2D start;
+  start.SetUpStartPos();
+  driver.SetPosition(Game(start));
+  GoParameters go;
+  go.moveTime = 500;
+  driver.Go(go);
+  CHECK(engine.hardLimit == 500 - TimeManager::MOVE_OVERHEAD);
+}
+
+int main()
+{
+  TestMoveTime();
+  TestClock();
+  TestExtension();
+  TestPonder();
+  TestLimits();
+  TestSetParameter();
+  TestDriver();
+  return CHECK_RESULT();
+}
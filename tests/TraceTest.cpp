@@ -0,0 +1,273 @@
+/** @file TraceTest.cpp
+  Tests of the ring buffers of the TraceCollector, and of reading its
+  binary trace files.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include "Trace.hpp"
+#include "TraceFile.hpp"
+#include "Check.hpp"
+
+#include <sstream>
+#include <thread>
+
+using namespace std;
+
+/// Name of file used for trace messages
+const char* TRACE_FILE = "TraceTest.log";
+
+TRACE_FLAG(traceTestFlag)
+TRACE_FLAG_LEVEL(traceTestDeep, 3)
+
+/// Bytes of a message of which four fill a ring
+static const size_t LARGE = 250000;
+
+/// Start the trace file again, after the messages traced so far
+static void Restart()
+{
+  TraceCollector::SetTraceFile(TRACE_FILE);
+}
+
+/// Lines of the trace file after its first lines
+static vector<string> Lines()
+{
+  TraceCollector::GetInstance().Flush();
+  ifstream in(TRACE_FILE);
+  vector<string> lines;
+  string line;
+  bool started = false;
+  while (getline(in, line)) {
+    if (started) lines.push_back(line);
+    else if (line.compare(0, 16, "Trace started at") == 0) started = true;
+  }
+  return lines;
+}
+
+/// Record a text message without time stamp
+static void Text(const string& text)
+{
+  TraceCollector::GetInstance().Record(0, text.data(), text.size(), false);
+}
+
+static string Large(char c)
+{
+  return string(LARGE, c) + '\n';
+}
+
+/// Messages that wrap around the end of the ring are written whole
+static void TestWraparound()
+{
+  Restart();
+  // Six messages are more than the ring holds, so the last ones wrap
+  for (char c = 'a'; c < 'g'; c++) {
+    Text(Large(c));
+    if (c == 'c') TraceCollector::GetInstance().Flush();
+  }
+  const vector<string> lines = Lines();
+  CHECK(lines.size() == 6);
+  for (size_t i = 0; i < lines.size() and i < 6; i++) {
+    CHECK(lines[i] == string(LARGE, (char)('a' + i)));
+  }
+}
+
+/// The messages of all threads are written in the order they were traced
+static void TestOrderAcrossThreads()
+{
+  Restart();
+  const unsigned THREADS = 4;
+  const unsigned MESSAGES = 1000;
+  mutex order;
+  unsigned next = 0;
+  {
+    // No messages are written until all are traced
+    lock_guard<recursive_mutex> hold(TraceCollector::GetInstance().mutex);
+    vector<thread> threads;
+    for (unsigned t = 0; t < THREADS; t++) {
+      threads.push_back(thread([&order, &next, t]() {
+        for (unsigned i = 0; i < MESSAGES; i++) {
+          lock_guard<mutex> lock(order);
+          ostringstream text;
+          text << next++ << ' ' << t << '\n';
+          Text(text.str());
+        }
+      }));
+    }
+    for (size_t t = 0; t < threads.size(); t++) threads[t].join();
+  }
+  const vector<string> lines = Lines();
+  CHECK(lines.size() == THREADS * MESSAGES);
+  vector<unsigned> count(THREADS);
+  bool ordered = true;
+  for (size_t i = 0; i < lines.size(); i++) {
+    istringstream text(lines[i]);
+    unsigned n = 0, t = THREADS;
+    text >> n >> t;
+    if (n != i) ordered = false;
+    if (t < THREADS) count[t]++;
+  }
+  CHECK(ordered);
+  for (unsigned t = 0; t < THREADS; t++) CHECK(count[t] == MESSAGES);
+}
+
+/// A message that does not fit is dropped at once, and the drops counted
+static void TestDropWhenFull()
+{
+  Restart();
+  {
+    // The flusher cannot drain the ring meanwhile
+    lock_guard<recursive_mutex> hold(TraceCollector::GetInstance().mutex);
+    for (char c = 'a'; c < 'g'; c++) Text(Large(c));
+  }
+  const vector<string> lines = Lines();
+  CHECK(lines.size() == 5);
+  for (size_t i = 0; i < lines.size() and i < 4; i++) {
+    CHECK(lines[i] == string(LARGE, (char)('a' + i)));
+  }
+  const string lost = "2 trace messages lost, buffer full";
+  CHECK(lines.size() == 5 and lines[4].size() > lost.size()
+    and lines[4].compare(lines[4].size() - lost.size(), lost.size(), lost) == 0);
+  // The ring is empty again
+  Restart();
+  Text("after\n");
+  const vector<string> after = Lines();
+  CHECK(after.size() == 1 and after[0] == "after");
+}
+
+/// A binary trace of a site and a text
+static string BinaryTrace()
+{
+  const char* binaryFile = "TraceTest.abt";
+  TraceCollector::SetBinaryTraceFile(binaryFile);
+  static TraceSite site("TraceTest.cpp", 7, "\"x = \" << i");
+  for (int i = 0; i < 3; i++) {
+    TraceMessage message;
+    message << "x = " << i << '\n';
+    message.Record(site, true);
+  }
+  Text("text\n");
+  Restart();
+  ifstream in(binaryFile, ios::binary);
+  ostringstream bytes;
+  bytes << in.rdbuf();
+  return bytes.str();
+}
+
+/// Messages read from a trace, and whether the reader found it corrupt
+static vector<TraceFileMessage> ReadTrace(const string& bytes, bool& valid, bool& corrupt)
+{
+  istringstream in(bytes);
+  TraceFileReader reader(in);
+  vector<TraceFileMessage> messages;
+  TraceFileMessage message;
+  while (reader.Next(message)) messages.push_back(message);
+  valid = reader.Valid();
+  corrupt = reader.Corrupt();
+  return messages;
+}
+
+static void PatchU32(string& bytes, size_t pos, unsigned long value)
+{
+  for (int i = 0; i < 4; i++) bytes[pos + i] = (char)(value >> 8*i);
+}
+
+/// The messages of a binary trace file are read as they were traced
+static void TestBinaryRoundTrip()
+{
+  const string bytes = BinaryTrace();
+  bool valid = false, corrupt = true;
+  const vector<TraceFileMessage> messages = ReadTrace(bytes, valid, corrupt);
+  CHECK(valid and not corrupt);
+  CHECK(messages.size() == 4);
+  for (size_t i = 0; i < messages.size() and i < 3; i++) {
+    const TraceFileMessage& m = messages[i];
+    CHECK(m.text == "x = " + to_string(i) + "\n");
+    CHECK(m.site != 0 and m.stamp);
+    CHECK(m.file == "TraceTest.cpp" and m.line == 7 and m.statement == "\"x = \" << i");
+    CHECK(m.thread == messages[0].thread);
+  }
+  CHECK(messages.size() == 4 and messages[3].site == 0 and not messages[3].stamp
+    and messages[3].text == "text\n");
+}
+
+/// A file that is cut, or whose ids and lengths are wrong, is corrupt
+static void TestCorruptBinaryTrace()
+{
+  const string bytes = BinaryTrace();
+  // The header, the site, its messages of "x = " and 'i', and the text
+  const size_t site = 24;
+  const size_t message = site + 1 + 12 + strlen("TraceTest.cpp") + 4 + strlen("\"x = \" << i");
+  const size_t messageSize = 1 + 21 + (1 + 4 + 4) + (1 + 8) + (1 + 1);
+  const size_t text = message + 3 * messageSize;
+  CHECK(bytes.size() == text + 1 + 21 + 5);
+  CHECK(bytes[site] == 'S' and bytes[message] == 'M' and bytes[text] == 'M');
+  bool valid = false, corrupt = false;
+  for (size_t size = 0; size < bytes.size(); size++) {
+    const vector<TraceFileMessage> messages = ReadTrace(bytes.substr(0, size), valid, corrupt);
+    if (size < site) {
+      CHECK(not valid and messages.empty());
+    }
+    else if (size == site or size == text or (size >= message and (size - message) % messageSize == 0)) {
+      // A file that ends between records is not corrupt
+      CHECK(valid and not corrupt);
+      CHECK(messages.size() == (size < message ? 0 : (size - message) / messageSize));
+    }
+    else {
+      CHECK(valid and corrupt and messages.size() < 4);
+    }
+  }
+  string wrong = bytes;
+  PatchU32(wrong, site + 9, 0xFFFFFFFF);
+  CHECK(ReadTrace(wrong, valid, corrupt).empty() and corrupt);
+  wrong = bytes;
+  PatchU32(wrong, site + 1, 0);
+  CHECK(ReadTrace(wrong, valid, corrupt).empty() and corrupt);
+  // A message of a site that was not read
+  wrong = bytes;
+  PatchU32(wrong, message + 13, 1000);
+  CHECK(ReadTrace(wrong, valid, corrupt).empty() and corrupt);
+  wrong = bytes;
+  PatchU32(wrong, message + 18, 0xFFFFFFF0);
+  CHECK(ReadTrace(wrong, valid, corrupt).empty() and corrupt);
+}
+
+/// Flags are set by name or by file, and a flag of a high level stays off
+static void TestTraceFlags()
+{
+  CHECK(not TRACE_ENABLED(traceTestFlag));
+#ifndef NDEBUG
+  CHECK(SetTraceFlag("traceTestFlag", "", true));
+  CHECK(TRACE_ENABLED(traceTestFlag));
+  CHECK(SetTraceFlag("", __FILE__, false));
+  CHECK(not TRACE_ENABLED(traceTestFlag));
+  CHECK(SetTraceFlag("traceTestFlag", __FILE__, true));
+  CHECK(TRACE_ENABLED(traceTestFlag));
+  CHECK(not SetTraceFlag("traceTestFlag", "Other.cpp", false));
+  CHECK(TRACE_ENABLED(traceTestFlag));
+  CHECK(SetTraceFlag("traceTestDeep", "", true));
+  CHECK(not TRACE_ENABLED(traceTestDeep));
+#endif
+}
+
+int main()
+{
+  TestWraparound();
+  TestOrderAcrossThreads();
+  TestDropWhenFull();
+  TestBinaryRoundTrip();
+  TestCorruptBinaryTrace();
+  TestTraceFlags();
+  return CHECK_RESULT();
+}
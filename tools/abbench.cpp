@@ -0,0 +1,453 @@
+/** @file abbench.cpp
+  Microbenchmarks of the hot paths of the library, and a comparison of
+  two runs to find regressions.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Board2D.hpp"
+#include "Game.hpp"
+#include "Persistence.hpp"
+#include "Settings.hpp"
+
+using namespace std;
+using namespace Haliotis;
+
+/// Name of file used for trace messages
+const char* TRACE_FILE = "abbench.log";
+
+static void Usage()
+{
+  cerr <<
+    "Usage: abbench [options]\n"
+    "       abbench -c base.json new.json [-t percent]\n"
+    "Time the hot paths of the library on games of random moves, and write\n"
+    "the ns per operation of each benchmark as JSON. With -c, compare two\n"
+    "such files and fail if a benchmark got slower or is missing from the new\n"
+    "file.\n"
+    "\n"
+    "  -o file      write the results to this JSON file\n"
+    "  -f text      only run the benchmarks whose name contains text\n"
+    "  -m ms        least time of each of the rounds (default: 100)\n"
+    "  -r rounds    rounds of each benchmark, the median is kept (default: 5)\n"
+    "  -g games     sample games (default: 20)\n"
+    "  -c           compare base.json with new.json\n"
+    "  -t percent   slower than this is a regression (default: 10)\n";
+}
+
+/** The data the benchmarks run on. Games of random legal moves, so the
+  positions are not only those of the opening. */
+struct Samples {
+  vector<Game*> games;
+  vector<vector<Board2D::Move> > moves;     //< Main line of each game
+  vector<Board2D> positions;                //< Every position of the games
+  vector<pair<Board2D, Board2D::Move> > legal; //< Legal moves of some positions
+  vector<string> texts;                     //< The games as .AG
+  string settings;                          //< Text of a configuration
+
+  ~Samples() {
+    for (size_t i = 0; i < games.size(); i++) delete games[i];
+  }
+};
+
+/// Random numbers that are the same on every platform
+static unsigned NextRandom(unsigned long long& state)
+{
+  state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+  return (unsigned)(state >> 33);
+}
+
+static void MakeSamples(unsigned gameCount, Samples& samples)
+{
+  unsigned long long state = 1;
+  const int MAX_PLIES = 300;
+  for (unsigned g = 0; g < gameCount; g++) {
+    Board2D board;
+    board.SetUpStartPos();
+    Game* game = new Game(board);
+    vector<Board2D::Move> line;
+    vector<Board2D::Move> moves;
+    for (int ply = 0; ply < MAX_PLIES; ply++) {
+      if (board.OutOfBoard(true) >= 6 or board.OutOfBoard(false) >= 6) break;
+      moves.clear();
+      for (auto& m : board.AllMoves()) moves.push_back(m.move);
+      if (moves.empty()) break;
+      samples.positions.push_back(board);
+      if (ply % 10 == 0) {
+        for (size_t i = 0; i < moves.size(); i++) {
+          samples.legal.push_back(make_pair(board, moves[i]));
+        }
+      }
+      const Board2D::Move move = moves[NextRandom(state) % moves.size()];
+      board.DoMove(move);
+      game->DoMove(move);
+      line.push_back(move);
+    }
+    samples.games.push_back(game);
+    samples.moves.push_back(line);
+    ostringstream text;
+    AbaloneGameFormat_Write(text, *game);
+    samples.texts.push_back(text.str());
+  }
+  ostringstream settings;
+  for (int i = 0; i < 50; i++) {
+    settings << "engine.option" << i << '=' << i * 37 << '\n';
+  }
+  samples.settings = settings.str();
+}
+
+/// Results are summed here, so the compiler cannot drop the work
+static volatile unsigned long long sink;
+
+/** One pass of a benchmark over the samples.
+  @return  the operations done */
+typedef unsigned long long (*BenchmarkPass)(const Samples& samples);
+
+static unsigned long long BoardDoMove(const Samples& samples)
+{
+  unsigned long long sum = 0;
+  for (size_t i = 0; i < samples.legal.size(); i++) {
+    Board2D board(samples.legal[i].first);
+    sum += board.DoMove(samples.legal[i].second) + board.field[4][4];
+  }
+  sink += sum;
+  return samples.legal.size();
+}
+
+static unsigned long long BoardEnumerate(const Samples& samples)
+{
+  unsigned long long sum = 0;
+  for (size_t i = 0; i < samples.positions.size(); i++) {
+    Board2D::Move move;
+    Board2D after;
+    for (bool ok = samples.positions[i].FirstMove(move, after); ok;
+         ok = samples.positions[i].NextMove(move, after)) {
+      sum++;
+    }
+  }
+  sink += sum;
+  return samples.positions.size();
+}
+
+static unsigned long long BoardValidMove(const Samples& samples)
+{
+  unsigned long long sum = 0;
+  for (size_t i = 0; i < samples.legal.size(); i++) {
+    sum += samples.legal[i].first.ValidMove(samples.legal[i].second);
+  }
+  sink += sum;
+  return samples.legal.size();
+}
+
+static unsigned long long BoardHashCode(const Samples& samples)
+{
+  unsigned long long sum = 0;
+  for (size_t i = 0; i < samples.positions.size(); i++) {
+    sum += samples.positions[i].HashCode();
+  }
+  sink += sum;
+  return samples.positions.size();
+}
+
+static unsigned long long BoardHash64(const Samples& samples)
+{
+  unsigned long long sum = 0;
+  for (size_t i = 0; i < samples.positions.size(); i++) {
+    sum += samples.positions[i].Hash64();
+  }
+  sink += sum;
+  return samples.positions.size();
+}
+
+static unsigned long long BoardCompare(const Samples& samples)
+{
+  unsigned long long sum = 0;
+  for (size_t i = 1; i < samples.positions.size(); i++) {
+    sum += samples.positions[i].Compare(samples.positions[i - 1]);
+  }
+  sink += sum;
+  return samples.positions.size() - 1;
+}
+
+static unsigned long long BoardExtendTail(const Samples& samples)
+{
+  unsigned long long sum = 0;
+  for (size_t i = 0; i < samples.legal.size(); i++) {
+    Board2D::Move move = samples.legal[i].second;
+    samples.legal[i].first.ExtendTail(move);
+    sum += move.tailCount;
+  }
+  sink += sum;
+  return samples.legal.size();
+}
+
+static unsigned long long ReverseMoves(const Samples& samples)
+{
+  unsigned long long sum = 0;
+  for (size_t i = 0; i < samples.positions.size(); i++) {
+    for (ReverseMove reverse(samples.positions[i]); reverse.Valid(); reverse.Next()) {
+      sum += reverse.BoardBefore().field[4][4];
+    }
+  }
+  sink += sum;
+  return samples.positions.size();
+}
+
+/// Play each game on a new Game and take the moves back
+static unsigned long long GameDoUndo(const Samples& samples)
+{
+  unsigned long long sum = 0, ops = 0;
+  for (size_t g = 0; g < samples.games.size(); g++) {
+    Game game(samples.games[g]->StartPos());
+    const vector<Board2D::Move>& line = samples.moves[g];
+    for (size_t i = 0; i < line.size(); i++) sum += game.DoMove(line[i]);
+    while (game.MoreMovesToUndo()) game.UndoMove();
+    ops += line.size();
+  }
+  sink += sum;
+  return ops;
+}
+
+static unsigned long long AgWrite(const Samples& samples)
+{
+  unsigned long long sum = 0;
+  for (size_t g = 0; g < samples.games.size(); g++) {
+    ostringstream text;
+    AbaloneGameFormat_Write(text, *samples.games[g]);
+    sum += text.tellp();
+  }
+  sink += sum;
+  return samples.games.size();
+}
+
+static unsigned long long AgRead(const Samples& samples)
+{
+  unsigned long long sum = 0;
+  for (size_t g = 0; g < samples.texts.size(); g++) {
+    Game game;
+    const string& text = samples.texts[g];
+    sum += AbaloneGameFormat_Read(text.data(), text.size(), game);
+  }
+  sink += sum;
+  return samples.texts.size();
+}
+
+static unsigned long long SettingsParse(const Samples& samples)
+{
+  istringstream in(samples.settings);
+  Settings settings;
+  in >> settings;
+  sink += settings.size();
+  return 1;
+}
+
+struct Benchmark {
+  const char* name;
+  BenchmarkPass pass;
+};
+
+static const Benchmark BENCHMARKS[] = {
+  { "board.domove", BoardDoMove },
+  { "board.enumerate", BoardEnumerate },
+  { "board.validmove", BoardValidMove },
+  { "board.hashcode", BoardHashCode },
+  { "board.hash64", BoardHash64 },
+  { "board.compare", BoardCompare },
+  { "board.extendtail", BoardExtendTail },
+  { "reversemove.iterate", ReverseMoves },
+  { "game.domove_undomove", GameDoUndo },
+  { "ag.write", AgWrite },
+  { "ag.read", AgRead },
+  { "settings.parse", SettingsParse },
+};
+
+struct Result {
+  string name;
+  double nsPerOp;           //< Median of the rounds
+  unsigned long long ops;   //< In all rounds
+};
+
+/** Repeat passes until minMs have passed, for each round.
+  @return  the median ns per operation of the rounds */
+static Result Run(const Benchmark& benchmark, const Samples& samples,
+                  unsigned rounds, unsigned minMs)
+{
+  Result result;
+  result.name = benchmark.name;
+  result.ops = 0;
+  benchmark.pass(samples); // Warm the caches
+  vector<double> times;
+  for (unsigned r = 0; r < rounds; r++) {
+    unsigned long long ops = 0;
+    const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    double ns = 0;
+    do {
+      ops += benchmark.pass(samples);
+      ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+    } while (ns < minMs * 1e6);
+    times.push_back(ns / ops);
+    result.ops += ops;
+  }
+  sort(times.begin(), times.end());
+  result.nsPerOp = times[times.size() / 2];
+  return result;
+}
+
+static void WriteJson(ostream& out, const vector<Result>& results)
+{
+#ifdef __OPTIMIZE__
+  const bool optimized = true;
+#else
+  const bool optimized = false;
+#endif
+  out << "{\n  \"optimized\": " << (optimized ? "true" : "false") << ",\n";
+  out << "  \"benchmarks\": [\n";
+  for (size_t i = 0; i < results.size(); i++) {
+    char ns[32];
+    snprintf(ns, sizeof(ns), "%.3f", results[i].nsPerOp);
+    out << "    { \"name\": \"" << results[i].name << "\", \"ns_per_op\": " << ns
+        << ", \"ops\": " << results[i].ops << " }"
+        << (i + 1 < results.size() ? ",\n" : "\n");
+  }
+  out << "  ]\n}\n";
+}
+
+/** Read the results written by WriteJson(), one benchmark on each line.
+  @return false if the file cannot be read */
+static bool ReadJson(const char* filename, map<string, double>& results)
+{
+  ifstream in(filename);
+  if (not in) return false;
+  string line;
+  while (getline(in, line)) {
+    const size_t name = line.find("\"name\": \"");
+    const size_t ns = line.find("\"ns_per_op\": ");
+    if (name == string::npos or ns == string::npos) continue;
+    const size_t start = name + 9;
+    const size_t end = line.find('"', start);
+    if (end == string::npos) continue;
+    results[line.substr(start, end - start)] = atof(line.c_str() + ns + 13);
+  }
+  return true;
+}
+
+/** Print the change of each benchmark.
+  @return 1 if one is more than threshold percent slower, or missing from
+  newFile */
+static int Compare(const char* baseFile, const char* newFile, double threshold)
+{
+  map<string, double> base, current;
+  if (not ReadJson(baseFile, base)) {
+    cerr << "abbench: cannot read " << baseFile << endl;
+    return 2;
+  }
+  if (not ReadJson(newFile, current)) {
+    cerr << "abbench: cannot read " << newFile << endl;
+    return 2;
+  }
+  printf("%-24s %12s %12s %8s\n", "ns/op", "base", "new", "change");
+  int status = 0;
+  for (map<string, double>::const_iterator i = current.begin(); i != current.end(); i++) {
+    map<string, double>::const_iterator b = base.find(i->first);
+    if (b == base.end() or b->second <= 0) {
+      printf("%-24s %12s %12.1f\n", i->first.c_str(), "-", i->second);
+      continue;
+    }
+    const double change = (i->second / b->second - 1) * 100;
+    const bool regression = change > threshold;
+    if (regression) status = 1;
+    printf("%-24s %12.1f %12.1f %+7.1f%%%s\n", i->first.c_str(), b->second,
+           i->second, change, regression ? "  REGRESSION" : "");
+  }
+  // A benchmark that was not run cannot be found to be slower
+  for (map<string, double>::const_iterator b = base.begin(); b != base.end(); b++) {
+    if (current.count(b->first) > 0) continue;
+    status = 1;
+    printf("%-24s %12.1f %12s %8s  MISSING\n", b->first.c_str(), b->second, "-", "");
+  }
+  return status;
+}
+
+int main(int argc, char* argv[])
+{
+  const char* output = 0;
+  const char* filter = 0;
+  unsigned minMs = 100;
+  unsigned rounds = 5;
+  unsigned gameCount = 20;
+  bool compare = false;
+  double threshold = 10;
+  vector<const char*> files;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-o") == 0 and i+1 < argc) output = argv[++i];
+    else if (strcmp(argv[i], "-f") == 0 and i+1 < argc) filter = argv[++i];
+    else if (strcmp(argv[i], "-m") == 0 and i+1 < argc) minMs = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-r") == 0 and i+1 < argc) rounds = max(atoi(argv[++i]), 1);
+    else if (strcmp(argv[i], "-g") == 0 and i+1 < argc) gameCount = max(atoi(argv[++i]), 1);
+    else if (strcmp(argv[i], "-c") == 0) compare = true;
+    else if (strcmp(argv[i], "-t") == 0 and i+1 < argc) threshold = atof(argv[++i]);
+    else if (argv[i][0] != '-') files.push_back(argv[i]);
+    else { Usage(); return 2; }
+  }
+  if (compare) {
+    if (files.size() != 2) {
+      Usage();
+      return 2;
+    }
+    return Compare(files[0], files[1], threshold);
+  }
+  if (not files.empty()) {
+    Usage();
+    return 2;
+  }
+
+#ifndef __OPTIMIZE__
+  cout << "abbench: not optimized, configure with -DCMAKE_BUILD_TYPE=Release" << endl;
+#endif
+  Samples samples;
+  MakeSamples(gameCount, samples);
+  cout << samples.games.size() << " games, " << samples.positions.size()
+       << " positions, " << samples.legal.size() << " moves" << endl;
+
+  vector<Result> results;
+  for (size_t i = 0; i < sizeof(BENCHMARKS) / sizeof(BENCHMARKS[0]); i++) {
+    if (filter and strstr(BENCHMARKS[i].name, filter) == 0) continue;
+    results.push_back(Run(BENCHMARKS[i], samples, rounds, minMs));
+    printf("%-24s %12.1f ns/op\n", results.back().name.c_str(), results.back().nsPerOp);
+    fflush(stdout);
+  }
+
+  if (output) {
+    ofstream file(output);
+    WriteJson(file, results);
+    if (not file) {
+      cerr << "abbench: cannot write " << output << endl;
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,164 @@
+/** @file abbook.cpp
+  Build an opening book from .AG files, and look up positions in it.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sys/stat.h>
+
+#include "GameImport.hpp"
+#include "OpeningBook.hpp"
+#include "Persistence.hpp"
+
+using namespace std;
+
+/// Name of file used for trace messages
+const char* TRACE_FILE = "abbook.log";
+
+static void Usage()
+{
+  cerr <<
+    "Usage: abbook build [options] -o book file|directory...\n"
+    "       abbook probe book [position]\n"
+    "Build an opening book from the main line of the games in .AG files,\n"
+    "or show the book moves of a position. The position is given in the\n"
+    "format of the apf attribute, and is the start position by default.\n"
+    "\n"
+    "  -o book     book file to write\n"
+    "  -n plies    positions after this many moves are left out (default: 30)\n"
+    "  -m games    positions seen in fewer games are left out (default: 2)\n"
+    "  -j threads  number of threads reading games (default: one per core)\n";
+}
+
+/** Add the games to the book and report files with errors */
+class BookImport: public GameImportListener {
+public:
+  BookImport(OpeningBookBuilder& builder) : m_builder(builder) {}
+  virtual void Games(vector<ImportedGame*>& batch) {
+    for (size_t i = 0; i < batch.size(); i++) {
+      m_builder.Add(batch[i]->game);
+    }
+  }
+  virtual void FileDone(const ImportFileResult& result) {
+    if (result.errors > 0) {
+      cout << result.filename << ": " << result.games << " games, "
+           << result.errors << " errors, " << result.error << endl;
+    }
+  }
+private:
+  OpeningBookBuilder& m_builder;
+};
+
+static int Build(int argc, char* argv[])
+{
+  OpeningBookOptions options;
+  const char* output = 0;
+  unsigned threads = 0;
+  vector<const char*> inputs;
+  for (int i = 0; i < argc; i++) {
+    if (strcmp(argv[i], "-o") == 0 and i+1 < argc) output = argv[++i];
+    else if (strcmp(argv[i], "-n") == 0 and i+1 < argc) options.maxPly = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-m") == 0 and i+1 < argc) options.minGames = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-j") == 0 and i+1 < argc) threads = atoi(argv[++i]);
+    else if (argv[i][0] == '-') { Usage(); return 2; }
+    else inputs.push_back(argv[i]);
+  }
+  if (output == 0 or inputs.empty()) {
+    Usage();
+    return 2;
+  }
+
+  GameImporter games(threads);
+  for (size_t i = 0; i < inputs.size(); i++) {
+    struct stat st;
+    if (stat(inputs[i], &st) == 0 and S_ISDIR(st.st_mode)) {
+      if (not games.AddDirectory(inputs[i])) {
+        cerr << "abbook: cannot read directory " << inputs[i] << endl;
+        return 1;
+      }
+    }
+    else {
+      games.AddFile(inputs[i]);
+    }
+  }
+
+  OpeningBookBuilder builder(options);
+  BookImport import(builder);
+  ImportStatistics stat = games.Run(import);
+  ofstream out(output, ios::binary);
+  const size_t written = builder.Write(out);
+  out.close();
+  if (not out) {
+    cerr << "abbook: cannot write " << output << endl;
+    return 1;
+  }
+  cout << stat.games << " games, " << stat.errors << " errors, "
+       << builder.Size() << " positions seen, "
+       << written << " positions written to " << output << endl;
+  return stat.errors == 0 ? 0 : 1;
+}
+
+static int Probe(int argc, char* argv[])
+{
+  if (argc < 1 or argc > 2) {
+    Usage();
+    return 2;
+  }
+  OpeningBook book;
+  if (not book.Open(argv[0])) {
+    cerr << "abbook: cannot read book " << argv[0] << endl;
+    return 1;
+  }
+  Board2D board;
+  board.SetUpStartPos();
+  if (argc == 2 and not parse_apf(argv[1], board)) {
+    cerr << "abbook: bad position " << argv[1] << endl;
+    return 2;
+  }
+
+  typedef chrono::steady_clock Clock;
+  const int LOOKUPS = 1000;
+  BookPosition position;
+  bool found = false;
+  const Clock::time_point start = Clock::now();
+  for (int i = 0; i < LOOKUPS; i++) found = book.Find(board, position);
+  const double seconds = chrono::duration<double>(Clock::now() - start).count();
+
+  cout << book.Size() << " positions in book, lookup took "
+       << seconds / LOOKUPS * 1e6 << " us" << endl;
+  if (not found) {
+    cout << "position not in book" << endl;
+    return 1;
+  }
+  cout << "wins " << position.wins << ", draws " << position.draws
+       << ", losses " << position.losses << " for the player to move" << endl;
+  for (size_t i = 0; i < position.moves.size(); i++) {
+    cout << position.moves[i].move << " " << position.moves[i].count << endl;
+  }
+  return 0;
+}
+
+int main(int argc, char* argv[])
+{
+  if (argc >= 2 and strcmp(argv[1], "build") == 0) return Build(argc - 2, argv + 2);
+  if (argc >= 2 and strcmp(argv[1], "probe") == 0) return Probe(argc - 2, argv + 2);
+  Usage();
+  return 2;
+}
@@ -0,0 +1,229 @@
+/** @file abconvert.cpp
+  Convert game files between the .AG, AbaPro and Waterloo1993 formats.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <sys/stat.h>
+
+#include "GameFormats.hpp"
+#include "GameImport.hpp"
+#include "MappedFile.hpp"
+#include "ThreadPool.hpp"
+
+using namespace std;
+using namespace Haliotis;
+
+/// Name of file used for trace messages
+const char* TRACE_FILE = "abconvert.log";
+
+static void Usage()
+{
+  cerr <<
+    "Usage: abconvert -t format [options] file|directory...\n"
+    "Convert game files, each holding one or more games. The format is\n"
+    "ag, abapro or waterloo1993, and is found from the file extension\n"
+    "(.ag, .abp, .wat) unless -f is given. Directories are searched\n"
+    "recursively. Each file is written next to the input with the\n"
+    "extension of the new format.\n"
+    "\n"
+    "  -t format   format to write\n"
+    "  -f format   format of the input files\n"
+    "  -d dir      write the files in dir instead\n"
+    "  -j threads  number of worker threads (default: one per core)\n"
+    "  -q          only report files with errors and the summary\n";
+}
+
+struct Conversion {
+  string input;
+  string output;
+  GameFormat from;
+  ImportFileResult result;
+};
+
+/** Name of the converted file */
+static string OutputName(const string& input, const char* dir, GameFormat to)
+{
+  string name = input;
+  if (dir != 0) {
+    size_t slash = name.find_last_of('/');
+    if (slash != string::npos) name.erase(0, slash + 1);
+    name = string(dir) + "/" + name;
+  }
+  size_t dot = name.find_last_of('.');
+  if (dot != string::npos and name.find('/', dot) == string::npos) name.erase(dot);
+  return name + GameFormatExtension(to);
+}
+
+/** Skip blank lines and find the next line starting with '[' */
+static const char* NextGame(const char* p, const char* end)
+{
+  while (p < end) {
+    p = (const char*)memchr(p, '\n', end - p);
+    if (p == 0) return end;
+    if (++p < end and *p == '[') return p;
+  }
+  return end;
+}
+
+/** Convert one file. Runs on a worker. */
+static void Convert(Conversion& c, GameFormat to)
+{
+  ImportFileResult& result = c.result;
+  result.filename = c.input;
+  MappedFile file;
+  if (not file.Open(c.input)) {
+    result.errors = 1;
+    result.error = "cannot open file";
+    return;
+  }
+  file.Advise(MappedFile::ACCESS_SEQUENTIAL);
+  result.bytes = file.Size();
+  ofstream out(c.output.c_str(), ios::binary);
+  if (not out) {
+    result.errors = 1;
+    result.error = "cannot write " + c.output;
+    return;
+  }
+
+  GameFormatReader reader(c.from);
+  GameFormatWriter writer(to);
+  Game game;
+  const char* begin = file.Data();
+  const char* end = begin + file.Size();
+  const char* p = begin;
+  size_t number = 0;
+  while (true) {
+    while (p < end and isspace((unsigned char)*p)) p++;
+    if (p == end) break;
+    if (reader.Read(p, end, game)) {
+      writer.Write(out, game);
+      result.games++;
+    }
+    else {
+      if (result.errors == 0) {
+        ostringstream msg;
+        msg << "game " << number + 1
+            << ": parse error at offset " << (p - begin);
+        result.error = msg.str();
+      }
+      result.errors++;
+      p = NextGame(p, end);
+    }
+    number++;
+  }
+  if (not out) {
+    result.errors++;
+    result.error = "cannot write " + c.output;
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  GameFormat to = FORMAT_UNKNOWN;
+  GameFormat from = FORMAT_UNKNOWN;
+  const char* dir = 0;
+  unsigned threads = 0;
+  bool quiet = false;
+  vector<const char*> inputs;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-t") == 0 and i+1 < argc) to = GameFormatFromName(argv[++i]);
+    else if (strcmp(argv[i], "-f") == 0 and i+1 < argc) from = GameFormatFromName(argv[++i]);
+    else if (strcmp(argv[i], "-d") == 0 and i+1 < argc) dir = argv[++i];
+    else if (strcmp(argv[i], "-j") == 0 and i+1 < argc) threads = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-q") == 0) quiet = true;
+    else if (argv[i][0] == '-') { Usage(); return 2; }
+    else inputs.push_back(argv[i]);
+  }
+  if (inputs.empty() or to == FORMAT_UNKNOWN) {
+    Usage();
+    return 2;
+  }
+
+  // GameImporter knows how to search directories
+  GameImporter files;
+  for (size_t i = 0; i < inputs.size(); i++) {
+    struct stat st;
+    if (stat(inputs[i], &st) == 0 and S_ISDIR(st.st_mode)) {
+      for (int f = FORMAT_AG; f < FORMAT_UNKNOWN; f++) {
+        if (from != FORMAT_UNKNOWN and f != from) continue;
+        if (not files.AddDirectory(inputs[i], GameFormatExtension(GameFormat(f)))) {
+          cerr << "abconvert: cannot read directory " << inputs[i] << endl;
+          return 1;
+        }
+      }
+    }
+    else {
+      files.AddFile(inputs[i]);
+    }
+  }
+
+  vector<Conversion> conversions;
+  for (size_t i = 0; i < files.Files().size(); i++) {
+    Conversion c;
+    c.input = files.Files()[i];
+    c.output = OutputName(c.input, dir, to);
+    c.from = from != FORMAT_UNKNOWN ? from : GameFormatOfFile(c.input);
+    if (c.from == FORMAT_UNKNOWN) {
+      cerr << "abconvert: unknown format of " << c.input << ", use -f" << endl;
+      return 2;
+    }
+    if (c.output == c.input) {
+      cerr << "abconvert: " << c.input << " is already in this format" << endl;
+      continue;
+    }
+    conversions.push_back(c);
+  }
+
+  typedef chrono::steady_clock Clock;
+  const Clock::time_point start = Clock::now();
+  {
+    ThreadPool pool(threads);
+    for (size_t i = 0; i < conversions.size(); i++) {
+      Conversion* c = &conversions[i];
+      pool.Submit([c, to]() { Convert(*c, to); });
+    }
+    pool.Wait();
+  }
+  const double seconds = chrono::duration<double>(Clock::now() - start).count();
+
+  ImportStatistics stat;
+  stat.seconds = seconds;
+  for (size_t i = 0; i < conversions.size(); i++) {
+    const Conversion& c = conversions[i];
+    const ImportFileResult& result = c.result;
+    stat.files++;
+    stat.games += result.games;
+    stat.errors += result.errors;
+    stat.bytes += result.bytes;
+    if (result.errors > 0) {
+      cout << c.input << " -> " << c.output << ": " << result.games << " games, "
+           << result.errors << " errors, " << result.error << endl;
+    }
+    else if (not quiet) {
+      cout << c.input << " -> " << c.output << ": " << result.games << " games" << endl;
+    }
+  }
+  cout << stat.files << " files, " << stat.games << " games, "
+       << stat.errors << " errors in " << stat.seconds << " s: "
+       << stat.GamesPerSecond() << " games/s" << endl;
+  return stat.errors == 0 ? 0 : 1;
+}
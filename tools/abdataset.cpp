@@ -0,0 +1,128 @@
+/** @file abdataset.cpp
+  Export the positions of .AG files as a binary training dataset.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sys/stat.h>
+
+#include "GameImport.hpp"
+#include "PositionDataset.hpp"
+
+using namespace std;
+
+/// Name of file used for trace messages
+const char* TRACE_FILE = "abdataset.log";
+
+static void Usage()
+{
+  cerr <<
+    "Usage: abdataset [options] file|directory...\n"
+    "Write the positions of the main line of each game in .AG files as\n"
+    "fixed size binary records, see PositionDataset.hpp. Directories are\n"
+    "searched recursively for files ending in .ag\n"
+    "\n"
+    "  -o prefix   shards are named prefix-00000.abd ... (default: positions)\n"
+    "  -n records  records per shard, 0 for one shard (default: 1000000)\n"
+    "  -s records  shuffle with a buffer of this many records\n"
+    "  -r seed     seed of the shuffle (default: 1)\n"
+    "  -u          skip positions that have already been written\n"
+    "  -U limit    positions remembered by -u, 8 bytes each (default: 4194304)\n"
+    "  -z          compress the blocks with zlib\n"
+    "  -j threads  number of threads reading games (default: one per core)\n"
+    "  -q          only report files with errors and the summary\n";
+}
+
+/** Add the games to the dataset and report each file */
+class DatasetExport: public GameImportListener {
+public:
+  DatasetExport(PositionDatasetWriter& dataset, bool quiet)
+  : m_dataset(dataset), m_quiet(quiet) {}
+  virtual void Games(vector<ImportedGame*>& batch) {
+    for (size_t i = 0; i < batch.size(); i++) {
+      m_dataset.Add(batch[i]->game);
+    }
+  }
+  virtual void FileDone(const ImportFileResult& result) {
+    if (result.errors > 0) {
+      cout << result.filename << ": " << result.games << " games, "
+           << result.errors << " errors, " << result.error << endl;
+    }
+    else if (not m_quiet) {
+      cout << result.filename << ": " << result.games << " games" << endl;
+    }
+  }
+private:
+  PositionDatasetWriter& m_dataset;
+  bool m_quiet;
+};
+
+int main(int argc, char* argv[])
+{
+  const char* prefix = "positions";
+  PositionDatasetOptions options;
+  unsigned threads = 0;
+  bool quiet = false;
+  vector<const char*> inputs;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-o") == 0 and i+1 < argc) prefix = argv[++i];
+    else if (strcmp(argv[i], "-n") == 0 and i+1 < argc) options.shardRecords = atol(argv[++i]);
+    else if (strcmp(argv[i], "-s") == 0 and i+1 < argc) options.shuffleBuffer = atol(argv[++i]);
+    else if (strcmp(argv[i], "-r") == 0 and i+1 < argc) options.seed = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-u") == 0) options.unique = true;
+    else if (strcmp(argv[i], "-U") == 0 and i+1 < argc) options.uniqueLimit = atol(argv[++i]);
+    else if (strcmp(argv[i], "-z") == 0) options.compress = true;
+    else if (strcmp(argv[i], "-j") == 0 and i+1 < argc) threads = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-q") == 0) quiet = true;
+    else if (argv[i][0] == '-') { Usage(); return 2; }
+    else inputs.push_back(argv[i]);
+  }
+  if (inputs.empty()) {
+    Usage();
+    return 2;
+  }
+
+  GameImporter importer(threads);
+  for (size_t i = 0; i < inputs.size(); i++) {
+    struct stat st;
+    if (stat(inputs[i], &st) == 0 and S_ISDIR(st.st_mode)) {
+      if (not importer.AddDirectory(inputs[i])) {
+        cerr << "abdataset: cannot read directory " << inputs[i] << endl;
+        return 1;
+      }
+    }
+    else {
+      importer.AddFile(inputs[i]);
+    }
+  }
+
+  PositionDatasetWriter dataset(prefix, options);
+  DatasetExport report(dataset, quiet);
+  ImportStatistics stat = importer.Run(report);
+  if (not dataset.Close()) {
+    cerr << "abdataset: cannot write " << prefix << endl;
+    return 1;
+  }
+
+  cout << stat.files << " files, " << stat.games << " games, "
+       << stat.errors << " errors in " << stat.seconds << " s: "
+       << dataset.Records() << " positions, "
+       << dataset.Duplicates() << " duplicates, "
+       << dataset.Shards().size() << " shards" << endl;
+  return stat.errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,126 @@
+/** @file abimport.cpp
+  Read many .AG files in parallel and report the speed and the errors.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sys/stat.h>
+
+#include "GameArchive.hpp"
+#include "GameImport.hpp"
+
+using namespace std;
+
+/// Name of file used for trace messages
+const char* TRACE_FILE = "abimport.log";
+
+static void Usage()
+{
+  cerr <<
+    "Usage: abimport [options] file|directory...\n"
+    "Read .AG files, each holding one or more games. Directories are\n"
+    "searched recursively for files ending in .ag\n"
+    "\n"
+    "  -j threads  number of worker threads (default: one per core)\n"
+    "  -b games    games per batch (default: 256)\n"
+    "  -o file     write all games to a binary game archive\n"
+    "  -q          only report files with errors and the summary\n";
+}
+
+/** Write the games to an archive and report each file */
+class ImportReport: public GameImportListener {
+public:
+  ImportReport(GameArchiveWriter* archive, bool quiet)
+  : m_archive(archive), m_quiet(quiet) {}
+  virtual void Games(vector<ImportedGame*>& batch) {
+    if (m_archive == 0) return;
+    for (size_t i = 0; i < batch.size(); i++) {
+      m_archive->Write(batch[i]->game);
+    }
+  }
+  virtual void FileDone(const ImportFileResult& result) {
+    if (result.errors > 0) {
+      cout << result.filename << ": " << result.games << " games, "
+           << result.errors << " errors, " << result.error << endl;
+    }
+    else if (not m_quiet) {
+      cout << result.filename << ": " << result.games << " games" << endl;
+    }
+  }
+private:
+  GameArchiveWriter* m_archive;
+  bool m_quiet;
+};
+
+int main(int argc, char* argv[])
+{
+  unsigned threads = 0;
+  size_t batchSize = 256;
+  const char* output = 0;
+  bool quiet = false;
+  vector<const char*> inputs;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-j") == 0 and i+1 < argc) threads = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-b") == 0 and i+1 < argc) batchSize = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-o") == 0 and i+1 < argc) output = argv[++i];
+    else if (strcmp(argv[i], "-q") == 0) quiet = true;
+    else if (argv[i][0] == '-') { Usage(); return 2; }
+    else inputs.push_back(argv[i]);
+  }
+  if (inputs.empty()) {
+    Usage();
+    return 2;
+  }
+
+  GameImporter importer(threads, batchSize);
+  for (size_t i = 0; i < inputs.size(); i++) {
+    struct stat st;
+    if (stat(inputs[i], &st) == 0 and S_ISDIR(st.st_mode)) {
+      if (not importer.AddDirectory(inputs[i])) {
+        cerr << "abimport: cannot read directory " << inputs[i] << endl;
+        return 1;
+      }
+    }
+    else {
+      importer.AddFile(inputs[i]);
+    }
+  }
+
+  ofstream out;
+  GameArchiveWriter* archive = 0;
+  if (output != 0) {
+    out.open(output, ios::binary);
+    if (not out) {
+      cerr << "abimport: cannot write " << output << endl;
+      return 1;
+    }
+    archive = new GameArchiveWriter(out);
+  }
+
+  ImportReport report(archive, quiet);
+  ImportStatistics stat = importer.Run(report);
+  delete archive;
+
+  cout << stat.files << " files, " << stat.games << " games, "
+       << stat.errors << " errors in " << stat.seconds << " s: "
+       << stat.GamesPerSecond() << " games/s, "
+       << (stat.seconds > 0 ? stat.bytes / stat.seconds / 1e6 : 0) << " MB/s"
+       << endl;
+  return stat.errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,182 @@
+/** @file abmatch.cpp
+  Play a match between two AEP engines, and tell which one is stronger.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "Match.hpp"
+
+using namespace std;
+
+/// Name of file used for trace messages
+const char* TRACE_FILE = "abmatch.log";
+
+static void Usage()
+{
+  cerr <<
+    "Usage: abmatch [options] -e command -e command\n"
+    "Play games between two engines that talk the Abalone Engine Protocol.\n"
+    "Each start layout is played twice, with colours swapped, and the score\n"
+    "of the first engine is reported after each game.\n"
+    "\n"
+    "  -e command     command line of an engine, given twice\n"
+    "  -n games       number of games (default: 100)\n"
+    "  -c games       games played at the same time (default: 1)\n"
+    "  -l layouts     start layouts separated by commas (default: Standard)\n"
+    "                 Standard, BelgianDaisy, GermanDaisy, SwissDaisy, DutchDaisy\n"
+    "  -tc base+inc   clock of each player in seconds (default: 10+0.1)\n"
+    "  -st seconds    fixed time for each move instead of a clock\n"
+    "  -m plies       games longer than this are drawn (default: 400)\n"
+    "  -o file        append the games to this .AG file\n"
+    "  -sprt elo0,elo1[,alpha,beta]\n"
+    "                 stop when a sequential probability ratio test tells\n"
+    "                 whether the first engine is elo1 or elo0 stronger\n"
+    "  -s name=value  set an option of both engines\n";
+}
+
+/// Split text at each separator
+static vector<string> Split(const string& text, char separator)
+{
+  vector<string> parts;
+  istringstream in(text);
+  string part;
+  while (getline(in, part, separator)) parts.push_back(part);
+  return parts;
+}
+
+static long long Milliseconds(const string& seconds)
+{
+  return (long long)(atof(seconds.c_str()) * 1000 + 0.5);
+}
+
+/** Report each game and the score so far */
+class MatchReport: public MatchListener {
+public:
+  MatchReport(const MatchOptions& options) : m_options(options) {}
+  virtual void GameDone(const MatchGame& game, const MatchStatistics& stats) {
+    const Settings& att = game.game.attributes;
+    double margin;
+    const double elo = stats.Elo(&margin);
+    char score[200];
+    snprintf(score, sizeof(score), "%u - %u - %u  [%.3f] %u  Elo %.1f +/- %.1f",
+      stats.wins, stats.losses, stats.draws, stats.Score(), stats.Games(),
+      elo, margin);
+    cout << "Game " << game.number << " (" << game.layout << "): "
+         << att.find("White")->second << " - " << att.find("Black")->second << " "
+         << att.find("Result")->second << " {" << game.reason << "}\n"
+         << "Score: " << score;
+    if (m_options.sprt) {
+      snprintf(score, sizeof(score), "  LLR %.2f (%.2f, %.2f)",
+        stats.LLR(m_options.elo0, m_options.elo1),
+        log(m_options.beta / (1 - m_options.alpha)),
+        log((1 - m_options.beta) / m_options.alpha));
+      cout << score;
+    }
+    cout << endl;
+  }
+private:
+  const MatchOptions& m_options;
+};
+
+int main(int argc, char* argv[])
+{
+  MatchOptions options;
+  vector<string> engines;
+  AepProcessPlayer::OptionList engineOptions;
+  const char* output = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-e") == 0 and i+1 < argc) engines.push_back(argv[++i]);
+    else if (strcmp(argv[i], "-n") == 0 and i+1 < argc) options.games = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-c") == 0 and i+1 < argc) options.concurrency = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-l") == 0 and i+1 < argc) options.layouts = Split(argv[++i], ',');
+    else if (strcmp(argv[i], "-tc") == 0 and i+1 < argc) {
+      vector<string> tc = Split(argv[++i], '+');
+      options.timeControl.base = Milliseconds(tc[0]);
+      options.timeControl.inc = tc.size() > 1 ? Milliseconds(tc[1]) : 0;
+    }
+    else if (strcmp(argv[i], "-st") == 0 and i+1 < argc) {
+      options.timeControl.moveTime = Milliseconds(argv[++i]);
+    }
+    else if (strcmp(argv[i], "-m") == 0 and i+1 < argc) options.maxPlies = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-o") == 0 and i+1 < argc) output = argv[++i];
+    else if (strcmp(argv[i], "-sprt") == 0 and i+1 < argc) {
+      vector<string> sprt = Split(argv[++i], ',');
+      if (sprt.size() != 2 and sprt.size() != 4) { Usage(); return 2; }
+      options.sprt = true;
+      options.elo0 = atof(sprt[0].c_str());
+      options.elo1 = atof(sprt[1].c_str());
+      if (sprt.size() == 4) {
+        options.alpha = atof(sprt[2].c_str());
+        options.beta = atof(sprt[3].c_str());
+      }
+    }
+    else if (strcmp(argv[i], "-s") == 0 and i+1 < argc) {
+      const string setting = argv[++i];
+      const size_t equal = setting.find('=');
+      if (equal == string::npos) { Usage(); return 2; }
+      engineOptions.push_back(make_pair(setting.substr(0, equal), setting.substr(equal + 1)));
+    }
+    else { Usage(); return 2; }
+  }
+  if (engines.size() != 2 or options.games == 0) {
+    Usage();
+    return 2;
+  }
+
+  // An engine that exits must not end the match when it is written to
+  signal(SIGPIPE, SIG_IGN);
+
+  ofstream file;
+  if (output) {
+    file.open(output, ios::app);
+    if (not file) {
+      cerr << "abmatch: cannot write " << output << endl;
+      return 1;
+    }
+  }
+  const string first = engines[0], second = engines[1];
+  Match match(options,
+    [&first, &engineOptions]() { return new AepProcessPlayer(first, engineOptions); },
+    [&second, &engineOptions]() { return new AepProcessPlayer(second, engineOptions); });
+  if (output) match.SetOutput(&file);
+  MatchReport report(options);
+  if (not match.Run(report)) {
+    cerr << "abmatch: unknown start layout, use one of Standard, BelgianDaisy,"
+            " GermanDaisy, SwissDaisy, DutchDaisy" << endl;
+    return 2;
+  }
+
+  const MatchStatistics stats = match.Statistics();
+  double margin;
+  const double elo = stats.Elo(&margin);
+  cout << "Finished " << stats.Games() << " games: " << stats.wins << " wins, "
+       << stats.losses << " losses, " << stats.draws << " draws, Elo "
+       << elo << " +/- " << margin << endl;
+  if (options.sprt) {
+    const int sprt = match.SprtResult();
+    cout << "SPRT: " << (sprt > 0 ? "elo1 accepted" : sprt < 0 ? "elo0 accepted"
+      : "no result") << endl;
+  }
+  return 0;
+}
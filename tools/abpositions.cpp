@@ -0,0 +1,165 @@
+/** @file abpositions.cpp
+  Index the positions of .AG files, and find the games reaching a position.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sys/stat.h>
+
+#include "GameImport.hpp"
+#include "Persistence.hpp"
+#include "PositionIndex.hpp"
+
+using namespace std;
+
+/// Name of file used for trace messages
+const char* TRACE_FILE = "abpositions.log";
+
+static void Usage()
+{
+  cerr <<
+    "Usage: abpositions build [options] -o index file|directory...\n"
+    "       abpositions query [-l limit] index [position]\n"
+    "Index every position of the main line of the games in .AG files, or\n"
+    "list the games that reached a position. The position is given in the\n"
+    "format of the apf attribute, and is the start position by default.\n"
+    "\n"
+    "  -o index    index file to write\n"
+    "  -j threads  number of threads reading games and sorting (default:\n"
+    "              one per core)\n"
+    "  -l limit    the most games to list (default: 20)\n";
+}
+
+/** Add the games to the index and report files with errors */
+class IndexImport: public GameImportListener {
+public:
+  IndexImport(PositionIndexBuilder& builder, const vector<string>& files)
+  : m_builder(builder) {
+    for (size_t i = 0; i < files.size(); i++) m_builder.AddFile(files[i]);
+  }
+  virtual void Games(vector<ImportedGame*>& batch) {
+    for (size_t i = 0; i < batch.size(); i++) {
+      m_builder.Add(batch[i]->game, batch[i]->file, batch[i]->number);
+    }
+  }
+  virtual void FileDone(const ImportFileResult& result) {
+    if (result.errors > 0) {
+      cout << result.filename << ": " << result.games << " games, "
+           << result.errors << " errors, " << result.error << endl;
+    }
+  }
+private:
+  PositionIndexBuilder& m_builder;
+};
+
+static int Build(int argc, char* argv[])
+{
+  const char* output = 0;
+  unsigned threads = 0;
+  vector<const char*> inputs;
+  for (int i = 0; i < argc; i++) {
+    if (strcmp(argv[i], "-o") == 0 and i+1 < argc) output = argv[++i];
+    else if (strcmp(argv[i], "-j") == 0 and i+1 < argc) threads = atoi(argv[++i]);
+    else if (argv[i][0] == '-') { Usage(); return 2; }
+    else inputs.push_back(argv[i]);
+  }
+  if (output == 0 or inputs.empty()) {
+    Usage();
+    return 2;
+  }
+
+  GameImporter games(threads);
+  for (size_t i = 0; i < inputs.size(); i++) {
+    struct stat st;
+    if (stat(inputs[i], &st) == 0 and S_ISDIR(st.st_mode)) {
+      if (not games.AddDirectory(inputs[i])) {
+        cerr << "abpositions: cannot read directory " << inputs[i] << endl;
+        return 1;
+      }
+    }
+    else {
+      games.AddFile(inputs[i]);
+    }
+  }
+
+  typedef chrono::steady_clock Clock;
+  const Clock::time_point start = Clock::now();
+  PositionIndexBuilder builder(threads);
+  IndexImport import(builder, games.Files());
+  ImportStatistics stat = games.Run(import);
+  ofstream out(output, ios::binary);
+  builder.Write(out);
+  out.close();
+  if (not out) {
+    cerr << "abpositions: cannot write " << output << endl;
+    return 1;
+  }
+  const double seconds = chrono::duration<double>(Clock::now() - start).count();
+  cout << stat.games << " games, " << stat.errors << " errors, "
+       << builder.Size() << " positions indexed in " << seconds << " s" << endl;
+  return stat.errors == 0 ? 0 : 1;
+}
+
+static int Query(int argc, char* argv[])
+{
+  size_t limit = 20;
+  vector<const char*> args;
+  for (int i = 0; i < argc; i++) {
+    if (strcmp(argv[i], "-l") == 0 and i+1 < argc) limit = atol(argv[++i]);
+    else args.push_back(argv[i]);
+  }
+  if (args.size() < 1 or args.size() > 2) {
+    Usage();
+    return 2;
+  }
+
+  typedef chrono::steady_clock Clock;
+  const Clock::time_point start = Clock::now();
+  PositionIndex index;
+  if (not index.Open(args[0])) {
+    cerr << "abpositions: cannot read index " << args[0] << endl;
+    return 1;
+  }
+  Board2D board;
+  board.SetUpStartPos();
+  if (args.size() == 2 and not parse_apf(args[1], board)) {
+    cerr << "abpositions: bad position " << args[1] << endl;
+    return 2;
+  }
+  vector<PositionHit> hits;
+  const size_t count = index.Find(board, hits, limit);
+  const double seconds = chrono::duration<double>(Clock::now() - start).count();
+
+  for (size_t i = 0; i < hits.size(); i++) {
+    cout << hits[i].filename << " game " << hits[i].number + 1
+         << " ply " << hits[i].ply << endl;
+  }
+  cout << count << " occurrences among " << index.Games() << " games, found in "
+       << seconds * 1e3 << " ms" << endl;
+  return count > 0 ? 0 : 1;
+}
+
+int main(int argc, char* argv[])
+{
+  if (argc >= 2 and strcmp(argv[1], "build") == 0) return Build(argc - 2, argv + 2);
+  if (argc >= 2 and strcmp(argv[1], "query") == 0) return Query(argc - 2, argv + 2);
+  Usage();
+  return 2;
+}
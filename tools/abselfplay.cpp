@@ -0,0 +1,166 @@
+/** @file abselfplay.cpp
+  Generate games and training positions by self-play.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "SelfPlay.hpp"
+
+using namespace std;
+using namespace Haliotis;
+
+/// Name of file used for trace messages
+const char* TRACE_FILE = "abselfplay.log";
+
+static void Usage()
+{
+  cerr <<
+    "Usage: abselfplay [options]\n"
+    "Play games of a simple evaluation, marbles pushed off and closeness\n"
+    "to the centre, against itself. Write the games as .AG and the\n"
+    "positions as a binary training dataset, see PositionDataset.hpp.\n"
+    "\n"
+    "  -n games     games to play (default: 1000)\n"
+    "  -g games     games in play at the same time (default: 1024)\n"
+    "  -j threads   threads playing games (default: 1)\n"
+    "  -b count     most positions evaluated in one batch (default: 8192)\n"
+    "  -l layouts   start layouts separated by commas (default: Standard)\n"
+    "  -m plies     games longer than this are drawn (default: 300)\n"
+    "  -p plies     moves are sampled in the first plies (default: 30)\n"
+    "  -t temp      temperature of the sampling (default: 0.1)\n"
+    "  -r seed      seed of the sampling (default: 1)\n"
+    "  -o file      write the games to this .AG file\n"
+    "  -d prefix    write the positions to shards prefix-00000.abd ...\n"
+    "  -z           compress the dataset blocks with zlib\n";
+}
+
+/** Value for the player to move from the marbles pushed off, and how
+  close the marbles of each player are to the centre */
+class SimpleEvaluator: public SelfPlayEvaluator {
+public:
+  virtual void Evaluate(const Board2D* positions, size_t count, float* values) {
+    for (size_t i = 0; i < count; i++) values[i] = Value(positions[i]);
+  }
+private:
+  static float Value(const Board2D& board) {
+    // Rings from the centre, summed for the marbles of each player
+    int centre[3] = { 0, 0, 0 };
+    for (int x = 0; x < 9; x++) {
+      for (int y = 0; y < 9; y++) {
+        const int piece = board.field[x][y];
+        if (piece != 1 and piece != 2) continue;
+        const int dx = x - 4, dy = y - 4;
+        const int distance = max(abs(dx), max(abs(dy), abs(dx + dy)));
+        centre[piece] += 4 - distance;
+      }
+    }
+    const int me = board.GetTurn(), other = 3 - me;
+    const int lost = board.OutOfBoard(me == 1) - board.OutOfBoard(other == 1);
+    return (float)tanh(-0.5 * lost + 0.02 * (centre[me] - centre[other]));
+  }
+};
+
+/** Report progress every 100 games */
+class SelfPlayReport: public SelfPlayListener {
+public:
+  SelfPlayReport() : m_start(chrono::steady_clock::now()) {}
+  virtual void GameWritten(const Game&, const SelfPlayStatistics& stats) {
+    if (stats.games % 100 != 0) return;
+    const double seconds = chrono::duration<double>(
+      chrono::steady_clock::now() - m_start).count();
+    cout << stats.games << " games, " << stats.positions << " positions, "
+         << stats.games / seconds << " games/s" << endl;
+  }
+private:
+  chrono::steady_clock::time_point m_start;
+};
+
+int main(int argc, char* argv[])
+{
+  SelfPlayOptions options;
+  PositionDatasetOptions datasetOptions;
+  const char* output = 0;
+  const char* prefix = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-n") == 0 and i+1 < argc) options.games = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-g") == 0 and i+1 < argc) options.concurrentGames = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-j") == 0 and i+1 < argc) options.threads = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-b") == 0 and i+1 < argc) options.maxBatch = atol(argv[++i]);
+    else if (strcmp(argv[i], "-l") == 0 and i+1 < argc) {
+      istringstream in(argv[++i]);
+      string layout;
+      options.layouts.clear();
+      while (getline(in, layout, ',')) options.layouts.push_back(layout);
+    }
+    else if (strcmp(argv[i], "-m") == 0 and i+1 < argc) options.maxPlies = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-p") == 0 and i+1 < argc) options.samplePlies = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-t") == 0 and i+1 < argc) options.temperature = atof(argv[++i]);
+    else if (strcmp(argv[i], "-r") == 0 and i+1 < argc) options.seed = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-o") == 0 and i+1 < argc) output = argv[++i];
+    else if (strcmp(argv[i], "-d") == 0 and i+1 < argc) prefix = argv[++i];
+    else if (strcmp(argv[i], "-z") == 0) datasetOptions.compress = true;
+    else { Usage(); return 2; }
+  }
+
+  ofstream file;
+  if (output) {
+    file.open(output);
+    if (not file) {
+      cerr << "abselfplay: cannot write " << output << endl;
+      return 1;
+    }
+  }
+  PositionDatasetWriter* dataset = 0;
+  if (prefix) dataset = new PositionDatasetWriter(prefix, datasetOptions);
+
+  SimpleEvaluator evaluator;
+  SelfPlay selfPlay(options, evaluator);
+  if (output) selfPlay.SetGameOutput(&file);
+  selfPlay.SetDatasetOutput(dataset);
+  SelfPlayReport report;
+  selfPlay.SetListener(&report);
+  const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  const SelfPlayStatistics stats = selfPlay.Run();
+  const double seconds = chrono::duration<double>(
+    chrono::steady_clock::now() - start).count();
+  int status = 0;
+  if (dataset) {
+    if (not dataset->Close()) {
+      cerr << "abselfplay: cannot write " << prefix << endl;
+      status = 1;
+    }
+    delete dataset;
+  }
+  if (stats.games == 0 and options.games > 0) {
+    cerr << "abselfplay: unknown start layout" << endl;
+    return 2;
+  }
+
+  cout << stats.games << " games (" << stats.wins[0] << " won by player 1, "
+       << stats.wins[1] << " by player 2, " << stats.draws << " drawn), "
+       << stats.positions << " positions in " << seconds << " s: "
+       << stats.games / seconds << " games/s, "
+       << stats.evaluations / seconds << " evaluations/s in "
+       << stats.batches << " batches" << endl;
+  return status;
+}
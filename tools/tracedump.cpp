@@ -0,0 +1,114 @@
+/** @file tracedump.cpp
+  Turn a binary trace file into text.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <map>
+
+#include "TraceFile.hpp"
+
+using namespace std;
+
+/// Name of file used for trace messages
+const char* TRACE_FILE = "tracedump.log";
+
+static void Usage()
+{
+  cerr <<
+    "Usage: tracedump [options] file\n"
+    "Write a binary trace file as text, as the trace would have been\n"
+    "written without DEFINE_BINARY_TRACE_FILE.\n"
+    "\n"
+    "  -s          prefix each message with the file and line that traced it\n"
+    "  -t thread   only write the messages of this thread\n"
+    "  -c          count the messages of each site instead\n";
+}
+
+int main(int argc, char* argv[])
+{
+  bool sites = false;
+  bool count = false;
+  unsigned thread = 0;
+  const char* filename = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-s") == 0) sites = true;
+    else if (strcmp(argv[i], "-c") == 0) count = true;
+    else if (strcmp(argv[i], "-t") == 0 and i+1 < argc) thread = atoi(argv[++i]);
+    else if (argv[i][0] != '-' and filename == 0) filename = argv[i];
+    else { Usage(); return 2; }
+  }
+  if (filename == 0) {
+    Usage();
+    return 2;
+  }
+
+  ifstream in(filename, ios::binary);
+  if (not in) {
+    cerr << "tracedump: cannot read " << filename << endl;
+    return 1;
+  }
+  TraceFileReader reader(in);
+  if (not reader.Valid()) {
+    cerr << "tracedump: " << filename << " is not a binary trace file" << endl;
+    return 1;
+  }
+
+  // Messages of each site, by file and line
+  map<pair<string, int>, pair<unsigned long long, string> > counts;
+  TraceStampFormat stampFormat;
+  TraceFileMessage message;
+  string text;
+  if (not count) {
+    const time_t start = (time_t)(reader.StartTime() / 1000000);
+    cout << '\n'
+      << "----------------------------------------------------------------\n"
+      << "Trace started at " << ctime(&start);
+  }
+  while (reader.Next(message)) {
+    if (thread != 0 and message.thread != thread) continue;
+    if (count) {
+      pair<unsigned long long, string>& site = counts[make_pair(message.file, message.line)];
+      site.first++;
+      site.second = message.statement;
+      continue;
+    }
+    text.clear();
+    if (message.stamp) stampFormat.Append(message.time, message.thread, text);
+    if (sites and message.site != 0) {
+      text += message.file;
+      text += ':';
+      text += to_string(message.line);
+      text += ' ';
+    }
+    text += message.text;
+    cout << text;
+  }
+  for (auto& site : counts) {
+    cout << site.second.first << '\t' << site.first.first << ':' << site.first.second
+         << '\t' << site.second.second << '\n';
+  }
+  cout.flush();
+  if (reader.Corrupt()) {
+    cerr << "tracedump: " << filename << " is corrupt after the last message" << endl;
+    return 1;
+  }
+  return 0;
+}